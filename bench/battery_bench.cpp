@@ -0,0 +1,456 @@
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "BatteryPack.h"
+#include "Fleet.h"
+#include "Telemetry.h"
+
+#ifdef BATTERY_BENCH_QT
+#include <QApplication>
+#include <QImage>
+#include "BatteryCanvas.h"
+#endif
+
+// Cell counts from 10 to 10M, one decade apart
+static const long MIN_CELLS = 10;
+static const long MAX_CELLS = 10000000;
+
+static void cellCounts(benchmark::internal::Benchmark *b)
+{
+    b->RangeMultiplier(10)->Range(MIN_CELLS, MAX_CELLS);
+}
+
+/**
+ * @brief builds a pack of n identical cells with a spread of charges, so min-trackers have work to do
+ */
+static std::unique_ptr<BatteryPack> makePack(BatteryPack::ConnectionType type, long n)
+{
+    std::unique_ptr<BatteryPack> pack(new BatteryPack(type));
+    pack->addCells(static_cast<std::size_t>(n), 3.7, 3000, 3000);
+    std::vector<Battery *> &cells = pack->getCells();
+    for (long i = 0; i < n; i += 7)
+        cells[i]->use(0.001 * static_cast<double>(i % 1000));
+    return pack;
+}
+
+static void setCellsProcessed(benchmark::State &state)
+{
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Battery::use/recharge //
+
+/**
+ * @brief use/recharge on standalone Battery objects, one virtual call per cell
+ */
+static void BM_BatteryUseRecharge(benchmark::State &state)
+{
+    std::vector<Battery> cells(static_cast<std::size_t>(state.range(0)), Battery(3.7, 3000, 1500));
+    for (auto _ : state)
+    {
+        for (Battery &b : cells)
+            b.use(0.01);
+        for (Battery &b : cells)
+            b.recharge(0.01);
+        benchmark::ClobberMemory();
+    }
+    setCellsProcessed(state);
+}
+BENCHMARK(BM_BatteryUseRecharge)->Apply(cellCounts);
+
+/**
+ * @brief use/recharge of a whole pack, which runs as kernels over the cell store
+ */
+static void BM_PackUseRecharge(benchmark::State &state)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::SERIES, state.range(0));
+    for (auto _ : state)
+    {
+        pack->use(0.01);
+        pack->recharge(0.01);
+        benchmark::ClobberMemory();
+    }
+    setCellsProcessed(state);
+}
+BENCHMARK(BM_PackUseRecharge)->Apply(cellCounts);
+
+/**
+ * @brief the same with per-cell rates under a rate model, which runs the model's policy loop instead of the
+ *        uniform-delta kernels
+ */
+static void BM_PackUseRechargeModel(benchmark::State &state, const char *spec)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::SERIES, state.range(0));
+    RateModel model;
+    std::string error;
+    RateModel::parse(spec, model, error);
+    pack->setRateModel(model);
+    bool cRate = model.kind() == RateModel::C_RATE;
+    std::vector<Battery *> &cells = pack->getCells();
+    for (std::size_t i = 0; i < cells.size(); ++i)
+    {
+        double spread = 1 + 0.001 * static_cast<double>(i % 100);
+        cells[i]->setRates((cRate ? 0.03 : 100) * spread, (cRate ? 0.05 : 150) * spread);
+    }
+    for (auto _ : state)
+    {
+        pack->use(0.01);
+        pack->recharge(0.01);
+        benchmark::ClobberMemory();
+    }
+    setCellsProcessed(state);
+}
+BENCHMARK_CAPTURE(BM_PackUseRechargeModel, constant, "constant")->Apply(cellCounts);
+BENCHMARK_CAPTURE(BM_PackUseRechargeModel, crate, "crate")->Apply(cellCounts);
+BENCHMARK_CAPTURE(BM_PackUseRechargeModel, cccv, "cccv")->Apply(cellCounts);
+
+/**
+ * @brief a two-pair equivalent circuit of a typical lithium-ion cell
+ */
+static CircuitParameters makeCircuit()
+{
+    CircuitParameters circuit;
+    std::string error;
+    circuit.ocv.set({0, 0.1, 0.5, 0.9, 1}, {3.0, 3.45, 3.7, 4.0, 4.2}, error);
+    circuit.seriesResistance = 0.02;
+    circuit.pairs[0] = RcPair{0.015, 3000};
+    circuit.pairs[1] = RcPair{0.01, 30000};
+    return circuit;
+}
+
+/**
+ * @brief 1 ms use steps with a two-pair equivalent circuit attached; "realtime" is simulated seconds per second
+ */
+static void BM_PackUseCircuit(benchmark::State &state)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::SERIES, state.range(0));
+    pack->setCircuit(makeCircuit());
+    const double step = 0.001 / 3600;
+    for (auto _ : state)
+    {
+        pack->use(step);
+        benchmark::ClobberMemory();
+    }
+    setCellsProcessed(state);
+    state.counters["realtime"] = benchmark::Counter(0.001 * static_cast<double>(state.iterations()),
+                                                    benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_PackUseCircuit)->Apply(cellCounts);
+
+/**
+ * @brief 1 s use and recharge steps of one parallel group with the circuit splitting the current among all
+ *        branches; every tenth cell has twice the impedance, so the split is uneven. The recharge puts back
+ *        what the use took, so the cells stay away from empty and full.
+ */
+static void BM_PackUseSharing(benchmark::State &state)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::PARALLEL, state.range(0));
+    pack->setCircuit(makeCircuit());
+    for (long i = 0; i < state.range(0); i += 10)
+        pack->setImpedance(static_cast<int>(i), 2);
+    pack->setCurrentSharing(true);
+    const double step = 1.0 / 3600;
+    const double back = step * Battery::DISCHARGE_RATE / Battery::RECHARGE_RATE;
+    for (auto _ : state)
+    {
+        pack->use(step);
+        pack->recharge(back);
+        benchmark::ClobberMemory();
+    }
+    setCellsProcessed(state);
+}
+BENCHMARK(BM_PackUseSharing)->Apply(cellCounts);
+
+/**
+ * @brief 1 s use steps with the thermal model heating, conducting and derating every cell;
+ *        columns 0 lays the cells out in one row, otherwise in rows of that many cells
+ */
+static void BM_PackUseThermal(benchmark::State &state, std::size_t columns)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::SERIES, state.range(0));
+    ThermalParameters thermal;
+    thermal.columns = columns;
+    pack->setThermal(thermal);
+    const double step = 1.0 / 3600;
+    for (auto _ : state)
+    {
+        pack->use(step);
+        benchmark::ClobberMemory();
+    }
+    setCellsProcessed(state);
+}
+BENCHMARK_CAPTURE(BM_PackUseThermal, row, 0)->Apply(cellCounts);
+BENCHMARK_CAPTURE(BM_PackUseThermal, grid1000, 1000)->Apply(cellCounts);
+
+/**
+ * @brief a use and a recharge with cycle counting on every update; the cells turn on every iteration
+ */
+static void BM_PackUseRechargeAging(benchmark::State &state)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::SERIES, state.range(0));
+    pack->setAging(AgingParameters());
+    for (auto _ : state)
+    {
+        pack->use(0.01);
+        pack->recharge(0.01);
+        benchmark::ClobberMemory();
+    }
+    setCellsProcessed(state);
+}
+BENCHMARK(BM_PackUseRechargeAging)->Apply(cellCounts);
+
+/**
+ * @brief the same with every cell's state of charge streamed to a telemetry file, to show the recording overhead
+ */
+static void BM_PackUseRechargeTelemetry(benchmark::State &state)
+{
+    const char *path = "battery_bench.btl";
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::SERIES, state.range(0));
+    {
+        TelemetryWriter telemetry(path, *pack);
+        pack->setTelemetry(&telemetry);
+        for (auto _ : state)
+        {
+            pack->use(0.01);
+            pack->recharge(0.01);
+            benchmark::ClobberMemory();
+        }
+        pack->setTelemetry(nullptr);
+    }
+    std::remove(path);
+    setCellsProcessed(state);
+}
+BENCHMARK(BM_PackUseRechargeTelemetry)->Apply(cellCounts);
+
+// Fleets //
+
+// Cells of every fleet, cut into packs of 10 cells up to a single pack
+static const long FLEET_CELLS = 1000000;
+
+/**
+ * @brief use/recharge of a fleet of FLEET_CELLS / n packs of n cells with the per-cell rates of
+ *        BM_PackUseRechargeModel/constant, to compare against a single pack of as many cells
+ */
+static void BM_FleetUseRecharge(benchmark::State &state)
+{
+    const std::size_t n = static_cast<std::size_t>(state.range(0));
+    const std::size_t packs = static_cast<std::size_t>(FLEET_CELLS) / n;
+    std::vector<double> v(n, 3.7), c(n, 3000), q(n), d(n), r(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        double spread = 1 + 0.001 * static_cast<double>(i % 100);
+        q[i] = 3000 - 0.1 * static_cast<double>(i % 1000);
+        d[i] = 100 * spread;
+        r[i] = 150 * spread;
+    }
+    std::vector<ScenarioStep> steps;
+    for (int i = 0; i < 65536; ++i)
+    {
+        steps.push_back(ScenarioStep{ScenarioStep::USE, 0.01});
+        steps.push_back(ScenarioStep{ScenarioStep::RECHARGE, 0.01});
+    }
+    Fleet fleet(RateModel(), 1);
+    fleet.reserve(packs, packs * n);
+    std::size_t profile = fleet.addProfile(steps);
+    for (std::size_t p = 0; p < packs; ++p)
+        fleet.addPack(BatteryPack::SERIES, PackPlan(), v.data(), c.data(), q.data(), n, d.data(), r.data(), profile);
+    for (auto _ : state)
+    {
+        fleet.advance(0.01);
+        fleet.advance(0.01);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<long>(packs * n));
+}
+BENCHMARK(BM_FleetUseRecharge)->RangeMultiplier(10)->Range(MIN_CELLS, FLEET_CELLS);
+
+// Forecasts //
+
+/**
+ * @brief time to empty, time to full and the next ten saturations right after a single-cell update,
+ *        with per-cell rates so no shortcut through the minimum charge applies
+ */
+static void BM_PackForecast(benchmark::State &state)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::PARALLEL, state.range(0));
+    std::vector<Battery *> &cells = pack->getCells();
+    for (std::size_t i = 0; i < cells.size(); ++i)
+    {
+        double spread = 1 + 0.001 * static_cast<double>(i % 100);
+        cells[i]->setRates(100 * spread, 150 * spread);
+    }
+    Battery *cell = cells[cells.size() / 2];
+    for (auto _ : state)
+    {
+        cell->use(0.0001);
+        benchmark::DoNotOptimize(pack->hoursToEmpty());
+        benchmark::DoNotOptimize(pack->hoursToFull());
+        benchmark::DoNotOptimize(pack->saturationOrder(false, 10));
+    }
+}
+BENCHMARK(BM_PackForecast)->Apply(cellCounts);
+
+// Aggregate getters //
+
+/**
+ * @brief getVoltage/getCapacity/getCharge right after a single-cell update
+ */
+static void packGetters(benchmark::State &state, BatteryPack::ConnectionType type)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(type, state.range(0));
+    Battery *cell = pack->getCells()[static_cast<std::size_t>(state.range(0) / 2)];
+    for (auto _ : state)
+    {
+        cell->use(0.0001);
+        benchmark::DoNotOptimize(pack->getVoltage());
+        benchmark::DoNotOptimize(pack->getCapacity());
+        benchmark::DoNotOptimize(pack->getCharge());
+    }
+}
+
+static void BM_GettersSeries(benchmark::State &state)
+{
+    packGetters(state, BatteryPack::SERIES);
+}
+BENCHMARK(BM_GettersSeries)->Apply(cellCounts);
+
+static void BM_GettersParallel(benchmark::State &state)
+{
+    packGetters(state, BatteryPack::PARALLEL);
+}
+BENCHMARK(BM_GettersParallel)->Apply(cellCounts);
+
+// add/deleteBattery //
+
+/**
+ * @brief building a pack of n cells with addCells
+ */
+static void BM_PackAddCells(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        BatteryPack pack(BatteryPack::SERIES);
+        pack.addCells(static_cast<std::size_t>(state.range(0)), 3.7, 3000, 3000);
+        benchmark::DoNotOptimize(pack.getCharge());
+    }
+    setCellsProcessed(state);
+}
+BENCHMARK(BM_PackAddCells)->Apply(cellCounts);
+
+/**
+ * @brief building a pack of n cells by adding caller-owned Battery objects one at a time
+ */
+static void BM_PackAdd(benchmark::State &state)
+{
+    std::vector<Battery> cells(static_cast<std::size_t>(state.range(0)), Battery(3.7, 3000, 3000));
+    for (auto _ : state)
+    {
+        BatteryPack pack(BatteryPack::SERIES);
+        for (Battery &b : cells)
+            pack.add(&b);
+        benchmark::DoNotOptimize(pack.getCharge());
+    }
+    setCellsProcessed(state);
+}
+BENCHMARK(BM_PackAdd)->Apply(cellCounts);
+
+/**
+ * @brief deleting the middle cell of a pack of n cells and adding one back
+ */
+static void BM_PackDeleteBattery(benchmark::State &state)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::SERIES, state.range(0));
+    int middle = static_cast<int>(state.range(0) / 2);
+    for (auto _ : state)
+    {
+        pack->deleteBattery(middle);
+        pack->addCell(3.7, 3000, 3000);
+    }
+}
+BENCHMARK(BM_PackDeleteBattery)->Apply(cellCounts);
+
+/**
+ * @brief deleting the middle cell of a pack of n cells in groups of four in parallel and adding one back
+ */
+static void BM_PackDeleteTopology(benchmark::State &state)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::SERIES, state.range(0) / 4 * 4);
+    std::string error;
+    pack->setTopology(std::to_string(state.range(0) / 4) + "s4p", error);
+    int middle = static_cast<int>(state.range(0) / 2);
+    for (auto _ : state)
+    {
+        pack->deleteBattery(middle);
+        pack->addCell(3.7, 3000, 3000);
+    }
+}
+BENCHMARK(BM_PackDeleteTopology)->Apply(cellCounts);
+
+/**
+ * @brief switching series/parallel the way MainWindow::changePackType does, in place
+ */
+static void BM_ChangePackType(benchmark::State &state)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(BatteryPack::SERIES, state.range(0));
+    for (auto _ : state)
+    {
+        pack->setConnectionType(pack->getConnectionType() == BatteryPack::SERIES ? BatteryPack::PARALLEL
+                                                                                : BatteryPack::SERIES);
+        benchmark::DoNotOptimize(pack->getVoltage());
+    }
+    setCellsProcessed(state);
+}
+BENCHMARK(BM_ChangePackType)->Apply(cellCounts);
+
+#ifdef BATTERY_BENCH_QT
+/**
+ * @brief one full paint of the canvas into an offscreen QImage
+ */
+static void canvasPaint(benchmark::State &state, BatteryPack::ConnectionType type)
+{
+    std::unique_ptr<BatteryPack> pack = makePack(type, state.range(0));
+    BatteryCanvas canvas;
+    canvas.resize(1280, 800);
+    canvas.setBatteryPack(pack.get());
+    QImage image(canvas.size(), QImage::Format_ARGB32_Premultiplied);
+    for (auto _ : state)
+    {
+        canvas.render(&image);
+        benchmark::ClobberMemory();
+    }
+    setCellsProcessed(state);
+}
+
+static void BM_CanvasPaintSeries(benchmark::State &state)
+{
+    canvasPaint(state, BatteryPack::SERIES);
+}
+BENCHMARK(BM_CanvasPaintSeries)->Apply(cellCounts)->Unit(benchmark::kMillisecond);
+
+static void BM_CanvasPaintParallel(benchmark::State &state)
+{
+    canvasPaint(state, BatteryPack::PARALLEL);
+}
+BENCHMARK(BM_CanvasPaintParallel)->Apply(cellCounts)->Unit(benchmark::kMillisecond);
+#endif
+
+/**
+ * @brief runs the suite; pass --benchmark_format=json or --benchmark_out=<file> for machine-readable results
+ */
+int main(int argc, char **argv)
+{
+#ifdef BATTERY_BENCH_QT
+    // Paint without a display
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+#endif
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
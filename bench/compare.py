@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Compares two battery_bench JSON result files and flags regressions.
+
+Usage:
+    battery_bench --benchmark_out=current.json --benchmark_out_format=json
+    bench/compare.py bench/baseline.json current.json [--threshold 0.10]
+
+A benchmark regresses when its time per iteration grew by more than the threshold
+(relative). Exits with status 1 if any benchmark regressed, so CI can fail on it.
+Benchmarks that exist in only one of the files are listed but never fail the run.
+"""
+
+import argparse
+import json
+import sys
+
+UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+    """Returns {name: cpu time in ns} for the plain iteration results of a file."""
+    with open(path) as f:
+        data = json.load(f)
+    times = {}
+    for b in data.get("benchmarks", []):
+        if b.get("run_type", "iteration") != "iteration" or b.get("error_occurred"):
+            continue
+        times[b["name"]] = b["cpu_time"] * UNITS[b.get("time_unit", "ns")]
+    return times
+
+
+def main():
+    parser = argparse.ArgumentParser(description="flag battery_bench regressions against a baseline")
+    parser.add_argument("baseline", help="stored JSON results")
+    parser.add_argument("current", help="JSON results of the build under test")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="relative slowdown that counts as a regression (default 0.10)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+
+    regressions = 0
+    print("%-40s %14s %14s %9s" % ("benchmark", "baseline ns", "current ns", "change"))
+    for name in sorted(set(baseline) | set(current)):
+        if name not in baseline or name not in current:
+            print("%-40s %s" % (name, "only in current" if name in current else "only in baseline"))
+            continue
+        before, after = baseline[name], current[name]
+        change = (after - before) / before if before > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-40s %14.1f %14.1f %+8.1f%%%s" % (name, before, after, change * 100, flag))
+
+    if regressions:
+        print("%d benchmark(s) regressed by more than %.0f%%" % (regressions, args.threshold * 100))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,13 +1,35 @@
 #include <iostream>
+#include <cstddef>
 
 #ifndef BATTERY_H
 #define BATTERY_H
+class CellStore;
+class EventSink;
+
 class Battery
 {
 private:
     double voltage, capacity, charge;
+
+public:
     static constexpr double DISCHARGE_RATE = 100.0;
     static constexpr double RECHARGE_RATE = 150.0;
+
+private:
+    double dischargeRate = DISCHARGE_RATE, rechargeRate = RECHARGE_RATE;
+
+protected:
+    /**
+     * @brief the store this battery is a view of, nullptr while it stands alone
+     */
+    CellStore *boundStore = nullptr;
+    /**
+     * @brief the slot of this battery inside boundStore
+     */
+    std::size_t boundSlot = 0;
+
+    friend class BatteryPack;
+
     /**
      * @brief the constructer allows us to create a Battery object
      * @param v it shows us the voltage
@@ -17,15 +39,32 @@ private:
 public:
     Battery(double v, double c, double initialCharge);
     /**
-     * @brief Decreases charge based on a fixed discharge rate.
+     * @brief Decreases charge based on the cell's discharge rate.
      * @param hours Number of hours of usage.
      */
     virtual void use(double hours);
     /**
-     * @brief Decreases charge based on a fixed recharge rate.
+     * @brief Decreases charge based on the cell's recharge rate.
      * @param hours Number of hours of recharge.
      */
     virtual void recharge(double hours);
+    /**
+     * @brief sets the discharge and recharge rates of this cell
+     * @param discharge the discharge rate
+     * @param recharge the recharge rate
+     *
+     * A standalone cell uses them as constant currents; inside a pack the pack's
+     * RateModel defines their unit.
+     */
+    void setRates(double discharge, double recharge);
+    /**
+     * @brief returns the discharge rate
+     */
+    double getDischargeRate() const;
+    /**
+     * @brief returns the recharge rate
+     */
+    double getRechargeRate() const;
     /**
      * @brief returns the voltage
      */
@@ -42,6 +81,15 @@ public:
      * @brief returns charge/capacity in a percentage
      */
     virtual double getPercent() const;
+    /**
+     * @brief returns true while this battery is a view of a slot in a pack's cell store
+     */
+    bool isBound() const;
+    /**
+     * @brief sets the sink for events of batteries that are not part of a pack
+     * @param sink the sink, nullptr to drop those events
+     */
+    static void setEventSink(EventSink *sink);
     virtual ~Battery() {}
 };
-#endif
\ No newline at end of file
+#endif
@@ -1,15 +1,40 @@
 #ifndef BATTERYCANVAS_H
 #define BATTERYCANVAS_H
 
-#include <QWidget>
+#include <QAbstractScrollArea>
 #include <QMouseEvent>
+#include <QPixmap>
+#include <cstdint>
+#include <vector>
 #include "BatteryPack.h"
 
-class BatteryCanvas : public QWidget
+struct PackSnapshot;
+
+/**
+ * @brief Scrollable, zoomable view of a BatteryPack.
+ *
+ * Cells are laid out in a column (series) or a row (parallel). Only the cells
+ * inside the viewport are drawn; their index range is computed from the layout
+ * directly. When zoomed out so far that cells would be only a few pixels apart,
+ * the canvas draws heatmap tiles coloured by the mean charge of the cells they
+ * cover instead. Cells and tiles can be coloured by temperature instead of
+ * charge when the pack has a thermal model. Wheel scrolls, Ctrl+wheel zooms
+ * around the cursor.
+ */
+class BatteryCanvas : public QAbstractScrollArea
 {
     Q_OBJECT
 
 public:
+    /**
+     * @brief What the colour of a cell or heatmap tile shows
+     */
+    enum Colouring
+    {
+        CHARGE,     // green, orange and red bands of the state of charge
+        TEMPERATURE // blue at the coolant temperature to red HEAT_SPAN above it
+    };
+
     /**
      * @brief Constructor for BatteryCanvas
      */
@@ -18,6 +43,30 @@ public:
      * @brief Sets the BatteryPack to visualize
      */
     void setBatteryPack(BatteryPack *pack);
+    /**
+     * @brief Schedules a repaint of only the cells whose charge band or labels changed since they were drawn
+     */
+    void refreshCells();
+    /**
+     * @brief Shows charges from a snapshot instead of reading them from the pack, nullptr to go back
+     */
+    void setSnapshot(const PackSnapshot *snap);
+    /**
+     * @brief Sets the zoom factor, 1 draws cells at their natural size
+     */
+    void setZoom(double factor);
+    /**
+     * @brief returns the zoom factor
+     */
+    double getZoom() const;
+    /**
+     * @brief Colours the cells by charge or by temperature; cells without a thermal model show the coolant temperature
+     */
+    void setColouring(Colouring c);
+    /**
+     * @brief returns what the cells' colours show
+     */
+    Colouring getColouring() const;
 
 protected:
     /**
@@ -30,16 +79,178 @@ protected:
      */
     void mousePressEvent(QMouseEvent *event) override;
 
+    /**
+     * @brief Highlights the cell under the cursor
+     */
+    void mouseMoveEvent(QMouseEvent *event) override;
+
+    /**
+     * @brief Shows tooltips and clears the hover when the cursor leaves
+     */
+    bool viewportEvent(QEvent *event) override;
+
+    /**
+     * @brief Scrolls along the pack, or zooms with Ctrl held
+     */
+    void wheelEvent(QWheelEvent *event) override;
+
+    void resizeEvent(QResizeEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+
 private:
     /**
      * @brief The BatteryPack being visualized
      */
     BatteryPack *myPack = nullptr;
 
+    /**
+     * @brief charges to show while the pack is being simulated on another thread, nullptr otherwise
+     */
+    const PackSnapshot *snapshot = nullptr;
+
+    double zoom = 1.0;
+    Colouring colouring = CHARGE;
+    /**
+     * @brief the cell under the cursor, -1 if none
+     */
+    int hovered = -1;
+
+    /**
+     * @brief What a cell's glyph shows; cells with equal state share one cached pixmap
+     */
+    struct CellGlyph
+    {
+        int band;       // 0 red, 1 orange, 2 green; the step on the heat scale when colouring by temperature
+        int fill;       // height of the charge fill in layout pixels
+        int percent;    // label value, degrees Celsius when colouring by temperature
+        double voltage; // label value
+
+        bool operator==(const CellGlyph &other) const;
+    };
+
+    /**
+     * @brief state of the last paint: the glyph of every visible cell and the layout it was drawn with
+     */
+    std::vector<CellGlyph> drawn;
+    std::size_t drawnFirst = 0;
+    const BatteryPack *drawnPack = nullptr;
+    std::size_t drawnCount = 0;
+    bool drawnVertical = true;
+    double drawnZoom = 0;
+    int drawnScroll = 0;
+    bool drawnHeatmap = false;
+    std::uint64_t drawnVersion = 0;
+
+    /**
+     * @brief prefix sums of the shown value (charge percentage or temperature) over blocks of cells, for the heatmap
+     */
+    std::vector<double> blockSums;
+    const BatteryPack *summaryPack = nullptr;
+    std::uint64_t summaryVersion = 0;
+    std::size_t summaryCells = 0;
+
     /**
      * @brief Helper to calculate where a specific battery is drawn
      */
     QRect getBatteryRect(int index, int startX, int startY) const;
+
+    /**
+     * @brief returns the distance between two cells along the layout axis, unzoomed
+     */
+    int cellPitch() const;
+    /**
+     * @brief returns true if the layout runs top to bottom (series)
+     */
+    bool vertical() const;
+    /**
+     * @brief returns the scroll bar that moves along the layout axis
+     */
+    QScrollBar *axisBar() const;
+    /**
+     * @brief recomputes the scroll range from the cell count and zoom
+     */
+    void updateScrollRange();
+
+    /**
+     * @brief returns the cell whose body is under a viewport position, -1 if none, O(1)
+     */
+    int cellAt(const QPoint &pos) const;
+    /**
+     * @brief returns the range of cells covered by the heatmap tile under a viewport position
+     */
+    bool tileAt(const QPoint &pos, std::size_t &first, std::size_t &last) const;
+    /**
+     * @brief moves the hover highlight, repainting only the two cells involved
+     */
+    void setHovered(int index);
+    /**
+     * @brief computes the range of cells inside the viewport from the layout
+     */
+    void visibleRange(std::size_t &first, std::size_t &last) const;
+    /**
+     * @brief returns what the glyph of cell i currently shows
+     */
+    CellGlyph glyphState(std::size_t i) const;
+    /**
+     * @brief returns the area cell i draws into, including terminal and labels, in layout coordinates
+     */
+    QRect glyphBounds(std::size_t i) const;
+    /**
+     * @brief maps a rectangle from layout coordinates to whole viewport pixels
+     */
+    QRect toViewport(const QRect &r) const;
+    /**
+     * @brief Draws one battery: body, terminal, charge fill and labels
+     */
+    void drawCell(QPainter &painter, const QRect &bRect, const CellGlyph &g, bool showText) const;
+    /**
+     * @brief returns the pre-rendered image of a cell, from QPixmapCache when possible
+     */
+    QPixmap glyph(const CellGlyph &g, const QSize &size) const;
+    /**
+     * @brief draws aggregate tiles over the visible part of the pack
+     */
+    void paintHeatmap(QPainter &painter);
+    /**
+     * @brief rebuilds blockSums if the pack changed since the last heatmap
+     */
+    void refreshSummary();
+    /**
+     * @brief returns the charge of cell i, from the snapshot when one is set
+     */
+    double chargeOf(std::size_t i) const;
+    /**
+     * @brief returns the capacity of cell i, from the snapshot when it has them
+     */
+    double capacityOf(std::size_t i) const;
+    /**
+     * @brief returns the voltage of cell i, from the snapshot when it has them
+     */
+    double voltageOf(std::size_t i) const;
+    /**
+     * @brief returns the charge of cell i as a percentage of its capacity
+     */
+    double percentOf(std::size_t i) const;
+    /**
+     * @brief returns the temperature of cell i, the coolant temperature if it has none
+     */
+    double temperatureOf(std::size_t i) const;
+    /**
+     * @brief returns the temperature shown at the blue end of the heat scale
+     */
+    double coolantTemperature() const;
+    /**
+     * @brief returns what the colouring shows for cell i: its charge percentage or its temperature
+     */
+    double valueOf(std::size_t i) const;
+    /**
+     * @brief returns a counter that changes whenever the shown charges change
+     */
+    std::uint64_t chargeVersion() const;
+    /**
+     * @brief returns the mean of valueOf() over cells [first, last)
+     */
+    double meanValue(std::size_t first, std::size_t last) const;
 };
 
-#endif
\ No newline at end of file
+#endif
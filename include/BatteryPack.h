@@ -1,8 +1,16 @@
 #ifndef BATTERYPACK_H
 #define BATTERYPACK_H
 
+#include <cstdint>
+#include <string>
 #include <vector>
 #include "Battery.h"
+#include "CellArena.h"
+#include "CellStore.h"
+#include "PackPlan.h"
+#include "SlotMap.h"
+
+class TelemetryWriter;
 
 class BatteryPack : public Battery
 {
@@ -17,14 +25,132 @@ public:
 protected:
     ConnectionType type;
     std::vector<Battery *> cells;
+    /**
+     * @brief stable handles onto the positions in cells
+     */
+    SlotMap handles;
+    /**
+     * @brief storage of the Battery views created by addCell/addCells, owned by the pack
+     */
+    CellArena arena;
+    /**
+     * @brief packed voltage/capacity/charge arrays of every plain cell in the pack
+     */
+    CellStore cellStore;
+    /**
+     * @brief nested packs, which keep their own store and are visited through the Battery interface
+     */
+    std::vector<BatteryPack *> subPacks;
+    /**
+     * @brief optional multi-level topology over the cell store, empty for a flat pack
+     */
+    PackPlan plan;
+    /**
+     * @brief aggregates of the last plan evaluation and the store version they belong to
+     */
+    mutable std::uint64_t planVersion = ~std::uint64_t(0);
+    mutable double planVoltage = 0, planCapacity = 0, planCharge = 0;
+    /**
+     * @brief per-node scratch of hoursToSaturate()
+     */
+    mutable std::vector<double> planHours;
+    /**
+     * @brief slots a deleted cell is swapped through, see PackPlan::removeCell()
+     */
+    std::vector<std::size_t> removal;
+    /**
+     * @brief optional recorder of the pack's history, fed after every use/recharge
+     */
+    TelemetryWriter *telemetry = nullptr;
+    /**
+     * @brief whether the circuit splits the pack's current among its parallel branches
+     */
+    bool currentSharing = false;
+
+    /**
+     * @brief evaluates the plan unless the cached aggregates are still current
+     */
+    void evaluatePlan() const;
+    /**
+     * @brief returns the hours until the pack as a whole saturates, see hoursToEmpty() and hoursToFull()
+     */
+    double hoursToSaturate(bool recharging) const;
+
+    /**
+     * @brief moves the state of a bound cell back into the Battery object and detaches it
+     */
+    void unbind(Battery *b);
+    /**
+     * @brief copies a cell's values into the store and makes it a view of the new slot
+     */
+    void bind(Battery *b);
+    /**
+     * @brief hands the current topology and connection type to the cell store's sharing
+     */
+    void refreshSharing();
+    /**
+     * @brief hands the width of the current topology's leaf groups to the cell store's thermal grid
+     */
+    void refreshThermal();
+    /**
+     * @brief exchanges two plain cells in getCells() and in the store, keeping their views and handles
+     */
+    void swapCells(std::size_t a, std::size_t b);
 
 public:
     BatteryPack(ConnectionType t);
+    /**
+     * @brief detaches the cells added with add() so they stay usable after the pack is gone,
+     *        and releases the cells the pack created itself in one go
+     */
+    ~BatteryPack() override;
+    BatteryPack(const BatteryPack &) = delete;
+    BatteryPack &operator=(const BatteryPack &) = delete;
     /**
      * @brief adds a battery to the cells
      * @param b the battery thats being added to the cells
+     * @return false if b is a plain cell that already belongs to a pack, this one included; delete it from
+     *         that pack first
      */
-    void add(Battery *b);
+    bool add(Battery *b);
+    /**
+     * @brief creates a cell owned by the pack and adds it
+     * @param v the voltage
+     * @param c the capacity
+     * @param initialCharge the initial charge
+     * @return the new cell, valid until it is deleted from the pack or the pack is destroyed
+     */
+    Battery *addCell(double v, double c, double initialCharge);
+    /**
+     * @brief creates n identical cells owned by the pack with a single allocation
+     * @param n number of cells
+     * @param v the voltage
+     * @param c the capacity
+     * @param initialCharge the initial charge
+     * @param discharge the discharge rate
+     * @param recharge the recharge rate
+     */
+    void addCells(std::size_t n, double v, double c, double initialCharge, double discharge = DISCHARGE_RATE,
+                  double recharge = RECHARGE_RATE);
+    /**
+     * @brief creates n cells owned by the pack from column arrays, copying each column in one go
+     * @param v voltages
+     * @param c capacities
+     * @param q charges, each within [0, capacity]
+     * @param n number of cells
+     * @param d discharge rates, nullptr for the default rate
+     * @param r recharge rates, nullptr for the default rate
+     */
+    void addCells(const double *v, const double *c, const double *q, std::size_t n, const double *d = nullptr,
+                  const double *r = nullptr);
+    /**
+     * @brief returns the simulated hours of use and recharge applied to the pack's cells
+     */
+    double getElapsedHours() const;
+    /**
+     * @brief sets the simulated hours, e.g. when a saved pack is restored
+     */
+    void setElapsedHours(double hours);
     /**
      * @brief Decreases charge of all batteries in the cell based on the specific discharge rate of every single battery.
      * @param hours Number of hours of usage.
@@ -36,11 +162,79 @@ public:
      */
     void recharge(double hours) override;
     /**
-     * @brief deletes a battery from the cells
+     * @brief returns the hours until the next cell of this pack or its nested packs saturates
+     * @param recharging true to look at recharge (cells filling up), false at use (cells running empty)
+     * @return infinity if no cell can saturate any more
+     *
+     * Until then every cell changes linearly, so use/recharge over any shorter
+     * interval can be applied in a single step without missing an event.
+     */
+    double hoursUntilSaturation(bool recharging) const;
+    /**
+     * @brief returns the hours of use until the pack is empty, without stepping
+     * @return 0 if it already is, infinity if it never will be
+     *
+     * A series string is empty as soon as one of its members is, a parallel
+     * group once all of its branches are, the same rule getCharge() follows.
+     * Each group is one range query on the cell store's saturation queue, so
+     * repeated queries between updates cost O(groups log n); see
+     * CellStore::saturationOrder(). Current sharing is not taken into account.
+     */
+    double hoursToEmpty() const;
+    /**
+     * @brief returns the hours of recharge until the pack is full, without stepping
+     * @return 0 if it already is, infinity if it never will be
+     *
+     * A series string is full as soon as one of its members is, a parallel
+     * group once all of its branches are.
+     */
+    double hoursToFull() const;
+    /**
+     * @brief returns the pack's next cells to saturate, in order, with the hours until each does
+     * @param recharging true for recharge (cells filling up), false for use (cells running empty)
+     * @param limit the most cells to return
+     *
+     * Cells are identified by their slot in getCellStore(), like events; cells
+     * of nested packs are not included.
+     */
+    std::vector<CellSaturation> saturationOrder(bool recharging, std::size_t limit) const;
+    /**
+     * @brief deletes a battery from the cells; cells created by the pack are destroyed
+     *        and their memory recycled, cells added with add() are detached
+     *
+     * O(1) in a flat pack: the last cell moves into the gap, in getCells() and
+     * in the store. With a topology every later group moves one cell, so groups
+     * stay contiguous in O(groups) but the order within them changes, and with
+     * it the cell a parallel group takes its voltage from. Packs with nested
+     * packs shift every later cell down, in O(n). Use handles to keep track of
+     * cells across deletions.
      */
     void deleteBattery(int index);
     /**
-     *@brief returns the sum of all voltages
+     * @brief deletes the battery a handle refers to
+     * @param h the handle
+     * @return false if the handle is stale
+     */
+    bool deleteBattery(CellHandle h);
+    /**
+     * @brief returns a stable handle to a cell
+     * @param index the index of the cell in getCells()
+     * @return the handle, or one that matches no cell (like a deleted cell's) if index is out of range
+     *
+     * The handle follows the cell when deletions move it and turns stale once
+     * it is deleted itself, even if a new cell reuses its memory.
+     */
+    CellHandle getHandle(int index) const;
+    /**
+     * @brief returns the current index of a handle's cell in getCells(), -1 if it has been deleted, O(1)
+     */
+    int indexOf(CellHandle h) const;
+    /**
+     * @brief returns the cell a handle refers to, nullptr if it has been deleted, O(1)
+     */
+    Battery *getCell(CellHandle h) const;
+    /**
+     *@brief returns the sum of all voltages in series, the voltage of the first cell in parallel
      */
     
     double getVoltage() const override;
@@ -58,6 +252,133 @@ public:
      */
     std::vector<Battery *> &getCells() const;
 
+    /**
+     * @brief returns the packed storage of the plain cells
+     */
+    const CellStore &getCellStore() const;
+
+    /**
+     * @brief organises the cells into a multi-level topology such as "96s4p"
+     * @param notation NsMp notation, outermost level first
+     * @param error receives a message on failure
+     * @return false if the notation is invalid, the pack has nested packs or the
+     *         cell count does not match the topology
+     *
+     * Cells keep their order: the first group gets the first cells. The connection
+     * type becomes that of the outermost level. Cells added later join the last
+     * group; adding a nested pack removes the topology.
+     */
+    bool setTopology(const std::string &notation, std::string &error);
+    /**
+     * @brief goes back to a flat pack of the current connection type
+     */
+    void clearTopology();
+    /**
+     * @brief returns the topology plan, empty for a flat pack
+     */
+    const PackPlan &getTopology() const;
+
+    /**
+     * @brief sets the sink for depletion and overcharge events of this pack and its nested packs
+     * @param sink the sink, nullptr or a NullEventSink to disable events at no cost
+     */
+    void setEventSink(EventSink *sink);
+
+    /**
+     * @brief sets the model that turns cell rates into charge changes for this pack and its nested packs
+     * @param model the model, constant current by default
+     *
+     * Nested packs added later keep their own model.
+     */
+    void setRateModel(const RateModel &model);
+    /**
+     * @brief returns the model of this pack's cell store
+     */
+    const RateModel &getRateModel() const;
+
+    /**
+     * @brief attaches an equivalent-circuit model to the cells of this pack and its nested packs
+     * @param parameters the circuit shared by all cells; its OCV curve must be set
+     *
+     * The cells' voltages then follow their state of charge and load current,
+     * and so does getVoltage(). Nested packs added later keep their own model.
+     */
+    void setCircuit(const CircuitParameters &parameters);
+    /**
+     * @brief detaches the equivalent-circuit model and restores the cells' nominal voltages
+     */
+    void clearCircuit();
+    /**
+     * @brief sets the factor on a cell's circuit resistances, e.g. for an aged cell
+     * @param index the index of the cell in getCells()
+     * @param scale the factor, 1 for the circuit as given
+     * @return false if there is no such plain cell or no circuit is attached
+     *
+     * The factor is reset when the circuit is replaced.
+     */
+    bool setImpedance(int index, double scale);
+
+    /**
+     * @brief attaches a thermal model to the cells of this pack and its nested packs
+     * @param parameters the model shared by all cells
+     *
+     * The cells sit on a grid in getCells() order: one row for a flat pack,
+     * rows as wide as the largest leaf group of a topology (so equal groups get
+     * a row each), unless the parameters fix the width. getCapacity() and the rates then
+     * follow the cells' temperatures; cells taken out of the pack get their
+     * nominal values back. Nested packs added later keep their own model.
+     */
+    void setThermal(const ThermalParameters &parameters);
+    /**
+     * @brief detaches the thermal model and restores the cells' nominal capacities and rates
+     */
+    void clearThermal();
+
+    /**
+     * @brief attaches an aging model to the cells of this pack and its nested packs
+     * @param parameters the model shared by all cells
+     *
+     * The cells' capacities then fade with time and with the cycles their
+     * state of charge goes through, see CellAging, and cells taken out of the
+     * pack keep the capacity they have faded to. Nested packs added later keep
+     * their own model.
+     */
+    void setAging(const AgingParameters &parameters);
+    /**
+     * @brief detaches the aging model; the cells keep their faded capacities
+     */
+    void clearAging();
+
+    /**
+     * @brief lets the equivalent circuit decide how the current splits among parallel branches,
+     *        for this pack and its nested packs
+     * @param on true to share, false to let every cell follow its own rate
+     *
+     * The rate model still sets the current each group draws (the sum over a
+     * parallel group, the mean over a series string); the split follows the
+     * cells' impedances and open-circuit voltages, see CurrentSharing. Has no
+     * effect without a circuit. Nested packs share among their own cells only.
+     */
+    void setCurrentSharing(bool on);
+    /**
+     * @brief returns true if current sharing is on
+     */
+    bool isCurrentSharing() const;
+
+    /**
+     * @brief sets the writer that records the pack's state after every use/recharge
+     * @param writer the writer, nullptr to stop recording; called on the thread that steps the pack
+     */
+    void setTelemetry(TelemetryWriter *writer);
+
+    /**
+     * @brief switches the pack between series and parallel in place
+     * @param t the new connection type
+     *
+     * The cells stay where they are; only the cached aggregates are dropped.
+     * A topology fixes the wiring itself, so it is removed.
+     */
+    void setConnectionType(ConnectionType t);
     /**
      * @brief returns connection type
      */
@@ -66,4 +387,4 @@ public:
 
 };
 
-#endif // BATTERYPACK_H
\ No newline at end of file
+#endif // BATTERYPACK_H
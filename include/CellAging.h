@@ -0,0 +1,151 @@
+#include <cstddef>
+#include <vector>
+
+#ifndef CELLAGING_H
+#define CELLAGING_H
+
+/**
+ * @brief Parameters of the aging model, shared by every cell of a store
+ */
+struct AgingParameters
+{
+    /**
+     * @brief capacity fraction lost to calendar aging after one year at state of charge 0.5 and the reference
+     *        temperature; the loss grows with the square root of time
+     */
+    double calendarLoss = 0.02;
+    double socStress = 1;              // relative change of calendar aging per unit of mean state of charge above 0.5
+    double referenceTemperature = 25;  // degrees Celsius
+    double doublingKelvin = 10;        // calendar aging doubles every this many kelvin, with a thermal model
+    double cycleLoss = 0.0001;         // capacity fraction lost per full cycle between empty and full
+    double depthExponent = 1.5;        // a cycle of depth d costs cycleLoss * d^depthExponent
+    /**
+     * @brief hours of whole-store updates between capacity updates, 0 to update after every one
+     */
+    double interval = 168;
+};
+
+/**
+ * @brief Capacity fade of the cells of a CellStore from calendar and cycle aging.
+ *
+ * Every cell's health is the fraction of its capacity it has left. Calendar
+ * aging grows with the square root of time, faster at a high mean state of
+ * charge and, with a thermal model, at high temperature; a change of those
+ * carries on from the equivalent time of the loss so far. Cycle aging counts
+ * the cycles in each cell's state of charge with a streaming rainflow counter
+ * (ASTM E1049): every whole-store update gives one sample, turning points go
+ * onto a per-cell residue of at most DEPTH points, and every closed cycle adds
+ * its damage right away, so no history is kept and each sample costs O(1)
+ * amortized. A residue that fills up counts its oldest range as a half cycle.
+ *
+ * The losses accumulate on every update, but capacities only change once
+ * interval hours have passed: age() then rescales every cell in one pass.
+ */
+class CellAging
+{
+public:
+    /**
+     * @brief turning points kept per cell; memory stays bounded however long the simulation runs
+     */
+    static const std::size_t DEPTH = 8;
+
+    explicit CellAging(const AgingParameters &parameters);
+
+    /**
+     * @brief remaining fraction of every cell's capacity, 1 for a new cell
+     */
+    std::vector<double> health;
+    /**
+     * @brief capacity fractions lost to calendar and to cycle aging so far
+     */
+    std::vector<double> calendarLoss;
+    std::vector<double> cycleLoss;
+    /**
+     * @brief cycles counted so far, half cycles as 0.5
+     */
+    std::vector<double> cycles;
+
+    const AgingParameters &getParameters() const;
+
+    /**
+     * @brief appends a new cell
+     * @param soc its state of charge, the start of its history
+     */
+    void push(double soc);
+    /**
+     * @brief removes a cell, shifting every later slot down by one
+     */
+    void erase(std::size_t slot);
+    /**
+     * @brief exchanges the state of two cells
+     */
+    void swap(std::size_t a, std::size_t b);
+    /**
+     * @brief removes the last cell
+     */
+    void pop();
+    /**
+     * @brief removes every cell
+     */
+    void clear();
+
+    /**
+     * @brief feeds the state of charge of a single cell after a change to the cycle counter
+     */
+    void sample(std::size_t slot, double soc);
+    /**
+     * @brief feeds every cell's state of charge after a whole-store update to the cycle counter
+     * @param charge the charges after the update
+     * @param capacity the capacities
+     * @param n number of cells
+     * @param hours the length of the update
+     * @return true once interval hours have passed since the last age()
+     */
+    bool record(const double *charge, const double *capacity, std::size_t n, double hours);
+    /**
+     * @brief returns the hours of whole-store updates left until record() asks for the next age(), 0 if it is due
+     */
+    double hoursUntilAging() const;
+    /**
+     * @brief adds the calendar aging since the last call and rescales every cell to its new health
+     * @param charge rescaled at the same state of charge
+     * @param capacity rescaled to the new health
+     * @param nominal further capacities to rescale along with them, nullptr if none
+     * @param temperature every cell's temperature, nullptr to age at the reference temperature
+     * @param n number of cells
+     */
+    void age(double *charge, double *capacity, double *nominal, const double *temperature, std::size_t n);
+
+private:
+    AgingParameters parameters;
+    /**
+     * @brief hours of updates since the last age()
+     */
+    double pending = 0;
+    /**
+     * @brief per cell: the newest sample, the direction it has been moving in (-1, 0 before the first move, 1),
+     *        the turning points still open and the integral of the state of charge since the last age()
+     */
+    std::vector<double> latest;
+    std::vector<double> direction;
+    std::vector<float> residue; // DEPTH per cell, oldest first
+    std::vector<unsigned char> depth;
+    std::vector<double> socHours;
+
+    /**
+     * @brief the samples of the current update, scratch of record()
+     */
+    std::vector<double> next;
+
+    /**
+     * @brief pushes a turning point onto a cell's residue and counts the cycles it closes
+     */
+    void turn(std::size_t slot, float point);
+    /**
+     * @brief adds the damage of a cycle of the given depth
+     * @param weight 1 for a full cycle, 0.5 for a half cycle
+     */
+    void count(std::size_t slot, double range, double weight);
+};
+
+#endif // CELLAGING_H
@@ -0,0 +1,78 @@
+#include <cstddef>
+#include <vector>
+
+#ifndef CELLARENA_H
+#define CELLARENA_H
+
+class Battery;
+
+/**
+ * @brief Slab allocator for the Battery views owned by a BatteryPack.
+ *
+ * Cells are placement-constructed into large slabs instead of one heap
+ * allocation each. Destroyed cells go onto a free list and are reused in O(1).
+ * Tearing the arena down releases whole slabs at once; Battery holds no
+ * resources, so live cells are not destroyed one by one.
+ */
+class CellArena
+{
+public:
+    CellArena() = default;
+    /**
+     * @brief releases every slab in one go
+     */
+    ~CellArena();
+    CellArena(const CellArena &) = delete;
+    CellArena &operator=(const CellArena &) = delete;
+
+    /**
+     * @brief constructs a cell in the arena
+     * @param v the voltage
+     * @param c the capacity
+     * @param initialCharge the initial charge
+     */
+    Battery *create(double v, double c, double initialCharge);
+    /**
+     * @brief destroys a cell created by this arena and recycles its slot
+     */
+    void destroy(Battery *b);
+    /**
+     * @brief makes sure the next n creations need no further allocation
+     */
+    void reserve(std::size_t n);
+    /**
+     * @brief returns true if b lives in one of this arena's slabs, O(log slabs)
+     */
+    bool owns(const Battery *b) const;
+    /**
+     * @brief returns the number of live cells
+     */
+    std::size_t live() const;
+    /**
+     * @brief releases every slab; all cells created so far become invalid
+     */
+    void clear();
+
+private:
+    struct Slab
+    {
+        Battery *begin;
+        std::size_t capacity;
+    };
+
+    // Sorted by address so owns() can binary search
+    std::vector<Slab> slabs;
+    // Unused part of the newest slab, new cells are carved from it when the free list is empty
+    Battery *cursor = nullptr;
+    Battery *cursorEnd = nullptr;
+    std::vector<Battery *> freeList;
+    std::size_t liveCount = 0;
+    std::size_t nextSlabSize = 64;
+
+    /**
+     * @brief allocates a slab with room for at least n cells and makes it current
+     */
+    void addSlab(std::size_t n);
+};
+
+#endif // CELLARENA_H
@@ -0,0 +1,224 @@
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifndef CELLCIRCUIT_H
+#define CELLCIRCUIT_H
+
+/**
+ * @brief Open-circuit voltage as a function of state of charge
+ *
+ * The curve is given as (state of charge, volts) points and resampled to a
+ * uniform grid, so a lookup is one multiply and one linear interpolation
+ * without a search.
+ */
+class OcvCurve
+{
+public:
+    /**
+     * @brief number of grid intervals between state of charge 0 and 1
+     */
+    static constexpr std::size_t INTERVALS = 256;
+
+    /**
+     * @brief sets the curve from points
+     * @param soc states of charge, strictly increasing, the first 0 and the last 1
+     * @param volts the open-circuit voltage at each state of charge
+     * @param error receives a message on failure
+     * @return false if the points do not describe a curve over [0, 1]
+     */
+    bool set(const std::vector<double> &soc, const std::vector<double> &volts, std::string &error);
+    /**
+     * @brief returns true until set() succeeded
+     */
+    bool empty() const;
+    /**
+     * @brief returns the open-circuit voltage at a state of charge, extrapolating linearly outside [0, 1]
+     */
+    double at(double soc) const
+    {
+        return lookup(base.data(), slope.data(), soc);
+    }
+    /**
+     * @brief the interpolation behind at(), on raw grid arrays so update loops can inline it
+     *
+     * Only the interval index is clamped, which keeps the lookup free of
+     * branches and lets the compiler vectorize it.
+     */
+    static double lookup(const double *base, const double *slope, double soc)
+    {
+        double x = soc * static_cast<double>(INTERVALS);
+        int i = static_cast<int>(x);
+        i = i < 0 ? 0 : (i > static_cast<int>(INTERVALS) - 1 ? static_cast<int>(INTERVALS) - 1 : i);
+        return base[i] + (x - i) * slope[i];
+    }
+    /**
+     * @brief returns the points the curve was set from
+     */
+    const std::vector<double> &points() const;
+
+private:
+    friend class CellCircuit;
+
+    std::vector<double> base;   // voltage at the start of every interval
+    std::vector<double> slope;  // voltage change across every interval
+    std::vector<double> source; // soc0, volts0, soc1, volts1, ...
+};
+
+/**
+ * @brief One resistor-capacitor pair of the equivalent circuit, disabled while the resistance is 0
+ */
+struct RcPair
+{
+    double resistance = 0; // ohms
+    double capacitance = 0; // farads
+};
+
+/**
+ * @brief Parameters of a Thevenin equivalent circuit, shared by every cell of a store
+ */
+struct CircuitParameters
+{
+    static constexpr std::size_t PAIRS = 2;
+
+    OcvCurve ocv;
+    double seriesResistance = 0; // ohms
+    RcPair pairs[PAIRS];
+    /**
+     * @brief amperes per charge unit per hour, 0.001 for charges in mAh
+     */
+    double ampsPerRate = 0.001;
+};
+
+/**
+ * @brief Thevenin equivalent-circuit state of the cells of a CellStore.
+ *
+ * A cell is an open-circuit voltage source that depends on its state of
+ * charge, a series resistance and up to two RC pairs. Attached to a store, the
+ * circuit turns each update into a cell current (the charge moved divided by
+ * the step length), advances the voltage across every RC pair and writes the
+ * terminal voltage
+ *
+ *     V = OCV(charge / capacity) - I * R0 - v1 - v2
+ *
+ * into the store's voltage column, so every pack aggregate sees the voltage
+ * under load. For a constant current each RC pair is solved exactly,
+ *
+ *     v' = v * exp(-h / RC) + I * R * (1 - exp(-h / RC)),
+ *
+ * with the decay factors computed once per step length and shared by all
+ * cells. A fast-forwarded stretch of ticks therefore lands on the same state
+ * as the ticks one by one. The per-cell columns are laid out like the store,
+ * and the update runs over all cells in one vectorized pass.
+ *
+ * Each cell also has an impedance factor that scales its series and RC
+ * resistances (keeping the RC time constants), so aged or mismatched cells can
+ * be modelled without a circuit of their own.
+ */
+class CellCircuit
+{
+public:
+    explicit CellCircuit(const CircuitParameters &parameters);
+
+    /**
+     * @brief the voltages the cells had before the circuit was attached, restored when it is removed
+     */
+    std::vector<double> nominal;
+    /**
+     * @brief voltage across each RC pair of every cell
+     */
+    std::vector<double> polarisation[CircuitParameters::PAIRS];
+    /**
+     * @brief factor on the resistances of every cell, 1 for the circuit as given
+     */
+    std::vector<double> impedance;
+
+    const CircuitParameters &getParameters() const;
+    /**
+     * @brief returns the terminal voltage of a cell at rest
+     */
+    double restVoltage(double q, double c) const;
+
+    /**
+     * @brief appends a cell at rest
+     * @param v the cell's nominal voltage
+     */
+    void push(double v);
+    /**
+     * @brief removes a cell, shifting every later slot down by one
+     */
+    void erase(std::size_t slot);
+    /**
+     * @brief exchanges the state of two cells
+     */
+    void swap(std::size_t a, std::size_t b);
+    /**
+     * @brief removes the last cell
+     */
+    void pop();
+    /**
+     * @brief removes every cell
+     */
+    void clear();
+
+    /**
+     * @brief remembers the charges before a whole-store update
+     */
+    void begin(const double *charge, std::size_t n);
+    /**
+     * @brief advances every cell over an update that began with begin()
+     * @param charge the charges after the update
+     * @param capacity the capacities
+     * @param voltage receives the terminal voltages
+     * @param n number of cells
+     * @param hours the length of the update
+     * @return the sum of the terminal voltages, accumulated over eight lanes in a fixed order
+     */
+    double step(const double *charge, const double *capacity, double *voltage, std::size_t n, double hours);
+    /**
+     * @brief advances a single cell
+     * @param slot the slot of the cell
+     * @param before the charge before the update
+     * @param after the charge after the update
+     * @param capacity the capacity of the cell
+     * @param hours the length of the update
+     * @return the new terminal voltage
+     */
+    double stepCell(std::size_t slot, double before, double after, double capacity, double hours);
+
+    /**
+     * @brief returns the charges remembered by begin()
+     */
+    const double *startCharges() const;
+    /**
+     * @brief computes every cell's Thevenin equivalent for an update that began with begin()
+     * @param capacity the capacities
+     * @param n number of cells
+     * @param hours the length of the update
+     * @param source receives the voltage each cell would show at zero current at the end of the update
+     * @param conductance receives the inverse of each cell's resistance to a current held over the update
+     *
+     * A cell held at current I for the update ends at the terminal voltage
+     * source - I / conductance, up to the curvature of the OCV curve within one
+     * grid interval. The resistance includes the OCV drop the current itself
+     * causes over the update, so the equivalent stays well damped for long steps.
+     */
+    void thevenin(const double *capacity, std::size_t n, double hours, double *source, double *conductance);
+
+private:
+    CircuitParameters parameters;
+    std::vector<double> previous;
+    /**
+     * @brief decay factors and gains of the RC pairs for cachedHours
+     */
+    double cachedHours = -1;
+    double decay[CircuitParameters::PAIRS] = {1, 1};
+    double gain[CircuitParameters::PAIRS] = {0, 0};
+
+    /**
+     * @brief computes the decay factors for a step length unless they are cached
+     */
+    void prepare(double hours);
+};
+
+#endif // CELLCIRCUIT_H
@@ -0,0 +1,110 @@
+#include <cstddef>
+
+#ifndef CELLKERNELS_H
+#define CELLKERNELS_H
+
+/**
+ * @brief Explicitly vectorized loops over the packed arrays of a CellStore.
+ *
+ * Every kernel exists as an AVX2, an SSE2 and a scalar version; the best one the
+ * CPU supports is picked at runtime. All versions accumulate sums over the same
+ * eight interleaved lanes, so forcing the scalar path reproduces the vector
+ * results bit for bit.
+ */
+namespace CellKernels
+{
+    enum class Isa
+    {
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+    /**
+     * @brief returns the instruction set the kernels currently dispatch to
+     */
+    Isa activeIsa();
+    /**
+     * @brief returns a printable name for an instruction set
+     */
+    const char *isaName(Isa isa);
+    /**
+     * @brief forces the scalar kernels even when SIMD is available
+     * @param force true to use the scalar path
+     *
+     * The scalar path is also forced when the BATTERY_FORCE_SCALAR environment
+     * variable is set to anything but "0" at startup.
+     */
+    void setForceScalar(bool force);
+    /**
+     * @brief returns true if the scalar path is forced
+     */
+    bool isScalarForced();
+    /**
+     * @brief returns true if loops built with CELLKERNELS_AVX2_CLONE should run their AVX2 build
+     */
+    bool useAvx2();
+
+    /**
+     * @brief number of interleaved lanes sums are accumulated over: x[i] goes to lane i % LANES
+     */
+    constexpr std::size_t LANES = 8;
+
+    /**
+     * @brief returns the total of LANES partial sums, combined in the fixed order every kernel uses
+     *
+     * A loop outside the kernels that adds its full blocks of LANES over the
+     * lanes, combines them here and then adds the tail one value at a time gets
+     * sums bit for bit equal to sum().
+     */
+    inline double sumLanes(const double *lanes)
+    {
+        return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+
+    /**
+     * @brief returns the smallest of LANES partial minima
+     */
+    inline double minLanes(const double *lanes)
+    {
+        double m = lanes[0];
+        for (std::size_t j = 1; j < LANES; ++j)
+            m = lanes[j] < m ? lanes[j] : m;
+        return m;
+    }
+
+    /**
+     * @brief Summary of the charges written by an update kernel
+     */
+    struct ChargeStats
+    {
+        std::size_t clamped; // cells that saturated
+        double sum;          // sum of the new charges, accumulated like sum()
+        double min;          // smallest new charge, 0 if n is 0
+    };
+
+    /**
+     * @brief computes charge[i] = max(charge[i] - delta, 0)
+     * @return the number of clamped cells and the sum/min of the new charges
+     */
+    ChargeStats discharge(double *charge, std::size_t n, double delta);
+    /**
+     * @brief computes charge[i] = min(charge[i] + delta, capacity[i])
+     * @return the number of clamped cells and the sum/min of the new charges
+     */
+    ChargeStats recharge(double *charge, const double *capacity, std::size_t n, double delta);
+    /**
+     * @brief returns the sum of x[0..n)
+     */
+    double sum(const double *x, std::size_t n);
+    /**
+     * @brief returns the smallest of x[0..n), 0 if n is 0
+     */
+    double min(const double *x, std::size_t n);
+    /**
+     * @brief returns the smallest capacity[i] - charge[i], 0 if n is 0
+     */
+    double minHeadroom(const double *charge, const double *capacity, std::size_t n);
+}
+
+#endif // CELLKERNELS_H
@@ -0,0 +1,45 @@
+#include "CellKernels.h"
+
+#ifndef CELLKERNELSCLONE_H
+#define CELLKERNELSCLONE_H
+
+/**
+ * @brief Baseline and AVX2 builds of plain C++ loops, dispatched like the CellKernels.
+ *
+ * A loop is written once as a template on a dummy bool, which only makes the
+ * two builds separate instantiations, and marked CELLKERNELS_INLINE:
+ *
+ *     template <bool Wide>
+ *     CELLKERNELS_INLINE double scale(double *x, std::size_t n, double f) { ... }
+ *     CELLKERNELS_AVX2_CLONE(double, scale, (double *x, std::size_t n, double f), (x, n, f))
+ *
+ * The clone macro defines scaleBaseline() and scaleAvx2(), and callers pick one
+ * with CellKernels::useAvx2(). Without an AVX2 build, scaleAvx2() is a second
+ * baseline build that useAvx2() never selects.
+ */
+#if defined(__GNUC__)
+// The loop must be inlined into each build; GCC otherwise keeps one baseline copy
+#define CELLKERNELS_INLINE inline __attribute__((always_inline))
+#if defined(__x86_64__)
+#define CELLKERNELS_AVX2 1
+#define CELLKERNELS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define CELLKERNELS_INLINE inline
+#endif
+
+#if !CELLKERNELS_AVX2
+#define CELLKERNELS_TARGET_AVX2
+#endif
+
+#define CELLKERNELS_AVX2_CLONE(Result, loop, parameters, arguments)                                                     \
+    Result loop##Baseline parameters                                                                                   \
+    {                                                                                                                  \
+        return loop<false> arguments;                                                                                  \
+    }                                                                                                                  \
+    CELLKERNELS_TARGET_AVX2 Result loop##Avx2 parameters                                                               \
+    {                                                                                                                  \
+        return loop<true> arguments;                                                                                   \
+    }
+
+#endif // CELLKERNELSCLONE_H
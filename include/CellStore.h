@@ -0,0 +1,510 @@
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "CellAging.h"
+#include "CellCircuit.h"
+#include "CellThermal.h"
+#include "CurrentSharing.h"
+#include "MinTree.h"
+#include "RateModel.h"
+#include "SaturationQueue.h"
+
+#ifndef CELLSTORE_H
+#define CELLSTORE_H
+
+class EventSink;
+
+/**
+ * @brief A cell that has yet to saturate and the hours until it does
+ */
+struct CellSaturation
+{
+    std::size_t slot;
+    double hours;
+};
+
+/**
+ * @brief Contiguous structure-of-arrays storage for the cells of a BatteryPack.
+ *
+ * Every cell occupies one slot; its voltage, capacity, charge and rates live at
+ * the same index of packed arrays so that whole-pack operations are plain
+ * loops over doubles instead of virtual calls through Battery pointers.
+ *
+ * The store also keeps running sums and min-trackers so the aggregate getters
+ * are O(1). The arrays may be read freely, but writes must go through the member
+ * functions (or be followed by rebuildAggregates()).
+ */
+class CellStore
+{
+public:
+    std::vector<double> voltage;
+    std::vector<double> capacity;
+    std::vector<double> charge;
+    /**
+     * @brief per-cell rate parameters, in the unit of the store's RateModel
+     */
+    std::vector<double> dischargeRate;
+    std::vector<double> rechargeRate;
+
+    /**
+     * @brief simulated hours of use and recharge applied to the whole store, used to timestamp events
+     */
+    double elapsed = 0;
+
+    /**
+     * @brief sets the sink that receives depletion and overcharge events
+     * @param sink the sink, nullptr or a disabled sink turns event detection off
+     *
+     * Events identify cells by their slot in the store.
+     */
+    void setEventSink(EventSink *sink);
+    /**
+     * @brief returns the active sink, nullptr if events are off
+     */
+    EventSink *getEventSink() const;
+
+    /**
+     * @brief returns the number of cells in the store
+     */
+    std::size_t size() const;
+    /**
+     * @brief returns true if the store holds no cells
+     */
+    bool empty() const;
+    /**
+     * @brief appends a cell and returns its slot
+     * @param v the voltage of the cell
+     * @param c the capacity of the cell
+     * @param q the (already clamped) charge of the cell
+     * @param d the discharge rate of the cell
+     * @param r the recharge rate of the cell
+     */
+    std::size_t push(double v, double c, double q, double d, double r);
+    /**
+     * @brief appends n cells from column arrays and rebuilds the aggregates once
+     * @param v voltages
+     * @param c capacities
+     * @param q (already clamped) charges
+     * @param n number of cells
+     * @param d discharge rates, nullptr for the default rate
+     * @param r recharge rates, nullptr for the default rate
+     */
+    void append(const double *v, const double *c, const double *q, std::size_t n, const double *d = nullptr,
+                const double *r = nullptr);
+    /**
+     * @brief preallocates room for n cells
+     */
+    void reserve(std::size_t n);
+    /**
+     * @brief removes a cell, shifting every later slot down by one
+     * @param slot the slot to remove
+     */
+    void erase(std::size_t slot);
+    /**
+     * @brief exchanges the slots of two cells, O(log n)
+     *
+     * Only the cells' positions change, so every sum stays as it is; the
+     * per-cell trees, queues and circuit state move along with them.
+     */
+    void swap(std::size_t a, std::size_t b);
+    /**
+     * @brief removes the cell in the last slot, O(log n)
+     *
+     * Together with swap() this removes any cell without shifting the others.
+     */
+    void pop();
+    /**
+     * @brief removes every cell
+     */
+    void clear();
+
+    /**
+     * @brief changes the rates of a single cell
+     * @param slot the slot of the cell
+     * @param d the new discharge rate
+     * @param r the new recharge rate
+     *
+     * With a thermal model the rates are nominal ones, scaled by the cell's temperature.
+     */
+    void setRates(std::size_t slot, double d, double r);
+    /**
+     * @brief sets the model that turns the per-cell rates into charge changes
+     */
+    void setRateModel(const RateModel &m);
+    /**
+     * @brief returns the model that turns the per-cell rates into charge changes
+     */
+    const RateModel &getRateModel() const;
+
+    /**
+     * @brief attaches an equivalent-circuit model, replacing any previous one
+     * @param parameters the circuit shared by all cells; its OCV curve must be set
+     *
+     * From now on the voltage column holds terminal voltages: every cell starts
+     * at rest at the open-circuit voltage of its state of charge.
+     */
+    void setCircuit(const CircuitParameters &parameters);
+    /**
+     * @brief detaches the circuit model and restores the nominal voltages
+     */
+    void clearCircuit();
+    /**
+     * @brief returns the attached circuit, nullptr if there is none
+     */
+    const CellCircuit *getCircuit() const;
+    /**
+     * @brief returns the voltage a cell was given, which differs from voltage[slot] while a circuit is attached
+     */
+    double nominalVoltage(std::size_t slot) const;
+    /**
+     * @brief returns the nominal voltages of all cells, see nominalVoltage()
+     */
+    const double *nominalVoltages() const;
+    /**
+     * @brief sets the factor on a cell's circuit resistances
+     * @param slot the slot of the cell
+     * @param scale the factor, 1 for the circuit as given
+     * @return false if no circuit is attached
+     */
+    bool setImpedance(std::size_t slot, double scale);
+
+    /**
+     * @brief attaches a thermal model, replacing any previous one
+     * @param parameters the model shared by all cells
+     *
+     * Every cell starts at the coolant temperature. From now on the capacity
+     * and rate columns hold the values at each cell's temperature, and the
+     * values the cells were given are kept as nominal ones. Whole-store updates
+     * heat the cells and apply the feedback; single-cell updates do not.
+     */
+    void setThermal(const ThermalParameters &parameters);
+    /**
+     * @brief detaches the thermal model and restores the nominal capacities and rates
+     *
+     * Charges keep their state of charge.
+     */
+    void clearThermal();
+    /**
+     * @brief returns the attached thermal model, nullptr if there is none
+     */
+    const CellThermal *getThermal() const;
+    /**
+     * @brief sets the width of the thermal grid, 0 for a single row; ignored without a thermal model
+     */
+    void setThermalColumns(std::size_t n);
+    /**
+     * @brief returns the capacity a cell was given, which differs from capacity[slot] while a thermal model is attached
+     */
+    double nominalCapacity(std::size_t slot) const;
+    /**
+     * @brief returns a cell's charge at its nominal capacity and the same state of charge
+     */
+    double nominalCharge(std::size_t slot) const;
+    /**
+     * @brief returns the discharge rate a cell was given, see nominalCapacity()
+     */
+    double nominalDischargeRate(std::size_t slot) const;
+    /**
+     * @brief returns the recharge rate a cell was given, see nominalCapacity()
+     */
+    double nominalRechargeRate(std::size_t slot) const;
+    /**
+     * @brief returns the nominal capacities of all cells, see nominalCapacity()
+     */
+    const double *nominalCapacities() const;
+    /**
+     * @brief returns the nominal discharge rates of all cells
+     */
+    const double *nominalDischargeRates() const;
+    /**
+     * @brief returns the nominal recharge rates of all cells
+     */
+    const double *nominalRechargeRates() const;
+
+    /**
+     * @brief attaches an aging model, replacing any previous one
+     * @param parameters the model shared by all cells
+     *
+     * Every cell starts at full health with its current capacity. Whole-store
+     * updates feed the cells' states of charge to the model, and once its
+     * interval has passed the capacities fade in one pass, at the same state of
+     * charge. With a thermal model the nominal capacities fade too.
+     */
+    void setAging(const AgingParameters &parameters);
+    /**
+     * @brief detaches the aging model; the cells keep the capacities they have faded to
+     */
+    void clearAging();
+    /**
+     * @brief returns the attached aging model, nullptr if there is none
+     */
+    const CellAging *getAging() const;
+
+    /**
+     * @brief lets the circuit split the store's current among its parallel branches
+     * @param plan the topology the cells are wired in, read on every update; nullptr turns sharing off
+     * @param parallel the connection type used while the plan is empty
+     *
+     * Only takes effect while a circuit is attached; see CurrentSharing. Single
+     * cell updates (useCell(), rechargeCell()) are not shared.
+     */
+    void setCurrentSharing(const PackPlan *plan, bool parallel);
+    /**
+     * @brief returns true while updates are shared among branches: sharing set and a circuit attached
+     */
+    bool sharesCurrent() const;
+
+    /**
+     * @brief Decreases the charge of every cell based on its discharge rate and the rate model.
+     * @param hours Number of hours of usage.
+     */
+    void use(double hours);
+    /**
+     * @brief Increases the charge of every cell based on its recharge rate and the rate model.
+     * @param hours Number of hours of recharge.
+     */
+    void recharge(double hours);
+    /**
+     * @brief Decreases the charge of a single cell.
+     * @param slot the slot of the cell
+     * @param hours Number of hours of usage.
+     */
+    void useCell(std::size_t slot, double hours);
+    /**
+     * @brief Increases the charge of a single cell.
+     * @param slot the slot of the cell
+     * @param hours Number of hours of recharge.
+     */
+    void rechargeCell(std::size_t slot, double hours);
+
+    /**
+     * @brief recomputes every aggregate from the arrays, O(n)
+     */
+    void rebuildAggregates();
+    /**
+     * @brief returns a counter that changes whenever any cell value changes, for caches built on the store
+     */
+    std::uint64_t version() const;
+
+    /**
+     * @brief returns the sum of all voltages, O(1)
+     */
+    double sumVoltage() const;
+    /**
+     * @brief returns the sum of all capacities, O(1)
+     */
+    double sumCapacity() const;
+    /**
+     * @brief returns the smallest capacity, 0 if the store is empty, O(1)
+     */
+    double minCapacity() const;
+    /**
+     * @brief returns the sum of all charges, O(1)
+     */
+    double sumCharge() const;
+    /**
+     * @brief returns the smallest charge, 0 if the store is empty, O(1)
+     */
+    double minCharge() const;
+
+    /**
+     * @brief returns the hours of use until the next cell that still has charge runs empty
+     * @return infinity if every cell is already empty or the store is empty
+     *
+     * O(1) while no cell is empty and the rates are uniform, otherwise one scan of the charges.
+     * Current sharing is not taken into account.
+     */
+    double hoursUntilDepleted() const;
+    /**
+     * @brief returns the hours of recharge until the next cell that is not yet full fills up
+     * @return infinity if every cell is already full or the store is empty
+     */
+    double hoursUntilFull() const;
+
+    /**
+     * @brief returns the hours of use until a cell runs empty, 0 if it is empty, O(1)
+     */
+    double hoursToEmpty(std::size_t slot) const;
+    /**
+     * @brief returns the hours of recharge until a cell is full, 0 if it is full, O(1)
+     */
+    double hoursToFull(std::size_t slot) const;
+    /**
+     * @brief returns the hours until the first cell of slots [begin, end) saturates
+     * @param recharging true for recharge (cells filling up), false for use (cells running empty)
+     * @return 0 if one already has, infinity if none ever will or the range is empty
+     *
+     * Answered from a queue of the cells' saturation times, see saturationOrder().
+     */
+    double hoursUntilFirst(bool recharging, std::size_t begin, std::size_t end) const;
+    /**
+     * @brief returns the hours until every cell of slots [begin, end) has saturated
+     * @param recharging true for recharge (cells filling up), false for use (cells running empty)
+     * @return 0 if all have or the range is empty, infinity if one never will
+     */
+    double hoursUntilLast(bool recharging, std::size_t begin, std::size_t end) const;
+    /**
+     * @brief returns the next cells to saturate, in the order they will, with the hours until each does
+     * @param recharging true for recharge (cells filling up), false for use (cells running empty)
+     * @param limit the most cells to return
+     *
+     * The first query builds a queue of every cell's saturation time, O(n).
+     * From then on it stays valid: updates in the same direction only advance
+     * its clock, and single-cell changes, appends and rate changes update one
+     * entry in O(log n), so queries cost O(log n) per range (and per cell
+     * returned here). An update in the other direction, a bulk append or a new
+     * rate model rebuilds it on the next query. Current sharing is not taken
+     * into account.
+     */
+    std::vector<CellSaturation> saturationOrder(bool recharging, std::size_t limit) const;
+
+    /**
+     * @brief applies one discharge step to a single charge value
+     * @param charge the charge to update
+     * @param rate the discharge current
+     * @param hours Number of hours of usage.
+     * @param overshoot receives the hours left after the charge hit 0
+     * @return true if the charge was clamped to 0
+     */
+    static bool discharge(double &charge, double rate, double hours, double &overshoot);
+    /**
+     * @brief applies one recharge step to a single charge value
+     * @param charge the charge to update
+     * @param capacity the capacity the charge is clamped to
+     * @param rate the recharge current
+     * @param hours Number of hours of recharge.
+     * @param overshoot receives the hours left after the charge hit capacity
+     * @return true if the charge was clamped to capacity
+     */
+    static bool fill(double &charge, double capacity, double rate, double hours, double &overshoot);
+
+private:
+    /**
+     * @brief Neumaier-compensated sum, so adding and removing cells does not drift
+     */
+    struct RunningSum
+    {
+        double sum = 0;
+        double compensation = 0;
+
+        void add(double x);
+        void reset(double value);
+        double value() const;
+    };
+
+    EventSink *sink = nullptr;
+    std::uint64_t changes = 0;
+    RateModel model;
+    std::unique_ptr<CellCircuit> circuit;
+    std::unique_ptr<CurrentSharing> sharing;
+    std::unique_ptr<CellThermal> thermal;
+    std::unique_ptr<CellAging> aging;
+    /**
+     * @brief number of cells whose rates differ from Battery::DISCHARGE_RATE / RECHARGE_RATE
+     */
+    std::size_t customRates = 0;
+
+    RunningSum voltageSum;
+    RunningSum capacitySum;
+    RunningSum chargeSum;
+    /**
+     * @brief per-cell capacity minimum; stale after the thermal feedback, like chargeMin
+     */
+    MinTree capacityMin;
+    bool capacityMinStale = false;
+    double bulkCapacityMin = 0;
+    /**
+     * @brief per-cell charge minimum; bulk updates only record their minimum in
+     *        bulkChargeMin and mark the tree stale, it is rebuilt on the next point update
+     */
+    MinTree chargeMin;
+    bool chargeMinStale = false;
+    double bulkChargeMin = 0;
+
+    /**
+     * @brief saturation times of the cells under one direction of update, measured on its own clock
+     *
+     * Not kept up to date until the first query; stale whenever an update
+     * changed the times in a way the clock cannot express.
+     */
+    struct Forecast
+    {
+        SaturationQueue queue;
+        double clock = 0; // hours of updates in this direction since the queue was built
+        bool stale = true;
+    };
+    mutable Forecast emptying;
+    mutable Forecast filling;
+
+    /**
+     * @brief returns the clock value at which a cell saturates, -infinity if it already has
+     */
+    double saturationTime(const Forecast &f, bool recharging, std::size_t slot) const;
+    /**
+     * @brief rebuilds a forecast if stale and looks again at the cells whose time has come
+     */
+    const Forecast &refreshForecast(bool recharging) const;
+    /**
+     * @brief records hours of whole-store updates in one direction in the forecasts
+     */
+    void forecastAdvanced(bool recharging, double hours);
+    /**
+     * @brief records a change of a single cell in the forecasts
+     */
+    void forecastChanged(std::size_t slot);
+
+    /**
+     * @brief rebuilds the charge tree if a bulk update made it stale
+     */
+    void refreshChargeMin();
+    /**
+     * @brief rebuilds the capacity tree if the thermal feedback made it stale
+     */
+    void refreshCapacityMin();
+    /**
+     * @brief takes over the totals of columns the thermal model rewrote
+     */
+    void thermalChanged(const ThermalStats &stats);
+    /**
+     * @brief applies the aging of the last interval to every capacity and rebuilds the aggregates
+     */
+    void applyAging();
+    /**
+     * @brief records a single cell's charge change in the aggregates
+     */
+    void chargeChanged(std::size_t slot, double before);
+    /**
+     * @brief advances the circuit of a single cell after a point update and records its new voltage
+     */
+    void circuitChanged(std::size_t slot, double before, double hours);
+
+    /**
+     * @brief returns true while the store can use the uniform-delta SIMD kernels:
+     *        constant-current model and every cell at the default rates
+     */
+    bool uniformRates() const;
+    /**
+     * @brief counts a cell's rates into customRates (sign 1) or out of it (sign -1)
+     */
+    void countRates(double d, double r, int sign);
+
+    /**
+     * @brief records one event for every cell that a discharge of delta will empty
+     */
+    void reportDepleted(double hours, double delta) const;
+    /**
+     * @brief records one event for every cell that a recharge of delta will fill up
+     */
+    void reportOvercharged(double hours, double delta) const;
+    /**
+     * @brief records one event for every cell that hours of use will empty under the rate model
+     */
+    void reportModelDepleted(double hours) const;
+    /**
+     * @brief records one event for every cell that hours of recharge will fill up under the rate model
+     */
+    void reportModelOvercharged(double hours) const;
+};
+
+#endif // CELLSTORE_H
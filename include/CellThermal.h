@@ -0,0 +1,182 @@
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#ifndef CELLTHERMAL_H
+#define CELLTHERMAL_H
+
+class CellCircuit;
+class ThreadPool;
+
+/**
+ * @brief Parameters of the thermal model, shared by every cell of a store
+ */
+struct ThermalParameters
+{
+    double heatCapacity = 45;          // joules per kelvin, per cell
+    double neighbourConductance = 0.5; // watts per kelvin between two adjacent cells
+    double coolantConductance = 0.1;   // watts per kelvin from every cell to the coolant
+    double coolantTemperature = 25;    // degrees Celsius, also the cells' starting temperature
+    /**
+     * @brief ohms each cell heats with when no circuit is attached; with one, its series and RC resistances
+     */
+    double resistance = 0.02;
+    /**
+     * @brief temperature at which capacities and rates are as given
+     */
+    double referenceTemperature = 25;
+    double capacityCoefficient = 0.005; // relative capacity change per kelvin
+    double rateCoefficient = 0.01;      // relative rate change per kelvin
+    /**
+     * @brief amperes per charge unit per hour, 0.001 for charges in mAh
+     */
+    double ampsPerRate = 0.001;
+    /**
+     * @brief width of the cell grid, 0 to follow the pack's layout
+     */
+    std::size_t columns = 0;
+    /**
+     * @brief worker threads for large grids, 0 for one per hardware thread
+     */
+    std::size_t threads = 0;
+};
+
+/**
+ * @brief per-update totals of the columns the thermal feedback rewrote
+ */
+struct ThermalStats
+{
+    double capacitySum;
+    double capacityMin;
+    double chargeSum;
+    double chargeMin;
+    std::size_t customRates; // cells whose rates now differ from Battery's defaults
+};
+
+/**
+ * @brief Temperatures of the cells of a CellStore on a 2D grid, and their effect on capacity and rates.
+ *
+ * The cells are laid out row by row in slot order, columns() cells per row
+ * (the last row may be shorter). Every cell heats with I^2 R, the current
+ * being the charge moved divided by the step length, exchanges heat with its
+ * four grid neighbours and loses heat to the coolant:
+ *
+ *     C dT/dt = I^2 R + G * sum over neighbours (Tn - T) + Gc (Tc - T)
+ *
+ * Edges are insulated. The update is explicit, in as many equal substeps as
+ * stability requires. It runs over tiles of the grid: each tile copies itself
+ * plus a halo as deep as the substeps it takes into a small buffer, takes all
+ * of them there while the buffer stays in cache, and writes back its inner
+ * part. The errors from the halo's open edge travel one cell per substep and
+ * never reach the inner part, so the result does not depend on the tile size
+ * or on the number of threads, and tiles run in parallel on a thread pool.
+ *
+ * Each temperature then scales the cell's capacity (at constant state of
+ * charge) and rates linearly around the reference temperature, in the same
+ * pass. The values given to the store are kept as the nominal columns.
+ */
+class CellThermal
+{
+public:
+    explicit CellThermal(const ThermalParameters &parameters);
+    ~CellThermal();
+    CellThermal(const CellThermal &) = delete;
+    CellThermal &operator=(const CellThermal &) = delete;
+
+    /**
+     * @brief temperature of every cell, degrees Celsius
+     */
+    std::vector<double> temperature;
+    /**
+     * @brief the capacities and rates the cells were given, before the temperature scales them
+     */
+    std::vector<double> nominalCapacity;
+    std::vector<double> nominalDischarge;
+    std::vector<double> nominalRecharge;
+
+    const ThermalParameters &getParameters() const;
+    /**
+     * @brief sets the grid width, 0 for a single row of all cells
+     */
+    void setColumns(std::size_t n);
+    /**
+     * @brief returns the grid width in effect for n cells
+     */
+    std::size_t columns(std::size_t n) const;
+
+    /**
+     * @brief returns the factor the temperature puts on a capacity
+     */
+    double capacityFactor(double t) const;
+    /**
+     * @brief returns the factor the temperature puts on a rate
+     */
+    double rateFactor(double t) const;
+
+    /**
+     * @brief appends a cell at the coolant temperature
+     * @param c its nominal capacity
+     * @param d its nominal discharge rate
+     * @param r its nominal recharge rate
+     */
+    void push(double c, double d, double r);
+    /**
+     * @brief removes a cell, shifting every later slot down by one
+     */
+    void erase(std::size_t slot);
+    /**
+     * @brief exchanges the state of two cells
+     */
+    void swap(std::size_t a, std::size_t b);
+    /**
+     * @brief removes the last cell
+     */
+    void pop();
+    /**
+     * @brief removes every cell
+     */
+    void clear();
+
+    /**
+     * @brief remembers the charges before a whole-store update
+     */
+    void begin(const double *charge, std::size_t n);
+    /**
+     * @brief advances every temperature over an update that began with begin() and applies the feedback
+     * @param charge the charges after the update, rescaled to the new capacities
+     * @param capacity receives the new capacities
+     * @param discharge receives the new discharge rates
+     * @param recharge receives the new recharge rates
+     * @param n number of cells
+     * @param hours the length of the update
+     * @param circuit the store's circuit, nullptr to heat with the parameters' resistance
+     * @return the totals of the rewritten columns
+     */
+    ThermalStats step(double *charge, double *capacity, double *discharge, double *recharge, std::size_t n,
+                      double hours, const CellCircuit *circuit);
+    /**
+     * @brief writes the capacities, charges and rates the current temperatures give, without a step
+     * @return the totals of the rewritten columns
+     */
+    ThermalStats derate(double *charge, double *capacity, double *discharge, double *recharge, std::size_t n);
+
+private:
+    ThermalParameters parameters;
+    std::size_t width = 0;
+    std::vector<double> previous;
+    std::vector<double> next;
+    std::unique_ptr<ThreadPool> pool;
+
+    /**
+     * @brief applies temperatures to the columns of cells [begin, end) and adds them to the totals
+     */
+    void derateRange(std::size_t begin, std::size_t end, const double *t, double *charge, double *capacity,
+                     double *discharge, double *recharge, ThermalStats &stats) const;
+    /**
+     * @brief runs body(i) for every i in [0, count), on the pool when the grid of n cells is large enough
+     */
+    void forEach(std::size_t count, std::size_t n, const std::function<void(std::size_t)> &body);
+};
+
+#endif // CELLTHERMAL_H
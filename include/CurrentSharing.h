@@ -0,0 +1,82 @@
+#include <cstddef>
+#include <vector>
+#include "CellKernels.h"
+#include "PackPlan.h"
+
+#ifndef CURRENTSHARING_H
+#define CURRENTSHARING_H
+
+class CellCircuit;
+class EventSink;
+
+/**
+ * @brief Splits a pack's current among its parallel branches by impedance and OCV differences.
+ *
+ * Without it every cell moves the charge its own rate asks for. With it the
+ * rate model only decides how much current the pack draws: a parallel group
+ * carries the sum of its branches' currents and a series string the mean of
+ * its members'. The solver then applies the current the way the circuit would
+ * split it. Every cell is replaced by its Thevenin equivalent over the update
+ * (CellCircuit::thevenin()). Each group is reduced to one equivalent on the way
+ * up the pack tree, and its current is split on the way back down:
+ *
+ *     series:    E = sum e_k,                G = 1 / sum (1 / g_k),   every child carries I
+ *     parallel:  E = sum e_k g_k / sum g_k,  G = sum g_k,             I_k = (e_k - V) g_k,  V = E - I / G
+ *
+ * The branches of a parallel group meet at one node, so its linear system is
+ * a star whose Schur complement is the scalar conductance sum. Solving the
+ * whole pack therefore costs two passes over the plan's node array. The
+ * conductances include the OCV slope of each cell's state of charge, so they
+ * change every update; rebuilding them in the per-cell pass costs no more than
+ * downdating a cached factorization would. Cells removed from the pack drop
+ * out of the plan and are not seen again.
+ *
+ * The per-cell work (Thevenin equivalents, demand currents, the final charges)
+ * runs over all cells at once, across groups. Only the group reductions walk
+ * the plan. A cell whose share would take it past empty or full within the
+ * update is clamped and reports an event, like a cell under its own rate.
+ */
+class CurrentSharing
+{
+public:
+    /**
+     * @brief prepares sharing over a pack's topology
+     * @param plan the pack's topology, read on every update; an empty plan is one flat group
+     * @param parallel the connection type of a flat pack
+     */
+    CurrentSharing(const PackPlan &plan, bool parallel);
+
+    /**
+     * @brief redistributes one pack update among the branches
+     * @param circuit the circuit of the cells, begin() called with the charges before the update
+     * @param charge the charges after the rate model's update, replaced by the shared ones
+     * @param capacity the capacities
+     * @param n number of cells
+     * @param hours the length of the update, positive
+     * @param sink receives an event for every cell clamped at empty or full, nullptr for none
+     * @param elapsed the time stamp of the events
+     * @return the sum and minimum of the new charges
+     */
+    CellKernels::ChargeStats apply(CellCircuit &circuit, double *charge, const double *capacity, std::size_t n,
+                                   double hours, EventSink *sink, double elapsed);
+
+private:
+    const PackPlan &plan;
+    bool parallel;
+    std::vector<PackPlan::Node> flat;
+
+    // Per-cell and per-node scratch: open-circuit source, conductance and current
+    std::vector<double> source, conductance, current;
+    std::vector<double> nodeSource, nodeConductance, nodeCurrent;
+
+    /**
+     * @brief reduces every node to its Thevenin equivalent and its demand current, children first
+     */
+    void reduce(const std::vector<PackPlan::Node> &nodes);
+    /**
+     * @brief hands every node's current down to its children, parents first
+     */
+    void distribute(const std::vector<PackPlan::Node> &nodes);
+};
+
+#endif // CURRENTSHARING_H
@@ -0,0 +1,132 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifndef EVENTSINK_H
+#define EVENTSINK_H
+
+/**
+ * @brief A cell hitting empty during use or full during recharge
+ */
+struct CellEvent
+{
+    enum Kind : std::uint8_t
+    {
+        DEPLETED,
+        OVERCHARGED
+    };
+
+    /**
+     * @brief cell id used for batteries that are not part of a pack
+     */
+    static constexpr std::uint32_t NO_CELL = 0xffffffffu;
+
+    double time;      // simulated hours at the start of the step
+    double overshoot; // hours of the step left after the cell saturated
+    std::uint32_t cell;
+    Kind kind;
+};
+
+/**
+ * @brief Receives cell events from the simulation; record() is called with small batches.
+ */
+class EventSink
+{
+public:
+    virtual ~EventSink() {}
+    /**
+     * @brief consumes a batch of events
+     */
+    virtual void record(const CellEvent *events, std::size_t count) = 0;
+    /**
+     * @brief returns false if the sink discards everything, so producers can skip event detection
+     */
+    virtual bool enabled() const { return true; }
+};
+
+/**
+ * @brief Discards all events; packs treat it like having no sink and skip detection entirely.
+ */
+class NullEventSink : public EventSink
+{
+public:
+    void record(const CellEvent *, std::size_t) override {}
+    bool enabled() const override { return false; }
+};
+
+/**
+ * @brief Lock-free single-producer/single-consumer ring buffer of events.
+ *
+ * The simulation thread records, any one other thread drains. When the ring is
+ * full new events are dropped and counted instead of blocking the producer.
+ */
+class RingBufferEventSink : public EventSink
+{
+public:
+    /**
+     * @brief creates the ring
+     * @param capacity number of events, rounded up to a power of two
+     */
+    explicit RingBufferEventSink(std::size_t capacity = 4096);
+    void record(const CellEvent *events, std::size_t count) override;
+    /**
+     * @brief takes the oldest event, returns false if the ring is empty
+     */
+    bool pop(CellEvent &event);
+    /**
+     * @brief appends every buffered event to out and returns how many were taken
+     */
+    std::size_t drain(std::vector<CellEvent> &out);
+    /**
+     * @brief returns the number of events dropped because the ring was full
+     */
+    std::size_t dropped() const;
+
+private:
+    std::vector<CellEvent> ring;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head{0}; // next slot to read, owned by the consumer
+    alignas(64) std::atomic<std::size_t> tail{0}; // next slot to write, owned by the producer
+    alignas(64) std::atomic<std::size_t> droppedCount{0};
+};
+
+/**
+ * @brief Collects events in memory and appends them to a CSV file (kind,cell,time,overshoot) in batches.
+ */
+class FileEventSink : public EventSink
+{
+public:
+    /**
+     * @brief opens the file for writing
+     * @param path the file to write
+     * @param batchSize number of events buffered before they are written out
+     */
+    explicit FileEventSink(const std::string &path, std::size_t batchSize = 8192);
+    /**
+     * @brief writes the remaining events and closes the file
+     */
+    ~FileEventSink() override;
+    FileEventSink(const FileEventSink &) = delete;
+    FileEventSink &operator=(const FileEventSink &) = delete;
+
+    /**
+     * @brief returns true if the file could be opened
+     */
+    bool isOpen() const;
+    bool enabled() const override;
+    void record(const CellEvent *events, std::size_t count) override;
+    /**
+     * @brief writes the buffered events to the file
+     */
+    void flush();
+
+private:
+    std::FILE *file;
+    std::vector<CellEvent> pending;
+    std::size_t batchSize;
+};
+
+#endif // EVENTSINK_H
@@ -0,0 +1,239 @@
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef FLEET_H
+#define FLEET_H
+
+#include "PackPlan.h"
+#include "RateModel.h"
+#include "Scenario.h"
+
+class ThreadPool;
+
+/**
+ * @brief Many independent packs, each on its own load profile, simulated in one structure of arrays.
+ *
+ * The cells of all packs share the same packed columns, pack after pack, and
+ * an offset table gives every pack its slice, instead of one BatteryPack with
+ * its own Battery pointers per vehicle. Each pack's topology is a run of
+ * PackPlan nodes in one shared node array (a flat series or parallel pack is a
+ * single node), so the pack aggregates are segmented reductions: series min and
+ * parallel sum over each pack's slice. A flat pack takes its charge aggregate
+ * from the update loop itself; a topology is walked like PackPlan::evaluate()
+ * over its own nodes.
+ *
+ * advance() moves every pack along its profile: first an idle delay, then the
+ * profile's steps with their hours scaled by the pack's duty factor, played
+ * once. A step that ends within an advance splits the pack's update there, and
+ * the rate models integrate exactly, so the tick length does not change the
+ * charges. The packs are sharded across a thread pool in contiguous runs of
+ * about equal cell counts. A shard never splits a pack, so every pack is
+ * updated by a single thread and the results do not depend on the thread count.
+ *
+ * Circuits, current sharing, thermal and aging models and events are not
+ * simulated; voltages and capacities stay as the cells were given. Node ranges
+ * are 32-bit like PackPlan's, so a fleet holds at most 2^32 cells.
+ */
+class Fleet
+{
+public:
+    /**
+     * @brief creates an empty fleet
+     * @param model how every pack's rates turn into charge changes
+     * @param threads worker threads for large fleets, 0 for one per hardware thread
+     */
+    explicit Fleet(const RateModel &model = RateModel(), std::size_t threads = 0);
+    ~Fleet();
+    Fleet(const Fleet &) = delete;
+    Fleet &operator=(const Fleet &) = delete;
+
+    /**
+     * @brief the cells of every pack, pack after pack, see packBegin()
+     */
+    std::vector<double> voltage;
+    std::vector<double> capacity;
+    std::vector<double> charge;
+    std::vector<double> dischargeRate;
+    std::vector<double> rechargeRate;
+
+    /**
+     * @brief simulated hours of advance() so far
+     */
+    double elapsed = 0;
+
+    const RateModel &getRateModel() const;
+
+    /**
+     * @brief adds a load profile that packs can follow
+     * @param steps the use and recharge steps, played once
+     * @return its index
+     */
+    std::size_t addProfile(const std::vector<ScenarioStep> &steps);
+    /**
+     * @brief preallocates room for packs packs of cells cells in all
+     */
+    void reserve(std::size_t packs, std::size_t cells);
+    /**
+     * @brief appends a pack and returns its index
+     * @param type the connection type of a flat pack
+     * @param plan the pack's topology, covering exactly n cells; an empty plan for a flat pack of type
+     * @param v voltages
+     * @param c capacities
+     * @param q (already clamped) charges
+     * @param n number of cells
+     * @param d discharge rates, nullptr for the default rate
+     * @param r recharge rates, nullptr for the default rate
+     * @param profile the index of the load profile the pack follows
+     * @param delay idle hours before the pack starts its profile
+     * @param duty factor on the hours of every step of the profile
+     */
+    std::size_t addPack(BatteryPack::ConnectionType type, const PackPlan &plan, const double *v, const double *c,
+                        const double *q, std::size_t n, const double *d, const double *r, std::size_t profile,
+                        double delay = 0, double duty = 1);
+
+    /**
+     * @brief returns the number of packs
+     */
+    std::size_t packCount() const;
+    /**
+     * @brief returns the number of cells of all packs
+     */
+    std::size_t cellCount() const;
+    /**
+     * @brief returns the first slot of a pack's cells in the columns
+     */
+    std::size_t packBegin(std::size_t pack) const;
+    /**
+     * @brief returns one past the last slot of a pack's cells in the columns
+     */
+    std::size_t packEnd(std::size_t pack) const;
+    /**
+     * @brief returns a pack's aggregate voltage, capacity and charge, like BatteryPack's getters, O(1)
+     */
+    double packVoltage(std::size_t pack) const;
+    double packCapacity(std::size_t pack) const;
+    double packCharge(std::size_t pack) const;
+    /**
+     * @brief returns the hours a pack has spent empty, counted in whole advances
+     */
+    double depletedHours(std::size_t pack) const;
+    /**
+     * @brief returns the hours until the last pack has played its profile
+     */
+    double duration() const;
+    /**
+     * @brief returns the number of threads advance() runs on
+     */
+    std::size_t threadCount() const;
+
+    /**
+     * @brief moves every pack hours further along its profile
+     */
+    void advance(double hours);
+
+private:
+    RateModel model;
+    std::size_t threads;
+    std::unique_ptr<ThreadPool> pool;
+
+    std::vector<std::vector<ScenarioStep>> profiles;
+    std::vector<double> profileHours;
+    double end = 0;
+
+    /**
+     * @brief per pack: its slices of the cell and node arrays (packCount() + 1 entries each), its profile and
+     *        timing, the step it is playing and the hours of that step played, and its hours spent empty
+     */
+    std::vector<std::size_t> cellOffsets;
+    std::vector<std::size_t> nodeOffsets;
+    std::vector<std::size_t> profile;
+    std::vector<double> wait;
+    std::vector<double> duty;
+    std::vector<std::size_t> cursor;
+    std::vector<double> played;
+    std::vector<double> depleted;
+
+    /**
+     * @brief the topologies of all packs, with absolute node and cell indices, and their aggregates
+     */
+    std::vector<PackPlan::Node> nodes;
+    std::vector<double> nodeVoltage, nodeCapacity, nodeCharge;
+
+    /**
+     * @brief the first pack of every shard followed by packCount(); rebuilt by advance() after packs were added
+     */
+    std::vector<std::size_t> shards;
+    bool shardsStale = true;
+
+    /**
+     * @brief cuts the packs into shards and starts the pool if the fleet is large enough
+     */
+    void buildShards();
+    /**
+     * @brief moves a single pack hours further along its profile
+     */
+    void advancePack(std::size_t pack, double hours);
+    /**
+     * @brief recomputes a pack's node charges, and its voltages and capacities too if all is set
+     */
+    void evaluate(std::size_t pack, bool all);
+};
+
+/**
+ * @brief A fleet run: a base scenario whose pack and profile every vehicle gets, on spread-out timings.
+ *
+ * Fleet files are scenario files with extra directives:
+ *
+ *     vehicles 10000   # number of packs (default 1)
+ *     stagger 8        # vehicle k of N starts its profile k/N of this many hours late
+ *     duty 0.8 1.2     # vehicles scale their step hours by factors spread evenly over this range
+ *
+ * The scenario's timestep is the fleet's tick and must be set. Its type,
+ * topology, cells, rates, rate model and steps apply; its circuit, sharing,
+ * thermal and aging models are not used.
+ */
+struct FleetSpec
+{
+    Scenario base;
+    std::size_t vehicles = 1;
+    double stagger = 0;
+    double dutyMin = 1;
+    double dutyMax = 1;
+};
+
+/**
+ * @brief Every pack's final state and hours spent empty, with throughput
+ */
+struct FleetResult
+{
+    std::size_t packs = 0;
+    std::size_t cells = 0;
+    std::size_t threads = 0;
+    std::size_t ticks = 0;
+    double hours = 0;
+    double seconds = 0;
+    double cellUpdatesPerSecond = 0;
+    std::vector<StepResult> final;
+    std::vector<double> depleted;
+};
+
+/**
+ * @brief parses a fleet file, see FleetSpec
+ */
+bool loadFleet(const std::string &path, FleetSpec &spec, std::string &error);
+/**
+ * @brief builds the fleet of a spec and advances it tick by tick until every vehicle has played its profile
+ * @param spec the fleet to run
+ * @param threads number of worker threads, 0 for one per hardware thread
+ * @return the packs' final states, identical for any number of threads
+ */
+FleetResult runFleet(const FleetSpec &spec, std::size_t threads = 0);
+/**
+ * @brief writes one CSV row per pack: its final voltage, capacity and charge and its hours spent empty
+ */
+void writeFleetResults(std::ostream &out, const FleetResult &result);
+
+#endif // FLEET_H
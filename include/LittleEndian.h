@@ -0,0 +1,79 @@
+#include <cstdint>
+#include <cstring>
+
+#ifndef LITTLEENDIAN_H
+#define LITTLEENDIAN_H
+
+/**
+ * @brief Byte order helpers for the binary file formats, which are little endian on every host
+ */
+namespace LittleEndian
+{
+    /**
+     * @brief returns true if the host stores integers little endian, so words can be copied as they are
+     */
+    inline bool host()
+    {
+        const std::uint16_t one = 1;
+        unsigned char first;
+        std::memcpy(&first, &one, 1);
+        return first == 1;
+    }
+
+    inline std::uint64_t swap64(std::uint64_t x)
+    {
+        x = ((x & 0x00ff00ff00ff00ffull) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffull);
+        x = ((x & 0x0000ffff0000ffffull) << 16) | ((x >> 16) & 0x0000ffff0000ffffull);
+        return (x << 32) | (x >> 32);
+    }
+
+    inline void put32(unsigned char *p, std::uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            p[i] = static_cast<unsigned char>(v >> (8 * i));
+    }
+
+    inline void put64(unsigned char *p, std::uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i)
+            p[i] = static_cast<unsigned char>(v >> (8 * i));
+    }
+
+    inline std::uint32_t get32(const unsigned char *p)
+    {
+        std::uint32_t v = 0;
+        for (int i = 3; i >= 0; --i)
+            v = (v << 8) | p[i];
+        return v;
+    }
+
+    inline std::uint64_t get64(const unsigned char *p)
+    {
+        std::uint64_t v = 0;
+        for (int i = 7; i >= 0; --i)
+            v = (v << 8) | p[i];
+        return v;
+    }
+
+    /**
+     * @brief returns the bit pattern of a double
+     */
+    inline std::uint64_t bits(double d)
+    {
+        std::uint64_t b;
+        std::memcpy(&b, &d, sizeof b);
+        return b;
+    }
+
+    /**
+     * @brief returns the double with the given bit pattern
+     */
+    inline double fromBits(std::uint64_t b)
+    {
+        double d;
+        std::memcpy(&d, &b, sizeof d);
+        return d;
+    }
+}
+
+#endif // LITTLEENDIAN_H
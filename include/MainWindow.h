@@ -5,11 +5,18 @@
 #include <vector>
 #include "BatteryPack.h"
 #include "BatteryCanvas.h"
+#include "EventSink.h"
+#include "SimulationWorker.h"
 
+class QCheckBox;
 class QLineEdit;
 class QLabel;
 class QComboBox;
 class QDoubleSpinBox;
+class QGroupBox;
+class QProgressBar;
+class QPushButton;
+class QTimer;
 
 class MainWindow : public QMainWindow
 {
@@ -38,6 +45,31 @@ private slots:
      */
     void changePackType(int index);
     
+    /**
+     * @brief Slot to organise the cells into the topology typed by the user (e.g. 4s2p)
+     */
+    void applyTopology();
+
+    /**
+     * @brief Slot to attach or detach the thermal model
+     */
+    void toggleThermal(bool on);
+
+    /**
+     * @brief Slot to colour the cells by charge (index 0) or by temperature (index 1)
+     */
+    void changeColouring(int index);
+
+    /**
+     * @brief Slot to write the pack to a snapshot file, also while a simulation runs
+     */
+    void savePackFile();
+
+    /**
+     * @brief Slot to replace the pack with one read from a snapshot file
+     */
+    void loadPackFile();
+
     /**
      * @brief Slot to simulate battery usage
      */
@@ -48,14 +80,43 @@ private slots:
      */
     void simulateRecharge();
 
+    /**
+     * @brief Slot to stop a running simulation early
+     */
+    void cancelSimulation();
+
+    /**
+     * @brief Slot called every frame while a simulation runs: shows the newest snapshot and the progress
+     */
+    void showSimulationFrame();
+
 private:
     /**
      * @brief Updates the labels in the UI
      */
     void updateLabels();
 
+    /**
+     * @brief plays hours of use or recharge on the worker thread
+     */
+    void startSimulation(ScenarioStep::Action action);
+    /**
+     * @brief joins the worker and gives the pack back to the UI
+     */
+    void finishSimulation();
+    /**
+     * @brief enables or disables every control that changes the pack
+     */
+    void setEditable(bool editable);
+
     BatteryPack *pack;
-    std::vector<Battery *> allBatteries;
+    RingBufferEventSink events;
+    SimulationWorker worker;
+    /**
+     * @brief the snapshot on screen while a simulation runs, nullptr otherwise
+     */
+    const PackSnapshot *liveSnapshot = nullptr;
+    QTimer *frameTimer;
 
     // UI Components //
     BatteryCanvas *canvas;
@@ -64,7 +125,17 @@ private:
     QLineEdit *chargeInput;
     QDoubleSpinBox* hoursInput;
     QComboBox *typeCombo;
+    QLineEdit *topologyInput;
+    QCheckBox *thermalCheck;
+    QComboBox *colouringCombo;
     QLabel *statusLabel;
+    QGroupBox *addGroup;
+    QGroupBox *configGroup;
+    QPushButton *btnUse;
+    QPushButton *btnCharge;
+    QPushButton *btnCancel;
+    QPushButton *btnLoad;
+    QProgressBar *progressBar;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include <cstddef>
+#include <vector>
+
+#ifndef MINTREE_H
+#define MINTREE_H
+
+/**
+ * @brief Array-backed segment tree that keeps the minimum of a growing list of doubles.
+ *
+ * Point updates, appends, swaps and removing the last element are O(log n), the
+ * minimum is O(1). Removing any other element shifts the later ones down and
+ * rebuilds the tree in O(n).
+ */
+class MinTree
+{
+public:
+    /**
+     * @brief replaces the contents with values[0..n)
+     */
+    void build(const double *values, std::size_t n);
+    /**
+     * @brief removes every value
+     */
+    void clear();
+    /**
+     * @brief appends a value, amortized O(log n)
+     */
+    void push(double value);
+    /**
+     * @brief changes the value at index i
+     */
+    void set(std::size_t i, double value);
+    /**
+     * @brief removes the value at index i, shifting later values down
+     */
+    void erase(std::size_t i);
+    /**
+     * @brief exchanges the values at indices i and j
+     */
+    void swap(std::size_t i, std::size_t j);
+    /**
+     * @brief removes the last value
+     */
+    void pop();
+    /**
+     * @brief returns the value at index i
+     */
+    double get(std::size_t i) const;
+    /**
+     * @brief returns the smallest value, +infinity if empty
+     */
+    double min() const;
+    /**
+     * @brief returns the index of the smallest value, size() if empty
+     */
+    std::size_t argmin() const;
+    /**
+     * @brief returns the number of values
+     */
+    std::size_t size() const;
+
+private:
+    // nodes[1] is the root, the leaves live at nodes[leaves + i]
+    std::vector<double> nodes;
+    std::size_t leaves = 0;
+    std::size_t count = 0;
+
+    /**
+     * @brief recomputes every inner node from the leaves
+     */
+    void rebuildInner();
+    /**
+     * @brief makes room for at least n leaves
+     */
+    void reserveLeaves(std::size_t n);
+};
+
+#endif // MINTREE_H
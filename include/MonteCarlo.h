@@ -0,0 +1,94 @@
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+#ifndef MONTECARLO_H
+#define MONTECARLO_H
+
+#include "QuantileSketch.h"
+#include "Scenario.h"
+
+/**
+ * @brief Random spread of one cell parameter around its nominal value
+ */
+struct Variation
+{
+    enum Distribution
+    {
+        NONE,
+        NORMAL,
+        UNIFORM
+    };
+
+    Distribution distribution = NONE;
+    double spread = 0; // relative standard deviation (NORMAL) or relative half-width (UNIFORM)
+};
+
+/**
+ * @brief A Monte Carlo analysis: a base scenario whose cells are drawn anew for every pack realization.
+ *
+ * Monte Carlo files are scenario files with extra directives:
+ *
+ *     realizations 100000          # number of packs to draw (default 1000)
+ *     seed 42                      # key of the random streams (default 1)
+ *     vary capacity normal 0.02    # relative standard deviation of every cell's capacity
+ *     vary charge uniform 0.05     # relative half-width of every cell's initial state of charge
+ *     vary voltage normal 0.005    # relative standard deviation of every cell's voltage
+ *
+ * The charge varies as a state of charge, so a cell drawn with more capacity
+ * also starts with more charge; it is clamped to [0, capacity]. Parameters
+ * that are not varied keep their nominal values. The scenario's connection
+ * type, topology, rates and rate model apply; its steps, circuit and sharing
+ * are not used.
+ */
+struct MonteCarloSpec
+{
+    Scenario base;
+    std::size_t realizations = 1000;
+    std::uint64_t seed = 1;
+    Variation capacity;
+    Variation charge;
+    Variation voltage;
+};
+
+/**
+ * @brief Distributions of the pack metrics over all realizations, with throughput
+ *
+ * capacity   pack capacity (the weakest cell gates a series string)
+ * runtime    hours of use from the initial charges until the pack is empty under
+ *            each cell's own discharge rate: a series string stops with its
+ *            first empty member, a parallel group with its last
+ * imbalance  highest minus lowest initial state of charge across the cells
+ * voltage    pack voltage from the cells' drawn voltages
+ */
+struct MonteCarloResult
+{
+    std::size_t realizations = 0;
+    std::size_t cells = 0;
+    std::size_t threads = 0;
+    double seconds = 0;
+    double realizationsPerSecond = 0;
+    QuantileSketch capacity;
+    QuantileSketch runtime;
+    QuantileSketch imbalance;
+    QuantileSketch voltage;
+};
+
+/**
+ * @brief parses a Monte Carlo file, see MonteCarloSpec
+ */
+bool loadMonteCarlo(const std::string &path, MonteCarloSpec &spec, std::string &error);
+/**
+ * @brief draws every realization of the spec on a work-stealing pool and summarises the pack metrics
+ * @param spec the analysis to run
+ * @param threads number of worker threads, 0 for one per hardware thread
+ * @return the summaries, identical for any number of threads
+ */
+MonteCarloResult runMonteCarlo(const MonteCarloSpec &spec, std::size_t threads = 0);
+/**
+ * @brief writes one CSV row per metric: count, mean, standard deviation, extremes and percentiles
+ */
+void writeMonteCarloResults(std::ostream &out, const MonteCarloResult &result);
+
+#endif // MONTECARLO_H
@@ -0,0 +1,74 @@
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#ifndef PACKFILE_H
+#define PACKFILE_H
+
+#include "BatteryPack.h"
+
+struct PackSnapshot;
+
+/**
+ * @brief Binary pack snapshot format (.bpk).
+ *
+ * All fields are little endian. A 64-byte header is followed by the topology
+ * and rate model notations, each zero padded to a multiple of 8 bytes, and
+ * then the five cell columns as IEEE doubles, one after the other:
+ *
+ *     offset  size  field
+ *          0     8  magic "BATPACK\0"
+ *          8     4  format version (PackFile::VERSION)
+ *         12     4  flags, PackFile::CHECKSUM if the checksum field is set
+ *         16     4  connection type, 0 series, 1 parallel
+ *         20     4  length of the topology notation in bytes, 0 for a flat pack
+ *         24     8  number of cells n
+ *         32     8  elapsed hours, see BatteryPack::getElapsedHours()
+ *         40     8  checksum of everything after the header
+ *         48     4  length of the rate model notation (RateModel::notation()) in bytes
+ *         52    12  reserved, zero
+ *         64        topology, rate model, then voltage[n], capacity[n], charge[n],
+ *                   dischargeRate[n], rechargeRate[n]
+ *
+ * Version 1 files have no rate model and only the first three columns; they
+ * load with the constant-current model and default rates.
+ *
+ * The voltage column holds the nominal voltages (CellStore::nominalVoltages());
+ * an equivalent-circuit model is not saved and has to be attached again after
+ * loading.
+ *
+ * The checksum is FNV-1a over the 64-bit little-endian words after the header.
+ * Every column starts 8-byte aligned, so a mapped file can be copied into the
+ * pack's cell storage column by column without parsing.
+ */
+namespace PackFile
+{
+    constexpr std::uint32_t VERSION = 2;
+    constexpr std::uint32_t CHECKSUM = 1; // flag: the checksum field is set
+    constexpr std::size_t HEADER_SIZE = 64;
+}
+
+/**
+ * @brief writes a pack to a snapshot file
+ * @param path the file to write
+ * @param pack the pack; only packs of plain cells can be saved
+ * @param error receives a message on failure
+ * @param charges optional snapshot to take the charges and elapsed hours from instead of the pack,
+ *        so a pack can be saved while a SimulationWorker is stepping it
+ * @param checksum whether to compute and store the checksum
+ * @return false if the pack has nested packs or the file cannot be written
+ */
+bool savePack(const std::string &path, const BatteryPack &pack, std::string &error, const PackSnapshot *charges = nullptr,
+              bool checksum = true);
+
+/**
+ * @brief reads a pack from a snapshot file
+ * @param path the file to read
+ * @param error receives a message on failure
+ * @param verify whether to check the checksum when the file has one
+ * @return the pack, nullptr if the file cannot be read or is not a valid snapshot
+ */
+std::unique_ptr<BatteryPack> loadPack(const std::string &path, std::string &error, bool verify = true);
+
+#endif // PACKFILE_H
@@ -0,0 +1,89 @@
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef PACKPLAN_H
+#define PACKPLAN_H
+
+class CellStore;
+
+/**
+ * @brief Multi-level pack topology compiled into a flat evaluation plan.
+ *
+ * The topology is written in NsMp notation, outermost level first: "96s4p" is 96
+ * groups in series, each made of 4 cells in parallel; "2s3p4s" nests one level
+ * deeper. The tree is stored breadth first so every node's children are a
+ * contiguous index range with higher indices than the node itself. Leaf groups
+ * refer to a contiguous range of cell slots. Evaluating the pack is therefore one
+ * reverse pass over the node array (vectorized reductions over cell ranges at the
+ * bottom) instead of recursive virtual calls.
+ */
+class PackPlan
+{
+public:
+    struct Node
+    {
+        bool series;        // SERIES reduction (sum voltage, min capacity/charge) or PARALLEL
+        bool leafGroup;     // children are cells rather than nodes
+        std::uint32_t begin; // first child (node index or cell slot)
+        std::uint32_t end;   // one past the last child
+    };
+
+    /**
+     * @brief parses NsMp notation and builds the plan
+     * @param notation e.g. "96s4p"
+     * @param plan receives the plan
+     * @param error receives a message on failure
+     * @return true on success
+     */
+    static bool parse(const std::string &notation, PackPlan &plan, std::string &error);
+
+    /**
+     * @brief returns true if no topology is set
+     */
+    bool empty() const;
+    /**
+     * @brief returns the notation the plan was built from
+     */
+    const std::string &notation() const;
+    /**
+     * @brief returns the number of cells the plan covers
+     */
+    std::size_t cellCount() const;
+    /**
+     * @brief returns the nodes in breadth-first order, the root first
+     */
+    const std::vector<Node> &getNodes() const;
+
+    /**
+     * @brief computes the aggregate voltage, capacity and charge of the root in one pass
+     */
+    void evaluate(const CellStore &store, double &voltage, double &capacity, double &charge) const;
+    /**
+     * @brief takes a cell slot out of its group without shifting the slots of the others
+     * @param slot the slot to remove
+     * @param path receives the slots the cell has to travel through to the end of the
+     *        store: swapping path[k] and path[k + 1] for every k in order moves it
+     *        into the last slot, ready to be popped
+     *
+     * Every later group passes its last cell on to the front of the group before,
+     * so the groups stay contiguous at the cost of one swap per group, and the
+     * order of the cells within a group changes.
+     */
+    void removeCell(std::size_t slot, std::vector<std::size_t> &path);
+    /**
+     * @brief appends a new cell slot to the last group
+     */
+    void appendCell();
+
+private:
+    std::vector<Node> nodes;
+    std::string text;
+    std::size_t cells = 0;
+
+    // Per-node results of the last evaluation
+    mutable std::vector<double> nodeVoltage, nodeCapacity, nodeCharge;
+};
+
+#endif // PACKPLAN_H
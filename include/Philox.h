@@ -0,0 +1,91 @@
+#include <cmath>
+#include <cstdint>
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+/**
+ * @brief Philox4x32-10 counter-based random numbers (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+ *
+ * A draw is a pure function of a 64-bit key and a 128-bit counter, so any
+ * number of streams can be generated in any order, on any thread, without
+ * shared state. The same (key, counter) always gives the same numbers.
+ */
+namespace Philox
+{
+    /**
+     * @brief four 32-bit words of output, or a 128-bit counter
+     */
+    struct Block
+    {
+        std::uint32_t word[4];
+    };
+
+    /**
+     * @brief returns the ten-round Philox4x32 bijection of counter under key
+     */
+    inline Block generate(std::uint64_t key, Block counter)
+    {
+        const std::uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+        const std::uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+        std::uint32_t k0 = static_cast<std::uint32_t>(key);
+        std::uint32_t k1 = static_cast<std::uint32_t>(key >> 32);
+        std::uint32_t *c = counter.word;
+        for (int round = 0; round < 10; ++round)
+        {
+            std::uint64_t p0 = static_cast<std::uint64_t>(M0) * c[0];
+            std::uint64_t p1 = static_cast<std::uint64_t>(M1) * c[2];
+            std::uint32_t x0 = static_cast<std::uint32_t>(p1 >> 32) ^ c[1] ^ k0;
+            std::uint32_t x1 = static_cast<std::uint32_t>(p1);
+            std::uint32_t x2 = static_cast<std::uint32_t>(p0 >> 32) ^ c[3] ^ k1;
+            std::uint32_t x3 = static_cast<std::uint32_t>(p0);
+            c[0] = x0;
+            c[1] = x1;
+            c[2] = x2;
+            c[3] = x3;
+            k0 += W0;
+            k1 += W1;
+        }
+        return counter;
+    }
+
+    /**
+     * @brief returns the output for the counter (a, b), each half 64 bits
+     */
+    inline Block generate(std::uint64_t key, std::uint64_t a, std::uint64_t b)
+    {
+        Block counter{{static_cast<std::uint32_t>(a), static_cast<std::uint32_t>(a >> 32), static_cast<std::uint32_t>(b),
+                       static_cast<std::uint32_t>(b >> 32)}};
+        return generate(key, counter);
+    }
+
+    /**
+     * @brief turns two words into a double in (0, 1] with 53 random bits
+     */
+    inline double unit(std::uint32_t high, std::uint32_t low)
+    {
+        std::uint64_t bits = (static_cast<std::uint64_t>(high) << 32 | low) >> 11;
+        return static_cast<double>(bits + 1) * (1.0 / 9007199254740992.0);
+    }
+
+    /**
+     * @brief returns a uniform double in (0, 1] from the first half of a block
+     */
+    inline double uniform(const Block &b)
+    {
+        return unit(b.word[0], b.word[1]);
+    }
+
+    /**
+     * @brief returns a standard normal value from a whole block (Box-Muller)
+     */
+    inline double normal(const Block &b)
+    {
+        const double TWO_PI = 6.283185307179586;
+        double u1 = unit(b.word[0], b.word[1]);
+        double u2 = unit(b.word[2], b.word[3]);
+        return std::sqrt(-2 * std::log(u1)) * std::cos(TWO_PI * u2);
+    }
+}
+
+#endif // PHILOX_H
@@ -0,0 +1,83 @@
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifndef QUANTILESKETCH_H
+#define QUANTILESKETCH_H
+
+/**
+ * @brief Streaming summary of non-negative samples: exact count, mean, spread and extremes plus quantiles
+ *        with a bounded relative error, in memory that does not grow with the number of samples.
+ *
+ * Quantiles use logarithmic buckets (the DDSketch scheme): bucket i counts the
+ * samples in (gamma^(i-1), gamma^i] with gamma = (1 + alpha) / (1 - alpha), and
+ * a quantile is reported as the bucket's midpoint in relative terms, which is
+ * within a factor 1 +- alpha of the true sample. Samples that span a factor of
+ * ten need about 1.15 / alpha buckets. Zeros (and values below 1e-300) have a
+ * bucket of their own.
+ *
+ * Two sketches with the same alpha merge exactly: the bucket counts add up, so
+ * merging per-thread sketches gives the same quantiles as one sketch fed with
+ * every sample. The moments are merged with Chan's formula, so they only
+ * match bit for bit when sketches are merged in the same order.
+ */
+class QuantileSketch
+{
+public:
+    /**
+     * @brief creates an empty sketch
+     * @param alpha relative accuracy of the quantiles, e.g. 0.001 for 0.1%
+     *
+     * The default of 0.001% keeps the buckets well below the relative spread of
+     * pack metrics, which is often a fraction of a percent: wider buckets would
+     * report bucket edges instead of distinct quantiles.
+     */
+    explicit QuantileSketch(double alpha = 0.00001);
+
+    /**
+     * @brief adds one sample, which must not be negative
+     */
+    void add(double x);
+    /**
+     * @brief adds every sample of another sketch with the same alpha
+     */
+    void merge(const QuantileSketch &other);
+
+    std::uint64_t count() const;
+    double mean() const;
+    /**
+     * @brief returns the sample standard deviation, 0 for fewer than two samples
+     */
+    double stddev() const;
+    double min() const;
+    double max() const;
+    /**
+     * @brief returns the q-quantile, q in [0, 1]; 0 for an empty sketch
+     *
+     * The 0- and 1-quantiles are the exact minimum and maximum.
+     */
+    double quantile(double q) const;
+
+private:
+    double alpha;
+    double logGamma;
+    std::uint64_t n = 0;
+    double average = 0;
+    double m2 = 0; // sum of squared deviations from the mean
+    double lowest = 0, highest = 0;
+
+    std::uint64_t zeros = 0;
+    std::vector<std::uint64_t> buckets;
+    int first = 0; // bucket index of buckets[0]
+
+    /**
+     * @brief returns the index of the bucket that holds a positive x
+     */
+    int bucketOf(double x) const;
+    /**
+     * @brief makes room for bucket index i
+     */
+    void cover(int i);
+};
+
+#endif // QUANTILESKETCH_H
@@ -0,0 +1,397 @@
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <string>
+#include "CellKernels.h"
+
+#ifndef RATEMODEL_H
+#define RATEMODEL_H
+
+/**
+ * @brief Compile-time models of how fast a cell's charge changes.
+ *
+ * Every policy works on one cell from its charge q, capacity c and the cell's
+ * own rate parameter r (CellStore::dischargeRate / rechargeRate), whose unit
+ * the policy defines:
+ *
+ *     double discharged(q, c, r, hours) const   charge after hours of use, clamped at 0
+ *     double recharged(q, c, r, hours) const    charge after hours of recharge, clamped at c
+ *     double hoursToEmpty(q, c, r) const        hours of use until the charge reaches 0
+ *     double hoursToFull(q, c, r) const         hours of recharge until the charge reaches c
+ *
+ * Each step is integrated exactly, so one long step gives the same charge as
+ * many short ones and the Simulator can keep fast-forwarding.
+ */
+namespace RatePolicy
+{
+    /**
+     * @brief r is the current in charge units per hour, the same in every state
+     */
+    struct ConstantCurrent
+    {
+        double discharged(double q, double, double r, double hours) const
+        {
+            double x = q - hours * r;
+            return x < 0 ? 0 : x;
+        }
+        double recharged(double q, double c, double r, double hours) const
+        {
+            double x = q + hours * r;
+            return x > c ? c : x;
+        }
+        double hoursToEmpty(double q, double, double r) const
+        {
+            return q / r;
+        }
+        double hoursToFull(double q, double c, double r) const
+        {
+            return (c - q) / r;
+        }
+    };
+
+    /**
+     * @brief r is a C-rate: the current is r * capacity, so 1C empties or fills a cell in an hour
+     */
+    struct CRate
+    {
+        double discharged(double q, double c, double r, double hours) const
+        {
+            double x = q - hours * r * c;
+            return x < 0 ? 0 : x;
+        }
+        double recharged(double q, double c, double r, double hours) const
+        {
+            double x = q + hours * r * c;
+            return x > c ? c : x;
+        }
+        double hoursToEmpty(double q, double c, double r) const
+        {
+            return q / (r * c);
+        }
+        double hoursToFull(double q, double c, double r) const
+        {
+            return (c - q) / (r * c);
+        }
+    };
+
+    /**
+     * @brief CC/CV charging: constant current r up to cvStart * capacity, then a tapering current
+     *
+     * In the constant-voltage phase the current is proportional to the headroom
+     * c - q, continuous with r at the knee, so the headroom decays exponentially.
+     * Charging ends (the cell counts as full) once the current falls to
+     * cutoff * r. Discharge is constant current.
+     */
+    struct CcCv
+    {
+        double cvStart = 0.8;
+        double cutoff = 0.05;
+
+        double discharged(double q, double, double r, double hours) const
+        {
+            double x = q - hours * r;
+            return x < 0 ? 0 : x;
+        }
+        double recharged(double q, double c, double r, double hours) const
+        {
+            double knee = cvStart * c;
+            if (q < knee)
+            {
+                double x = q + hours * r;
+                if (x <= knee)
+                    return x;
+                hours -= (knee - q) / r;
+                q = knee;
+            }
+            double width = (1 - cvStart) * c;
+            // The decay only shrinks the headroom, so a cell already at the cutoff needs no exp
+            if (c - q <= cutoff * width)
+                return c;
+            double headroom = (c - q) * std::exp(-hours * r / width);
+            return headroom <= cutoff * width ? c : c - headroom;
+        }
+        double hoursToEmpty(double q, double, double r) const
+        {
+            return q / r;
+        }
+        double hoursToFull(double q, double c, double r) const
+        {
+            double width = (1 - cvStart) * c;
+            double end = cutoff * width;
+            double hours = 0;
+            double knee = cvStart * c;
+            if (q < knee)
+            {
+                hours = (knee - q) / r;
+                q = knee;
+            }
+            double headroom = c - q;
+            return headroom <= end ? hours : hours + std::log(headroom / end) * width / r;
+        }
+    };
+
+    using CellKernels::LANES;
+
+    inline CellKernels::ChargeStats combine(const double *sum, const double *min, std::size_t clamped, std::size_t n)
+    {
+        return CellKernels::ChargeStats{clamped, CellKernels::sumLanes(sum), n ? CellKernels::minLanes(min) : 0};
+    }
+
+    /**
+     * @brief runs a step over n cells in blocks of LANES, the same loop shape as the CellKernels
+     *
+     * Each block is read completely before it is written, so the compiler can
+     * turn a block into vector operations without proving that q does not alias
+     * the other columns.
+     */
+    template <class Step>
+    CellKernels::ChargeStats stepAll(Step step, double *q, std::size_t n)
+    {
+        const double inf = std::numeric_limits<double>::infinity();
+        double sum[LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+        double min[LANES] = {inf, inf, inf, inf, inf, inf, inf, inf};
+        std::size_t clamped = 0;
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            double x[LANES];
+            for (std::size_t j = 0; j < LANES; ++j)
+            {
+                x[j] = step(i + j);
+                clamped += step.saturated(x[j], i + j);
+            }
+            for (std::size_t j = 0; j < LANES; ++j)
+            {
+                q[i + j] = x[j];
+                sum[j] += x[j];
+                min[j] = x[j] < min[j] ? x[j] : min[j];
+            }
+        }
+        for (; i < n; ++i)
+        {
+            double x = step(i);
+            clamped += step.saturated(x, i);
+            q[i] = x;
+            sum[i % LANES] += x;
+            min[i % LANES] = x < min[i % LANES] ? x : min[i % LANES];
+        }
+        return combine(sum, min, clamped, n);
+    }
+
+    template <class Policy>
+    struct Discharged
+    {
+        const Policy &policy;
+        const double *q, *c, *r;
+        double hours;
+
+        double operator()(std::size_t i) const
+        {
+            return policy.discharged(q[i], c[i], r[i], hours);
+        }
+        bool saturated(double x, std::size_t i) const
+        {
+            return x == 0 && q[i] > 0;
+        }
+    };
+
+    template <class Policy>
+    struct Recharged
+    {
+        const Policy &policy;
+        const double *q, *c, *r;
+        double hours;
+
+        double operator()(std::size_t i) const
+        {
+            return policy.recharged(q[i], c[i], r[i], hours);
+        }
+        bool saturated(double x, std::size_t i) const
+        {
+            return x == c[i] && q[i] < c[i];
+        }
+    };
+
+    /**
+     * @brief applies hours of use to n cells with the model inlined into the loop
+     * @return the number of cells that ran empty and the sum/min of the new charges
+     */
+    template <class Policy>
+    CellKernels::ChargeStats discharge(const Policy &policy, double *q, const double *c, const double *r, std::size_t n,
+                                       double hours)
+    {
+        return stepAll(Discharged<Policy>{policy, q, c, r, hours}, q, n);
+    }
+
+    /**
+     * @brief applies hours of recharge to n cells with the model inlined into the loop
+     * @return the number of cells that filled up and the sum/min of the new charges
+     */
+    template <class Policy>
+    CellKernels::ChargeStats recharge(const Policy &policy, double *q, const double *c, const double *r, std::size_t n,
+                                      double hours)
+    {
+        return stepAll(Recharged<Policy>{policy, q, c, r, hours}, q, n);
+    }
+
+    /**
+     * @brief returns the hours of use until the next cell that still has charge runs empty, infinity if none
+     */
+    template <class Policy>
+    double hoursToEmpty(const Policy &policy, const double *q, const double *c, const double *r, std::size_t n)
+    {
+        double nearest = std::numeric_limits<double>::infinity();
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (q[i] > 0)
+            {
+                double t = policy.hoursToEmpty(q[i], c[i], r[i]);
+                nearest = t < nearest ? t : nearest;
+            }
+        }
+        return nearest;
+    }
+
+    /**
+     * @brief returns the hours of recharge until the next cell that is not yet full fills up, infinity if none
+     */
+    template <class Policy>
+    double hoursToFull(const Policy &policy, const double *q, const double *c, const double *r, std::size_t n)
+    {
+        double nearest = std::numeric_limits<double>::infinity();
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (q[i] < c[i])
+            {
+                double t = policy.hoursToFull(q[i], c[i], r[i]);
+                nearest = t < nearest ? t : nearest;
+            }
+        }
+        return nearest;
+    }
+
+    /**
+     * @brief writes every cell's hours of use until it runs empty to t, -infinity for cells that already are
+     */
+    template <class Policy>
+    void timesToEmpty(const Policy &policy, const double *q, const double *c, const double *r, std::size_t n,
+                      double *t)
+    {
+        const double inf = std::numeric_limits<double>::infinity();
+        for (std::size_t i = 0; i < n; ++i)
+            t[i] = q[i] > 0 ? policy.hoursToEmpty(q[i], c[i], r[i]) : -inf;
+    }
+
+    /**
+     * @brief writes every cell's hours of recharge until it is full to t, -infinity for cells that already are
+     */
+    template <class Policy>
+    void timesToFull(const Policy &policy, const double *q, const double *c, const double *r, std::size_t n,
+                     double *t)
+    {
+        const double inf = std::numeric_limits<double>::infinity();
+        for (std::size_t i = 0; i < n; ++i)
+            t[i] = q[i] < c[i] ? policy.hoursToFull(q[i], c[i], r[i]) : -inf;
+    }
+}
+
+/**
+ * @brief Runtime choice of a RatePolicy, e.g. from a scenario file.
+ *
+ * Holds the policy's parameters and a table of its batch functions, each an
+ * instantiation of the RatePolicy templates. Selecting the model costs one
+ * indirect call per batch; the per-cell work is the inlined policy.
+ */
+class RateModel
+{
+public:
+    enum Kind
+    {
+        CONSTANT_CURRENT,
+        C_RATE,
+        CC_CV
+    };
+
+    /**
+     * @brief the constant-current model, the default of every pack
+     */
+    RateModel();
+    /**
+     * @brief returns the constant-current model: rates are currents in charge units per hour
+     */
+    static RateModel constantCurrent();
+    /**
+     * @brief returns the C-rate model: rates are multiples of the cell's capacity per hour
+     */
+    static RateModel cRate();
+    /**
+     * @brief returns the CC/CV charging model
+     * @param cvStart fraction of the capacity where the constant-voltage phase starts, in [0, 1)
+     * @param cutoff fraction of the charging current at which charging ends, in (0, 1]
+     */
+    static RateModel ccCv(double cvStart = 0.8, double cutoff = 0.05);
+    /**
+     * @brief parses "constant", "crate" or "cccv [cvStart [cutoff]]"
+     * @param spec the model name followed by its parameters
+     * @param model receives the model
+     * @param error receives a message on failure
+     * @return false if the name or a parameter is invalid
+     */
+    static bool parse(const std::string &spec, RateModel &model, std::string &error);
+    /**
+     * @brief returns the spec parse() reads back into this model
+     */
+    std::string notation() const;
+
+    Kind kind() const;
+
+    /**
+     * @brief applies hours of use to n cells
+     * @return the number of cells that ran empty and the sum/min of the new charges
+     */
+    CellKernels::ChargeStats discharge(double *q, const double *c, const double *r, std::size_t n, double hours) const;
+    /**
+     * @brief applies hours of recharge to n cells
+     * @return the number of cells that filled up and the sum/min of the new charges
+     */
+    CellKernels::ChargeStats recharge(double *q, const double *c, const double *r, std::size_t n, double hours) const;
+    /**
+     * @brief returns the hours of use until the next cell that still has charge runs empty, infinity if none
+     */
+    double hoursToEmpty(const double *q, const double *c, const double *r, std::size_t n) const;
+    /**
+     * @brief returns the hours of recharge until the next cell that is not yet full fills up, infinity if none
+     */
+    double hoursToFull(const double *q, const double *c, const double *r, std::size_t n) const;
+    /**
+     * @brief writes every cell's hours of use until it runs empty to t, -infinity for cells that already are
+     */
+    void timesToEmpty(const double *q, const double *c, const double *r, std::size_t n, double *t) const;
+    /**
+     * @brief writes every cell's hours of recharge until it is full to t, -infinity for cells that already are
+     */
+    void timesToFull(const double *q, const double *c, const double *r, std::size_t n, double *t) const;
+
+private:
+    struct Table
+    {
+        CellKernels::ChargeStats (*discharge)(const RateModel &, double *, const double *, const double *, std::size_t, double);
+        CellKernels::ChargeStats (*recharge)(const RateModel &, double *, const double *, const double *, std::size_t, double);
+        double (*hoursToEmpty)(const RateModel &, const double *, const double *, const double *, std::size_t);
+        double (*hoursToFull)(const RateModel &, const double *, const double *, const double *, std::size_t);
+        void (*timesToEmpty)(const RateModel &, const double *, const double *, const double *, std::size_t, double *);
+        void (*timesToFull)(const RateModel &, const double *, const double *, const double *, std::size_t, double *);
+    };
+
+    Kind type;
+    RatePolicy::CcCv taper;
+    const Table *table; // baseline and AVX2 builds, see tableFor()
+
+    RateModel(Kind k, const Table *t);
+    template <class Policy>
+    static const Table *tableFor();
+    template <class Policy>
+    const Policy &policy() const;
+};
+
+#endif // RATEMODEL_H
@@ -0,0 +1,107 @@
+#include <cstddef>
+#include <vector>
+
+#ifndef SATURATIONQUEUE_H
+#define SATURATIONQUEUE_H
+
+/**
+ * @brief Segment tree over the times at which a list of cells saturate.
+ *
+ * Every cell holds the clock value at which it runs empty (or fills up), or
+ * -infinity if it already has. The leaves of the tree summarise blocks of
+ * eight cells: the earliest and latest pending time and whether a cell has
+ * saturated. The first and last saturation of any range of cells are then
+ * O(log n), and the next k saturations in order O(k log n). Point updates,
+ * appends, swaps and removing the last cell are O(log n); removing any other
+ * cell shifts the later ones down and rebuilds in O(n), like MinTree.
+ */
+class SaturationQueue
+{
+public:
+    /**
+     * @brief summary of a range of cells
+     */
+    struct Span
+    {
+        double first;   // earliest pending time, +infinity if none
+        double last;    // latest pending time, -infinity if none
+        bool saturated; // a cell in the range has already saturated
+    };
+
+    /**
+     * @brief resizes to n cells and returns their times to be filled in, followed by rebuild()
+     */
+    double *reset(std::size_t n);
+    /**
+     * @brief recomputes the tree from the times, O(n)
+     */
+    void rebuild();
+    /**
+     * @brief removes every cell
+     */
+    void clear();
+    /**
+     * @brief appends a cell, amortized O(log n)
+     */
+    void push(double time);
+    /**
+     * @brief changes the time of cell i, -infinity once it has saturated
+     */
+    void set(std::size_t i, double time);
+    /**
+     * @brief removes cell i, shifting later cells down
+     */
+    void erase(std::size_t i);
+    /**
+     * @brief exchanges the times of cells i and j
+     */
+    void swap(std::size_t i, std::size_t j);
+    /**
+     * @brief removes the last cell
+     */
+    void pop();
+    /**
+     * @brief returns the time of cell i
+     */
+    double get(std::size_t i) const;
+    /**
+     * @brief returns the number of cells
+     */
+    std::size_t size() const;
+
+    /**
+     * @brief returns the summary of cells [begin, end)
+     */
+    Span span(std::size_t begin, std::size_t end) const;
+    /**
+     * @brief returns the cell with the earliest pending time, size() if none is pending
+     */
+    std::size_t next() const;
+    /**
+     * @brief appends the up to k cells with the earliest finite pending times to out, earliest first
+     *
+     * Walks the tree best first, so only the nodes above the reported cells are visited.
+     */
+    void earliest(std::size_t k, std::vector<std::size_t> &out) const;
+
+private:
+    std::vector<double> times;
+    // nodes[1] is the root, the leaf of block b lives at nodes[leaves + b]
+    std::vector<Span> nodes;
+    std::size_t leaves = 0;
+
+    /**
+     * @brief returns the summary of cells [begin, end) from their times, without the tree
+     */
+    Span scan(std::size_t begin, std::size_t end) const;
+    /**
+     * @brief recomputes the leaf of block b and the nodes above it
+     */
+    void updateBlock(std::size_t b);
+    /**
+     * @brief makes room for the blocks of at least n cells
+     */
+    void reserveCells(std::size_t n);
+};
+
+#endif // SATURATIONQUEUE_H
@@ -0,0 +1,158 @@
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include "BatteryPack.h"
+#include "EventSink.h"
+#include "RateModel.h"
+
+/**
+ * @brief One group of identical cells in a scenario
+ */
+struct CellSpec
+{
+    double voltage;
+    double capacity;
+    double initialCharge;
+    std::size_t count;
+    double dischargeRate = Battery::DISCHARGE_RATE;
+    double rechargeRate = Battery::RECHARGE_RATE;
+    double impedance = 1; // factor on the circuit's resistances
+};
+
+/**
+ * @brief One entry of a scenario's use/recharge time series
+ */
+struct ScenarioStep
+{
+    enum Action
+    {
+        USE,
+        RECHARGE
+    };
+
+    Action action;
+    double hours;
+};
+
+/**
+ * @brief Pack state after one step of a scenario
+ */
+struct StepResult
+{
+    double voltage;
+    double capacity;
+    double charge;
+    double temperature = 0; // hottest cell, with a thermal model
+    double health = 1;      // mean remaining capacity fraction of the cells, with an aging model
+};
+
+/**
+ * @brief A headless simulation run: pack topology, cell parameters and a time series of actions.
+ *
+ * Scenario files are plain text, one directive per line, '#' starts a comment:
+ *
+ *     type series              # or parallel
+ *     topology 96s4p           # optional multi-level topology, overrides type
+ *     model cccv 0.8 0.05      # optional rate model: constant, crate or cccv [cvStart [cutoff]]
+ *     cell 3.7 2000 2000       # voltage capacity initialCharge [count [dischargeRate rechargeRate [impedance]]]
+ *     ocv 0 3.0 0.5 3.7 1 4.2  # optional equivalent circuit: (soc, volts) points of the OCV curve
+ *     resistance 0.015         # series resistance in ohms
+ *     rc 0.01 2000             # an RC pair in ohms and farads, at most two
+ *     sharing                  # split the current among parallel branches through the circuit
+ *     thermal 45 0.5 0.1 25    # optional thermal model: heatCapacity neighbourG coolantG coolantT [ohms [columns]]
+ *     derating 0.005 0.01      # capacity and rate change per kelvin under the thermal model, within [-1, 1]
+ *     aging 0.02 0.0001        # optional aging model: calendarLoss cycleLoss [depthExponent [interval]]
+ *     timestep 0.0002777778    # optional, play steps in fixed ticks of this many hours
+ *     use 1.5                  # hours
+ *     recharge 0.5             # hours
+ *     repeat 3650              # play the steps since the last repeat (or the start) this many times in all
+ *
+ * A profile expands to at most 2^24 steps.
+ */
+struct Scenario
+{
+    std::string name;
+    BatteryPack::ConnectionType type = BatteryPack::SERIES;
+    std::string topology;
+    /**
+     * @brief tick length in hours for the fixed-step Simulator, 0 to apply every step in one jump
+     */
+    double timestep = 0;
+    /**
+     * @brief how the cells' rates turn into charge changes
+     */
+    RateModel model;
+    /**
+     * @brief equivalent-circuit model of every cell, used when its OCV curve is set
+     */
+    CircuitParameters circuit;
+    /**
+     * @brief whether the circuit splits the current among parallel branches, see BatteryPack::setCurrentSharing()
+     */
+    bool sharing = false;
+    /**
+     * @brief thermal model of every cell, used when thermalModel is set
+     */
+    ThermalParameters thermal;
+    bool thermalModel = false;
+    /**
+     * @brief aging model of every cell, used when agingModel is set
+     */
+    AgingParameters aging;
+    bool agingModel = false;
+    std::vector<CellSpec> cells;
+    std::vector<ScenarioStep> steps;
+
+    /**
+     * @brief returns the total number of cells described by the scenario
+     */
+    std::size_t cellCount() const;
+};
+
+/**
+ * @brief parses a scenario from a stream
+ * @param in the stream to read
+ * @param scenario receives the parsed scenario
+ * @param error receives a message naming the offending line on failure
+ * @return true on success
+ */
+bool parseScenario(std::istream &in, Scenario &scenario, std::string &error);
+/**
+ * @brief parses a scenario file, see parseScenario
+ */
+bool loadScenario(const std::string &path, Scenario &scenario, std::string &error);
+/**
+ * @brief builds the pack described by the scenario and plays its time series
+ * @param scenario the scenario to run
+ * @param events optional sink for depletion and overcharge events
+ * @param fastForward with a timestep, skip analytically over ticks in which no cell saturates
+ * @return the pack state before the first step followed by the state after every step
+ */
+std::vector<StepResult> runScenario(const Scenario &scenario, EventSink *events = nullptr, bool fastForward = true);
+/**
+ * @brief adds the scenario's cells to a pack and applies its rate model, circuit, topology, sharing, thermal and
+ *        aging models
+ * @param scenario the scenario to build
+ * @param pack an empty pack of the scenario's connection type
+ */
+void buildPack(const Scenario &scenario, BatteryPack &pack);
+/**
+ * @brief plays the time series of a scenario on an existing pack, ignoring the scenario's cells
+ * @param scenario the scenario whose steps and timestep to use
+ * @param pack the pack to drive
+ * @param fastForward with a timestep, skip analytically over ticks in which no cell saturates
+ * @return the pack state before the first step followed by the state after every step
+ */
+std::vector<StepResult> playScenario(const Scenario &scenario, BatteryPack &pack, bool fastForward = true);
+/**
+ * @brief writes results as CSV (step,action,hours,voltage,capacity,charge), plus temperature with a thermal model
+ *        and health with an aging model
+ */
+void writeResults(std::ostream &out, const Scenario &scenario, const std::vector<StepResult> &results);
+
+#endif // SCENARIO_H
@@ -0,0 +1,146 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#ifndef SIMULATIONWORKER_H
+#define SIMULATIONWORKER_H
+
+#include "BatteryPack.h"
+#include "Scenario.h"
+
+/**
+ * @brief Consistent copy of a pack's state taken between two simulation updates
+ */
+struct PackSnapshot
+{
+    std::uint64_t sequence = 0; // increases with every published snapshot of a run
+    double hours = 0;           // simulated hours since the run started
+    double progress = 0;        // fraction of the profile played, 0..1
+    double elapsed = 0;         // BatteryPack::getElapsedHours() of the pack
+    double voltage = 0;
+    double capacity = 0;
+    double charge = 0;
+    /**
+     * @brief charge of every entry of BatteryPack::getCells(), in the same order
+     */
+    std::vector<double> cellCharge;
+    /**
+     * @brief capacity of every entry, empty when the capacities cannot change during a run
+     *
+     * Thermal and aging models change capacities as the pack is stepped, so
+     * they are copied whenever the pack has one or has nested packs.
+     */
+    std::vector<double> cellCapacity;
+    /**
+     * @brief voltage of every entry, empty when the voltages cannot change during a run
+     *
+     * A circuit rewrites the terminal voltages on every update, so they are
+     * copied whenever the pack has one or has nested packs.
+     */
+    std::vector<double> cellVoltage;
+    /**
+     * @brief temperature of every entry while the cells of a pack without nested packs have a thermal model
+     */
+    std::vector<double> cellTemperature;
+
+    /**
+     * @brief copies the aggregates and the per-cell state of a pack
+     */
+    void capture(const BatteryPack &pack);
+};
+
+/**
+ * @brief Runs a Simulator on its own thread and hands snapshots of the pack to another thread.
+ *
+ * While a run is active the worker owns the pack: the caller must not touch it
+ * except for reading cell voltages and capacities, which the simulation never
+ * changes unless a circuit, thermal or aging model is attached. Everything else
+ * (aggregates, charges, voltages with a circuit, and capacities and
+ * temperatures with the other models) is read from snapshots.
+ *
+ * Snapshots are triple buffered: the worker fills a back buffer and swaps it
+ * with the shared middle one in a single atomic exchange; the reader swaps the
+ * middle one into its front buffer when it is newer. Neither side ever waits
+ * and the reader never sees a half-written snapshot. Snapshots are published
+ * at most about every publishInterval and once more at the end of the run.
+ */
+class SimulationWorker
+{
+public:
+    SimulationWorker() = default;
+    /**
+     * @brief cancels a running simulation and joins the thread
+     */
+    ~SimulationWorker();
+    SimulationWorker(const SimulationWorker &) = delete;
+    SimulationWorker &operator=(const SimulationWorker &) = delete;
+
+    /**
+     * @brief starts playing a profile on the worker thread
+     * @param pack the pack to drive, must outlive the run
+     * @param profile the segments to play
+     * @param stepHours the tick length, see Simulator
+     * @return false if a run is still in progress
+     */
+    bool start(BatteryPack &pack, const std::vector<ScenarioStep> &profile, double stepHours);
+    /**
+     * @brief asks the worker to stop after the current chunk of ticks, about publishInterval of work
+     */
+    void cancel();
+    /**
+     * @brief returns true while the worker thread is still stepping
+     */
+    bool running() const;
+    /**
+     * @brief waits for the run to end and releases the thread; the pack belongs to the caller again
+     * @return true if the profile was played to the end, false if it was cancelled
+     */
+    bool wait();
+    /**
+     * @brief returns the fraction of the profile played so far, 0..1
+     */
+    double progress() const;
+
+    /**
+     * @brief returns the newest published snapshot, nullptr before the first one
+     *
+     * Only one thread may call this. The snapshot stays valid and unchanged until
+     * the next call, or until the next start().
+     */
+    const PackSnapshot *latest();
+
+    /**
+     * @brief sets the minimum time between two published snapshots
+     * @param seconds e.g. 1/60 to match the display
+     */
+    void setPublishInterval(double seconds);
+
+private:
+    static constexpr unsigned FRESH = 4; // set in middle while it holds a snapshot the reader has not taken
+
+    PackSnapshot buffers[3];
+    std::atomic<unsigned> middle{1};
+    unsigned back = 0;  // owned by the worker thread
+    unsigned front = 2; // owned by the reader
+    bool published = false;
+
+    std::thread thread;
+    std::atomic<bool> active{false};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> completed{false};
+    std::atomic<double> fraction{0};
+    double publishInterval = 1.0 / 60;
+
+    /**
+     * @brief worker thread body
+     */
+    void run(BatteryPack *pack, std::vector<ScenarioStep> profile, double stepHours);
+    /**
+     * @brief captures the pack into the back buffer and swaps it into the middle
+     */
+    void publish(const BatteryPack &pack, std::uint64_t sequence, double hours);
+};
+
+#endif // SIMULATIONWORKER_H
@@ -0,0 +1,136 @@
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "BatteryPack.h"
+#include "Scenario.h"
+
+/**
+ * @brief Fixed-timestep simulation of a BatteryPack driven by a use/recharge profile.
+ *
+ * The profile is a list of segments (the same steps a scenario has) played back
+ * in ticks of stepHours. A segment that is not a whole number of ticks ends with
+ * one shorter tick, so every segment lasts exactly its hours.
+ *
+ * With fast-forward on (the default) ticks are not applied one by one: cells
+ * change linearly until one of them runs empty or fills up, so all ticks before
+ * the next saturation are applied as a single pack update. The tick in which a
+ * cell saturates is applied on its own, so events carry the same time and
+ * overshoot as with plain ticking. Cells that are already saturated report one
+ * event per pack update instead of one per tick. A pack with current sharing
+ * (BatteryPack::setCurrentSharing()) is always played tick by tick, because
+ * the split changes as the cells drift apart, and so is one with a thermal
+ * model (BatteryPack::setThermal()), whose temperatures change the rates.
+ * With an aging model (BatteryPack::setAging()) ticks are still merged, since
+ * the state of charge only turns between updates, but no merged update runs
+ * past the end of an aging interval: capacities fade at the end of the tick
+ * that completes it, as with plain ticking, and the faded capacities move the
+ * next saturations.
+ */
+class Simulator
+{
+public:
+    /**
+     * @brief prepares a run, nothing is applied until advance() or run()
+     * @param pack the pack to drive, must outlive the simulator
+     * @param profile the segments to play, in order
+     * @param stepHours the length of one tick in hours, must be positive
+     */
+    Simulator(BatteryPack &pack, const std::vector<ScenarioStep> &profile, double stepHours);
+
+    /**
+     * @brief turns the analytic fast-forward on or off
+     * @param on false to apply every tick separately
+     */
+    void setFastForward(bool on);
+    /**
+     * @brief returns true if fast-forward is on
+     */
+    bool isFastForward() const;
+
+    /**
+     * @brief plays up to ticks ticks of the profile
+     * @return the number of ticks played, less than requested only at the end of the profile
+     */
+    std::uint64_t advance(std::uint64_t ticks);
+    /**
+     * @brief plays the rest of the current segment
+     * @return the number of ticks played
+     */
+    std::uint64_t finishSegment();
+    /**
+     * @brief plays the rest of the profile
+     * @return the number of ticks played
+     */
+    std::uint64_t run();
+
+    /**
+     * @brief returns true once every segment has been played
+     */
+    bool done() const;
+    /**
+     * @brief returns the index of the segment the next tick belongs to
+     */
+    std::size_t segment() const;
+    /**
+     * @brief returns the number of ticks played so far
+     */
+    std::uint64_t ticks() const;
+    /**
+     * @brief returns the simulated hours played so far
+     */
+    double hours() const;
+    /**
+     * @brief returns the number of ticks the whole profile takes
+     */
+    std::uint64_t totalTicks() const;
+    /**
+     * @brief returns the number of use/recharge calls made on the pack so far
+     */
+    std::uint64_t packUpdates() const;
+
+private:
+    /**
+     * @brief tick layout of one profile segment
+     */
+    struct Segment
+    {
+        bool recharging;
+        std::uint64_t fullTicks; // ticks of stepHours
+        double lastTick;         // length of the final short tick, 0 if there is none
+    };
+
+    BatteryPack &pack;
+    std::vector<Segment> segments;
+    double stepHours;
+    bool fastForward = true;
+
+    std::size_t current = 0;
+    std::uint64_t tickInSegment = 0;
+    std::uint64_t played = 0;
+    double elapsed = 0;
+    std::uint64_t updates = 0;
+
+    /**
+     * @brief returns the number of ticks in a segment, including the short one
+     */
+    static std::uint64_t tickCount(const Segment &s);
+    /**
+     * @brief moves past finished and empty segments so segment() and done() are exact
+     */
+    void skipFinished();
+    /**
+     * @brief applies hours of use or recharge to the pack
+     */
+    void apply(bool recharging, double hours);
+    /**
+     * @brief plays at most n full-length ticks of the current segment, n > 0
+     * @return the number of ticks played
+     */
+    std::uint64_t playFullTicks(std::uint64_t n);
+};
+
+#endif // SIMULATOR_H
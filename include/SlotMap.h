@@ -0,0 +1,93 @@
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+/**
+ * @brief Stable reference to a cell of a BatteryPack that survives the removal of other cells.
+ *
+ * A handle whose cell has been deleted stays detectably stale, even after its
+ * key has been reused for a new cell.
+ */
+struct CellHandle
+{
+    std::uint32_t key = ~std::uint32_t(0);
+    std::uint32_t generation = 0;
+
+    bool operator==(const CellHandle &other) const
+    {
+        return key == other.key && generation == other.generation;
+    }
+    bool operator!=(const CellHandle &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/**
+ * @brief Generation-checked handles onto the positions of a dense array.
+ *
+ * The array itself lives elsewhere and stays packed; the map only follows its
+ * elements as they move. Every position has a key, and every key records its
+ * current position and a generation that is bumped when its element is
+ * removed. Looking a handle up, inserting, swapping two positions and removing
+ * the last one are O(1); keys of removed elements are recycled.
+ */
+class SlotMap
+{
+public:
+    /**
+     * @brief returns a handle for a new element at position size()
+     */
+    CellHandle insert();
+    /**
+     * @brief records that the elements at positions a and b have been exchanged
+     */
+    void swap(std::size_t a, std::size_t b);
+    /**
+     * @brief records that the last element has been removed; its handles become stale
+     */
+    void pop();
+    /**
+     * @brief records that the element at position i has been removed and the later ones shifted down, O(n)
+     */
+    void erase(std::size_t i);
+    /**
+     * @brief removes every element, making every handle stale
+     */
+    void clear();
+
+    /**
+     * @brief returns the position of a handle's element, size() if the handle is stale
+     */
+    std::size_t find(CellHandle h) const;
+    /**
+     * @brief returns the handle of the element at position i
+     */
+    CellHandle handle(std::size_t i) const;
+    /**
+     * @brief returns the number of elements
+     */
+    std::size_t size() const;
+
+private:
+    struct Key
+    {
+        std::uint32_t position;
+        std::uint32_t generation;
+    };
+
+    std::vector<Key> keys;
+    // key of the element at every position
+    std::vector<std::uint32_t> owners;
+    std::vector<std::uint32_t> freeKeys;
+
+    /**
+     * @brief retires the key of a removed element so its handles go stale
+     */
+    void release(std::uint32_t key);
+};
+
+#endif // SLOTMAP_H
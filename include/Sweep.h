@@ -0,0 +1,85 @@
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "Scenario.h"
+
+/**
+ * @brief A parameter sweep: a base scenario plus value lists whose cartesian product is simulated.
+ *
+ * Sweep files are scenario files with extra "sweep" directives:
+ *
+ *     sweep cells 10 100 1000        # one group of N copies of the first cell (drops any topology)
+ *     sweep capacity 2000 3000       # overrides the capacity of every cell
+ *     sweep charge 1000 2000         # overrides the initial charge of every cell
+ *     sweep type series parallel     # needs 'sweep cells' when the base has a topology
+ *     sweep duty 0.5 1 2             # scales the hours of every step
+ *
+ * Parameters that are not swept keep the value from the base scenario.
+ */
+struct SweepSpec
+{
+    Scenario base;
+    std::vector<std::size_t> cellCounts;
+    std::vector<double> capacities;
+    std::vector<double> initialCharges;
+    std::vector<BatteryPack::ConnectionType> types;
+    std::vector<double> dutyScales;
+};
+
+/**
+ * @brief Parameters and outcome of one scenario of a sweep
+ */
+struct SweepCase
+{
+    std::size_t index;
+    BatteryPack::ConnectionType type;
+    std::size_t cells;
+    double capacity;
+    double initialCharge;
+    double duty;
+    StepResult initial;
+    StepResult final;
+    double minCharge;
+};
+
+/**
+ * @brief Per-scenario results in expansion order plus aggregate throughput
+ */
+struct SweepResult
+{
+    std::vector<SweepCase> cases;
+    std::size_t threads;
+    double seconds;
+    double scenariosPerSecond;
+};
+
+/**
+ * @brief parses a sweep file, see SweepSpec
+ */
+bool loadSweep(const std::string &path, SweepSpec &spec, std::string &error);
+/**
+ * @brief returns the number of scenarios the sweep expands to
+ */
+std::size_t sweepSize(const SweepSpec &spec);
+/**
+ * @brief builds scenario number index of the cartesian product and fills the parameter fields of its case
+ */
+Scenario expandSweep(const SweepSpec &spec, std::size_t index, SweepCase &sweepCase);
+/**
+ * @brief runs every scenario of the sweep on a work-stealing pool
+ * @param spec the sweep to run
+ * @param threads number of worker threads, 0 for one per hardware thread
+ * @return results ordered by scenario index regardless of completion order
+ */
+SweepResult runSweep(const SweepSpec &spec, std::size_t threads = 0);
+/**
+ * @brief writes one CSV row per scenario
+ */
+void writeSweepResults(std::ostream &out, const SweepResult &result);
+
+#endif // SWEEP_H
@@ -0,0 +1,183 @@
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+class BatteryPack;
+
+/**
+ * @brief What a TelemetryWriter records and how it encodes it
+ */
+struct TelemetryOptions
+{
+    /**
+     * @brief keep one pack update in this many, 1 records every update
+     */
+    std::size_t decimation = 1;
+    /**
+     * @brief sample every cellStride-th cell of the store, 0 for no per-cell columns
+     */
+    std::size_t cellStride = 1;
+    /**
+     * @brief explicit store slots to sample; overrides cellStride when not empty
+     */
+    std::vector<std::uint32_t> cells;
+    /**
+     * @brief store every value XORed with the previous value of its column
+     */
+    bool xorEncode = true;
+    /**
+     * @brief zlib level 1..9, 0 to store blocks uncompressed (also the case in builds without zlib)
+     */
+    int compression = 1;
+};
+
+/**
+ * @brief One recorded history, as returned by loadTelemetry()
+ */
+struct TelemetryData
+{
+    std::vector<std::uint32_t> cells; // store slots of the per-cell columns
+    std::vector<double> hours;        // BatteryPack::getElapsedHours() of every row
+    std::vector<double> voltage;
+    std::vector<double> charge;
+    /**
+     * @brief state of charge (charge / capacity) of the sampled cells, row after row
+     */
+    std::vector<double> stateOfCharge;
+};
+
+/**
+ * @brief Streams the history of a pack to a columnar, block-compressed file (.btl).
+ *
+ * Attached with BatteryPack::setTelemetry(), the writer gets one record() call
+ * after every use()/recharge() of the pack. A row holds the elapsed hours, the
+ * pack voltage and charge, and the state of charge of the sampled cells. Rows
+ * are gathered into blocks; full blocks are handed to a background thread that
+ * transposes them into columns, XOR-encodes each value against the previous
+ * row, splits the 64-bit words into byte planes and compresses them, so the
+ * stepping thread only copies values. The stepper waits only if every block
+ * in flight is still being compressed.
+ *
+ * File layout, little endian: magic "BATTELEM", u32 version, u32 flags (1 = XOR
+ * encoded), u32 number of sampled cells k, u32 reserved, k u32 store slots
+ * padded to 8 bytes, then blocks. A block header holds u32 rows, u32 codec
+ * (0 stored, 1 zlib), u64 stored size and u64 raw size. Its payload is 8 byte
+ * planes; plane b holds byte b of every value of the block, the 3 + k columns
+ * one after the other. XOR chains continue across blocks, so blocks are
+ * decoded in order.
+ */
+class TelemetryWriter
+{
+public:
+    /**
+     * @brief opens the file, writes its header and records the pack's current state as the first row
+     * @param path the file to write
+     * @param pack the pack whose store slots the sampling options refer to
+     * @param options sampling and encoding
+     */
+    TelemetryWriter(const std::string &path, const BatteryPack &pack, const TelemetryOptions &options = TelemetryOptions());
+    /**
+     * @brief writes the remaining rows and closes the file
+     */
+    ~TelemetryWriter();
+    TelemetryWriter(const TelemetryWriter &) = delete;
+    TelemetryWriter &operator=(const TelemetryWriter &) = delete;
+
+    /**
+     * @brief returns true if the file could be opened
+     */
+    bool isOpen() const;
+    /**
+     * @brief records the pack's state after an update, subject to decimation
+     */
+    void record(const BatteryPack &pack);
+    /**
+     * @brief writes the remaining rows, stops the background thread and closes the file
+     * @return false if any write failed
+     */
+    bool close();
+    /**
+     * @brief returns the number of rows recorded so far
+     */
+    std::uint64_t rows() const;
+
+private:
+    /**
+     * @brief rows gathered by the stepping thread, row after row
+     */
+    struct Block
+    {
+        std::vector<double> values;
+        std::size_t rows = 0;
+    };
+
+    static constexpr std::size_t IN_FLIGHT = 4; // blocks being filled, queued or compressed
+
+    std::FILE *file = nullptr;
+    std::vector<std::uint32_t> slots;
+    std::uint32_t maxSlot = 0;
+    bool contiguous = false; // slots are 0, 1, 2, ...
+    std::size_t width = 0;     // values per row, 3 + slots.size()
+    std::size_t blockRows = 0; // rows per block
+    std::size_t decimation = 1;
+    std::size_t skipped = 0;
+    std::uint64_t recorded = 0;
+    bool xorEncode = true;
+    int level = 1;
+
+    Block blocks[IN_FLIGHT];
+    Block *filling = nullptr; // owned by the stepping thread
+    std::vector<Block *> idle;
+    std::deque<Block *> full;
+    bool closing = false;
+    bool failed = false;
+    std::mutex mutex;
+    std::condition_variable blockFreed;
+    std::condition_variable blockQueued;
+    std::thread encoder;
+
+    // Owned by the encoder thread
+    std::vector<std::uint64_t> previous;
+    std::vector<unsigned char> planes;
+    std::vector<unsigned char> packed;
+
+    /**
+     * @brief queues the block being filled and takes an idle one, waiting if there is none
+     */
+    void submit();
+    /**
+     * @brief encoder thread body: encodes and writes queued blocks until closed
+     */
+    void encodeLoop();
+    /**
+     * @brief encodes one block and appends it to the file
+     * @return false if the write failed
+     */
+    bool writeBlock(const Block &block);
+};
+
+/**
+ * @brief reads a telemetry file written by TelemetryWriter
+ * @param path the file to read
+ * @param data receives the history
+ * @param error receives a message on failure
+ * @return false if the file cannot be read or is corrupt
+ */
+bool loadTelemetry(const std::string &path, TelemetryData &data, std::string &error);
+
+/**
+ * @brief writes a history as CSV (hours,voltage,charge,cell<slot>...)
+ */
+void writeTelemetryCsv(std::ostream &out, const TelemetryData &data);
+
+#endif // TELEMETRY_H
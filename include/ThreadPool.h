@@ -0,0 +1,86 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/**
+ * @brief Fixed-size pool of worker threads with per-worker task deques and work stealing.
+ *
+ * Each worker pops from the back of its own deque and, when that is empty, steals
+ * from the front of the other workers' deques, so uneven task costs balance out
+ * without a single shared queue becoming the bottleneck.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @brief starts the workers
+     * @param threads number of workers, 0 for one per hardware thread
+     */
+    explicit ThreadPool(std::size_t threads = 0);
+    /**
+     * @brief waits for all queued tasks and joins the workers
+     */
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * @brief returns the number of workers
+     */
+    std::size_t size() const;
+    /**
+     * @brief queues a task; tasks submitted from a worker go to that worker's own deque
+     */
+    void submit(std::function<void()> task);
+    /**
+     * @brief blocks until every submitted task has finished
+     */
+    void wait();
+    /**
+     * @brief runs body(i) for every i in [0, count) across the pool and waits for completion
+     * @param count number of iterations
+     * @param body the function to run, must be safe to call concurrently for different i
+     * @param grain iterations per task, 0 to pick one from count and the pool size
+     *
+     * Must not be called from inside a pool task.
+     */
+    void parallelFor(std::size_t count, const std::function<void(std::size_t)> &body, std::size_t grain = 0);
+
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<std::size_t> queued{0};
+    std::atomic<std::size_t> pending{0};
+    std::atomic<std::size_t> nextQueue{0};
+    bool stopping = false;
+
+    /**
+     * @brief takes a task from the worker's own deque or steals one from another worker
+     */
+    bool take(std::size_t self, std::function<void()> &task);
+    /**
+     * @brief main loop of worker self
+     */
+    void run(std::size_t self);
+};
+
+#endif // THREADPOOL_H
@@ -1,5 +1,10 @@
 #include <iostream>
 #include "Battery.h"
+#include "CellStore.h"
+#include "EventSink.h"
+
+static EventSink *standaloneSink = nullptr;
+
 Battery::Battery(double v, double c, double initialCharge)
 {
    voltage = v;
@@ -16,33 +21,57 @@ Battery::Battery(double v, double c, double initialCharge)
 }
 
 /**
- * @brief Decreases charge based on a fixed discharge rate.
+ * @brief Decreases charge based on the cell's discharge rate.
  * @param hours Number of hours of usage.
  */
 void Battery::use(double hours)
 {
-   double usableTime = charge / DISCHARGE_RATE;
-   charge = charge - hours * DISCHARGE_RATE;
-   if (charge < 0)
+   if (boundStore)
    {
-      charge = 0;
-      std::cout << "The battery can't be used this long, it was used for " << usableTime << std::endl;
+      boundStore->useCell(boundSlot, hours);
+      return;
+   }
+   double overshoot;
+   if (CellStore::discharge(charge, dischargeRate, hours, overshoot) && standaloneSink)
+   {
+      CellEvent event{0, overshoot, CellEvent::NO_CELL, CellEvent::DEPLETED};
+      standaloneSink->record(&event, 1);
    }
 }
 
 /**
- * @brief Decreases charge based on a fixed recharge rate.
+ * @brief Decreases charge based on the cell's recharge rate.
  * @param hours Number of hours of recharge.
  */
 void Battery::recharge(double hours)
 {
-   double chargeableTime = (capacity - charge) / RECHARGE_RATE;
-   charge = charge + hours * RECHARGE_RATE;
-   if (charge > capacity)
+   if (boundStore)
    {
-      charge = capacity;
-      std::cout << "The battery has been overcharged,its been charging for an extra" << hours - chargeableTime << std::endl;
+      boundStore->rechargeCell(boundSlot, hours);
+      return;
+   }
+   double overshoot;
+   if (CellStore::fill(charge, capacity, rechargeRate, hours, overshoot) && standaloneSink)
+   {
+      CellEvent event{0, overshoot, CellEvent::NO_CELL, CellEvent::OVERCHARGED};
+      standaloneSink->record(&event, 1);
+   }
+}
+
+/**
+ * @brief sets the discharge and recharge rates of this cell
+ * @param discharge the discharge rate
+ * @param recharge the recharge rate
+ */
+void Battery::setRates(double discharge, double recharge)
+{
+   if (boundStore)
+   {
+      boundStore->setRates(boundSlot, discharge, recharge);
+      return;
    }
+   dischargeRate = discharge;
+   rechargeRate = recharge;
 }
 
 
@@ -50,17 +79,33 @@ void Battery::recharge(double hours)
 
 double Battery::getVoltage() const
 {
-   return voltage;
+   return boundStore ? boundStore->voltage[boundSlot] : voltage;
 }
 double Battery::getCharge() const
 {
-   return charge;
+   return boundStore ? boundStore->charge[boundSlot] : charge;
 }
 double Battery::getCapacity() const
 {
-   return capacity;
+   return boundStore ? boundStore->capacity[boundSlot] : capacity;
+}
+double Battery::getDischargeRate() const
+{
+   return boundStore ? boundStore->dischargeRate[boundSlot] : dischargeRate;
+}
+double Battery::getRechargeRate() const
+{
+   return boundStore ? boundStore->rechargeRate[boundSlot] : rechargeRate;
 }
 double Battery::getPercent() const
 {
-   return (charge / capacity) * 100;
-}
\ No newline at end of file
+   return (getCharge() / getCapacity()) * 100;
+}
+bool Battery::isBound() const
+{
+   return boundStore != nullptr;
+}
+void Battery::setEventSink(EventSink *sink)
+{
+   standaloneSink = (sink && sink->enabled()) ? sink : nullptr;
+}
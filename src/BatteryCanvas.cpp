@@ -1,6 +1,14 @@
 #include "BatteryCanvas.h"
+#include "SimulationWorker.h"
 #include <QPainter>
+#include <QPixmapCache>
 #include <QDebug>
+#include <QScrollBar>
+#include <QToolTip>
+#include <QWheelEvent>
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
 // Constants for drawing //
 const int B_WIDTH_P = 50;
@@ -16,13 +24,40 @@ const int SPACING = 20;
 const int START_X = 50;
 const int START_Y = 50;
 
-BatteryCanvas::BatteryCanvas(QWidget *parent) : QWidget(parent)
+// Zoom limits; at the lower end 10M cells fit in a few hundred pixels
+const double MIN_ZOOM = 1e-7;
+const double MAX_ZOOM = 2.0;
+// Below this on-screen distance between cells the heatmap replaces single cells
+const double MIN_DETAIL_PITCH = 12.0;
+// Below this zoom the voltage/percent labels are unreadable and skipped
+const double MIN_TEXT_ZOOM = 0.6;
+// Heatmap tiles: length along the pack and thickness across it, in screen pixels
+const int TILE = 4;
+const int HEATMAP_BAND = 60;
+// Cells per entry of the heatmap prefix sums
+const std::size_t SUMMARY_BLOCK = 64;
+// Temperature colouring: kelvin above the coolant that show as full red, and the steps glyphs are cached in
+const double HEAT_SPAN = 40.0;
+const int HEAT_STEPS = 32;
+
+/**
+ * @brief returns the colour of a temperature on the heat scale, from blue at 0 to red at 1
+ */
+static QColor heatColour(double fraction)
+{
+    fraction = std::min(std::max(fraction, 0.0), 1.0);
+    return QColor::fromHsvF(0.66 * (1 - fraction), 0.85, 0.9);
+}
+
+BatteryCanvas::BatteryCanvas(QWidget *parent) : QAbstractScrollArea(parent)
 {
     setMinimumSize(400, 300);
-    QPalette pal = palette();
+    QPalette pal = viewport()->palette();
     pal.setColor(QPalette::Window, Qt::gray);
-    setAutoFillBackground(true);
-    setPalette(pal);
+    viewport()->setAutoFillBackground(true);
+    viewport()->setPalette(pal);
+    // Hover highlighting needs move events without a pressed button
+    viewport()->setMouseTracking(true);
 }
 
 /**
@@ -32,7 +67,46 @@ BatteryCanvas::BatteryCanvas(QWidget *parent) : QWidget(parent)
 void BatteryCanvas::setBatteryPack(BatteryPack *pack)
 {
     myPack = pack;
-    update();
+    summaryPack = nullptr;
+    hovered = -1;
+    updateScrollRange();
+    viewport()->update();
+}
+
+/**
+ * @brief Sets the zoom factor, 1 draws cells at their natural size
+ * @param factor the new zoom, clamped to [MIN_ZOOM, MAX_ZOOM]
+ */
+void BatteryCanvas::setZoom(double factor)
+{
+    zoom = std::min(std::max(factor, MIN_ZOOM), MAX_ZOOM);
+    updateScrollRange();
+    viewport()->update();
+}
+
+double BatteryCanvas::getZoom() const
+{
+    return zoom;
+}
+
+/**
+ * @brief Colours the cells by charge or by temperature
+ * @param c what the colours show
+ */
+void BatteryCanvas::setColouring(Colouring c)
+{
+    if (c == colouring)
+        return;
+    colouring = c;
+    // The heatmap sums and the drawn glyphs hold the other value
+    summaryPack = nullptr;
+    drawnPack = nullptr;
+    viewport()->update();
+}
+
+BatteryCanvas::Colouring BatteryCanvas::getColouring() const
+{
+    return colouring;
 }
 
 /**
@@ -59,106 +133,718 @@ QRect BatteryCanvas::getBatteryRect(int index, int startX, int startY) const
     }
 }
 
+bool BatteryCanvas::vertical() const
+{
+    return !myPack || myPack->getConnectionType() == BatteryPack::SERIES;
+}
+
+int BatteryCanvas::cellPitch() const
+{
+    return vertical() ? B_HEIGHT_S + SPACING : B_WIDTH_S + SPACING;
+}
+
+QScrollBar *BatteryCanvas::axisBar() const
+{
+    return vertical() ? verticalScrollBar() : horizontalScrollBar();
+}
+
+/**
+ * @brief recomputes the scroll range from the cell count and zoom
+ *
+ * Only the bar along the layout axis is used; the other one is kept at 0.
+ */
+void BatteryCanvas::updateScrollRange()
+{
+    std::size_t n = myPack ? myPack->getCells().size() : 0;
+    int start = vertical() ? START_Y : START_X;
+    int length = vertical() ? viewport()->height() : viewport()->width();
+    double content = (2.0 * start + static_cast<double>(n) * cellPitch()) * zoom;
+    double range = std::min(std::max(content - length, 0.0), static_cast<double>(INT_MAX));
+
+    QScrollBar *bar = axisBar();
+    QScrollBar *other = vertical() ? horizontalScrollBar() : verticalScrollBar();
+    other->setRange(0, 0);
+    bar->setRange(0, static_cast<int>(range));
+    bar->setPageStep(std::max(length, 1));
+    bar->setSingleStep(std::max(static_cast<int>(cellPitch() * zoom), 1));
+}
+
+void BatteryCanvas::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollRange();
+}
+
+void BatteryCanvas::scrollContentsBy(int, int)
+{
+    viewport()->update();
+}
+
+/**
+ * @brief computes the range of cells inside the viewport from the layout
+ * @param first receives the first visible cell
+ * @param last receives one past the last visible cell
+ */
+void BatteryCanvas::visibleRange(std::size_t &first, std::size_t &last) const
+{
+    std::size_t n = myPack ? myPack->getCells().size() : 0;
+    double pitch = cellPitch() * zoom;
+    double offset = axisBar()->value();
+    double start = (vertical() ? START_Y : START_X) * zoom;
+    int length = vertical() ? viewport()->height() : viewport()->width();
+    // One extra cell on each side for the terminal and the labels that stick out
+    double a = std::floor((offset - start) / pitch) - 1;
+    double b = std::ceil((offset + length - start) / pitch) + 1;
+    first = a < 0 ? 0 : std::min(static_cast<std::size_t>(a), n);
+    last = std::max(first, std::min(static_cast<std::size_t>(std::max(b, 0.0)), n));
+}
+
+/**
+ * @brief returns what the glyph of cell i currently shows
+ */
+BatteryCanvas::CellGlyph BatteryCanvas::glyphState(std::size_t i) const
+{
+    int height = vertical() ? B_HEIGHT_S : B_HEIGHT_P;
+    double pct = percentOf(i);
+
+    CellGlyph g;
+    g.band = (pct > 50) ? 2 : (pct > 20 ? 1 : 0);
+    g.fill = std::min(std::max(static_cast<int>(height * (pct / 100.0)), 0), height);
+    g.percent = static_cast<int>(std::lround(pct));
+    g.voltage = voltageOf(i);
+    if (colouring == TEMPERATURE)
+    {
+        double t = temperatureOf(i);
+        double step = std::floor((t - coolantTemperature()) / HEAT_SPAN * HEAT_STEPS);
+        g.band = static_cast<int>(std::min(std::max(step, 0.0), static_cast<double>(HEAT_STEPS)));
+        g.percent = static_cast<int>(std::lround(t));
+    }
+    return g;
+}
+
+bool BatteryCanvas::CellGlyph::operator==(const CellGlyph &other) const
+{
+    return band == other.band && fill == other.fill && percent == other.percent && voltage == other.voltage;
+}
+
+/**
+ * @brief returns the area cell i draws into, including terminal and labels, in layout coordinates
+ */
+QRect BatteryCanvas::glyphBounds(std::size_t i) const
+{
+    QRect body = getBatteryRect(static_cast<int>(i), START_X, START_Y);
+    if (vertical())
+        return QRect(body.x() - 2, body.y() - 8, B_WIDTH_S + 100, B_HEIGHT_S + 12);
+    return QRect(body.x() - SPACING / 2, body.y() - 8, B_WIDTH_P + SPACING, B_HEIGHT_P + 40);
+}
+
+/**
+ * @brief maps a rectangle from layout coordinates to whole viewport pixels
+ */
+QRect BatteryCanvas::toViewport(const QRect &r) const
+{
+    int x = static_cast<int>(std::floor(r.x() * zoom)) - horizontalScrollBar()->value();
+    int y = static_cast<int>(std::floor(r.y() * zoom)) - verticalScrollBar()->value();
+    return QRect(x, y, static_cast<int>(std::ceil(r.width() * zoom)) + 1, static_cast<int>(std::ceil(r.height() * zoom)) + 1);
+}
+
+/**
+ * @brief Draws one battery: body, terminal, charge fill and labels
+ * @param painter painter in layout coordinates
+ * @param bRect the body of the battery
+ * @param g what to show
+ * @param showText false to skip the labels
+ */
+void BatteryCanvas::drawCell(QPainter &painter, const QRect &bRect, const CellGlyph &g, bool showText) const
+{
+    B_HEIGHT = vertical() ? B_HEIGHT_S : B_HEIGHT_P;
+    B_WIDTH = vertical() ? B_WIDTH_S : B_WIDTH_P;
+
+    // --- Draw 1. Battery Body --- //
+    painter.setPen(QPen(Qt::black, 2));
+    painter.setBrush(Qt::NoBrush);
+    painter.drawRect(bRect);
+
+    // Positive Terminal
+    painter.setBrush(Qt::black);
+    painter.drawRect(bRect.x() + (B_WIDTH / 4), bRect.y() - 6, (B_WIDTH / 2), 6);
+
+    // --- Draw 2. Charge (Color) ---
+    QColor color = (g.band == 2) ? Qt::green : (g.band == 1 ? QColor("orange") : Qt::red);
+    if (colouring == TEMPERATURE)
+        color = heatColour(static_cast<double>(g.band) / HEAT_STEPS);
+    QRect fillRect(bRect.x() + 1, bRect.y() + (B_HEIGHT - g.fill), B_WIDTH - 2, g.fill);
+    painter.setBrush(color);
+    painter.setPen(Qt::NoPen);
+    painter.drawRect(fillRect);
+
+    // ---  Draw 3. Text  ---
+    if (!showText)
+        return;
+    painter.setPen(Qt::black);
+    QString vText = QString::number(g.voltage) + "V";
+    QString pText = QString::number(g.percent) + (colouring == TEMPERATURE ? QString::fromUtf8("\u00b0C") : "%");
+
+    if (vertical())
+    {
+        // SERIES MODE: Draw text to the RIGHT of the battery
+        // This prevents it from being covered by the battery below
+        painter.drawText(bRect.right() + 10, bRect.center().y() - 5, vText);
+        painter.drawText(bRect.right() + 10, bRect.center().y() + 10, pText);
+    }
+    else
+    {
+        // PARALLEL MODE: Draw text UNDER the battery
+        painter.drawText(bRect.x(), bRect.bottom() + 15, B_WIDTH, 15, Qt::AlignCenter, vText);
+        painter.drawText(bRect.center().x() - 15, bRect.center().y(), pText);
+    }
+}
+
+/**
+ * @brief returns the pre-rendered image of a cell, from QPixmapCache when possible
+ * @param g what the cell shows
+ * @param size the pixmap size in viewport pixels
+ */
+QPixmap BatteryCanvas::glyph(const CellGlyph &g, const QSize &size) const
+{
+    bool showText = zoom >= MIN_TEXT_ZOOM;
+    qreal ratio = viewport()->devicePixelRatioF();
+    QString key = QStringLiteral("cell:%1:%2:%3:%4:%5:%6:%7:%8:%9")
+                      .arg(vertical() ? 's' : 'p')
+                      .arg(colouring == TEMPERATURE ? 't' : 'c')
+                      .arg(zoom, 0, 'g', 17)
+                      .arg(ratio)
+                      .arg(g.band)
+                      .arg(g.fill)
+                      .arg(showText ? g.percent : -1)
+                      .arg(showText ? g.voltage : 0, 0, 'g', 17)
+                      .arg(size.width());
+
+    QPixmap pixmap;
+    if (QPixmapCache::find(key, &pixmap))
+        return pixmap;
+
+    pixmap = QPixmap(size * ratio);
+    pixmap.setDevicePixelRatio(ratio);
+    pixmap.fill(Qt::transparent);
+    QPainter painter(&pixmap);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.scale(zoom, zoom);
+    // The body sits at the same offset inside every glyph
+    QRect body = vertical() ? QRect(2, 8, B_WIDTH_S, B_HEIGHT_S) : QRect(SPACING / 2, 8, B_WIDTH_P, B_HEIGHT_P);
+    drawCell(painter, body, g, showText);
+    painter.end();
+
+    QPixmapCache::insert(key, pixmap);
+    return pixmap;
+}
+
 /**
  * @brief Custom paint event to draw batteries
  * @param event The paint event
+ *
+ * The visible index range follows from the scroll offset and the cell pitch, so
+ * the cost depends on the viewport size, not on the number of cells. Only cells
+ * that touch the repainted region are drawn, each as one cached glyph, and what
+ * they showed is remembered for refreshCells().
  */
-void BatteryCanvas::paintEvent(QPaintEvent *)
+void BatteryCanvas::paintEvent(QPaintEvent *event)
 {
-    QPainter painter(this);
+    QPainter painter(viewport());
     painter.setRenderHint(QPainter::Antialiasing);
 
+    // Anything that returns early leaves the snapshot invalid, so the next refreshCells() repaints fully
+    const BatteryPack *previousPack = drawnPack;
+    drawnPack = nullptr;
     if (!myPack)
         return;
 
     std::vector<Battery *> &cells = myPack->getCells();
     if (cells.empty())
     {
-        painter.drawText(rect(), Qt::AlignCenter, "No Batteries - You can add Batteries using the left window!");
+        painter.drawText(viewport()->rect(), Qt::AlignCenter, "No Batteries - You can add Batteries using the left window!");
         return;
     }
 
-    for (size_t i = 0; i < cells.size(); ++i)
-    {
-        B_HEIGHT = (myPack->getConnectionType() == BatteryPack::SERIES) ? B_HEIGHT_S : B_HEIGHT_P;
-        B_WIDTH = (myPack->getConnectionType() == BatteryPack::SERIES) ? B_WIDTH_S : B_WIDTH_P;
+    // Cells may have been added or removed since the last paint
+    updateScrollRange();
 
-        Battery *b = cells[i];
+    bool heatmap = cellPitch() * zoom < MIN_DETAIL_PITCH;
+    if (heatmap)
+    {
+        paintHeatmap(painter);
+    }
+    else
+    {
+        std::size_t first, last;
+        visibleRange(first, last);
+        if (first != drawnFirst || drawn.size() != last - first)
+        {
+            // Nothing known about these cells yet; refreshCells() repaints whatever this paint skips
+            drawn.assign(last - first, CellGlyph{-1, -1, -1, 0});
+            drawnFirst = first;
+        }
+        else if (previousPack != myPack || drawnCount != cells.size() || drawnVertical != vertical() ||
+                 drawnZoom != zoom || drawnScroll != axisBar()->value() || drawnHeatmap)
+        {
+            std::fill(drawn.begin(), drawn.end(), CellGlyph{-1, -1, -1, 0});
+        }
 
-        // Get the position for this specific battery
-        QRect bRect = getBatteryRect(i, START_X, START_Y);
+        QRect dirty = event->rect();
+        for (std::size_t i = first; i < last; ++i)
+        {
+            QRect target = toViewport(glyphBounds(i));
+            if (!target.intersects(dirty))
+                continue;
+            CellGlyph g = glyphState(i);
+            painter.drawPixmap(target.topLeft(), glyph(g, target.size()));
+            drawn[i - first] = g;
+        }
+        if (hovered >= static_cast<int>(first) && hovered < static_cast<int>(last))
+        {
+            painter.setPen(QPen(Qt::blue, 2));
+            painter.setBrush(Qt::NoBrush);
+            painter.drawRect(toViewport(getBatteryRect(hovered, START_X, START_Y)).adjusted(-2, -2, 1, 1));
+        }
+    }
 
-        // --- Draw 1. Battery Body --- //
-        painter.setPen(QPen(Qt::black, 2));
-        painter.setBrush(Qt::NoBrush);
-        painter.drawRect(bRect);
+    drawnPack = myPack;
+    drawnCount = cells.size();
+    drawnVertical = vertical();
+    drawnZoom = zoom;
+    drawnScroll = axisBar()->value();
+    drawnHeatmap = heatmap;
+    drawnVersion = chargeVersion();
+}
 
-        // Positive Terminal
-        painter.setBrush(Qt::black);
-        painter.drawRect(bRect.x() + (B_WIDTH / 4), bRect.y() - 6, (B_WIDTH / 2), 6);
+/**
+ * @brief Schedules a repaint of only the cells whose glyph changed since they were drawn
+ *
+ * Call after the pack changed. Falls back to a full repaint when the layout
+ * changed (cells added or removed, scrolled, zoomed, different pack).
+ */
+void BatteryCanvas::refreshCells()
+{
+    if (!myPack)
+    {
+        viewport()->update();
+        return;
+    }
+    updateScrollRange();
 
-        // --- Draw 2. Charge (Color) ---
-        double pct = b->getPercent();
-        QColor color = (pct > 50) ? Qt::green : (pct > 20 ? QColor("orange") : Qt::red);
+    std::size_t n = myPack->getCells().size();
+    bool heatmap = cellPitch() * zoom < MIN_DETAIL_PITCH;
+    if (drawnPack != myPack || drawnCount != n || drawnVertical != vertical() || drawnZoom != zoom ||
+        drawnScroll != axisBar()->value() || drawnHeatmap != heatmap)
+    {
+        viewport()->update();
+        return;
+    }
+    if (heatmap)
+    {
+        if (drawnVersion != chargeVersion())
+            viewport()->update();
+        return;
+    }
 
-        int fillHeight = static_cast<int>(B_HEIGHT * (pct / 100.0));
-        // Clamp to avoid drawing errors
-        if (fillHeight > B_HEIGHT)
-            fillHeight = B_HEIGHT;
-        if (fillHeight < 0)
-            fillHeight = 0;
+    std::size_t first, last;
+    visibleRange(first, last);
+    if (first != drawnFirst || drawn.size() != last - first)
+    {
+        viewport()->update();
+        return;
+    }
+    for (std::size_t i = first; i < last; ++i)
+    {
+        if (!(glyphState(i) == drawn[i - first]))
+            viewport()->update(toViewport(glyphBounds(i)));
+    }
+}
 
-        QRect fillRect(bRect.x() + 1, bRect.y() + (B_HEIGHT - fillHeight), B_WIDTH - 2, fillHeight);
-        painter.setBrush(color);
-        painter.setPen(Qt::NoPen);
-        painter.drawRect(fillRect);
+/**
+ * @brief draws aggregate tiles over the visible part of the pack
+ *
+ * Every tile covers the cells under TILE screen pixels and is coloured from red
+ * (empty) to green (full) by their mean charge percentage.
+ */
+void BatteryCanvas::paintHeatmap(QPainter &painter)
+{
+    refreshSummary();
+    std::size_t n = myPack->getCells().size();
+    double pitch = cellPitch() * zoom;
+    double offset = axisBar()->value();
+    double start = (vertical() ? START_Y : START_X) * zoom;
+    int length = vertical() ? viewport()->height() : viewport()->width();
 
-        // ---  Draw 3. Text  ---
-        painter.setPen(Qt::black);
-        QString vText = QString::number(b->getVoltage()) + "V";
-        QString pText = QString::number(pct, 'f', 0) + "%";
+    painter.setPen(Qt::NoPen);
+    for (int p = 0; p < length; p += TILE)
+    {
+        double a = std::floor((offset + p - start) / pitch);
+        double b = std::ceil((offset + p + TILE - start) / pitch);
+        if (b <= 0 || a >= static_cast<double>(n))
+            continue;
+        std::size_t first = a < 0 ? 0 : static_cast<std::size_t>(a);
+        std::size_t last = std::min(static_cast<std::size_t>(b), n);
+        if (first >= last)
+            continue;
 
-        if (myPack->getConnectionType() == BatteryPack::SERIES)
+        double mean = meanValue(first, last);
+        if (colouring == TEMPERATURE)
         {
-            // SERIES MODE: Draw text to the RIGHT of the battery
-            // This prevents it from being covered by the battery below
-            painter.drawText(bRect.right() + 10, bRect.center().y() - 5, vText);
-            painter.drawText(bRect.right() + 10, bRect.center().y() + 10, pText);
+            painter.setBrush(heatColour((mean - coolantTemperature()) / HEAT_SPAN));
         }
         else
         {
-            // PARALLEL MODE: Draw text UNDER the battery
-            painter.drawText(bRect.x(), bRect.bottom() + 15, B_WIDTH, 15, Qt::AlignCenter, vText);
-            painter.drawText(bRect.center().x() - 15, bRect.center().y(), pText);
+            double pct = std::min(std::max(mean, 0.0), 100.0);
+            painter.setBrush(QColor::fromHsvF(0.33 * pct / 100.0, 0.85, 0.9));
+        }
+        if (vertical())
+            painter.drawRect(START_X, p, HEATMAP_BAND, TILE);
+        else
+            painter.drawRect(p, START_Y, TILE, HEATMAP_BAND);
+    }
+
+    painter.setPen(Qt::black);
+    double perTile = TILE / pitch;
+    painter.drawText(10, 20, QString::number(n) + " cells, ~" + QString::number(perTile, 'f', perTile < 10 ? 1 : 0) +
+                                 " per tile (Ctrl+wheel to zoom in)");
+}
+
+/**
+ * @brief rebuilds blockSums if the pack changed since the last heatmap
+ *
+ * Charges of plain packs are read straight from the cell store (or the
+ * snapshot); temperatures and nested packs go through valueOf(). Changes
+ * inside nested packs do not bump the store version, so those are only
+ * picked up when the cell count or the pack changes.
+ */
+void BatteryCanvas::refreshSummary()
+{
+    const std::vector<Battery *> &cells = myPack->getCells();
+    const CellStore &store = myPack->getCellStore();
+    if (summaryPack == myPack && summaryVersion == chargeVersion() && summaryCells == cells.size())
+        return;
+
+    bool flat = store.size() == cells.size() && colouring == CHARGE;
+    const double *charge = snapshot ? snapshot->cellCharge.data() : store.charge.data();
+    const double *capacity = snapshot && !snapshot->cellCapacity.empty() ? snapshot->cellCapacity.data()
+                                                                         : store.capacity.data();
+    std::size_t blocks = cells.size() / SUMMARY_BLOCK;
+    blockSums.assign(blocks + 1, 0.0);
+    double total = 0;
+    for (std::size_t blk = 0; blk < blocks; ++blk)
+    {
+        double sum = 0;
+        for (std::size_t i = blk * SUMMARY_BLOCK; i < (blk + 1) * SUMMARY_BLOCK; ++i)
+        {
+            if (flat)
+                sum += capacity[i] > 0 ? charge[i] / capacity[i] * 100 : 0;
+            else
+                sum += valueOf(i);
         }
+        total += sum;
+        blockSums[blk + 1] = total;
+    }
+
+    summaryPack = myPack;
+    summaryVersion = chargeVersion();
+    summaryCells = cells.size();
+}
+
+/**
+ * @brief Shows charges from a snapshot instead of reading them from the pack
+ * @param snap the snapshot, nullptr to read the pack again
+ *
+ * While a snapshot is set the pack may be changing on another thread: only the
+ * cell voltages and capacities the snapshot does not carry are read from it,
+ * and clicks do not delete cells.
+ */
+void BatteryCanvas::setSnapshot(const PackSnapshot *snap)
+{
+    if ((snap == nullptr) != (snapshot == nullptr))
+    {
+        // Versions of snapshots and of the store are unrelated
+        summaryPack = nullptr;
+        drawnPack = nullptr;
+    }
+    snapshot = snap;
+}
+
+/**
+ * @brief returns the charge of cell i, from the snapshot when one is set
+ */
+double BatteryCanvas::chargeOf(std::size_t i) const
+{
+    return snapshot ? snapshot->cellCharge[i] : myPack->getCells()[i]->getCharge();
+}
+
+/**
+ * @brief returns the capacity of cell i, from the snapshot when it has them
+ *
+ * A thermal model changes capacities on every update, so snapshots of such
+ * packs carry them; otherwise they only change on the GUI thread.
+ */
+double BatteryCanvas::capacityOf(std::size_t i) const
+{
+    if (snapshot && !snapshot->cellCapacity.empty())
+        return snapshot->cellCapacity[i];
+    return myPack->getCells()[i]->getCapacity();
+}
+
+/**
+ * @brief returns the voltage of cell i, from the snapshot when it has them
+ *
+ * A circuit rewrites the voltages on every update, so snapshots of such packs
+ * carry them; otherwise they only change on the GUI thread.
+ */
+double BatteryCanvas::voltageOf(std::size_t i) const
+{
+    if (snapshot && !snapshot->cellVoltage.empty())
+        return snapshot->cellVoltage[i];
+    return myPack->getCells()[i]->getVoltage();
+}
+
+/**
+ * @brief returns the charge of cell i as a percentage of its capacity
+ */
+double BatteryCanvas::percentOf(std::size_t i) const
+{
+    double capacity = capacityOf(i);
+    return capacity > 0 ? chargeOf(i) / capacity * 100 : 0;
+}
+
+/**
+ * @brief returns the temperature of cell i, the coolant temperature if it has none
+ *
+ * Only cells in the pack's own store have one: cells of nested packs, and
+ * every cell while a snapshot without temperatures is shown, sit at the coolant.
+ */
+double BatteryCanvas::temperatureOf(std::size_t i) const
+{
+    if (snapshot)
+        return snapshot->cellTemperature.empty() ? coolantTemperature() : snapshot->cellTemperature[i];
+    const CellStore &store = myPack->getCellStore();
+    const CellThermal *thermal = store.getThermal();
+    if (thermal && store.size() == myPack->getCells().size())
+        return thermal->temperature[i];
+    return coolantTemperature();
+}
+
+/**
+ * @brief returns the temperature shown at the blue end of the heat scale
+ */
+double BatteryCanvas::coolantTemperature() const
+{
+    const CellThermal *thermal = myPack->getCellStore().getThermal();
+    return thermal ? thermal->getParameters().coolantTemperature : ThermalParameters().coolantTemperature;
+}
+
+/**
+ * @brief returns what the colouring shows for cell i: its charge percentage or its temperature
+ */
+double BatteryCanvas::valueOf(std::size_t i) const
+{
+    return colouring == TEMPERATURE ? temperatureOf(i) : percentOf(i);
+}
+
+/**
+ * @brief returns a counter that changes whenever the shown charges change
+ */
+std::uint64_t BatteryCanvas::chargeVersion() const
+{
+    return snapshot ? snapshot->sequence : myPack->getCellStore().version();
+}
+
+/**
+ * @brief returns the mean of valueOf() over cells [first, last)
+ *
+ * Whole blocks come from the prefix sums, so this reads at most two partial
+ * blocks of cells however many cells the range covers.
+ */
+double BatteryCanvas::meanValue(std::size_t first, std::size_t last) const
+{
+    std::size_t blockFirst = (first + SUMMARY_BLOCK - 1) / SUMMARY_BLOCK;
+    std::size_t blockLast = last / SUMMARY_BLOCK;
+    double sum = 0;
+    if (blockFirst >= blockLast)
+    {
+        for (std::size_t i = first; i < last; ++i)
+            sum += valueOf(i);
     }
+    else
+    {
+        sum = blockSums[blockLast] - blockSums[blockFirst];
+        for (std::size_t i = first; i < blockFirst * SUMMARY_BLOCK; ++i)
+            sum += valueOf(i);
+        for (std::size_t i = blockLast * SUMMARY_BLOCK; i < last; ++i)
+            sum += valueOf(i);
+    }
+    return sum / static_cast<double>(last - first);
+}
+
+/**
+ * @brief returns the cell whose body is under a viewport position, -1 if none
+ * @param pos position in viewport coordinates
+ *
+ * The layout is a regular column or row, so the index follows from inverting
+ * the layout math: O(1) whatever the pack size. No cell is hit on the heatmap.
+ */
+int BatteryCanvas::cellAt(const QPoint &pos) const
+{
+    if (!myPack || cellPitch() * zoom < MIN_DETAIL_PITCH)
+        return -1;
+
+    // Back to unzoomed layout coordinates
+    QPointF content = (QPointF(pos) + QPointF(horizontalScrollBar()->value(), verticalScrollBar()->value())) / zoom;
+    double along = vertical() ? content.y() - START_Y : content.x() - START_X;
+    double index = std::floor(along / cellPitch());
+    if (index < 0 || index >= static_cast<double>(myPack->getCells().size()))
+        return -1;
+
+    int i = static_cast<int>(index);
+    return getBatteryRect(i, START_X, START_Y).contains(content.toPoint()) ? i : -1;
+}
+
+/**
+ * @brief returns the range of cells covered by the heatmap tile under a viewport position
+ * @return false if the position is not on a tile
+ */
+bool BatteryCanvas::tileAt(const QPoint &pos, std::size_t &first, std::size_t &last) const
+{
+    if (!myPack || cellPitch() * zoom >= MIN_DETAIL_PITCH)
+        return false;
+    int across = vertical() ? pos.x() - START_X : pos.y() - START_Y;
+    if (across < 0 || across >= HEATMAP_BAND)
+        return false;
+
+    std::size_t n = myPack->getCells().size();
+    double pitch = cellPitch() * zoom;
+    double start = (vertical() ? START_Y : START_X) * zoom;
+    int p = (vertical() ? pos.y() : pos.x()) / TILE * TILE;
+    double a = std::floor((axisBar()->value() + p - start) / pitch);
+    double b = std::ceil((axisBar()->value() + p + TILE - start) / pitch);
+    if (b <= 0 || a >= static_cast<double>(n))
+        return false;
+    first = a < 0 ? 0 : static_cast<std::size_t>(a);
+    last = std::min(static_cast<std::size_t>(b), n);
+    return first < last;
+}
+
+/**
+ * @brief moves the hover highlight, repainting only the two cells involved
+ */
+void BatteryCanvas::setHovered(int index)
+{
+    if (index == hovered)
+        return;
+    std::size_t n = myPack ? myPack->getCells().size() : 0;
+    if (hovered >= 0 && static_cast<std::size_t>(hovered) < n)
+        viewport()->update(toViewport(glyphBounds(hovered)));
+    hovered = index;
+    if (hovered >= 0)
+        viewport()->update(toViewport(glyphBounds(hovered)));
 }
 
 /**
  * @brief Handle mouse clicks to remove batteries
  * @param event The mouse event
+ *
+ * Only the cell under the cursor is tested, see cellAt(). Clicks on the heatmap do nothing.
  */
 void BatteryCanvas::mousePressEvent(QMouseEvent *event)
 {
-    if (!myPack)
+    // The pack belongs to the simulation thread while a snapshot is shown
+    if (snapshot)
         return;
+    int i = cellAt(event->pos());
+    if (i >= 0)
+    {
+        // Click detected! Remove the battery.
+        myPack->deleteBattery(i);
+        hovered = -1;
 
-    // Iterate through all batteries to see if one was clicked
-    std::vector<Battery *> &cells = myPack->getCells();
+        // Trigger a redraw immediately
+        updateScrollRange();
+        viewport()->update();
+    }
+}
 
-    // We loop backwards so if elements overlap (unlikely here), top one catches click
-    for (int i = cells.size() - 1; i >= 0; --i)
-    {
-        QRect rect = getBatteryRect(i, START_X, START_Y);
+/**
+ * @brief Highlights the cell under the cursor
+ * @param event The mouse event
+ */
+void BatteryCanvas::mouseMoveEvent(QMouseEvent *event)
+{
+    setHovered(cellAt(event->pos()));
+}
 
-        if (rect.contains(event->pos()))
+/**
+ * @brief Shows a tooltip for the cell or heatmap tile under the cursor and clears the hover when the cursor leaves
+ */
+bool BatteryCanvas::viewportEvent(QEvent *event)
+{
+    if (event->type() == QEvent::Leave)
+    {
+        setHovered(-1);
+    }
+    else if (event->type() == QEvent::ToolTip)
+    {
+        QHelpEvent *help = static_cast<QHelpEvent *>(event);
+        int i = cellAt(help->pos());
+        std::size_t first, last;
+        if (i >= 0)
         {
-            // Click detected! Remove the battery.
-            myPack->deleteBattery(i);
-
-            // Trigger a redraw immediately
-            update();
-            break;
+            QString text = QString("Cell %1\n%2 V\n%3 / %4 (%5%)")
+                               .arg(i)
+                               .arg(voltageOf(i))
+                               .arg(chargeOf(i))
+                               .arg(capacityOf(i))
+                               .arg(percentOf(i), 0, 'f', 1);
+            if (colouring == TEMPERATURE)
+                text += QString::fromUtf8("\n%1 \u00b0C").arg(temperatureOf(i), 0, 'f', 1);
+            QToolTip::showText(help->globalPos(), text, viewport());
         }
+        else if (tileAt(help->pos(), first, last))
+        {
+            refreshSummary();
+            QString format = colouring == TEMPERATURE ? QString::fromUtf8("Cells %1 - %2\nmean temperature %3 \u00b0C")
+                                                      : QString("Cells %1 - %2\nmean charge %3%");
+            QToolTip::showText(help->globalPos(),
+                               format.arg(first).arg(last - 1).arg(meanValue(first, last), 0, 'f', 1), viewport());
+        }
+        else
+        {
+            QToolTip::hideText();
+        }
+        return true;
+    }
+    return QAbstractScrollArea::viewportEvent(event);
+}
+
+/**
+ * @brief Scrolls along the pack, or zooms around the cursor with Ctrl held
+ * @param event The wheel event
+ */
+void BatteryCanvas::wheelEvent(QWheelEvent *event)
+{
+    QPoint delta = event->angleDelta();
+    int steps = delta.y() != 0 ? delta.y() : delta.x();
+    if (event->modifiers() & Qt::ControlModifier)
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        QPointF cursor = event->position();
+#else
+        QPointF cursor = event->posF();
+#endif
+        // Keep the point under the cursor in place
+        double c = vertical() ? cursor.y() : cursor.x();
+        double anchor = (axisBar()->value() + c) / zoom;
+        setZoom(zoom * std::pow(1.0015, steps));
+        axisBar()->setValue(static_cast<int>(std::lround(std::min(anchor * zoom - c, static_cast<double>(INT_MAX)))));
     }
-}
\ No newline at end of file
+    else
+    {
+        axisBar()->setValue(axisBar()->value() - steps);
+    }
+    event->accept();
+}
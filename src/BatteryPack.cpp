@@ -1,37 +1,289 @@
 #include <iostream>
+#include <algorithm>
+#include <utility>
 #include "BatteryPack.h"
+#include "Telemetry.h"
 
 BatteryPack::BatteryPack(ConnectionType t)
     : Battery(0, 0, 0), type(t) {}
 
+/**
+ * @brief detaches every cell so the Battery objects stay usable after the pack is gone
+ */
+BatteryPack::~BatteryPack()
+{
+    for (Battery *b : cells)
+    {
+        if (b->boundStore == &cellStore && !arena.owns(b))
+            unbind(b);
+    }
+}
+
+/**
+ * @brief moves the state of a bound cell back into the Battery object and detaches it
+ * @param b the cell to detach
+ */
+void BatteryPack::unbind(Battery *b)
+{
+    b->voltage = cellStore.nominalVoltage(b->boundSlot);
+    b->capacity = cellStore.nominalCapacity(b->boundSlot);
+    b->charge = cellStore.nominalCharge(b->boundSlot);
+    b->dischargeRate = cellStore.nominalDischargeRate(b->boundSlot);
+    b->rechargeRate = cellStore.nominalRechargeRate(b->boundSlot);
+    b->boundStore = nullptr;
+    b->boundSlot = 0;
+}
+
+/**
+ * @brief copies a cell's values into the store and makes it a view of the new slot
+ * @param b the cell to bind
+ */
+void BatteryPack::bind(Battery *b)
+{
+    b->boundSlot = cellStore.push(b->voltage, b->capacity, b->charge, b->dischargeRate, b->rechargeRate);
+    b->boundStore = &cellStore;
+    if (!plan.empty())
+        plan.appendCell();
+}
+
 /**
  * @brief adds a battery to the cells
  * @param b the battery thats being added to the cells
+ * @return false if b is a plain cell that already belongs to a pack, this one included
+ *
+ * Plain cells are copied into the pack's CellStore and the Battery object becomes a
+ * view of that slot, so a cell belongs to one pack at a time: one still listed by a
+ * pack has to be deleted from it first, which detaches it again. Nested packs keep
+ * their own storage.
+ */
+bool BatteryPack::add(Battery *b)
+{
+    if (BatteryPack *p = dynamic_cast<BatteryPack *>(b))
+    {
+        subPacks.push_back(p);
+        clearTopology();
+    }
+    else
+    {
+        if (b->boundStore)
+            return false;
+        bind(b);
+    }
+    cells.push_back(b);
+    handles.insert();
+    return true;
+}
+
+/**
+ * @brief creates a cell owned by the pack and adds it
+ * @param v the voltage
+ * @param c the capacity
+ * @param initialCharge the initial charge
+ * @return the new cell, valid until it is deleted from the pack or the pack is destroyed
  */
-void BatteryPack::add(Battery *b)
+Battery *BatteryPack::addCell(double v, double c, double initialCharge)
 {
+    Battery *b = arena.create(v, c, initialCharge);
+    bind(b);
     cells.push_back(b);
+    handles.insert();
+    return b;
+}
+
+/**
+ * @brief creates n identical cells owned by the pack with a single allocation
+ * @param n number of cells
+ * @param v the voltage
+ * @param c the capacity
+ * @param initialCharge the initial charge
+ * @param discharge the discharge rate
+ * @param recharge the recharge rate
+ */
+void BatteryPack::addCells(std::size_t n, double v, double c, double initialCharge, double discharge, double recharge)
+{
+    arena.reserve(n);
+    cells.reserve(cells.size() + n);
+    cellStore.reserve(cellStore.size() + n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        Battery *b = arena.create(v, c, initialCharge);
+        b->dischargeRate = discharge;
+        b->rechargeRate = recharge;
+        bind(b);
+        cells.push_back(b);
+        handles.insert();
+    }
+}
+
+/**
+ * @brief creates n cells owned by the pack from column arrays, copying each column in one go
+ * @param v voltages
+ * @param c capacities
+ * @param q charges, each within [0, capacity]
+ * @param n number of cells
+ * @param d discharge rates, nullptr for the default rate
+ * @param r recharge rates, nullptr for the default rate
+ *
+ * The store is filled column by column and its aggregates rebuilt once; the
+ * Battery views are then bound to the new slots directly.
+ */
+void BatteryPack::addCells(const double *v, const double *c, const double *q, std::size_t n, const double *d,
+                           const double *r)
+{
+    std::size_t first = cellStore.size();
+    cellStore.append(v, c, q, n, d, r);
+    arena.reserve(n);
+    cells.reserve(cells.size() + n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        Battery *b = arena.create(v[i], c[i], q[i]);
+        b->boundStore = &cellStore;
+        b->boundSlot = first + i;
+        cells.push_back(b);
+        handles.insert();
+        if (!plan.empty())
+            plan.appendCell();
+    }
+}
+
+double BatteryPack::getElapsedHours() const
+{
+    return cellStore.elapsed;
+}
+
+void BatteryPack::setElapsedHours(double hours)
+{
+    cellStore.elapsed = hours;
 }
 
 /**
  * @brief deletes a battery from the cells
  * @param index the index of the battery to delete
+ *
+ * Without nested packs getCells() and the store are in the same order, and the
+ * cell is moved to the end of both before it is popped: the last cell takes its
+ * place in a flat pack, and in a topology every later group passes one cell on.
+ * Nested packs are not in the store, so with any of them the later cells are
+ * shifted down instead, in O(n).
  */
 void BatteryPack::deleteBattery(int index)
 {
-    if (index >= 0 && index < static_cast<int>(cells.size()))
+    if (index < 0 || index >= static_cast<int>(cells.size()))
+        return;
+    Battery *b = cells[index];
+    if (subPacks.empty())
+    {
+        std::size_t slot = static_cast<std::size_t>(index);
+        if (plan.empty())
+            removal.assign({slot, cells.size() - 1});
+        else
+            plan.removeCell(slot, removal);
+        for (std::size_t k = 0; k + 1 < removal.size(); ++k)
+            swapCells(removal[k], removal[k + 1]);
+
+        bool owned = arena.owns(b);
+        if (!owned)
+            unbind(b);
+        cellStore.pop();
+        cells.pop_back();
+        handles.pop();
+        if (owned)
+            arena.destroy(b);
+        return;
+    }
+
+    if (b->boundStore == &cellStore)
     {
-        cells.erase(cells.begin() + index);
+        std::size_t slot = b->boundSlot;
+        bool owned = arena.owns(b);
+        if (!owned)
+            unbind(b);
+        cellStore.erase(slot);
+        for (Battery *other : cells)
+        {
+            if (other->boundStore == &cellStore && other->boundSlot > slot)
+                --other->boundSlot;
+        }
+        if (owned)
+            arena.destroy(b);
     }
+    else
+    {
+        subPacks.erase(std::remove(subPacks.begin(), subPacks.end(), b), subPacks.end());
+    }
+    cells.erase(cells.begin() + index);
+    handles.erase(static_cast<std::size_t>(index));
+}
+
+/**
+ * @brief deletes the battery a handle refers to
+ * @param h the handle
+ * @return false if the handle is stale
+ */
+bool BatteryPack::deleteBattery(CellHandle h)
+{
+    std::size_t index = handles.find(h);
+    if (index == cells.size())
+        return false;
+    deleteBattery(static_cast<int>(index));
+    return true;
 }
+
+/**
+ * @brief returns a stable handle to a cell
+ * @param index the index of the cell in getCells()
+ * @return the handle, or one that matches no cell if index is out of range
+ */
+CellHandle BatteryPack::getHandle(int index) const
+{
+    if (index < 0 || index >= static_cast<int>(cells.size()))
+        return CellHandle();
+    return handles.handle(static_cast<std::size_t>(index));
+}
+
+/**
+ * @brief returns the current index of a handle's cell in getCells(), -1 if it has been deleted
+ */
+int BatteryPack::indexOf(CellHandle h) const
+{
+    std::size_t index = handles.find(h);
+    return index == cells.size() ? -1 : static_cast<int>(index);
+}
+
+/**
+ * @brief returns the cell a handle refers to, nullptr if it has been deleted
+ */
+Battery *BatteryPack::getCell(CellHandle h) const
+{
+    std::size_t index = handles.find(h);
+    return index == cells.size() ? nullptr : cells[index];
+}
+
+/**
+ * @brief exchanges two plain cells in getCells() and in the store, keeping their views and handles
+ */
+void BatteryPack::swapCells(std::size_t a, std::size_t b)
+{
+    if (a == b)
+        return;
+    cellStore.swap(a, b);
+    std::swap(cells[a], cells[b]);
+    cells[a]->boundSlot = a;
+    cells[b]->boundSlot = b;
+    handles.swap(a, b);
+}
+
 /**
  * @brief Decreases charge of all batteries in the cell based on the specific discharge rate of every single battery.
  * @param hours Number of hours of usage.
  */
 void BatteryPack::use(double hours)
 {
-    for (Battery *b : cells)
-        b->use(hours);
+    cellStore.use(hours);
+    for (BatteryPack *p : subPacks)
+        p->use(hours);
+    if (telemetry)
+        telemetry->record(*this);
 }
 
 /**
@@ -40,47 +292,147 @@ void BatteryPack::use(double hours)
  */
 void BatteryPack::recharge(double hours)
 {
-    for (Battery *b : cells)
-        b->recharge(hours);
+    cellStore.recharge(hours);
+    for (BatteryPack *p : subPacks)
+        p->recharge(hours);
+    if (telemetry)
+        telemetry->record(*this);
+}
+
+/**
+ * @brief returns the hours until the next cell of this pack or its nested packs saturates
+ * @param recharging true to look at recharge, false at use
+ * @return infinity if no cell can saturate any more
+ */
+double BatteryPack::hoursUntilSaturation(bool recharging) const
+{
+    double hours = recharging ? cellStore.hoursUntilFull() : cellStore.hoursUntilDepleted();
+    for (BatteryPack *p : subPacks)
+        hours = std::min(hours, p->hoursUntilSaturation(recharging));
+    return hours;
+}
+
+/**
+ * @brief returns the hours until the pack as a whole saturates, see hoursToEmpty() and hoursToFull()
+ *
+ * Walks the topology bottom-up like evaluatePlan(): a leaf group is one range
+ * query on the store, a series node takes its first child to saturate and a
+ * parallel node its last.
+ */
+double BatteryPack::hoursToSaturate(bool recharging) const
+{
+    if (cells.empty())
+        return 0;
+    if (!plan.empty())
+    {
+        const std::vector<PackPlan::Node> &nodes = plan.getNodes();
+        planHours.resize(nodes.size());
+        for (std::size_t k = nodes.size(); k-- > 0;)
+        {
+            const PackPlan::Node &node = nodes[k];
+            if (node.end == node.begin)
+                planHours[k] = 0;
+            else if (node.leafGroup)
+                planHours[k] = node.series ? cellStore.hoursUntilFirst(recharging, node.begin, node.end)
+                                           : cellStore.hoursUntilLast(recharging, node.begin, node.end);
+            else if (node.series)
+                planHours[k] = *std::min_element(planHours.begin() + node.begin, planHours.begin() + node.end);
+            else
+                planHours[k] = *std::max_element(planHours.begin() + node.begin, planHours.begin() + node.end);
+        }
+        return planHours[0];
+    }
+
+    if (type == SERIES)
+    {
+        double hours = cellStore.hoursUntilFirst(recharging, 0, cellStore.size());
+        for (BatteryPack *p : subPacks)
+            hours = std::min(hours, p->hoursToSaturate(recharging));
+        return hours;
+    }
+    double hours = cellStore.hoursUntilLast(recharging, 0, cellStore.size());
+    for (BatteryPack *p : subPacks)
+        hours = std::max(hours, p->hoursToSaturate(recharging));
+    return hours;
+}
+
+/**
+ * @brief returns the hours of use until the pack is empty, without stepping
+ * @return 0 if it already is, infinity if it never will be
+ */
+double BatteryPack::hoursToEmpty() const
+{
+    return hoursToSaturate(false);
+}
+
+/**
+ * @brief returns the hours of recharge until the pack is full, without stepping
+ * @return 0 if it already is, infinity if it never will be
+ */
+double BatteryPack::hoursToFull() const
+{
+    return hoursToSaturate(true);
+}
+
+/**
+ * @brief returns the pack's next cells to saturate, in order, with the hours until each does
+ * @param recharging true for recharge (cells filling up), false for use (cells running empty)
+ * @param limit the most cells to return
+ */
+std::vector<CellSaturation> BatteryPack::saturationOrder(bool recharging, std::size_t limit) const
+{
+    return cellStore.saturationOrder(recharging, limit);
 }
 
 // Getters //
 
 double BatteryPack::getVoltage() const
 {
+    if (!plan.empty())
+    {
+        evaluatePlan();
+        return planVoltage;
+    }
     double voltage = 0;
     if (type == SERIES)
     {
-
-        for (Battery *b : cells)
+        voltage = cellStore.sumVoltage();
+        for (BatteryPack *p : subPacks)
         {
-            voltage += b->getVoltage();
+            voltage += p->getVoltage();
         }
         return voltage;
     }
 
-    return cells[0]->getVoltage();
+    return cells.empty() ? 0 : cells[0]->getVoltage();
 }
 double BatteryPack::getCapacity() const
 {
+    if (!plan.empty())
+    {
+        evaluatePlan();
+        return planCapacity;
+    }
     if (type == ConnectionType::SERIES)
     {
-        double minCapacity = cells.empty() ? 0 : cells[0]->getCapacity();
-        for (Battery *b : cells)
+        if (cells.empty())
+            return 0;
+        double minCapacity = cellStore.empty() ? subPacks[0]->getCapacity() : cellStore.minCapacity();
+        for (BatteryPack *p : subPacks)
         {
-            if (b->getCapacity() < minCapacity)
+            if (p->getCapacity() < minCapacity)
             {
-                minCapacity = b->getCapacity();
+                minCapacity = p->getCapacity();
             }
         }
         return minCapacity;
     }
     else if (type == ConnectionType::PARALLEL)
     {
-        double totalCapacity = 0;
-        for (Battery *b : cells)
+        double totalCapacity = cellStore.sumCapacity();
+        for (BatteryPack *p : subPacks)
         {
-            totalCapacity += b->getCapacity();
+            totalCapacity += p->getCapacity();
         }
         return totalCapacity;
     }
@@ -88,24 +440,31 @@ double BatteryPack::getCapacity() const
 }
 double BatteryPack::getCharge() const
 {
+    if (!plan.empty())
+    {
+        evaluatePlan();
+        return planCharge;
+    }
     if (type == ConnectionType::SERIES)
     {
-        double minCharge = cells.empty() ? 0 : cells[0]->getCharge();
-        for (Battery *b : cells)
+        if (cells.empty())
+            return 0;
+        double minCharge = cellStore.empty() ? subPacks[0]->getCharge() : cellStore.minCharge();
+        for (BatteryPack *p : subPacks)
         {
-            if (b->getCharge() < minCharge)
+            if (p->getCharge() < minCharge)
             {
-                minCharge = b->getCharge();
+                minCharge = p->getCharge();
             }
         }
         return minCharge;
     }
     else if (type == ConnectionType::PARALLEL)
     {
-        double totalCharge = 0;
-        for (Battery *b : cells)
+        double totalCharge = cellStore.sumCharge();
+        for (BatteryPack *p : subPacks)
         {
-            totalCharge += b->getCharge();
+            totalCharge += p->getCharge();
         }
         return totalCharge;
     }
@@ -115,7 +474,234 @@ std::vector<Battery *> &BatteryPack::getCells() const
 {
     return const_cast<std::vector<Battery *> &>(cells);
 }
+const CellStore &BatteryPack::getCellStore() const
+{
+    return cellStore;
+}
+/**
+ * @brief evaluates the plan unless the cached aggregates are still current
+ */
+void BatteryPack::evaluatePlan() const
+{
+    if (planVersion == cellStore.version())
+        return;
+    plan.evaluate(cellStore, planVoltage, planCapacity, planCharge);
+    planVersion = cellStore.version();
+}
+
+/**
+ * @brief organises the cells into a multi-level topology such as "96s4p"
+ * @param notation NsMp notation, outermost level first
+ * @param error receives a message on failure
+ * @return false if the notation is invalid, the pack has nested packs or the
+ *         cell count does not match the topology
+ */
+bool BatteryPack::setTopology(const std::string &notation, std::string &error)
+{
+    PackPlan parsed;
+    if (!PackPlan::parse(notation, parsed, error))
+        return false;
+    if (!subPacks.empty())
+    {
+        error = "a topology can only be set on a pack without nested packs";
+        return false;
+    }
+    if (parsed.cellCount() != cellStore.size())
+    {
+        error = "topology " + notation + " needs " + std::to_string(parsed.cellCount()) + " cells, the pack has " +
+                std::to_string(cellStore.size());
+        return false;
+    }
+    plan = std::move(parsed);
+    type = plan.getNodes()[0].series ? SERIES : PARALLEL;
+    planVersion = ~std::uint64_t(0);
+    refreshSharing();
+    refreshThermal();
+    return true;
+}
+
+/**
+ * @brief goes back to a flat pack of the current connection type
+ */
+void BatteryPack::clearTopology()
+{
+    plan = PackPlan();
+    refreshSharing();
+    refreshThermal();
+}
+
+const PackPlan &BatteryPack::getTopology() const
+{
+    return plan;
+}
+
+/**
+ * @brief sets the sink for depletion and overcharge events of this pack and its nested packs
+ * @param sink the sink, nullptr or a NullEventSink to disable events at no cost
+ */
+void BatteryPack::setEventSink(EventSink *sink)
+{
+    cellStore.setEventSink(sink);
+    for (BatteryPack *p : subPacks)
+        p->setEventSink(sink);
+}
+
+/**
+ * @brief sets the model that turns cell rates into charge changes for this pack and its nested packs
+ * @param model the model, constant current by default
+ */
+void BatteryPack::setRateModel(const RateModel &model)
+{
+    cellStore.setRateModel(model);
+    for (BatteryPack *p : subPacks)
+        p->setRateModel(model);
+}
+
+const RateModel &BatteryPack::getRateModel() const
+{
+    return cellStore.getRateModel();
+}
+
+/**
+ * @brief attaches an equivalent-circuit model to the cells of this pack and its nested packs
+ * @param parameters the circuit shared by all cells; its OCV curve must be set
+ */
+void BatteryPack::setCircuit(const CircuitParameters &parameters)
+{
+    cellStore.setCircuit(parameters);
+    for (BatteryPack *p : subPacks)
+        p->setCircuit(parameters);
+}
+
+/**
+ * @brief detaches the equivalent-circuit model and restores the cells' nominal voltages
+ */
+void BatteryPack::clearCircuit()
+{
+    cellStore.clearCircuit();
+    for (BatteryPack *p : subPacks)
+        p->clearCircuit();
+}
+
+/**
+ * @brief sets the factor on a cell's circuit resistances, e.g. for an aged cell
+ * @param index the index of the cell in getCells()
+ * @param scale the factor, 1 for the circuit as given
+ * @return false if there is no such plain cell or no circuit is attached
+ */
+bool BatteryPack::setImpedance(int index, double scale)
+{
+    if (index < 0 || index >= static_cast<int>(cells.size()) || cells[index]->boundStore != &cellStore)
+        return false;
+    return cellStore.setImpedance(cells[index]->boundSlot, scale);
+}
+
+/**
+ * @brief attaches a thermal model to the cells of this pack and its nested packs
+ * @param parameters the model shared by all cells
+ */
+void BatteryPack::setThermal(const ThermalParameters &parameters)
+{
+    cellStore.setThermal(parameters);
+    refreshThermal();
+    for (BatteryPack *p : subPacks)
+        p->setThermal(parameters);
+}
+
+/**
+ * @brief detaches the thermal model and restores the cells' nominal capacities and rates
+ */
+void BatteryPack::clearThermal()
+{
+    cellStore.clearThermal();
+    for (BatteryPack *p : subPacks)
+        p->clearThermal();
+}
+
+/**
+ * @brief attaches an aging model to the cells of this pack and its nested packs
+ * @param parameters the model shared by all cells
+ */
+void BatteryPack::setAging(const AgingParameters &parameters)
+{
+    cellStore.setAging(parameters);
+    for (BatteryPack *p : subPacks)
+        p->setAging(parameters);
+}
+
+/**
+ * @brief detaches the aging model; the cells keep their faded capacities
+ */
+void BatteryPack::clearAging()
+{
+    cellStore.clearAging();
+    for (BatteryPack *p : subPacks)
+        p->clearAging();
+}
+
+/**
+ * @brief lays the thermal grid out in rows of the topology's largest leaf group, one row for a flat pack
+ */
+void BatteryPack::refreshThermal()
+{
+    std::size_t columns = 0;
+    for (const PackPlan::Node &node : plan.getNodes())
+    {
+        if (node.leafGroup)
+            columns = std::max<std::size_t>(columns, node.end - node.begin);
+    }
+    cellStore.setThermalColumns(columns);
+}
+
+/**
+ * @brief lets the equivalent circuit decide how the current splits among parallel branches,
+ *        for this pack and its nested packs
+ * @param on true to share, false to let every cell follow its own rate
+ */
+void BatteryPack::setCurrentSharing(bool on)
+{
+    currentSharing = on;
+    refreshSharing();
+    for (BatteryPack *p : subPacks)
+        p->setCurrentSharing(on);
+}
+
+bool BatteryPack::isCurrentSharing() const
+{
+    return currentSharing;
+}
+
+/**
+ * @brief hands the current topology and connection type to the cell store's sharing
+ */
+void BatteryPack::refreshSharing()
+{
+    cellStore.setCurrentSharing(currentSharing ? &plan : nullptr, type == PARALLEL);
+}
+
+/**
+ * @brief sets the writer that records the pack's state after every use/recharge
+ * @param writer the writer, nullptr to stop recording
+ */
+void BatteryPack::setTelemetry(TelemetryWriter *writer)
+{
+    telemetry = writer;
+}
+
+/**
+ * @brief switches the pack between series and parallel in place
+ * @param t the new connection type
+ */
+void BatteryPack::setConnectionType(ConnectionType t)
+{
+    type = t;
+    plan = PackPlan();
+    planVersion = ~std::uint64_t(0);
+    refreshSharing();
+    refreshThermal();
+}
+
 BatteryPack::ConnectionType BatteryPack::getConnectionType() const
 {
     return type;
-}
\ No newline at end of file
+}
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include "CellAging.h"
+#include "CellKernels.h"
+#include "CellKernelsClone.h"
+
+const std::size_t CellAging::DEPTH;
+
+// Hours of the year the calendar losses are given for
+static const double HOURS_PER_YEAR = 8760;
+// Cells keep at least this fraction of their capacity, so states of charge stay defined
+static const double MIN_HEALTH = 0.01;
+// Smaller moves of the state of charge against its direction are rounding, e.g. of a rescaled capacity, not turns
+static const double NOISE = 1e-12;
+// Relative slack on the interval, so it ends on the same update whether its hours were added up tick by tick or at once
+static const double INTERVAL_SLACK = 1e-9;
+
+namespace
+{
+    /**
+     * @brief returns the state of charge of a cell, 0 without capacity
+     */
+    CELLKERNELS_INLINE double stateOfCharge(double charge, double capacity)
+    {
+        const double soc = std::min(std::max(charge / capacity, 0.0), 1.0);
+        return capacity > 0 ? soc : 0;
+    }
+
+    /**
+     * @brief the sampling loop of record() over cells [0, n), built like CellCircuit's loops
+     * @param next receives every cell's new sample
+     * @return the number of cells whose sample moved against their direction, or for the first time
+     *
+     * Reads the newest samples without replacing them, so the few updates in
+     * which cells turn can still find the turning points.
+     */
+    template <bool Wide>
+    CELLKERNELS_INLINE std::size_t sampleCells(const double *charge, const double *capacity, const double *latest,
+                                             const double *direction, double *socHours, double *next,
+                                             double hours, std::size_t n)
+    {
+        const double half = 0.5 * hours;
+        std::size_t moved = 0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const double last = latest[i], d = direction[i];
+            const double s = stateOfCharge(charge[i], capacity[i]);
+            socHours[i] += half * (last + s);
+            next[i] = s;
+            // -step * d against the direction, or |step| before the first move (d is -1, 0 or 1)
+            const double step = s - last;
+            const double against = (1 - std::fabs(d)) * std::fabs(step) - step * d;
+            moved += static_cast<std::size_t>(against > NOISE);
+        }
+        return moved;
+    }
+
+    CELLKERNELS_AVX2_CLONE(std::size_t, sampleCells,
+                           (const double *charge, const double *capacity, const double *latest,
+                            const double *direction, double *socHours, double *next, double hours, std::size_t n),
+                           (charge, capacity, latest, direction, socHours, next, hours, n))
+}
+
+CellAging::CellAging(const AgingParameters &parameters) : parameters(parameters)
+{
+}
+
+const AgingParameters &CellAging::getParameters() const
+{
+    return parameters;
+}
+
+/**
+ * @brief appends a new cell
+ * @param soc its state of charge, the start of its history
+ */
+void CellAging::push(double soc)
+{
+    health.push_back(1);
+    calendarLoss.push_back(0);
+    cycleLoss.push_back(0);
+    cycles.push_back(0);
+    latest.push_back(soc);
+    direction.push_back(0);
+    residue.resize(residue.size() + DEPTH, 0.0f);
+    residue[residue.size() - DEPTH] = static_cast<float>(soc);
+    depth.push_back(1);
+    socHours.push_back(0);
+}
+
+void CellAging::erase(std::size_t slot)
+{
+    health.erase(health.begin() + slot);
+    calendarLoss.erase(calendarLoss.begin() + slot);
+    cycleLoss.erase(cycleLoss.begin() + slot);
+    cycles.erase(cycles.begin() + slot);
+    latest.erase(latest.begin() + slot);
+    direction.erase(direction.begin() + slot);
+    residue.erase(residue.begin() + slot * DEPTH, residue.begin() + (slot + 1) * DEPTH);
+    depth.erase(depth.begin() + slot);
+    socHours.erase(socHours.begin() + slot);
+}
+
+void CellAging::swap(std::size_t a, std::size_t b)
+{
+    std::swap(health[a], health[b]);
+    std::swap(calendarLoss[a], calendarLoss[b]);
+    std::swap(cycleLoss[a], cycleLoss[b]);
+    std::swap(cycles[a], cycles[b]);
+    std::swap(latest[a], latest[b]);
+    std::swap(direction[a], direction[b]);
+    std::swap_ranges(residue.begin() + a * DEPTH, residue.begin() + (a + 1) * DEPTH, residue.begin() + b * DEPTH);
+    std::swap(depth[a], depth[b]);
+    std::swap(socHours[a], socHours[b]);
+}
+
+void CellAging::pop()
+{
+    health.pop_back();
+    calendarLoss.pop_back();
+    cycleLoss.pop_back();
+    cycles.pop_back();
+    latest.pop_back();
+    direction.pop_back();
+    residue.resize(residue.size() - DEPTH);
+    depth.pop_back();
+    socHours.pop_back();
+}
+
+void CellAging::clear()
+{
+    health.clear();
+    calendarLoss.clear();
+    cycleLoss.clear();
+    cycles.clear();
+    latest.clear();
+    direction.clear();
+    residue.clear();
+    depth.clear();
+    socHours.clear();
+}
+
+/**
+ * @brief adds the damage of a cycle of the given depth
+ * @param weight 1 for a full cycle, 0.5 for a half cycle
+ */
+void CellAging::count(std::size_t slot, double range, double weight)
+{
+    cycleLoss[slot] += weight * parameters.cycleLoss * std::pow(range, parameters.depthExponent);
+    cycles[slot] += weight;
+}
+
+/**
+ * @brief pushes a turning point onto a cell's residue and counts the cycles it closes
+ *
+ * The last three points give the newest range X and the one before it, Y.
+ * While X is at least as deep as Y, Y is a closed cycle: a full one is counted
+ * and both its points dropped, or a half cycle if Y starts at the oldest point,
+ * which alone is dropped. What stays behind are ranges of decreasing depth.
+ */
+void CellAging::turn(std::size_t slot, float point)
+{
+    float *r = &residue[slot * DEPTH];
+    std::size_t n = depth[slot];
+    if (n == DEPTH)
+    {
+        count(slot, std::fabs(r[1] - r[0]), 0.5);
+        std::copy(r + 1, r + n, r);
+        --n;
+    }
+    r[n++] = point;
+    while (n >= 3)
+    {
+        float x = std::fabs(r[n - 1] - r[n - 2]), y = std::fabs(r[n - 2] - r[n - 3]);
+        if (x < y)
+            break;
+        if (n == 3)
+        {
+            count(slot, y, 0.5);
+            r[0] = r[1];
+            r[1] = r[2];
+            n = 2;
+        }
+        else
+        {
+            count(slot, y, 1);
+            r[n - 3] = r[n - 1];
+            n -= 2;
+        }
+    }
+    depth[slot] = static_cast<unsigned char>(n);
+}
+
+/**
+ * @brief feeds the state of charge of a single cell after a change to the cycle counter
+ *
+ * A sample that moves on in the current direction (or less than NOISE) only
+ * replaces the newest one; a sample that turns back makes the newest one a
+ * turning point.
+ */
+void CellAging::sample(std::size_t slot, double soc)
+{
+    double last = latest[slot];
+    double d = direction[slot];
+    latest[slot] = soc;
+    if (std::fabs(soc - last) <= NOISE)
+        return;
+    double move = soc > last ? 1 : -1;
+    if (d == 0)
+    {
+        direction[slot] = move;
+    }
+    else if (move != d)
+    {
+        turn(slot, static_cast<float>(last));
+        direction[slot] = move;
+    }
+}
+
+/**
+ * @brief feeds every cell's state of charge after a whole-store update to the cycle counter
+ * @return true once interval hours have passed since the last age()
+ *
+ * The state of charge changes monotonically within an update, so the mean
+ * of the two ends is its mean over the update. Cells only turn in the few
+ * updates that change direction, so a vectorized pass takes the samples and
+ * only those updates feed them through sample() one by one.
+ */
+bool CellAging::record(const double *charge, const double *capacity, std::size_t n, double hours)
+{
+    next.resize(n);
+    std::size_t moved;
+    if (CellKernels::useAvx2())
+        moved = sampleCellsAvx2(charge, capacity, latest.data(), direction.data(), socHours.data(), next.data(),
+                                hours, n);
+    else
+        moved = sampleCellsBaseline(charge, capacity, latest.data(), direction.data(), socHours.data(), next.data(),
+                                    hours, n);
+    if (moved == 0)
+    {
+        latest.swap(next);
+    }
+    else
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            sample(i, next[i]);
+    }
+    pending += hours;
+    return hoursUntilAging() == 0;
+}
+
+/**
+ * @brief returns the hours of whole-store updates left until record() asks for the next age(), 0 if it is due
+ */
+double CellAging::hoursUntilAging() const
+{
+    double left = parameters.interval - pending;
+    return left > parameters.interval * INTERVAL_SLACK ? left : 0;
+}
+
+/**
+ * @brief adds the calendar aging since the last call and rescales every cell to its new health
+ *
+ * The calendar loss L = k sqrt(t) of a cell aging at rate k has come about in
+ * the equivalent time (L / k)^2, from which the pending hours carry on at the
+ * rate of the last interval. Capacities and charges are rescaled by the change
+ * of health, so the states of charge stay as they are.
+ */
+void CellAging::age(double *charge, double *capacity, double *nominal, const double *temperature, std::size_t n)
+{
+    double years = pending / HOURS_PER_YEAR;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        double soc = pending > 0 ? socHours[i] / pending : latest[i];
+        double rate = parameters.calendarLoss * std::max(1 + parameters.socStress * (soc - 0.5), 0.0);
+        if (temperature)
+            rate *= std::exp2((temperature[i] - parameters.referenceTemperature) / parameters.doublingKelvin);
+        if (rate > 0 && years > 0)
+        {
+            double equivalent = calendarLoss[i] / rate;
+            calendarLoss[i] = rate * std::sqrt(equivalent * equivalent + years);
+        }
+        socHours[i] = 0;
+
+        double h = std::max(1 - calendarLoss[i] - cycleLoss[i], MIN_HEALTH);
+        if (h == health[i])
+            continue;
+        double f = h / health[i];
+        health[i] = h;
+        charge[i] *= f;
+        capacity[i] *= f;
+        if (nominal)
+            nominal[i] *= f;
+    }
+    pending = 0;
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <functional>
+#include <new>
+#include "CellArena.h"
+#include "Battery.h"
+
+/**
+ * @brief releases every slab in one go
+ */
+CellArena::~CellArena()
+{
+    clear();
+}
+
+/**
+ * @brief constructs a cell in the arena
+ * @param v the voltage
+ * @param c the capacity
+ * @param initialCharge the initial charge
+ */
+Battery *CellArena::create(double v, double c, double initialCharge)
+{
+    void *slot;
+    if (!freeList.empty())
+    {
+        slot = freeList.back();
+        freeList.pop_back();
+    }
+    else
+    {
+        if (cursor == cursorEnd)
+            addSlab(1);
+        slot = cursor++;
+    }
+    ++liveCount;
+    return new (slot) Battery(v, c, initialCharge);
+}
+
+/**
+ * @brief destroys a cell created by this arena and recycles its slot
+ */
+void CellArena::destroy(Battery *b)
+{
+    b->~Battery();
+    freeList.push_back(b);
+    --liveCount;
+}
+
+/**
+ * @brief makes sure the next n creations need no further allocation
+ */
+void CellArena::reserve(std::size_t n)
+{
+    std::size_t available = freeList.size() + static_cast<std::size_t>(cursorEnd - cursor);
+    if (available < n)
+        addSlab(n - freeList.size());
+}
+
+/**
+ * @brief returns true if b lives in one of this arena's slabs, O(log slabs)
+ */
+bool CellArena::owns(const Battery *b) const
+{
+    std::less<const Battery *> before;
+    auto it = std::upper_bound(slabs.begin(), slabs.end(), b,
+                               [&](const Battery *p, const Slab &s) { return before(p, s.begin); });
+    if (it == slabs.begin())
+        return false;
+    --it;
+    return before(b, it->begin + it->capacity);
+}
+
+std::size_t CellArena::live() const
+{
+    return liveCount;
+}
+
+/**
+ * @brief releases every slab; all cells created so far become invalid
+ */
+void CellArena::clear()
+{
+    for (Slab &s : slabs)
+        ::operator delete(static_cast<void *>(s.begin));
+    slabs.clear();
+    freeList.clear();
+    cursor = cursorEnd = nullptr;
+    liveCount = 0;
+    nextSlabSize = 64;
+}
+
+/**
+ * @brief allocates a slab with room for at least n cells and makes it current
+ */
+void CellArena::addSlab(std::size_t n)
+{
+    // Whatever is left of the newest slab goes to the free list so it isn't lost
+    for (; cursor != cursorEnd; ++cursor)
+        freeList.push_back(cursor);
+
+    std::size_t capacity = std::max(n, nextSlabSize);
+    nextSlabSize = std::min<std::size_t>(capacity * 2, std::size_t(1) << 20);
+
+    Slab slab;
+    slab.begin = static_cast<Battery *>(::operator new(capacity * sizeof(Battery)));
+    slab.capacity = capacity;
+
+    std::less<const Battery *> before;
+    auto it = std::upper_bound(slabs.begin(), slabs.end(), slab,
+                               [&](const Slab &a, const Slab &b) { return before(a.begin, b.begin); });
+    slabs.insert(it, slab);
+    cursor = slab.begin;
+    cursorEnd = slab.begin + capacity;
+}
@@ -0,0 +1,370 @@
+#include <cmath>
+#include <utility>
+#include "CellCircuit.h"
+#include "CellKernels.h"
+#include "CellKernelsClone.h"
+
+using CellKernels::LANES;
+
+/**
+ * @brief sets the curve from points
+ * @param soc states of charge, strictly increasing, the first 0 and the last 1
+ * @param volts the open-circuit voltage at each state of charge
+ * @param error receives a message on failure
+ * @return false if the points do not describe a curve over [0, 1]
+ */
+bool OcvCurve::set(const std::vector<double> &soc, const std::vector<double> &volts, std::string &error)
+{
+    if (soc.size() < 2 || soc.size() != volts.size())
+    {
+        error = "an OCV curve needs at least two (soc, volts) points";
+        return false;
+    }
+    if (soc.front() != 0 || soc.back() != 1)
+    {
+        error = "an OCV curve must start at soc 0 and end at soc 1";
+        return false;
+    }
+    for (std::size_t i = 1; i < soc.size(); ++i)
+    {
+        if (!(soc[i] > soc[i - 1]))
+        {
+            error = "OCV curve states of charge must be strictly increasing";
+            return false;
+        }
+    }
+
+    std::vector<double> grid(INTERVALS + 1);
+    std::size_t segment = 0;
+    for (std::size_t g = 0; g <= INTERVALS; ++g)
+    {
+        double s = static_cast<double>(g) / static_cast<double>(INTERVALS);
+        while (segment + 2 < soc.size() && s > soc[segment + 1])
+            ++segment;
+        double t = (s - soc[segment]) / (soc[segment + 1] - soc[segment]);
+        grid[g] = volts[segment] + t * (volts[segment + 1] - volts[segment]);
+    }
+    base.assign(grid.begin(), grid.end() - 1);
+    slope.resize(INTERVALS);
+    for (std::size_t g = 0; g < INTERVALS; ++g)
+        slope[g] = grid[g + 1] - grid[g];
+    source.clear();
+    for (std::size_t i = 0; i < soc.size(); ++i)
+    {
+        source.push_back(soc[i]);
+        source.push_back(volts[i]);
+    }
+    return true;
+}
+
+bool OcvCurve::empty() const
+{
+    return base.empty();
+}
+
+const std::vector<double> &OcvCurve::points() const
+{
+    return source;
+}
+
+namespace
+{
+    /**
+     * @brief everything the update loop needs, copied out of the circuit once per step
+     */
+    struct StepConstants
+    {
+        const double *base;
+        const double *slope;
+        double ampsPerDelta; // current per charge moved
+        double seriesResistance;
+        double decay0, decay1;
+        double gain0, gain1;
+    };
+
+    // Added to a cell's resistance in the Thevenin equivalent, so an ideal cell does not divide by zero
+    const double MIN_RESISTANCE = 1e-9;
+
+    /**
+     * @brief advances one cell with impedance factor z and returns its terminal voltage
+     */
+    CELLKERNELS_INLINE double advance(const StepConstants &k, double before, double after, double capacity, double z,
+                                      double &v0, double &v1)
+    {
+        // The impedance factor scales every resistance, so it can be folded into the current
+        double current = (before - after) * k.ampsPerDelta * z;
+        v0 = v0 * k.decay0 + current * k.gain0;
+        v1 = v1 * k.decay1 + current * k.gain1;
+        return OcvCurve::lookup(k.base, k.slope, after / capacity) - current * k.seriesResistance - v0 - v1;
+    }
+
+    /**
+     * @brief the update loop, built for the baseline ISA and for AVX2 by CELLKERNELS_AVX2_CLONE
+     *
+     * The constants are copied to locals and each block is read completely
+     * before it is written, so the compiler can vectorize a block without
+     * proving that the columns do not alias.
+     */
+    template <bool Wide>
+    CELLKERNELS_INLINE double integrate(const StepConstants &constants, const double *before, const double *q, const double *c,
+                                        const double *z, double *v0, double *v1, double *voltage, std::size_t n)
+    {
+        const StepConstants k = constants;
+        double sum[LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            double x[LANES], p0[LANES], p1[LANES];
+            for (std::size_t j = 0; j < LANES; ++j)
+            {
+                p0[j] = v0[i + j];
+                p1[j] = v1[i + j];
+                x[j] = advance(k, before[i + j], q[i + j], c[i + j], z[i + j], p0[j], p1[j]);
+            }
+            for (std::size_t j = 0; j < LANES; ++j)
+            {
+                v0[i + j] = p0[j];
+                v1[i + j] = p1[j];
+                voltage[i + j] = x[j];
+                sum[j] += x[j];
+            }
+        }
+        for (; i < n; ++i)
+        {
+            double x = advance(k, before[i], q[i], c[i], z[i], v0[i], v1[i]);
+            voltage[i] = x;
+            sum[i % LANES] += x;
+        }
+        return CellKernels::sumLanes(sum);
+    }
+
+    CELLKERNELS_AVX2_CLONE(double, integrate,
+                           (const StepConstants &k, const double *before, const double *q, const double *c,
+                            const double *z, double *v0, double *v1, double *voltage, std::size_t n),
+                           (k, before, q, c, z, v0, v1, voltage, n))
+
+    /**
+     * @brief everything the Thevenin pass needs, copied out of the circuit once per update
+     */
+    struct TheveninConstants
+    {
+        const double *base;
+        const double *slope;
+        double decay0, decay1;
+        double resistance;   // series resistance plus the RC gains, before the impedance factor
+        double ocvPerAmpSoc; // OCV change per volt of grid slope, per ampere, per unit of 1 / capacity
+    };
+
+    /**
+     * @brief computes one cell's Thevenin source and conductance
+     */
+    CELLKERNELS_INLINE void equivalent(const TheveninConstants &k, double q, double c, double z, double v0, double v1,
+                                       double &source, double &conductance)
+    {
+        const int last = static_cast<int>(OcvCurve::INTERVALS) - 1;
+        double x = q / c * static_cast<double>(OcvCurve::INTERVALS);
+        int g = static_cast<int>(x);
+        g = g < 0 ? 0 : (g > last ? last : g);
+        double r = z * k.resistance + std::fabs(k.slope[g]) * k.ocvPerAmpSoc / c + MIN_RESISTANCE;
+        source = k.base[g] + (x - g) * k.slope[g] - v0 * k.decay0 - v1 * k.decay1;
+        conductance = 1 / r;
+    }
+
+    /**
+     * @brief the Thevenin loop, built like integrate()
+     */
+    template <bool Wide>
+    CELLKERNELS_INLINE void equivalents(const TheveninConstants &constants, const double *q, const double *c,
+                                        const double *z, const double *v0, const double *v1, double *source,
+                                        double *conductance, std::size_t n)
+    {
+        const TheveninConstants k = constants;
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            double e[LANES], g[LANES];
+            for (std::size_t j = 0; j < LANES; ++j)
+                equivalent(k, q[i + j], c[i + j], z[i + j], v0[i + j], v1[i + j], e[j], g[j]);
+            for (std::size_t j = 0; j < LANES; ++j)
+            {
+                source[i + j] = e[j];
+                conductance[i + j] = g[j];
+            }
+        }
+        for (; i < n; ++i)
+            equivalent(k, q[i], c[i], z[i], v0[i], v1[i], source[i], conductance[i]);
+    }
+
+    CELLKERNELS_AVX2_CLONE(void, equivalents,
+                           (const TheveninConstants &k, const double *q, const double *c, const double *z,
+                            const double *v0, const double *v1, double *source, double *conductance, std::size_t n),
+                           (k, q, c, z, v0, v1, source, conductance, n))
+}
+
+CellCircuit::CellCircuit(const CircuitParameters &p) : parameters(p) {}
+
+const CircuitParameters &CellCircuit::getParameters() const
+{
+    return parameters;
+}
+
+/**
+ * @brief returns the terminal voltage of a cell at rest
+ */
+double CellCircuit::restVoltage(double q, double c) const
+{
+    return parameters.ocv.at(q / c);
+}
+
+void CellCircuit::push(double v)
+{
+    nominal.push_back(v);
+    impedance.push_back(1);
+    for (std::vector<double> &p : polarisation)
+        p.push_back(0);
+}
+
+void CellCircuit::erase(std::size_t slot)
+{
+    nominal.erase(nominal.begin() + slot);
+    impedance.erase(impedance.begin() + slot);
+    for (std::vector<double> &p : polarisation)
+        p.erase(p.begin() + slot);
+}
+
+void CellCircuit::swap(std::size_t a, std::size_t b)
+{
+    std::swap(nominal[a], nominal[b]);
+    std::swap(impedance[a], impedance[b]);
+    for (std::vector<double> &p : polarisation)
+        std::swap(p[a], p[b]);
+}
+
+void CellCircuit::pop()
+{
+    nominal.pop_back();
+    impedance.pop_back();
+    for (std::vector<double> &p : polarisation)
+        p.pop_back();
+}
+
+void CellCircuit::clear()
+{
+    nominal.clear();
+    impedance.clear();
+    for (std::vector<double> &p : polarisation)
+        p.clear();
+}
+
+/**
+ * @brief computes the decay factors for a step length unless they are cached
+ * @param hours the step length
+ *
+ * A disabled pair gets decay 0 and gain 0, so its voltage stays 0 without a
+ * branch in the loop.
+ */
+void CellCircuit::prepare(double hours)
+{
+    if (hours == cachedHours)
+        return;
+    cachedHours = hours;
+    double seconds = hours * 3600;
+    for (std::size_t p = 0; p < CircuitParameters::PAIRS; ++p)
+    {
+        const RcPair &pair = parameters.pairs[p];
+        if (pair.resistance > 0 && pair.capacitance > 0)
+        {
+            decay[p] = std::exp(-seconds / (pair.resistance * pair.capacitance));
+            gain[p] = pair.resistance * (1 - decay[p]);
+        }
+        else
+        {
+            decay[p] = 0;
+            gain[p] = 0;
+        }
+    }
+}
+
+/**
+ * @brief remembers the charges before a whole-store update
+ */
+void CellCircuit::begin(const double *charge, std::size_t n)
+{
+    previous.assign(charge, charge + n);
+}
+
+/**
+ * @brief advances every cell over an update that began with begin()
+ * @param charge the charges after the update
+ * @param capacity the capacities
+ * @param voltage receives the terminal voltages
+ * @param n number of cells
+ * @param hours the length of the update
+ * @return the sum of the terminal voltages, accumulated over eight lanes in a fixed order
+ *
+ * The loop is built twice, for the baseline instruction set and for AVX2, and
+ * follows CellKernels' choice; both builds give the same results.
+ */
+double CellCircuit::step(const double *charge, const double *capacity, double *voltage, std::size_t n, double hours)
+{
+    prepare(hours);
+    StepConstants k{parameters.ocv.base.data(), parameters.ocv.slope.data(),
+                    hours > 0 ? parameters.ampsPerRate / hours : 0, parameters.seriesResistance,
+                    decay[0], decay[1], gain[0], gain[1]};
+    double *v0 = polarisation[0].data();
+    double *v1 = polarisation[1].data();
+    if (CellKernels::useAvx2())
+        return integrateAvx2(k, previous.data(), charge, capacity, impedance.data(), v0, v1, voltage, n);
+    return integrateBaseline(k, previous.data(), charge, capacity, impedance.data(), v0, v1, voltage, n);
+}
+
+/**
+ * @brief advances a single cell
+ * @param slot the slot of the cell
+ * @param before the charge before the update
+ * @param after the charge after the update
+ * @param capacity the capacity of the cell
+ * @param hours the length of the update
+ * @return the new terminal voltage
+ */
+double CellCircuit::stepCell(std::size_t slot, double before, double after, double capacity, double hours)
+{
+    prepare(hours);
+    StepConstants k{parameters.ocv.base.data(), parameters.ocv.slope.data(),
+                    hours > 0 ? parameters.ampsPerRate / hours : 0, parameters.seriesResistance,
+                    decay[0], decay[1], gain[0], gain[1]};
+    return advance(k, before, after, capacity, impedance[slot], polarisation[0][slot], polarisation[1][slot]);
+}
+
+const double *CellCircuit::startCharges() const
+{
+    return previous.data();
+}
+
+/**
+ * @brief computes every cell's Thevenin equivalent for an update that began with begin()
+ * @param capacity the capacities
+ * @param n number of cells
+ * @param hours the length of the update, positive
+ * @param source receives the voltage each cell would show at zero current at the end of the update
+ * @param conductance receives the inverse of each cell's resistance to a current held over the update
+ *
+ * Holding a current I for the update adds I * gain to every RC voltage and
+ * moves the state of charge by I * hours / (ampsPerRate * capacity), which
+ * changes the OCV by the local slope of the curve times that amount; both are
+ * linear in I and go into the resistance. A falling stretch of the curve
+ * counts with its absolute slope, so the resistance never turns negative.
+ */
+void CellCircuit::thevenin(const double *capacity, std::size_t n, double hours, double *source, double *conductance)
+{
+    prepare(hours);
+    TheveninConstants k{parameters.ocv.base.data(), parameters.ocv.slope.data(), decay[0], decay[1],
+                        parameters.seriesResistance + gain[0] + gain[1],
+                        static_cast<double>(OcvCurve::INTERVALS) * hours / parameters.ampsPerRate};
+    const double *v0 = polarisation[0].data();
+    const double *v1 = polarisation[1].data();
+    if (CellKernels::useAvx2())
+        equivalentsAvx2(k, previous.data(), capacity, impedance.data(), v0, v1, source, conductance, n);
+    else
+        equivalentsBaseline(k, previous.data(), capacity, impedance.data(), v0, v1, source, conductance, n);
+}
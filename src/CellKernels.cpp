@@ -0,0 +1,539 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include "CellKernels.h"
+#include "CellKernelsClone.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define CELLKERNELS_SSE2 1
+#endif
+
+// Sums are accumulated over LANES interleaved partial sums and combined by
+// sumLanes(), which every implementation below follows exactly.
+using CellKernels::LANES;
+static const double INF = std::numeric_limits<double>::infinity();
+
+namespace
+{
+    int maskBits(int m)
+    {
+        int count = 0;
+        while (m)
+        {
+            count += m & 1;
+            m >>= 1;
+        }
+        return count;
+    }
+
+    // --- Scalar --- //
+
+    void dischargeTail(double *q, std::size_t i, std::size_t n, double delta, CellKernels::ChargeStats &stats)
+    {
+        for (; i < n; ++i)
+        {
+            double x = q[i] - delta;
+            if (x < 0)
+            {
+                x = 0;
+                ++stats.clamped;
+            }
+            q[i] = x;
+            stats.sum += x;
+            stats.min = x < stats.min ? x : stats.min;
+        }
+    }
+
+    void rechargeTail(double *q, const double *cap, std::size_t i, std::size_t n, double delta,
+                      CellKernels::ChargeStats &stats)
+    {
+        for (; i < n; ++i)
+        {
+            double x = q[i] + delta;
+            if (x > cap[i])
+            {
+                x = cap[i];
+                ++stats.clamped;
+            }
+            q[i] = x;
+            stats.sum += x;
+            stats.min = x < stats.min ? x : stats.min;
+        }
+    }
+
+    CellKernels::ChargeStats finish(CellKernels::ChargeStats stats, std::size_t n)
+    {
+        if (n == 0)
+            stats.min = 0;
+        return stats;
+    }
+
+    CellKernels::ChargeStats dischargeScalar(double *q, std::size_t n, double delta)
+    {
+        double a[LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+        double m[LANES] = {INF, INF, INF, INF, INF, INF, INF, INF};
+        CellKernels::ChargeStats stats{0, 0, 0};
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (std::size_t j = 0; j < LANES; ++j)
+            {
+                double x = q[i + j] - delta;
+                if (x < 0)
+                {
+                    x = 0;
+                    ++stats.clamped;
+                }
+                q[i + j] = x;
+                a[j] += x;
+                m[j] = x < m[j] ? x : m[j];
+            }
+        }
+        stats.sum = CellKernels::sumLanes(a);
+        stats.min = CellKernels::minLanes(m);
+        dischargeTail(q, i, n, delta, stats);
+        return finish(stats, n);
+    }
+
+    CellKernels::ChargeStats rechargeScalar(double *q, const double *cap, std::size_t n, double delta)
+    {
+        double a[LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+        double m[LANES] = {INF, INF, INF, INF, INF, INF, INF, INF};
+        CellKernels::ChargeStats stats{0, 0, 0};
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (std::size_t j = 0; j < LANES; ++j)
+            {
+                double x = q[i + j] + delta;
+                if (x > cap[i + j])
+                {
+                    x = cap[i + j];
+                    ++stats.clamped;
+                }
+                q[i + j] = x;
+                a[j] += x;
+                m[j] = x < m[j] ? x : m[j];
+            }
+        }
+        stats.sum = CellKernels::sumLanes(a);
+        stats.min = CellKernels::minLanes(m);
+        rechargeTail(q, cap, i, n, delta, stats);
+        return finish(stats, n);
+    }
+
+    double sumScalar(const double *x, std::size_t n)
+    {
+        double a[LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (std::size_t j = 0; j < LANES; ++j)
+                a[j] += x[i + j];
+        }
+        double total = CellKernels::sumLanes(a);
+        for (; i < n; ++i)
+            total += x[i];
+        return total;
+    }
+
+    double minScalar(const double *x, std::size_t n)
+    {
+        if (n == 0)
+            return 0;
+        double m = x[0];
+        for (std::size_t i = 1; i < n; ++i)
+            m = x[i] < m ? x[i] : m;
+        return m;
+    }
+
+    double minHeadroomScalar(const double *q, const double *cap, std::size_t n)
+    {
+        if (n == 0)
+            return 0;
+        double m = cap[0] - q[0];
+        for (std::size_t i = 1; i < n; ++i)
+        {
+            double h = cap[i] - q[i];
+            m = h < m ? h : m;
+        }
+        return m;
+    }
+
+#if CELLKERNELS_SSE2
+    // --- SSE2 (baseline on x86-64) --- //
+
+    CellKernels::ChargeStats dischargeSse2(double *q, std::size_t n, double delta)
+    {
+        const __m128d d = _mm_set1_pd(delta);
+        const __m128d zero = _mm_setzero_pd();
+        __m128d a[4] = {zero, zero, zero, zero};
+        __m128d m[4] = {_mm_set1_pd(INF), _mm_set1_pd(INF), _mm_set1_pd(INF), _mm_set1_pd(INF)};
+        CellKernels::ChargeStats stats{0, 0, 0};
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                __m128d x = _mm_sub_pd(_mm_loadu_pd(q + i + 2 * j), d);
+                __m128d below = _mm_cmplt_pd(x, zero);
+                stats.clamped += maskBits(_mm_movemask_pd(below));
+                x = _mm_andnot_pd(below, x);
+                _mm_storeu_pd(q + i + 2 * j, x);
+                a[j] = _mm_add_pd(a[j], x);
+                m[j] = _mm_min_pd(x, m[j]);
+            }
+        }
+        double lanes[LANES], mins[LANES];
+        for (int j = 0; j < 4; ++j)
+        {
+            _mm_storeu_pd(lanes + 2 * j, a[j]);
+            _mm_storeu_pd(mins + 2 * j, m[j]);
+        }
+        stats.sum = CellKernels::sumLanes(lanes);
+        stats.min = CellKernels::minLanes(mins);
+        dischargeTail(q, i, n, delta, stats);
+        return finish(stats, n);
+    }
+
+    CellKernels::ChargeStats rechargeSse2(double *q, const double *cap, std::size_t n, double delta)
+    {
+        const __m128d d = _mm_set1_pd(delta);
+        const __m128d zero = _mm_setzero_pd();
+        __m128d a[4] = {zero, zero, zero, zero};
+        __m128d m[4] = {_mm_set1_pd(INF), _mm_set1_pd(INF), _mm_set1_pd(INF), _mm_set1_pd(INF)};
+        CellKernels::ChargeStats stats{0, 0, 0};
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (int j = 0; j < 4; ++j)
+            {
+                __m128d x = _mm_add_pd(_mm_loadu_pd(q + i + 2 * j), d);
+                __m128d c = _mm_loadu_pd(cap + i + 2 * j);
+                __m128d over = _mm_cmpgt_pd(x, c);
+                stats.clamped += maskBits(_mm_movemask_pd(over));
+                x = _mm_or_pd(_mm_and_pd(over, c), _mm_andnot_pd(over, x));
+                _mm_storeu_pd(q + i + 2 * j, x);
+                a[j] = _mm_add_pd(a[j], x);
+                m[j] = _mm_min_pd(x, m[j]);
+            }
+        }
+        double lanes[LANES], mins[LANES];
+        for (int j = 0; j < 4; ++j)
+        {
+            _mm_storeu_pd(lanes + 2 * j, a[j]);
+            _mm_storeu_pd(mins + 2 * j, m[j]);
+        }
+        stats.sum = CellKernels::sumLanes(lanes);
+        stats.min = CellKernels::minLanes(mins);
+        rechargeTail(q, cap, i, n, delta, stats);
+        return finish(stats, n);
+    }
+
+    double sumSse2(const double *x, std::size_t n)
+    {
+        __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+        __m128d a2 = _mm_setzero_pd(), a3 = _mm_setzero_pd();
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            a0 = _mm_add_pd(a0, _mm_loadu_pd(x + i));
+            a1 = _mm_add_pd(a1, _mm_loadu_pd(x + i + 2));
+            a2 = _mm_add_pd(a2, _mm_loadu_pd(x + i + 4));
+            a3 = _mm_add_pd(a3, _mm_loadu_pd(x + i + 6));
+        }
+        double a[LANES];
+        _mm_storeu_pd(a, a0);
+        _mm_storeu_pd(a + 2, a1);
+        _mm_storeu_pd(a + 4, a2);
+        _mm_storeu_pd(a + 6, a3);
+        double total = CellKernels::sumLanes(a);
+        for (; i < n; ++i)
+            total += x[i];
+        return total;
+    }
+
+    double minSse2(const double *x, std::size_t n)
+    {
+        if (n < LANES)
+            return minScalar(x, n);
+        __m128d m0 = _mm_loadu_pd(x), m1 = _mm_loadu_pd(x + 2);
+        __m128d m2 = _mm_loadu_pd(x + 4), m3 = _mm_loadu_pd(x + 6);
+        std::size_t i = LANES;
+        for (; i + LANES <= n; i += LANES)
+        {
+            m0 = _mm_min_pd(_mm_loadu_pd(x + i), m0);
+            m1 = _mm_min_pd(_mm_loadu_pd(x + i + 2), m1);
+            m2 = _mm_min_pd(_mm_loadu_pd(x + i + 4), m2);
+            m3 = _mm_min_pd(_mm_loadu_pd(x + i + 6), m3);
+        }
+        double a[LANES];
+        _mm_storeu_pd(a, m0);
+        _mm_storeu_pd(a + 2, m1);
+        _mm_storeu_pd(a + 4, m2);
+        _mm_storeu_pd(a + 6, m3);
+        double m = CellKernels::minLanes(a);
+        for (; i < n; ++i)
+            m = x[i] < m ? x[i] : m;
+        return m;
+    }
+
+    double minHeadroomSse2(const double *q, const double *cap, std::size_t n)
+    {
+        if (n < 2)
+            return minHeadroomScalar(q, cap, n);
+        __m128d m = _mm_sub_pd(_mm_loadu_pd(cap), _mm_loadu_pd(q));
+        std::size_t i = 2;
+        for (; i + 2 <= n; i += 2)
+            m = _mm_min_pd(_mm_sub_pd(_mm_loadu_pd(cap + i), _mm_loadu_pd(q + i)), m);
+        double a[2];
+        _mm_storeu_pd(a, m);
+        double r = a[1] < a[0] ? a[1] : a[0];
+        for (; i < n; ++i)
+        {
+            double h = cap[i] - q[i];
+            r = h < r ? h : r;
+        }
+        return r;
+    }
+#endif
+
+#if CELLKERNELS_AVX2
+    // --- AVX2 (runtime detected) --- //
+
+    CELLKERNELS_TARGET_AVX2 CellKernels::ChargeStats dischargeAvx2(double *q, std::size_t n, double delta)
+    {
+        const __m256d d = _mm256_set1_pd(delta);
+        const __m256d zero = _mm256_setzero_pd();
+        __m256d a[2] = {zero, zero};
+        __m256d m[2] = {_mm256_set1_pd(INF), _mm256_set1_pd(INF)};
+        CellKernels::ChargeStats stats{0, 0, 0};
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (int j = 0; j < 2; ++j)
+            {
+                __m256d x = _mm256_sub_pd(_mm256_loadu_pd(q + i + 4 * j), d);
+                __m256d below = _mm256_cmp_pd(x, zero, _CMP_LT_OQ);
+                stats.clamped += maskBits(_mm256_movemask_pd(below));
+                x = _mm256_andnot_pd(below, x);
+                _mm256_storeu_pd(q + i + 4 * j, x);
+                a[j] = _mm256_add_pd(a[j], x);
+                m[j] = _mm256_min_pd(x, m[j]);
+            }
+        }
+        double lanes[LANES], mins[LANES];
+        for (int j = 0; j < 2; ++j)
+        {
+            _mm256_storeu_pd(lanes + 4 * j, a[j]);
+            _mm256_storeu_pd(mins + 4 * j, m[j]);
+        }
+        stats.sum = CellKernels::sumLanes(lanes);
+        stats.min = CellKernels::minLanes(mins);
+        dischargeTail(q, i, n, delta, stats);
+        return finish(stats, n);
+    }
+
+    CELLKERNELS_TARGET_AVX2 CellKernels::ChargeStats rechargeAvx2(double *q, const double *cap, std::size_t n, double delta)
+    {
+        const __m256d d = _mm256_set1_pd(delta);
+        const __m256d zero = _mm256_setzero_pd();
+        __m256d a[2] = {zero, zero};
+        __m256d m[2] = {_mm256_set1_pd(INF), _mm256_set1_pd(INF)};
+        CellKernels::ChargeStats stats{0, 0, 0};
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            for (int j = 0; j < 2; ++j)
+            {
+                __m256d x = _mm256_add_pd(_mm256_loadu_pd(q + i + 4 * j), d);
+                __m256d c = _mm256_loadu_pd(cap + i + 4 * j);
+                __m256d over = _mm256_cmp_pd(x, c, _CMP_GT_OQ);
+                stats.clamped += maskBits(_mm256_movemask_pd(over));
+                x = _mm256_blendv_pd(x, c, over);
+                _mm256_storeu_pd(q + i + 4 * j, x);
+                a[j] = _mm256_add_pd(a[j], x);
+                m[j] = _mm256_min_pd(x, m[j]);
+            }
+        }
+        double lanes[LANES], mins[LANES];
+        for (int j = 0; j < 2; ++j)
+        {
+            _mm256_storeu_pd(lanes + 4 * j, a[j]);
+            _mm256_storeu_pd(mins + 4 * j, m[j]);
+        }
+        stats.sum = CellKernels::sumLanes(lanes);
+        stats.min = CellKernels::minLanes(mins);
+        rechargeTail(q, cap, i, n, delta, stats);
+        return finish(stats, n);
+    }
+
+    CELLKERNELS_TARGET_AVX2 double sumAvx2(const double *x, std::size_t n)
+    {
+        __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+        std::size_t i = 0;
+        for (; i + LANES <= n; i += LANES)
+        {
+            a0 = _mm256_add_pd(a0, _mm256_loadu_pd(x + i));
+            a1 = _mm256_add_pd(a1, _mm256_loadu_pd(x + i + 4));
+        }
+        double a[LANES];
+        _mm256_storeu_pd(a, a0);
+        _mm256_storeu_pd(a + 4, a1);
+        double total = CellKernels::sumLanes(a);
+        for (; i < n; ++i)
+            total += x[i];
+        return total;
+    }
+
+    CELLKERNELS_TARGET_AVX2 double minAvx2(const double *x, std::size_t n)
+    {
+        if (n < LANES)
+            return minScalar(x, n);
+        __m256d m0 = _mm256_loadu_pd(x), m1 = _mm256_loadu_pd(x + 4);
+        std::size_t i = LANES;
+        for (; i + LANES <= n; i += LANES)
+        {
+            m0 = _mm256_min_pd(_mm256_loadu_pd(x + i), m0);
+            m1 = _mm256_min_pd(_mm256_loadu_pd(x + i + 4), m1);
+        }
+        double a[LANES];
+        _mm256_storeu_pd(a, m0);
+        _mm256_storeu_pd(a + 4, m1);
+        double m = CellKernels::minLanes(a);
+        for (; i < n; ++i)
+            m = x[i] < m ? x[i] : m;
+        return m;
+    }
+
+    CELLKERNELS_TARGET_AVX2 double minHeadroomAvx2(const double *q, const double *cap, std::size_t n)
+    {
+        if (n < 4)
+            return minHeadroomScalar(q, cap, n);
+        __m256d m = _mm256_sub_pd(_mm256_loadu_pd(cap), _mm256_loadu_pd(q));
+        std::size_t i = 4;
+        for (; i + 4 <= n; i += 4)
+            m = _mm256_min_pd(_mm256_sub_pd(_mm256_loadu_pd(cap + i), _mm256_loadu_pd(q + i)), m);
+        double a[4];
+        _mm256_storeu_pd(a, m);
+        double r = a[0];
+        for (int j = 1; j < 4; ++j)
+            r = a[j] < r ? a[j] : r;
+        for (; i < n; ++i)
+        {
+            double h = cap[i] - q[i];
+            r = h < r ? h : r;
+        }
+        return r;
+    }
+#endif
+
+    struct KernelTable
+    {
+        CellKernels::Isa isa;
+        CellKernels::ChargeStats (*discharge)(double *, std::size_t, double);
+        CellKernels::ChargeStats (*recharge)(double *, const double *, std::size_t, double);
+        double (*sum)(const double *, std::size_t);
+        double (*min)(const double *, std::size_t);
+        double (*minHeadroom)(const double *, const double *, std::size_t);
+    };
+
+    const KernelTable SCALAR_TABLE = {CellKernels::Isa::SCALAR, dischargeScalar, rechargeScalar,
+                                      sumScalar, minScalar, minHeadroomScalar};
+#if CELLKERNELS_SSE2
+    const KernelTable SSE2_TABLE = {CellKernels::Isa::SSE2, dischargeSse2, rechargeSse2,
+                                    sumSse2, minSse2, minHeadroomSse2};
+#endif
+#if CELLKERNELS_AVX2
+    const KernelTable AVX2_TABLE = {CellKernels::Isa::AVX2, dischargeAvx2, rechargeAvx2,
+                                    sumAvx2, minAvx2, minHeadroomAvx2};
+#endif
+
+    const KernelTable &nativeTable()
+    {
+#if CELLKERNELS_AVX2
+        static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+        if (hasAvx2)
+            return AVX2_TABLE;
+#endif
+#if CELLKERNELS_SSE2
+        return SSE2_TABLE;
+#else
+        return SCALAR_TABLE;
+#endif
+    }
+
+    std::atomic<bool> &scalarForced()
+    {
+        static std::atomic<bool> forced([] {
+            const char *env = std::getenv("BATTERY_FORCE_SCALAR");
+            return env && std::strcmp(env, "0") != 0;
+        }());
+        return forced;
+    }
+
+    const KernelTable &table()
+    {
+        return scalarForced().load(std::memory_order_relaxed) ? SCALAR_TABLE : nativeTable();
+    }
+}
+
+CellKernels::Isa CellKernels::activeIsa()
+{
+    return table().isa;
+}
+
+const char *CellKernels::isaName(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::AVX2:
+        return "avx2";
+    case Isa::SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+void CellKernels::setForceScalar(bool force)
+{
+    scalarForced().store(force, std::memory_order_relaxed);
+}
+
+bool CellKernels::isScalarForced()
+{
+    return scalarForced().load(std::memory_order_relaxed);
+}
+
+bool CellKernels::useAvx2()
+{
+    return activeIsa() == Isa::AVX2;
+}
+
+CellKernels::ChargeStats CellKernels::discharge(double *charge, std::size_t n, double delta)
+{
+    return table().discharge(charge, n, delta);
+}
+
+CellKernels::ChargeStats CellKernels::recharge(double *charge, const double *capacity, std::size_t n, double delta)
+{
+    return table().recharge(charge, capacity, n, delta);
+}
+
+double CellKernels::sum(const double *x, std::size_t n)
+{
+    return table().sum(x, n);
+}
+
+double CellKernels::min(const double *x, std::size_t n)
+{
+    return table().min(x, n);
+}
+
+double CellKernels::minHeadroom(const double *charge, const double *capacity, std::size_t n)
+{
+    return table().minHeadroom(charge, capacity, n);
+}
@@ -0,0 +1,1179 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include "CellStore.h"
+#include "Battery.h"
+#include "CellKernels.h"
+#include "EventSink.h"
+
+// Events are handed to the sink in batches of this size
+static const std::size_t EVENT_BATCH = 256;
+
+std::size_t CellStore::size() const
+{
+    return charge.size();
+}
+
+bool CellStore::empty() const
+{
+    return charge.empty();
+}
+
+/**
+ * @brief appends a cell and returns its slot
+ * @param v the voltage of the cell
+ * @param c the capacity of the cell
+ * @param q the (already clamped) charge of the cell
+ * @param d the discharge rate of the cell
+ * @param r the recharge rate of the cell
+ */
+std::size_t CellStore::push(double v, double c, double q, double d, double r)
+{
+    if (thermal)
+    {
+        // A new cell starts at the coolant temperature
+        thermal->push(c, d, r);
+        double t = thermal->getParameters().coolantTemperature;
+        double f = thermal->capacityFactor(t), g = thermal->rateFactor(t);
+        if (f != 1)
+        {
+            q *= f;
+            c *= f;
+        }
+        d *= g;
+        r *= g;
+    }
+    if (circuit)
+    {
+        circuit->push(v);
+        v = circuit->restVoltage(q, c);
+    }
+    if (aging)
+        aging->push(c > 0 ? q / c : 0);
+    voltage.push_back(v);
+    capacity.push_back(c);
+    charge.push_back(q);
+    dischargeRate.push_back(d);
+    rechargeRate.push_back(r);
+    countRates(d, r, 1);
+
+    voltageSum.add(v);
+    capacitySum.add(c);
+    chargeSum.add(q);
+    if (capacityMinStale)
+        bulkCapacityMin = c < bulkCapacityMin ? c : bulkCapacityMin;
+    else
+        capacityMin.push(c);
+    ++changes;
+    if (chargeMinStale)
+        bulkChargeMin = q < bulkChargeMin ? q : bulkChargeMin;
+    else
+        chargeMin.push(q);
+    std::size_t slot = charge.size() - 1;
+    if (!emptying.stale)
+        emptying.queue.push(saturationTime(emptying, false, slot));
+    if (!filling.stale)
+        filling.queue.push(saturationTime(filling, true, slot));
+    return slot;
+}
+
+/**
+ * @brief appends n cells from column arrays and rebuilds the aggregates once
+ * @param v voltages
+ * @param c capacities
+ * @param q (already clamped) charges
+ * @param n number of cells
+ * @param d discharge rates, nullptr for the default rate
+ * @param r recharge rates, nullptr for the default rate
+ */
+void CellStore::append(const double *v, const double *c, const double *q, std::size_t n, const double *d,
+                       const double *r)
+{
+    voltage.insert(voltage.end(), v, v + n);
+    capacity.insert(capacity.end(), c, c + n);
+    charge.insert(charge.end(), q, q + n);
+    if (d)
+        dischargeRate.insert(dischargeRate.end(), d, d + n);
+    else
+        dischargeRate.resize(dischargeRate.size() + n, Battery::DISCHARGE_RATE);
+    if (r)
+        rechargeRate.insert(rechargeRate.end(), r, r + n);
+    else
+        rechargeRate.resize(rechargeRate.size() + n, Battery::RECHARGE_RATE);
+    if (thermal)
+    {
+        double t = thermal->getParameters().coolantTemperature;
+        double f = thermal->capacityFactor(t), g = thermal->rateFactor(t);
+        for (std::size_t i = charge.size() - n; i < charge.size(); ++i)
+        {
+            thermal->push(capacity[i], dischargeRate[i], rechargeRate[i]);
+            if (f != 1)
+            {
+                charge[i] *= f;
+                capacity[i] *= f;
+            }
+            dischargeRate[i] *= g;
+            rechargeRate[i] *= g;
+        }
+    }
+    if (d || r || thermal)
+    {
+        for (std::size_t i = charge.size() - n; i < charge.size(); ++i)
+            countRates(dischargeRate[i], rechargeRate[i], 1);
+    }
+    if (circuit)
+    {
+        for (std::size_t i = charge.size() - n; i < charge.size(); ++i)
+        {
+            circuit->push(voltage[i]);
+            voltage[i] = circuit->restVoltage(charge[i], capacity[i]);
+        }
+    }
+    if (aging)
+    {
+        for (std::size_t i = charge.size() - n; i < charge.size(); ++i)
+            aging->push(capacity[i] > 0 ? charge[i] / capacity[i] : 0);
+    }
+    rebuildAggregates();
+}
+
+void CellStore::reserve(std::size_t n)
+{
+    voltage.reserve(n);
+    capacity.reserve(n);
+    charge.reserve(n);
+    dischargeRate.reserve(n);
+    rechargeRate.reserve(n);
+}
+
+/**
+ * @brief removes a cell, shifting every later slot down by one
+ * @param slot the slot to remove
+ */
+void CellStore::erase(std::size_t slot)
+{
+    voltageSum.add(-voltage[slot]);
+    capacitySum.add(-capacity[slot]);
+    chargeSum.add(-charge[slot]);
+
+    voltage.erase(voltage.begin() + slot);
+    capacity.erase(capacity.begin() + slot);
+    charge.erase(charge.begin() + slot);
+    countRates(dischargeRate[slot], rechargeRate[slot], -1);
+    dischargeRate.erase(dischargeRate.begin() + slot);
+    rechargeRate.erase(rechargeRate.begin() + slot);
+    if (circuit)
+        circuit->erase(slot);
+    if (thermal)
+        thermal->erase(slot);
+    if (aging)
+        aging->erase(slot);
+
+    if (capacityMinStale)
+        refreshCapacityMin();
+    else
+        capacityMin.erase(slot);
+    ++changes;
+    if (chargeMinStale)
+        refreshChargeMin();
+    else
+        chargeMin.erase(slot);
+    if (!emptying.stale)
+        emptying.queue.erase(slot);
+    if (!filling.stale)
+        filling.queue.erase(slot);
+}
+
+/**
+ * @brief exchanges the slots of two cells, O(log n)
+ */
+void CellStore::swap(std::size_t a, std::size_t b)
+{
+    if (a == b)
+        return;
+    std::swap(voltage[a], voltage[b]);
+    std::swap(capacity[a], capacity[b]);
+    std::swap(charge[a], charge[b]);
+    std::swap(dischargeRate[a], dischargeRate[b]);
+    std::swap(rechargeRate[a], rechargeRate[b]);
+    if (circuit)
+        circuit->swap(a, b);
+    if (thermal)
+        thermal->swap(a, b);
+    if (aging)
+        aging->swap(a, b);
+
+    if (!capacityMinStale)
+        capacityMin.swap(a, b);
+    ++changes;
+    if (!chargeMinStale)
+        chargeMin.swap(a, b);
+    if (!emptying.stale)
+        emptying.queue.swap(a, b);
+    if (!filling.stale)
+        filling.queue.swap(a, b);
+}
+
+/**
+ * @brief removes the cell in the last slot, O(log n)
+ */
+void CellStore::pop()
+{
+    voltageSum.add(-voltage.back());
+    capacitySum.add(-capacity.back());
+    chargeSum.add(-charge.back());
+    countRates(dischargeRate.back(), rechargeRate.back(), -1);
+
+    voltage.pop_back();
+    capacity.pop_back();
+    charge.pop_back();
+    dischargeRate.pop_back();
+    rechargeRate.pop_back();
+    if (circuit)
+        circuit->pop();
+    if (thermal)
+        thermal->pop();
+    if (aging)
+        aging->pop();
+
+    if (capacityMinStale)
+        refreshCapacityMin();
+    else
+        capacityMin.pop();
+    ++changes;
+    if (chargeMinStale)
+        refreshChargeMin();
+    else
+        chargeMin.pop();
+    if (!emptying.stale)
+        emptying.queue.pop();
+    if (!filling.stale)
+        filling.queue.pop();
+}
+
+void CellStore::clear()
+{
+    voltage.clear();
+    capacity.clear();
+    charge.clear();
+    dischargeRate.clear();
+    rechargeRate.clear();
+    customRates = 0;
+    if (circuit)
+        circuit->clear();
+    if (thermal)
+        thermal->clear();
+    if (aging)
+        aging->clear();
+    rebuildAggregates();
+}
+
+/**
+ * @brief recomputes every aggregate from the arrays, O(n)
+ */
+void CellStore::rebuildAggregates()
+{
+    voltageSum.reset(CellKernels::sum(voltage.data(), voltage.size()));
+    capacitySum.reset(CellKernels::sum(capacity.data(), capacity.size()));
+    chargeSum.reset(CellKernels::sum(charge.data(), charge.size()));
+    capacityMin.build(capacity.data(), capacity.size());
+    capacityMinStale = false;
+    chargeMin.build(charge.data(), charge.size());
+    chargeMinStale = false;
+    emptying.stale = filling.stale = true;
+    ++changes;
+}
+
+std::uint64_t CellStore::version() const
+{
+    return changes;
+}
+
+/**
+ * @brief rebuilds the charge tree if a bulk update made it stale
+ */
+void CellStore::refreshChargeMin()
+{
+    if (chargeMinStale)
+    {
+        chargeMin.build(charge.data(), charge.size());
+        chargeMinStale = false;
+    }
+}
+
+/**
+ * @brief rebuilds the capacity tree if the thermal feedback made it stale
+ */
+void CellStore::refreshCapacityMin()
+{
+    if (capacityMinStale)
+    {
+        capacityMin.build(capacity.data(), capacity.size());
+        capacityMinStale = false;
+    }
+}
+
+/**
+ * @brief takes over the totals of columns the thermal model rewrote
+ *
+ * Capacities, charges and rates may all have changed, so both min trees go
+ * stale and the forecasts are rebuilt on their next query.
+ */
+void CellStore::thermalChanged(const ThermalStats &stats)
+{
+    capacitySum.reset(stats.capacitySum);
+    chargeSum.reset(stats.chargeSum);
+    if (!charge.empty())
+    {
+        bulkCapacityMin = stats.capacityMin;
+        capacityMinStale = true;
+        bulkChargeMin = stats.chargeMin;
+        chargeMinStale = true;
+    }
+    customRates = stats.customRates;
+    emptying.stale = filling.stale = true;
+    ++changes;
+}
+
+/**
+ * @brief records a single cell's charge change in the aggregates
+ * @param slot the cell that changed
+ * @param before its charge before the change
+ */
+void CellStore::chargeChanged(std::size_t slot, double before)
+{
+    chargeSum.add(charge[slot] - before);
+    ++changes;
+    refreshChargeMin();
+    chargeMin.set(slot, charge[slot]);
+    forecastChanged(slot);
+}
+
+/**
+ * @brief advances the circuit of a single cell after a point update and records its new voltage
+ */
+void CellStore::circuitChanged(std::size_t slot, double before, double hours)
+{
+    double v = circuit->stepCell(slot, before, charge[slot], capacity[slot], hours);
+    voltageSum.add(v - voltage[slot]);
+    voltage[slot] = v;
+}
+
+void CellStore::RunningSum::add(double x)
+{
+    double t = sum + x;
+    if ((sum < 0 ? -sum : sum) >= (x < 0 ? -x : x))
+        compensation += (sum - t) + x;
+    else
+        compensation += (x - t) + sum;
+    sum = t;
+}
+
+void CellStore::RunningSum::reset(double value)
+{
+    sum = value;
+    compensation = 0;
+}
+
+double CellStore::RunningSum::value() const
+{
+    return sum + compensation;
+}
+
+/**
+ * @brief sets the sink that receives depletion and overcharge events
+ * @param sink the sink, nullptr or a disabled sink turns event detection off
+ */
+void CellStore::setEventSink(EventSink *sink)
+{
+    this->sink = (sink && sink->enabled()) ? sink : nullptr;
+}
+
+EventSink *CellStore::getEventSink() const
+{
+    return sink;
+}
+
+/**
+ * @brief applies one discharge step to a single charge value
+ * @param charge the charge to update
+ * @param rate the discharge current
+ * @param hours Number of hours of usage.
+ * @param overshoot receives the hours left after the charge hit 0
+ * @return true if the charge was clamped to 0
+ */
+bool CellStore::discharge(double &charge, double rate, double hours, double &overshoot)
+{
+    double usableTime = charge / rate;
+    charge = charge - hours * rate;
+    if (charge < 0)
+    {
+        charge = 0;
+        overshoot = hours - usableTime;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief applies one recharge step to a single charge value
+ * @param charge the charge to update
+ * @param capacity the capacity the charge is clamped to
+ * @param rate the recharge current
+ * @param hours Number of hours of recharge.
+ * @param overshoot receives the hours left after the charge hit capacity
+ * @return true if the charge was clamped to capacity
+ */
+bool CellStore::fill(double &charge, double capacity, double rate, double hours, double &overshoot)
+{
+    double chargeableTime = (capacity - charge) / rate;
+    charge = charge + hours * rate;
+    if (charge > capacity)
+    {
+        charge = capacity;
+        overshoot = hours - chargeableTime;
+        return true;
+    }
+    return false;
+}
+
+// Rates //
+
+/**
+ * @brief changes the rates of a single cell
+ * @param slot the slot of the cell
+ * @param d the new discharge rate
+ * @param r the new recharge rate
+ */
+void CellStore::setRates(std::size_t slot, double d, double r)
+{
+    if (thermal)
+    {
+        thermal->nominalDischarge[slot] = d;
+        thermal->nominalRecharge[slot] = r;
+        double f = thermal->rateFactor(thermal->temperature[slot]);
+        d *= f;
+        r *= f;
+    }
+    countRates(dischargeRate[slot], rechargeRate[slot], -1);
+    dischargeRate[slot] = d;
+    rechargeRate[slot] = r;
+    countRates(d, r, 1);
+    forecastChanged(slot);
+}
+
+void CellStore::setRateModel(const RateModel &m)
+{
+    model = m;
+    emptying.stale = filling.stale = true;
+}
+
+const RateModel &CellStore::getRateModel() const
+{
+    return model;
+}
+
+// Circuit //
+
+/**
+ * @brief attaches an equivalent-circuit model, replacing any previous one
+ * @param parameters the circuit shared by all cells; its OCV curve must be set
+ */
+void CellStore::setCircuit(const CircuitParameters &parameters)
+{
+    clearCircuit();
+    circuit.reset(new CellCircuit(parameters));
+    for (std::size_t i = 0; i < voltage.size(); ++i)
+    {
+        circuit->push(voltage[i]);
+        voltage[i] = circuit->restVoltage(charge[i], capacity[i]);
+    }
+    voltageSum.reset(CellKernels::sum(voltage.data(), voltage.size()));
+    ++changes;
+}
+
+/**
+ * @brief detaches the circuit model and restores the nominal voltages
+ */
+void CellStore::clearCircuit()
+{
+    if (!circuit)
+        return;
+    voltage = circuit->nominal;
+    circuit.reset();
+    voltageSum.reset(CellKernels::sum(voltage.data(), voltage.size()));
+    ++changes;
+}
+
+const CellCircuit *CellStore::getCircuit() const
+{
+    return circuit.get();
+}
+
+double CellStore::nominalVoltage(std::size_t slot) const
+{
+    return circuit ? circuit->nominal[slot] : voltage[slot];
+}
+
+const double *CellStore::nominalVoltages() const
+{
+    return circuit ? circuit->nominal.data() : voltage.data();
+}
+
+/**
+ * @brief sets the factor on a cell's circuit resistances
+ * @param slot the slot of the cell
+ * @param scale the factor, 1 for the circuit as given
+ * @return false if no circuit is attached
+ */
+bool CellStore::setImpedance(std::size_t slot, double scale)
+{
+    if (!circuit)
+        return false;
+    circuit->impedance[slot] = scale;
+    return true;
+}
+
+// Thermal //
+
+/**
+ * @brief attaches a thermal model, replacing any previous one
+ * @param parameters the model shared by all cells
+ */
+void CellStore::setThermal(const ThermalParameters &parameters)
+{
+    clearThermal();
+    thermal.reset(new CellThermal(parameters));
+    for (std::size_t i = 0; i < charge.size(); ++i)
+        thermal->push(capacity[i], dischargeRate[i], rechargeRate[i]);
+    thermalChanged(thermal->derate(charge.data(), capacity.data(), dischargeRate.data(), rechargeRate.data(),
+                                   charge.size()));
+}
+
+/**
+ * @brief detaches the thermal model and restores the nominal capacities and rates
+ */
+void CellStore::clearThermal()
+{
+    if (!thermal)
+        return;
+    for (std::size_t i = 0; i < charge.size(); ++i)
+    {
+        charge[i] = nominalCharge(i);
+        capacity[i] = thermal->nominalCapacity[i];
+    }
+    dischargeRate = thermal->nominalDischarge;
+    rechargeRate = thermal->nominalRecharge;
+    thermal.reset();
+    customRates = 0;
+    for (std::size_t i = 0; i < charge.size(); ++i)
+        countRates(dischargeRate[i], rechargeRate[i], 1);
+    rebuildAggregates();
+}
+
+const CellThermal *CellStore::getThermal() const
+{
+    return thermal.get();
+}
+
+void CellStore::setThermalColumns(std::size_t n)
+{
+    if (thermal)
+        thermal->setColumns(n);
+}
+
+double CellStore::nominalCapacity(std::size_t slot) const
+{
+    return thermal ? thermal->nominalCapacity[slot] : capacity[slot];
+}
+
+double CellStore::nominalCharge(std::size_t slot) const
+{
+    double c = nominalCapacity(slot);
+    if (c == capacity[slot])
+        return charge[slot];
+    return capacity[slot] > 0 ? std::min(charge[slot] / capacity[slot] * c, c) : 0;
+}
+
+double CellStore::nominalDischargeRate(std::size_t slot) const
+{
+    return thermal ? thermal->nominalDischarge[slot] : dischargeRate[slot];
+}
+
+double CellStore::nominalRechargeRate(std::size_t slot) const
+{
+    return thermal ? thermal->nominalRecharge[slot] : rechargeRate[slot];
+}
+
+const double *CellStore::nominalCapacities() const
+{
+    return thermal ? thermal->nominalCapacity.data() : capacity.data();
+}
+
+const double *CellStore::nominalDischargeRates() const
+{
+    return thermal ? thermal->nominalDischarge.data() : dischargeRate.data();
+}
+
+const double *CellStore::nominalRechargeRates() const
+{
+    return thermal ? thermal->nominalRecharge.data() : rechargeRate.data();
+}
+
+// Aging //
+
+/**
+ * @brief attaches an aging model, replacing any previous one
+ * @param parameters the model shared by all cells
+ */
+void CellStore::setAging(const AgingParameters &parameters)
+{
+    aging.reset(new CellAging(parameters));
+    for (std::size_t i = 0; i < charge.size(); ++i)
+        aging->push(capacity[i] > 0 ? charge[i] / capacity[i] : 0);
+}
+
+void CellStore::clearAging()
+{
+    aging.reset();
+}
+
+const CellAging *CellStore::getAging() const
+{
+    return aging.get();
+}
+
+/**
+ * @brief applies the aging of the last interval to every capacity and rebuilds the aggregates
+ *
+ * With a thermal model the nominal capacities fade along with the derated ones.
+ */
+void CellStore::applyAging()
+{
+    aging->age(charge.data(), capacity.data(), thermal ? thermal->nominalCapacity.data() : nullptr,
+               thermal ? thermal->temperature.data() : nullptr, charge.size());
+    rebuildAggregates();
+}
+
+/**
+ * @brief lets the circuit split the store's current among its parallel branches
+ * @param plan the topology the cells are wired in, read on every update; nullptr turns sharing off
+ * @param parallel the connection type used while the plan is empty
+ */
+void CellStore::setCurrentSharing(const PackPlan *plan, bool parallel)
+{
+    sharing.reset(plan ? new CurrentSharing(*plan, parallel) : nullptr);
+}
+
+bool CellStore::sharesCurrent() const
+{
+    return sharing && circuit;
+}
+
+bool CellStore::uniformRates() const
+{
+    return model.kind() == RateModel::CONSTANT_CURRENT && customRates == 0;
+}
+
+void CellStore::countRates(double d, double r, int sign)
+{
+    if (d != Battery::DISCHARGE_RATE || r != Battery::RECHARGE_RATE)
+        customRates += sign;
+}
+
+/**
+ * @brief records one event for every cell that a discharge of delta will saturate
+ * @param hours Number of hours of usage.
+ * @param delta the charge removed from every cell
+ */
+void CellStore::reportDepleted(double hours, double delta) const
+{
+    CellEvent batch[EVENT_BATCH];
+    std::size_t count = 0;
+    const double *q = charge.data();
+    for (std::size_t i = 0; i < charge.size(); ++i)
+    {
+        if (q[i] - delta < 0)
+        {
+            batch[count++] = CellEvent{elapsed, hours - q[i] / Battery::DISCHARGE_RATE,
+                                       static_cast<std::uint32_t>(i), CellEvent::DEPLETED};
+            if (count == EVENT_BATCH)
+            {
+                sink->record(batch, count);
+                count = 0;
+            }
+        }
+    }
+    if (count)
+        sink->record(batch, count);
+}
+
+/**
+ * @brief records one event for every cell that a recharge of delta will saturate
+ * @param hours Number of hours of recharge.
+ * @param delta the charge added to every cell
+ */
+void CellStore::reportOvercharged(double hours, double delta) const
+{
+    CellEvent batch[EVENT_BATCH];
+    std::size_t count = 0;
+    const double *q = charge.data();
+    const double *c = capacity.data();
+    for (std::size_t i = 0; i < charge.size(); ++i)
+    {
+        if (q[i] + delta > c[i])
+        {
+            batch[count++] = CellEvent{elapsed, hours - (c[i] - q[i]) / Battery::RECHARGE_RATE,
+                                       static_cast<std::uint32_t>(i), CellEvent::OVERCHARGED};
+            if (count == EVENT_BATCH)
+            {
+                sink->record(batch, count);
+                count = 0;
+            }
+        }
+    }
+    if (count)
+        sink->record(batch, count);
+}
+
+/**
+ * @brief records one event for every cell that hours of use will empty under the rate model
+ * @param hours Number of hours of usage.
+ *
+ * Only runs for updates in which a cell may saturate, so the model is asked
+ * about each cell separately.
+ */
+void CellStore::reportModelDepleted(double hours) const
+{
+    CellEvent batch[EVENT_BATCH];
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < charge.size(); ++i)
+    {
+        // Decide on the stepped charge itself so events match the update exactly
+        double x = charge[i];
+        model.discharge(&x, &capacity[i], &dischargeRate[i], 1, hours);
+        if (x == 0 && hours > 0)
+        {
+            double t = charge[i] > 0 ? model.hoursToEmpty(&charge[i], &capacity[i], &dischargeRate[i], 1) : 0;
+            double overshoot = hours > t ? hours - t : 0;
+            batch[count++] = CellEvent{elapsed, overshoot, static_cast<std::uint32_t>(i), CellEvent::DEPLETED};
+            if (count == EVENT_BATCH)
+            {
+                sink->record(batch, count);
+                count = 0;
+            }
+        }
+    }
+    if (count)
+        sink->record(batch, count);
+}
+
+/**
+ * @brief records one event for every cell that hours of recharge will fill up under the rate model
+ * @param hours Number of hours of recharge.
+ */
+void CellStore::reportModelOvercharged(double hours) const
+{
+    CellEvent batch[EVENT_BATCH];
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < charge.size(); ++i)
+    {
+        double x = charge[i];
+        model.recharge(&x, &capacity[i], &rechargeRate[i], 1, hours);
+        if (x == capacity[i] && hours > 0)
+        {
+            double t = charge[i] < capacity[i] ? model.hoursToFull(&charge[i], &capacity[i], &rechargeRate[i], 1) : 0;
+            double overshoot = hours > t ? hours - t : 0;
+            batch[count++] = CellEvent{elapsed, overshoot, static_cast<std::uint32_t>(i), CellEvent::OVERCHARGED};
+            if (count == EVENT_BATCH)
+            {
+                sink->record(batch, count);
+                count = 0;
+            }
+        }
+    }
+    if (count)
+        sink->record(batch, count);
+}
+
+/**
+ * @brief Decreases the charge of every cell based on its discharge rate and the rate model.
+ * @param hours Number of hours of usage.
+ *
+ * While every cell runs at the default constant current the update is a
+ * vectorized kernel with one delta for all cells; otherwise it is the model's
+ * batch function with the per-cell rates. Without an event sink nothing else
+ * happens; with one, a second pass finds the saturating cells, but only when
+ * the pack minimum (or the model's saturation horizon) shows that there are any.
+ * With current sharing the result is only the demand: CurrentSharing splits
+ * it among the branches and reports the events.
+ */
+void CellStore::use(double hours)
+{
+    double *q = charge.data();
+    const std::size_t n = charge.size();
+    CellKernels::ChargeStats stats;
+    // With sharing the model only sets the demand; the shared update reports its own events
+    const bool shared = sharesCurrent() && hours > 0;
+    EventSink *const events = shared ? nullptr : sink;
+    if (circuit)
+        circuit->begin(q, n);
+    if (thermal)
+        thermal->begin(q, n);
+    if (uniformRates())
+    {
+        const double delta = hours * Battery::DISCHARGE_RATE;
+        if (events && n != 0 && CellKernels::min(q, n) < delta)
+            reportDepleted(hours, delta);
+        stats = CellKernels::discharge(q, n, delta);
+    }
+    else
+    {
+        if (events && n != 0 &&
+            (CellKernels::min(q, n) <= 0 || model.hoursToEmpty(q, capacity.data(), dischargeRate.data(), n) <= hours * (1 + 1e-9)))
+            reportModelDepleted(hours);
+        stats = model.discharge(q, capacity.data(), dischargeRate.data(), n, hours);
+    }
+    if (shared)
+        stats = sharing->apply(*circuit, q, capacity.data(), n, hours, sink, elapsed);
+    chargeSum.reset(stats.sum);
+    if (n != 0)
+    {
+        bulkChargeMin = stats.min;
+        chargeMinStale = true;
+    }
+    if (circuit)
+        voltageSum.reset(circuit->step(q, capacity.data(), voltage.data(), n, hours));
+    forecastAdvanced(false, hours);
+    if (thermal)
+        thermalChanged(thermal->step(q, capacity.data(), dischargeRate.data(), rechargeRate.data(), n, hours,
+                                     circuit.get()));
+    if (aging && aging->record(q, capacity.data(), n, hours))
+        applyAging();
+    elapsed += hours;
+    ++changes;
+}
+
+/**
+ * @brief Increases the charge of every cell based on its recharge rate and the rate model.
+ * @param hours Number of hours of recharge.
+ */
+void CellStore::recharge(double hours)
+{
+    double *q = charge.data();
+    const double *c = capacity.data();
+    const std::size_t n = charge.size();
+    CellKernels::ChargeStats stats;
+    const bool shared = sharesCurrent() && hours > 0;
+    EventSink *const events = shared ? nullptr : sink;
+    if (circuit)
+        circuit->begin(q, n);
+    if (thermal)
+        thermal->begin(q, n);
+    if (uniformRates())
+    {
+        const double delta = hours * Battery::RECHARGE_RATE;
+        // cap - q and q + delta round differently, so the pre-check keeps a small margin
+        if (events && n != 0 && CellKernels::minHeadroom(q, c, n) <= delta * (1 + 1e-9))
+            reportOvercharged(hours, delta);
+        stats = CellKernels::recharge(q, c, n, delta);
+    }
+    else
+    {
+        if (events && n != 0 &&
+            (CellKernels::minHeadroom(q, c, n) <= 0 || model.hoursToFull(q, c, rechargeRate.data(), n) <= hours * (1 + 1e-9)))
+            reportModelOvercharged(hours);
+        stats = model.recharge(q, c, rechargeRate.data(), n, hours);
+    }
+    if (shared)
+        stats = sharing->apply(*circuit, q, c, n, hours, sink, elapsed);
+    chargeSum.reset(stats.sum);
+    if (n != 0)
+    {
+        bulkChargeMin = stats.min;
+        chargeMinStale = true;
+    }
+    if (circuit)
+        voltageSum.reset(circuit->step(q, capacity.data(), voltage.data(), n, hours));
+    forecastAdvanced(true, hours);
+    if (thermal)
+        thermalChanged(thermal->step(q, capacity.data(), dischargeRate.data(), rechargeRate.data(), n, hours,
+                                     circuit.get()));
+    if (aging && aging->record(q, capacity.data(), n, hours))
+        applyAging();
+    elapsed += hours;
+    ++changes;
+}
+
+void CellStore::useCell(std::size_t slot, double hours)
+{
+    double before = charge[slot];
+    double overshoot = 0;
+    bool depleted;
+    if (uniformRates())
+    {
+        depleted = discharge(charge[slot], Battery::DISCHARGE_RATE, hours, overshoot);
+    }
+    else
+    {
+        double t = before > 0 ? model.hoursToEmpty(&charge[slot], &capacity[slot], &dischargeRate[slot], 1) : 0;
+        model.discharge(&charge[slot], &capacity[slot], &dischargeRate[slot], 1, hours);
+        depleted = charge[slot] == 0 && hours > 0;
+        overshoot = hours > t ? hours - t : 0;
+    }
+    chargeChanged(slot, before);
+    if (circuit)
+        circuitChanged(slot, before, hours);
+    if (aging)
+        aging->sample(slot, capacity[slot] > 0 ? charge[slot] / capacity[slot] : 0);
+    if (depleted && sink)
+    {
+        CellEvent event{elapsed, overshoot, static_cast<std::uint32_t>(slot), CellEvent::DEPLETED};
+        sink->record(&event, 1);
+    }
+}
+
+void CellStore::rechargeCell(std::size_t slot, double hours)
+{
+    double before = charge[slot];
+    double overshoot = 0;
+    bool full;
+    if (uniformRates())
+    {
+        full = fill(charge[slot], capacity[slot], Battery::RECHARGE_RATE, hours, overshoot);
+    }
+    else
+    {
+        double t = before < capacity[slot] ? model.hoursToFull(&charge[slot], &capacity[slot], &rechargeRate[slot], 1) : 0;
+        model.recharge(&charge[slot], &capacity[slot], &rechargeRate[slot], 1, hours);
+        full = charge[slot] == capacity[slot] && hours > 0;
+        overshoot = hours > t ? hours - t : 0;
+    }
+    chargeChanged(slot, before);
+    if (circuit)
+        circuitChanged(slot, before, hours);
+    if (aging)
+        aging->sample(slot, capacity[slot] > 0 ? charge[slot] / capacity[slot] : 0);
+    if (full && sink)
+    {
+        CellEvent event{elapsed, overshoot, static_cast<std::uint32_t>(slot), CellEvent::OVERCHARGED};
+        sink->record(&event, 1);
+    }
+}
+
+// Reductions //
+
+double CellStore::sumVoltage() const
+{
+    return voltageSum.value();
+}
+
+double CellStore::sumCapacity() const
+{
+    return capacitySum.value();
+}
+
+double CellStore::minCapacity() const
+{
+    if (charge.empty())
+        return 0;
+    return capacityMinStale ? bulkCapacityMin : capacityMin.min();
+}
+
+double CellStore::sumCharge() const
+{
+    return chargeSum.value();
+}
+
+double CellStore::minCharge() const
+{
+    if (charge.empty())
+        return 0;
+    return chargeMinStale ? bulkChargeMin : chargeMin.min();
+}
+
+// Saturation horizon //
+
+/**
+ * @brief returns the hours of use until the next cell that still has charge runs empty
+ * @return infinity if every cell is already empty or the store is empty
+ */
+double CellStore::hoursUntilDepleted() const
+{
+    double nearest = std::numeric_limits<double>::infinity();
+    if (charge.empty())
+        return nearest;
+    if (!uniformRates())
+        return model.hoursToEmpty(charge.data(), capacity.data(), dischargeRate.data(), charge.size());
+    double m = minCharge();
+    if (m > 0)
+        return m / Battery::DISCHARGE_RATE;
+    // Empty cells stay empty, so look for the smallest charge above zero
+    for (double q : charge)
+    {
+        if (q > 0 && q < nearest)
+            nearest = q;
+    }
+    return nearest / Battery::DISCHARGE_RATE;
+}
+
+/**
+ * @brief returns the hours of recharge until the next cell that is not yet full fills up
+ * @return infinity if every cell is already full or the store is empty
+ */
+double CellStore::hoursUntilFull() const
+{
+    double nearest = std::numeric_limits<double>::infinity();
+    if (charge.empty())
+        return nearest;
+    if (!uniformRates())
+        return model.hoursToFull(charge.data(), capacity.data(), rechargeRate.data(), charge.size());
+    double m = CellKernels::minHeadroom(charge.data(), capacity.data(), charge.size());
+    if (m > 0)
+        return m / Battery::RECHARGE_RATE;
+    for (std::size_t i = 0; i < charge.size(); ++i)
+    {
+        double headroom = capacity[i] - charge[i];
+        if (headroom > 0 && headroom < nearest)
+            nearest = headroom;
+    }
+    return nearest / Battery::RECHARGE_RATE;
+}
+
+// Forecasts //
+
+/**
+ * @brief returns the hours of use until a cell runs empty, 0 if it is empty, O(1)
+ */
+double CellStore::hoursToEmpty(std::size_t slot) const
+{
+    return charge[slot] > 0 ? model.hoursToEmpty(&charge[slot], &capacity[slot], &dischargeRate[slot], 1) : 0;
+}
+
+/**
+ * @brief returns the hours of recharge until a cell is full, 0 if it is full, O(1)
+ */
+double CellStore::hoursToFull(std::size_t slot) const
+{
+    return charge[slot] < capacity[slot] ? model.hoursToFull(&charge[slot], &capacity[slot], &rechargeRate[slot], 1)
+                                         : 0;
+}
+
+/**
+ * @brief returns the clock value at which a cell saturates, -infinity if it already has
+ *
+ * Always later than the forecast's clock for a cell that has not saturated,
+ * so refreshForecast() visits every cell at most once.
+ */
+double CellStore::saturationTime(const Forecast &f, bool recharging, std::size_t slot) const
+{
+    if (recharging ? charge[slot] >= capacity[slot] : charge[slot] <= 0)
+        return -std::numeric_limits<double>::infinity();
+    double time = f.clock + (recharging ? hoursToFull(slot) : hoursToEmpty(slot));
+    return time > f.clock ? time : std::nextafter(f.clock, std::numeric_limits<double>::infinity());
+}
+
+/**
+ * @brief rebuilds a forecast if stale and looks again at the cells whose time has come
+ *
+ * Every rate model is time-invariant, so hours of updates in one direction
+ * take exactly that many hours off every pending cell's remaining time: the
+ * saturation times stay put and only the clock moves. Cells whose time the
+ * clock has reached are saturated (or within rounding of it) and are settled
+ * here, once each.
+ */
+const CellStore::Forecast &CellStore::refreshForecast(bool recharging) const
+{
+    Forecast &f = recharging ? filling : emptying;
+    if (f.stale)
+    {
+        f.clock = 0;
+        const std::size_t n = charge.size();
+        double *times = f.queue.reset(n);
+        if (recharging)
+            model.timesToFull(charge.data(), capacity.data(), rechargeRate.data(), n, times);
+        else
+            model.timesToEmpty(charge.data(), capacity.data(), dischargeRate.data(), n, times);
+        // A pending cell must lie ahead of the clock, even when its time underflows
+        const double soonest = std::nextafter(0.0, std::numeric_limits<double>::infinity());
+        for (std::size_t i = 0; i < n; ++i)
+            times[i] = times[i] == 0 ? soonest : times[i];
+        f.queue.rebuild();
+        f.stale = false;
+    }
+    for (std::size_t i = f.queue.next(); i < f.queue.size() && f.queue.get(i) <= f.clock; i = f.queue.next())
+        f.queue.set(i, saturationTime(f, recharging, i));
+    return f;
+}
+
+/**
+ * @brief records hours of whole-store updates in one direction in the forecasts
+ *
+ * The other direction's times change by a different amount for every cell, and
+ * a shared update splits the current unevenly, so those forecasts are rebuilt
+ * on their next query.
+ */
+void CellStore::forecastAdvanced(bool recharging, double hours)
+{
+    if (hours <= 0 || charge.empty())
+        return;
+    Forecast &same = recharging ? filling : emptying;
+    (recharging ? emptying : filling).stale = true;
+    if (sharesCurrent())
+        same.stale = true;
+    else
+        same.clock += hours;
+}
+
+/**
+ * @brief records a change of a single cell in the forecasts
+ */
+void CellStore::forecastChanged(std::size_t slot)
+{
+    if (!emptying.stale)
+        emptying.queue.set(slot, saturationTime(emptying, false, slot));
+    if (!filling.stale)
+        filling.queue.set(slot, saturationTime(filling, true, slot));
+}
+
+/**
+ * @brief returns the hours until the first cell of slots [begin, end) saturates
+ * @param recharging true for recharge (cells filling up), false for use (cells running empty)
+ * @return 0 if one already has, infinity if none ever will or the range is empty
+ */
+double CellStore::hoursUntilFirst(bool recharging, std::size_t begin, std::size_t end) const
+{
+    const Forecast &f = refreshForecast(recharging);
+    SaturationQueue::Span span = f.queue.span(begin, end);
+    return span.saturated ? 0 : span.first - f.clock;
+}
+
+/**
+ * @brief returns the hours until every cell of slots [begin, end) has saturated
+ * @param recharging true for recharge (cells filling up), false for use (cells running empty)
+ * @return 0 if all have or the range is empty, infinity if one never will
+ */
+double CellStore::hoursUntilLast(bool recharging, std::size_t begin, std::size_t end) const
+{
+    const Forecast &f = refreshForecast(recharging);
+    SaturationQueue::Span span = f.queue.span(begin, end);
+    return span.last == -std::numeric_limits<double>::infinity() ? 0 : span.last - f.clock;
+}
+
+/**
+ * @brief returns the next cells to saturate, in the order they will, with the hours until each does
+ * @param recharging true for recharge (cells filling up), false for use (cells running empty)
+ * @param limit the most cells to return
+ */
+std::vector<CellSaturation> CellStore::saturationOrder(bool recharging, std::size_t limit) const
+{
+    const Forecast &f = refreshForecast(recharging);
+    std::vector<std::size_t> slots;
+    f.queue.earliest(limit, slots);
+    std::vector<CellSaturation> order;
+    order.reserve(slots.size());
+    for (std::size_t slot : slots)
+        order.push_back(CellSaturation{slot, f.queue.get(slot) - f.clock});
+    return order;
+}
@@ -0,0 +1,440 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include "CellThermal.h"
+#include "Battery.h"
+#include "CellCircuit.h"
+#include "CellKernels.h"
+#include "CellKernelsClone.h"
+#include "ThreadPool.h"
+
+static const double INF = std::numeric_limits<double>::infinity();
+
+// Inner cells of a tile; with its halo and buffers it stays within L2
+static const std::size_t TILE_CELLS = 16384;
+// Widest tile, wider rows are split across several
+static const std::size_t TILE_COLUMNS = 1024;
+// Most substeps a tile takes in cache before writing back; longer updates take several passes
+static const std::size_t HALO = 8;
+// Smaller grids are updated on the calling thread
+static const std::size_t PARALLEL_CELLS = 65536;
+// Capacities and rates never drop below this fraction of their nominal value
+static const double MIN_FACTOR = 0.1;
+// Cells per block of the feedback loop
+static const std::size_t LANES = 8;
+
+namespace
+{
+    /**
+     * @brief one explicit substep of a grid row
+     * @param up the row above, mid itself where there is none
+     * @param mid the row
+     * @param down the row below, mid itself where there is none
+     * @param source heat gained per substep, coolant included
+     * @param out receives the new temperatures
+     * @param count cells in the row
+     * @param keep weight of the cell's own temperature
+     * @param share weight of each neighbour
+     *
+     * A missing neighbour reads as the cell itself, which is no heat flow, so
+     * the ends of the row and missing rows need no branches in the loop.
+     */
+    template <bool Wide>
+    CELLKERNELS_INLINE void relax(const double *up, const double *mid, const double *down, const double *source,
+                                  double *out, std::size_t count, double keep, double share)
+    {
+        if (count == 1)
+        {
+            out[0] = keep * mid[0] + share * (mid[0] + mid[0] + up[0] + down[0]) + source[0];
+            return;
+        }
+        out[0] = keep * mid[0] + share * (mid[0] + mid[1] + up[0] + down[0]) + source[0];
+        for (std::size_t c = 1; c + 1 < count; ++c)
+            out[c] = keep * mid[c] + share * (mid[c - 1] + mid[c + 1] + up[c] + down[c]) + source[c];
+        std::size_t l = count - 1;
+        out[l] = keep * mid[l] + share * (mid[l - 1] + mid[l] + up[l] + down[l]) + source[l];
+    }
+
+    CELLKERNELS_AVX2_CLONE(void, relax,
+                           (const double *up, const double *mid, const double *down, const double *source,
+                            double *out, std::size_t count, double keep, double share),
+                           (up, mid, down, source, out, count, keep, share))
+
+    /**
+     * @brief everything the feedback needs, copied out of the model once per update
+     */
+    struct DerateConstants
+    {
+        const double *nominalCapacity;
+        const double *nominalDischarge;
+        const double *nominalRecharge;
+        double reference;
+        double capacityCoefficient;
+        double rateCoefficient;
+    };
+
+    /**
+     * @brief derates one cell at temperature t: returns its new charge and sets c, d and r
+     *
+     * The charge is rescaled without a branch (the quotient of an empty cell is
+     * computed and then not used), so blocks of cells vectorize. A charge whose
+     * capacity did not change is kept bit for bit.
+     */
+    CELLKERNELS_INLINE double derateCell(const DerateConstants &k, std::size_t i, double t, double before, double x,
+                                         double &c, double &d, double &r)
+    {
+        const double dt = t - k.reference;
+        const double f = std::max(MIN_FACTOR, 1 + k.capacityCoefficient * dt);
+        const double g = std::max(MIN_FACTOR, 1 + k.rateCoefficient * dt);
+        c = k.nominalCapacity[i] * f;
+        d = k.nominalDischarge[i] * g;
+        r = k.nominalRecharge[i] * g;
+        const double scaled = std::min(x / before * c, c);
+        return c == before ? x : (before > 0 ? scaled : 0);
+    }
+
+    /**
+     * @brief the feedback loop over cells [begin, end), t[0] being the temperature of cell begin, built like
+     *        CellCircuit's loops
+     */
+    template <bool Wide>
+    CELLKERNELS_INLINE void derateCells(const DerateConstants &constants, const double *t, double *charge,
+                                        double *capacity, double *discharge, double *recharge, std::size_t begin,
+                                        std::size_t end)
+    {
+        const DerateConstants k = constants;
+        std::size_t i = begin;
+        for (; i + LANES <= end; i += LANES)
+        {
+            double q[LANES], c[LANES], d[LANES], r[LANES];
+            for (std::size_t j = 0; j < LANES; ++j)
+                q[j] = derateCell(k, i + j, t[i - begin + j], capacity[i + j], charge[i + j], c[j], d[j], r[j]);
+            for (std::size_t j = 0; j < LANES; ++j)
+            {
+                charge[i + j] = q[j];
+                capacity[i + j] = c[j];
+                discharge[i + j] = d[j];
+                recharge[i + j] = r[j];
+            }
+        }
+        for (; i < end; ++i)
+            charge[i] = derateCell(k, i, t[i - begin], capacity[i], charge[i], capacity[i], discharge[i], recharge[i]);
+    }
+
+    CELLKERNELS_AVX2_CLONE(void, derateCells,
+                           (const DerateConstants &k, const double *t, double *charge, double *capacity,
+                            double *discharge, double *recharge, std::size_t begin, std::size_t end),
+                           (k, t, charge, capacity, discharge, recharge, begin, end))
+}
+
+/**
+ * @brief adds the totals of one part of the grid to another, in a fixed order
+ */
+static void combine(ThermalStats &total, const ThermalStats &part)
+{
+    total.capacitySum += part.capacitySum;
+    total.capacityMin = std::min(total.capacityMin, part.capacityMin);
+    total.chargeSum += part.chargeSum;
+    total.chargeMin = std::min(total.chargeMin, part.chargeMin);
+    total.customRates += part.customRates;
+}
+
+CellThermal::CellThermal(const ThermalParameters &parameters) : parameters(parameters) {}
+
+CellThermal::~CellThermal() = default;
+
+const ThermalParameters &CellThermal::getParameters() const
+{
+    return parameters;
+}
+
+/**
+ * @brief sets the grid width, 0 for a single row of all cells
+ */
+void CellThermal::setColumns(std::size_t n)
+{
+    width = n;
+}
+
+/**
+ * @brief returns the grid width in effect for n cells
+ *
+ * The parameters' width wins over the pack's layout.
+ */
+std::size_t CellThermal::columns(std::size_t n) const
+{
+    std::size_t w = parameters.columns ? parameters.columns : width;
+    return w == 0 || w > n ? std::max<std::size_t>(n, 1) : w;
+}
+
+double CellThermal::capacityFactor(double t) const
+{
+    return std::max(MIN_FACTOR, 1 + parameters.capacityCoefficient * (t - parameters.referenceTemperature));
+}
+
+double CellThermal::rateFactor(double t) const
+{
+    return std::max(MIN_FACTOR, 1 + parameters.rateCoefficient * (t - parameters.referenceTemperature));
+}
+
+void CellThermal::push(double c, double d, double r)
+{
+    temperature.push_back(parameters.coolantTemperature);
+    nominalCapacity.push_back(c);
+    nominalDischarge.push_back(d);
+    nominalRecharge.push_back(r);
+}
+
+void CellThermal::erase(std::size_t slot)
+{
+    temperature.erase(temperature.begin() + slot);
+    nominalCapacity.erase(nominalCapacity.begin() + slot);
+    nominalDischarge.erase(nominalDischarge.begin() + slot);
+    nominalRecharge.erase(nominalRecharge.begin() + slot);
+}
+
+void CellThermal::swap(std::size_t a, std::size_t b)
+{
+    std::swap(temperature[a], temperature[b]);
+    std::swap(nominalCapacity[a], nominalCapacity[b]);
+    std::swap(nominalDischarge[a], nominalDischarge[b]);
+    std::swap(nominalRecharge[a], nominalRecharge[b]);
+}
+
+void CellThermal::pop()
+{
+    temperature.pop_back();
+    nominalCapacity.pop_back();
+    nominalDischarge.pop_back();
+    nominalRecharge.pop_back();
+}
+
+void CellThermal::clear()
+{
+    temperature.clear();
+    nominalCapacity.clear();
+    nominalDischarge.clear();
+    nominalRecharge.clear();
+}
+
+/**
+ * @brief remembers the charges before a whole-store update
+ */
+void CellThermal::begin(const double *charge, std::size_t n)
+{
+    previous.assign(charge, charge + n);
+}
+
+/**
+ * @brief applies temperatures to the columns of cells [begin, end) and adds them to the totals
+ * @param t the temperatures, t[0] for cell begin
+ *
+ * The totals come from CellKernels, over the range just written while it is
+ * still in cache.
+ */
+void CellThermal::derateRange(std::size_t begin, std::size_t end, const double *t, double *charge, double *capacity,
+                              double *discharge, double *recharge, ThermalStats &stats) const
+{
+    if (begin == end)
+        return;
+    DerateConstants k{nominalCapacity.data(), nominalDischarge.data(), nominalRecharge.data(),
+                      parameters.referenceTemperature, parameters.capacityCoefficient, parameters.rateCoefficient};
+    if (CellKernels::useAvx2())
+        derateCellsAvx2(k, t, charge, capacity, discharge, recharge, begin, end);
+    else
+        derateCellsBaseline(k, t, charge, capacity, discharge, recharge, begin, end);
+
+    const std::size_t n = end - begin;
+    stats.capacitySum += CellKernels::sum(capacity + begin, n);
+    stats.capacityMin = std::min(stats.capacityMin, CellKernels::min(capacity + begin, n));
+    stats.chargeSum += CellKernels::sum(charge + begin, n);
+    stats.chargeMin = std::min(stats.chargeMin, CellKernels::min(charge + begin, n));
+    std::size_t custom = 0;
+    for (std::size_t i = begin; i < end; ++i)
+        custom += (discharge[i] != Battery::DISCHARGE_RATE) | (recharge[i] != Battery::RECHARGE_RATE);
+    stats.customRates += custom;
+}
+
+/**
+ * @brief writes the capacities, charges and rates the current temperatures give, without a step
+ * @return the totals of the rewritten columns
+ */
+ThermalStats CellThermal::derate(double *charge, double *capacity, double *discharge, double *recharge, std::size_t n)
+{
+    ThermalStats stats{0, INF, 0, INF, 0};
+    derateRange(0, n, temperature.data(), charge, capacity, discharge, recharge, stats);
+    return stats;
+}
+
+namespace
+{
+    /**
+     * @brief scratch of one tile, kept per thread so tiles do not allocate
+     */
+    struct TileBuffers
+    {
+        std::vector<double> a, b, source, edge;
+        std::vector<std::size_t> count;
+    };
+}
+
+/**
+ * @brief advances every temperature over an update that began with begin() and applies the feedback
+ *
+ * The substeps are as long as the stability of the explicit update allows:
+ * then no cell gives away more heat than it has, keep >= 0 below.
+ */
+ThermalStats CellThermal::step(double *charge, double *capacity, double *discharge, double *recharge, std::size_t n,
+                               double hours, const CellCircuit *circuit)
+{
+    if (n == 0 || !(hours > 0))
+        return derate(charge, capacity, discharge, recharge, n);
+
+    const double seconds = hours * 3600;
+    const double heatCapacity = parameters.heatCapacity;
+    const double conductance = 4 * parameters.neighbourConductance + parameters.coolantConductance;
+    double stable = conductance > 0 ? std::ceil(seconds * conductance / heatCapacity) : 1;
+    std::size_t substeps = static_cast<std::size_t>(std::max(1.0, stable));
+    const double dt = seconds / static_cast<double>(substeps);
+    const double share = dt * parameters.neighbourConductance / heatCapacity;
+    const double cool = dt * parameters.coolantConductance / heatCapacity;
+    const double keep = 1 - 4 * share - cool;
+
+    // Heat per substep is gain * I^2 * R, the current being the charge moved over the update
+    double ohms = parameters.resistance;
+    if (circuit)
+    {
+        const CircuitParameters &p = circuit->getParameters();
+        ohms = p.seriesResistance;
+        for (const RcPair &pair : p.pairs)
+            ohms += pair.resistance;
+    }
+    const double gain = dt / heatCapacity;
+    const double ampsPerHour = parameters.ampsPerRate / hours;
+    const double coolant = cool * parameters.coolantTemperature;
+    const double *moved = previous.data();
+    const double *impedance = circuit ? circuit->impedance.data() : nullptr;
+
+    // Tiles of the grid, each taking up to HALO substeps per pass in its own buffer
+    const std::size_t w = columns(n);
+    const std::size_t rows = (n + w - 1) / w;
+    const std::size_t lastRow = n - (rows - 1) * w;
+    const std::size_t tileColumns = std::min(w, TILE_COLUMNS);
+    const std::size_t tileRows = std::max<std::size_t>(1, TILE_CELLS / tileColumns);
+    const std::size_t across = (w + tileColumns - 1) / tileColumns;
+    const std::size_t tiles = across * ((rows + tileRows - 1) / tileRows);
+    auto rowLength = [&](std::size_t r) { return r + 1 == rows ? lastRow : w; };
+    void (*relaxRow)(const double *, const double *, const double *, const double *, double *, std::size_t, double,
+                     double) = CellKernels::useAvx2() ? relaxAvx2 : relaxBaseline;
+
+    std::vector<ThermalStats> tileStats(tiles, ThermalStats{0, INF, 0, INF, 0});
+    next.resize(n);
+    for (std::size_t left = substeps; left > 0;)
+    {
+        const std::size_t halo = std::min(HALO, left);
+        left -= halo;
+        const bool last = left == 0;
+        forEach(tiles, n, [&](std::size_t tile) {
+            const std::size_t row = tile / across * tileRows, rowEnd = std::min(rows, row + tileRows);
+            const std::size_t col = tile % across * tileColumns, colEnd = std::min(w, col + tileColumns);
+            const std::size_t r0 = row > halo ? row - halo : 0, r1 = std::min(rows, rowEnd + halo);
+            const std::size_t c0 = col > halo ? col - halo : 0, c1 = std::min(w, colEnd + halo);
+            const std::size_t span = c1 - c0, height = r1 - r0;
+
+            static thread_local TileBuffers buffers;
+            std::vector<double> &a = buffers.a, &b = buffers.b, &s = buffers.source, &edge = buffers.edge;
+            std::vector<std::size_t> &count = buffers.count;
+            a.resize(height * span);
+            b.resize(height * span);
+            s.resize(height * span);
+            edge.resize(span);
+            count.resize(height);
+
+            // Cells of every buffer row that exist; only the grid's last row can be short
+            for (std::size_t k = 0; k < height; ++k)
+            {
+                std::size_t length = rowLength(r0 + k);
+                const std::size_t m = count[k] = length > c0 ? std::min(length, c1) - c0 : 0;
+                const std::size_t at = (r0 + k) * w + c0;
+                std::copy(temperature.begin() + at, temperature.begin() + at + m, a.begin() + k * span);
+                double *heat = &s[k * span];
+                for (std::size_t c = 0; c < m; ++c)
+                {
+                    double amps = std::fabs(charge[at + c] - moved[at + c]) * ampsPerHour;
+                    heat[c] = gain * amps * amps * ohms;
+                }
+                if (impedance)
+                {
+                    for (std::size_t c = 0; c < m; ++c)
+                        heat[c] *= impedance[at + c];
+                }
+                for (std::size_t c = 0; c < m; ++c)
+                    heat[c] += coolant;
+            }
+
+            for (std::size_t step = 0; step < halo; ++step)
+            {
+                for (std::size_t k = 0; k < height; ++k)
+                {
+                    const std::size_t m = count[k];
+                    if (m == 0)
+                        continue;
+                    const double *mid = &a[k * span];
+                    const double *up = k > 0 ? mid - span : mid;
+                    const double *down = mid;
+                    if (k + 1 < height && count[k + 1] >= m)
+                    {
+                        down = mid + span;
+                    }
+                    else if (k + 1 < height && count[k + 1] > 0)
+                    {
+                        // The row below ends early: past its end the cell sees itself
+                        std::copy(mid + span, mid + span + count[k + 1], edge.begin());
+                        std::copy(mid + count[k + 1], mid + m, edge.begin() + count[k + 1]);
+                        down = edge.data();
+                    }
+                    relaxRow(up, mid, down, &s[k * span], &b[k * span], m, keep, share);
+                }
+                a.swap(b);
+            }
+
+            // The tile owns its inner cells, so the feedback can write their columns right away
+            for (std::size_t r = row; r < rowEnd; ++r)
+            {
+                const std::size_t end = std::min(colEnd, rowLength(r));
+                if (end <= col)
+                    continue;
+                const double *t = &a[(r - r0) * span + (col - c0)];
+                std::copy(t, t + (end - col), next.begin() + r * w + col);
+                if (last)
+                    derateRange(r * w + col, r * w + end, t, charge, capacity, discharge, recharge, tileStats[tile]);
+            }
+        });
+        temperature.swap(next);
+    }
+
+    ThermalStats total{0, INF, 0, INF, 0};
+    for (const ThermalStats &part : tileStats)
+        combine(total, part);
+    return total;
+}
+
+/**
+ * @brief runs body(i) for every i in [0, count), on the pool when the grid of n cells is large enough
+ */
+void CellThermal::forEach(std::size_t count, std::size_t n, const std::function<void(std::size_t)> &body)
+{
+    if (n >= PARALLEL_CELLS && parameters.threads != 1 && count > 1)
+    {
+        if (!pool)
+            pool.reset(new ThreadPool(parameters.threads));
+        if (pool->size() > 1)
+        {
+            pool->parallelFor(count, body, 1);
+            return;
+        }
+    }
+    for (std::size_t i = 0; i < count; ++i)
+        body(i);
+}
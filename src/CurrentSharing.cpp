@@ -0,0 +1,188 @@
+#include "CurrentSharing.h"
+#include "CellCircuit.h"
+#include "CellKernels.h"
+#include "EventSink.h"
+
+// Events are handed to the sink in batches of this size, like CellStore's
+static const std::size_t EVENT_BATCH = 256;
+using CellKernels::LANES;
+
+/**
+ * @brief returns the sum of x[i] * w[i], accumulated over the lanes in a fixed order
+ */
+static double weightedSum(const double *x, const double *w, std::size_t n)
+{
+    double sum[LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (std::size_t i = 0; i < n; ++i)
+        sum[i % LANES] += x[i] * w[i];
+    return CellKernels::sumLanes(sum);
+}
+
+/**
+ * @brief returns the sum of 1 / g[i], accumulated over the lanes in a fixed order
+ */
+static double resistanceSum(const double *g, std::size_t n)
+{
+    double sum[LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (std::size_t i = 0; i < n; ++i)
+        sum[i % LANES] += 1 / g[i];
+    return CellKernels::sumLanes(sum);
+}
+
+/**
+ * @brief prepares sharing over a pack's topology
+ * @param plan the pack's topology, read on every update; an empty plan is one flat group
+ * @param parallel the connection type of a flat pack
+ */
+CurrentSharing::CurrentSharing(const PackPlan &plan, bool parallel) : plan(plan), parallel(parallel), flat(1) {}
+
+/**
+ * @brief reduces every node to its Thevenin equivalent and its demand current, children first
+ * @param nodes the plan's nodes, breadth first
+ */
+void CurrentSharing::reduce(const std::vector<PackPlan::Node> &nodes)
+{
+    for (std::size_t k = nodes.size(); k-- > 0;)
+    {
+        const PackPlan::Node &node = nodes[k];
+        std::size_t n = node.end - node.begin;
+        const double *e = (node.leafGroup ? source.data() : nodeSource.data()) + node.begin;
+        const double *g = (node.leafGroup ? conductance.data() : nodeConductance.data()) + node.begin;
+        const double *m = (node.leafGroup ? current.data() : nodeCurrent.data()) + node.begin;
+
+        double total = n == 0 ? 0 : (node.series ? 1 / resistanceSum(g, n) : CellKernels::sum(g, n));
+        if (total == 0)
+        {
+            // An empty group (all its cells removed) is an open circuit
+            nodeSource[k] = nodeConductance[k] = nodeCurrent[k] = 0;
+        }
+        else if (node.series)
+        {
+            nodeSource[k] = CellKernels::sum(e, n);
+            nodeConductance[k] = total;
+            nodeCurrent[k] = CellKernels::sum(m, n) / static_cast<double>(n);
+        }
+        else
+        {
+            nodeSource[k] = weightedSum(e, g, n) / total;
+            nodeConductance[k] = total;
+            nodeCurrent[k] = CellKernels::sum(m, n);
+        }
+    }
+}
+
+/**
+ * @brief hands every node's current down to its children, parents first
+ * @param nodes the plan's nodes, breadth first
+ *
+ * The root keeps the current it demanded; every other node's current is
+ * overwritten by its parent before the node itself is visited.
+ */
+void CurrentSharing::distribute(const std::vector<PackPlan::Node> &nodes)
+{
+    for (std::size_t k = 0; k < nodes.size(); ++k)
+    {
+        const PackPlan::Node &node = nodes[k];
+        std::size_t n = node.end - node.begin;
+        const double *e = (node.leafGroup ? source.data() : nodeSource.data()) + node.begin;
+        const double *g = (node.leafGroup ? conductance.data() : nodeConductance.data()) + node.begin;
+        double *out = (node.leafGroup ? current.data() : nodeCurrent.data()) + node.begin;
+        double total = nodeCurrent[k];
+
+        if (node.series || nodeConductance[k] == 0)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+                out[i] = nodeConductance[k] == 0 ? 0 : total;
+        }
+        else
+        {
+            double terminal = nodeSource[k] - total / nodeConductance[k];
+            for (std::size_t i = 0; i < n; ++i)
+                out[i] = (e[i] - terminal) * g[i];
+        }
+    }
+}
+
+/**
+ * @brief redistributes one pack update among the branches
+ * @param circuit the circuit of the cells, begin() called with the charges before the update
+ * @param charge the charges after the rate model's update, replaced by the shared ones
+ * @param capacity the capacities
+ * @param n number of cells
+ * @param hours the length of the update, positive
+ * @param sink receives an event for every cell clamped at empty or full, nullptr for none
+ * @param elapsed the time stamp of the events
+ * @return the sum and minimum of the new charges
+ *
+ * Currents are in amperes, positive while a cell discharges, so use and
+ * recharge share the same code and circulating currents between branches at
+ * different states of charge come out naturally.
+ */
+CellKernels::ChargeStats CurrentSharing::apply(CellCircuit &circuit, double *charge, const double *capacity,
+                                               std::size_t n, double hours, EventSink *sink, double elapsed)
+{
+    const double *before = circuit.startCharges();
+    const double ampsPerCharge = circuit.getParameters().ampsPerRate / hours;
+    const double chargePerAmp = hours / circuit.getParameters().ampsPerRate;
+    const std::vector<PackPlan::Node> *nodes = &plan.getNodes();
+    if (plan.empty())
+    {
+        flat[0] = PackPlan::Node{!parallel, true, 0, static_cast<std::uint32_t>(n)};
+        nodes = &flat;
+    }
+
+    source.resize(n);
+    conductance.resize(n);
+    current.resize(n);
+    nodeSource.resize(nodes->size());
+    nodeConductance.resize(nodes->size());
+    nodeCurrent.resize(nodes->size());
+
+    // 1. What every cell asks for under the rate model, and its equivalent over the update
+    circuit.thevenin(capacity, n, hours, source.data(), conductance.data());
+    for (std::size_t i = 0; i < n; ++i)
+        current[i] = (before[i] - charge[i]) * ampsPerCharge;
+
+    // 2. Solve the network
+    reduce(*nodes);
+    distribute(*nodes);
+
+    // 3. Apply the shared currents
+    CellEvent batch[EVENT_BATCH];
+    std::size_t events = 0;
+    CellKernels::ChargeStats stats{0, 0, 0};
+    double sum[LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+    double lowest = n ? capacity[0] : 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        double moved = current[i] * chargePerAmp;
+        double x = before[i] - moved;
+        bool depleted = x <= 0 && moved > 0;
+        bool full = x >= capacity[i] && moved < 0;
+        if (depleted || full)
+        {
+            double headroom = depleted ? before[i] : capacity[i] - before[i];
+            double t = hours * headroom / (moved < 0 ? -moved : moved);
+            x = depleted ? 0 : capacity[i];
+            ++stats.clamped;
+            if (sink)
+            {
+                batch[events++] = CellEvent{elapsed, hours > t ? hours - t : 0, static_cast<std::uint32_t>(i),
+                                            depleted ? CellEvent::DEPLETED : CellEvent::OVERCHARGED};
+                if (events == EVENT_BATCH)
+                {
+                    sink->record(batch, events);
+                    events = 0;
+                }
+            }
+        }
+        charge[i] = x;
+        sum[i % LANES] += x;
+        lowest = x < lowest ? x : lowest;
+    }
+    if (events)
+        sink->record(batch, events);
+    stats.sum = CellKernels::sumLanes(sum);
+    stats.min = lowest;
+    return stats;
+}
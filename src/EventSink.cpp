@@ -0,0 +1,120 @@
+#include "EventSink.h"
+
+// --- RingBufferEventSink --- //
+
+/**
+ * @brief creates the ring
+ * @param capacity number of events, rounded up to a power of two
+ */
+RingBufferEventSink::RingBufferEventSink(std::size_t capacity)
+{
+    std::size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    ring.resize(size);
+    mask = size - 1;
+}
+
+void RingBufferEventSink::record(const CellEvent *events, std::size_t count)
+{
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    std::size_t free = ring.size() - (t - head.load(std::memory_order_acquire));
+    std::size_t n = count < free ? count : free;
+    for (std::size_t i = 0; i < n; ++i)
+        ring[(t + i) & mask] = events[i];
+    tail.store(t + n, std::memory_order_release);
+    if (n < count)
+        droppedCount.fetch_add(count - n, std::memory_order_relaxed);
+}
+
+/**
+ * @brief takes the oldest event, returns false if the ring is empty
+ */
+bool RingBufferEventSink::pop(CellEvent &event)
+{
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+        return false;
+    event = ring[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief appends every buffered event to out and returns how many were taken
+ */
+std::size_t RingBufferEventSink::drain(std::vector<CellEvent> &out)
+{
+    std::size_t h = head.load(std::memory_order_relaxed);
+    std::size_t t = tail.load(std::memory_order_acquire);
+    for (std::size_t i = h; i != t; ++i)
+        out.push_back(ring[i & mask]);
+    head.store(t, std::memory_order_release);
+    return t - h;
+}
+
+std::size_t RingBufferEventSink::dropped() const
+{
+    return droppedCount.load(std::memory_order_relaxed);
+}
+
+// --- FileEventSink --- //
+
+/**
+ * @brief opens the file for writing
+ * @param path the file to write
+ * @param batchSize number of events buffered before they are written out
+ */
+FileEventSink::FileEventSink(const std::string &path, std::size_t batchSize)
+    : file(std::fopen(path.c_str(), "w")), batchSize(batchSize ? batchSize : 1)
+{
+    pending.reserve(this->batchSize);
+    if (file)
+        std::fputs("kind,cell,time,overshoot\n", file);
+}
+
+/**
+ * @brief writes the remaining events and closes the file
+ */
+FileEventSink::~FileEventSink()
+{
+    flush();
+    if (file)
+        std::fclose(file);
+}
+
+bool FileEventSink::isOpen() const
+{
+    return file != nullptr;
+}
+
+bool FileEventSink::enabled() const
+{
+    return file != nullptr;
+}
+
+void FileEventSink::record(const CellEvent *events, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        pending.push_back(events[i]);
+        if (pending.size() >= batchSize)
+            flush();
+    }
+}
+
+/**
+ * @brief writes the buffered events to the file
+ */
+void FileEventSink::flush()
+{
+    if (file)
+    {
+        for (const CellEvent &e : pending)
+        {
+            std::fprintf(file, "%s,%ld,%.17g,%.17g\n", e.kind == CellEvent::DEPLETED ? "depleted" : "overcharged",
+                         e.cell == CellEvent::NO_CELL ? -1L : static_cast<long>(e.cell), e.time, e.overshoot);
+        }
+    }
+    pending.clear();
+}
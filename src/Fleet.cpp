@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include "Fleet.h"
+#include "CellKernels.h"
+#include "ThreadPool.h"
+
+// Fleets with fewer cells are advanced on the calling thread, like CellThermal's small grids
+static const std::size_t PARALLEL_CELLS = 65536;
+// Shards per worker, so packs of uneven size still balance out over the pool
+static const std::size_t SHARDS_PER_THREAD = 4;
+// Node reductions over fewer children are plain loops, cheaper than a dispatched kernel call
+static const std::size_t SMALL_GROUP = 32;
+// Fractional part of the golden ratio: k * GOLDEN mod 1 spreads the duty factors evenly in any prefix of the fleet
+static const double GOLDEN = 0.6180339887498949;
+// Node ranges are 32-bit, so all packs together hold at most this many cells
+static const std::size_t MAX_CELLS = std::size_t(1) << 32;
+
+namespace
+{
+    /**
+     * @brief returns the sum of x[0..n) bit for bit like CellKernels::sum(); the typical few cells of a group are
+     *        added in place of a kernel call, in the kernels' order: full blocks over the lanes, then the tail
+     */
+    double reduceSum(const double *x, std::size_t n)
+    {
+        if (n >= SMALL_GROUP)
+            return CellKernels::sum(x, n);
+        double lanes[CellKernels::LANES] = {0, 0, 0, 0, 0, 0, 0, 0};
+        std::size_t i = 0;
+        for (; i + CellKernels::LANES <= n; i += CellKernels::LANES)
+        {
+            for (std::size_t j = 0; j < CellKernels::LANES; ++j)
+                lanes[j] += x[i + j];
+        }
+        double total = CellKernels::sumLanes(lanes);
+        for (; i < n; ++i)
+            total += x[i];
+        return total;
+    }
+
+    /**
+     * @brief returns the smallest of x[0..n), n > 0, see reduceSum()
+     */
+    double reduceMin(const double *x, std::size_t n)
+    {
+        if (n >= SMALL_GROUP)
+            return CellKernels::min(x, n);
+        double m = x[0];
+        for (std::size_t i = 1; i < n; ++i)
+            m = x[i] < m ? x[i] : m;
+        return m;
+    }
+}
+
+Fleet::Fleet(const RateModel &model, std::size_t threads) : model(model), threads(threads)
+{
+    cellOffsets.push_back(0);
+    nodeOffsets.push_back(0);
+}
+
+Fleet::~Fleet() = default;
+
+const RateModel &Fleet::getRateModel() const
+{
+    return model;
+}
+
+/**
+ * @brief adds a load profile that packs can follow
+ * @param steps the use and recharge steps, played once
+ * @return its index
+ */
+std::size_t Fleet::addProfile(const std::vector<ScenarioStep> &steps)
+{
+    double hours = 0;
+    for (const ScenarioStep &step : steps)
+        hours += step.hours;
+    profiles.push_back(steps);
+    profileHours.push_back(hours);
+    return profiles.size() - 1;
+}
+
+void Fleet::reserve(std::size_t packs, std::size_t cells)
+{
+    for (std::vector<double> *column : {&voltage, &capacity, &charge, &dischargeRate, &rechargeRate})
+        column->reserve(cells);
+    for (std::vector<std::size_t> *column : {&cellOffsets, &nodeOffsets})
+        column->reserve(packs + 1);
+    for (std::vector<double> *column : {&wait, &duty, &played, &depleted})
+        column->reserve(packs);
+    profile.reserve(packs);
+    cursor.reserve(packs);
+}
+
+/**
+ * @brief appends a pack and returns its index
+ *
+ * The plan's nodes are copied with their child ranges moved to the pack's
+ * place in the shared node and cell arrays.
+ */
+std::size_t Fleet::addPack(BatteryPack::ConnectionType type, const PackPlan &plan, const double *v, const double *c,
+                           const double *q, std::size_t n, const double *d, const double *r, std::size_t profile,
+                           double delay, double duty)
+{
+    const std::size_t pack = packCount();
+    const std::size_t firstCell = cellOffsets.back();
+    const std::size_t firstNode = nodeOffsets.back();
+    voltage.insert(voltage.end(), v, v + n);
+    capacity.insert(capacity.end(), c, c + n);
+    charge.insert(charge.end(), q, q + n);
+    if (d)
+        dischargeRate.insert(dischargeRate.end(), d, d + n);
+    else
+        dischargeRate.insert(dischargeRate.end(), n, Battery::DISCHARGE_RATE);
+    if (r)
+        rechargeRate.insert(rechargeRate.end(), r, r + n);
+    else
+        rechargeRate.insert(rechargeRate.end(), n, Battery::RECHARGE_RATE);
+
+    if (plan.empty())
+    {
+        nodes.push_back(PackPlan::Node{type == BatteryPack::SERIES, true, static_cast<std::uint32_t>(firstCell),
+                                       static_cast<std::uint32_t>(firstCell + n)});
+    }
+    else
+    {
+        for (PackPlan::Node node : plan.getNodes())
+        {
+            const std::size_t shift = node.leafGroup ? firstCell : firstNode;
+            node.begin += static_cast<std::uint32_t>(shift);
+            node.end += static_cast<std::uint32_t>(shift);
+            nodes.push_back(node);
+        }
+    }
+    cellOffsets.push_back(firstCell + n);
+    nodeOffsets.push_back(nodes.size());
+    nodeVoltage.resize(nodes.size());
+    nodeCapacity.resize(nodes.size());
+    nodeCharge.resize(nodes.size());
+    evaluate(pack, true);
+
+    this->profile.push_back(profile);
+    wait.push_back(delay);
+    this->duty.push_back(duty);
+    cursor.push_back(0);
+    played.push_back(0);
+    depleted.push_back(0);
+    end = std::max(end, delay + duty * profileHours[profile]);
+    shardsStale = true;
+    return pack;
+}
+
+std::size_t Fleet::packCount() const
+{
+    return cellOffsets.size() - 1;
+}
+
+std::size_t Fleet::cellCount() const
+{
+    return cellOffsets.back();
+}
+
+std::size_t Fleet::packBegin(std::size_t pack) const
+{
+    return cellOffsets[pack];
+}
+
+std::size_t Fleet::packEnd(std::size_t pack) const
+{
+    return cellOffsets[pack + 1];
+}
+
+double Fleet::packVoltage(std::size_t pack) const
+{
+    return nodeVoltage[nodeOffsets[pack]];
+}
+
+double Fleet::packCapacity(std::size_t pack) const
+{
+    return nodeCapacity[nodeOffsets[pack]];
+}
+
+double Fleet::packCharge(std::size_t pack) const
+{
+    return nodeCharge[nodeOffsets[pack]];
+}
+
+double Fleet::depletedHours(std::size_t pack) const
+{
+    return depleted[pack];
+}
+
+double Fleet::duration() const
+{
+    return end;
+}
+
+std::size_t Fleet::threadCount() const
+{
+    return pool ? pool->size() : 1;
+}
+
+/**
+ * @brief moves every pack hours further along its profile
+ *
+ * Each shard advances its packs one after the other, and each pack's update
+ * and reductions run over its own slice only, so shards share no writes.
+ */
+void Fleet::advance(double hours)
+{
+    if (shardsStale)
+        buildShards();
+    auto body = [&](std::size_t shard) {
+        for (std::size_t pack = shards[shard]; pack < shards[shard + 1]; ++pack)
+            advancePack(pack, hours);
+    };
+    const std::size_t count = shards.size() - 1;
+    if (pool && count > 1)
+    {
+        pool->parallelFor(count, body, 1);
+    }
+    else
+    {
+        for (std::size_t shard = 0; shard < count; ++shard)
+            body(shard);
+    }
+    elapsed += hours;
+}
+
+/**
+ * @brief cuts the packs into shards and starts the pool if the fleet is large enough
+ *
+ * A shard ends with the first pack that brings it to its share of the cells,
+ * so shards stay contiguous and never split a pack.
+ */
+void Fleet::buildShards()
+{
+    const std::size_t cells = cellCount();
+    if (!pool && threads != 1 && cells >= PARALLEL_CELLS)
+        pool.reset(new ThreadPool(threads));
+    const std::size_t workers = pool ? pool->size() : 1;
+    const std::size_t share = workers > 1 ? std::max<std::size_t>(cells / (workers * SHARDS_PER_THREAD), 1) : cells;
+
+    shards.assign(1, 0);
+    for (std::size_t pack = 0; pack < packCount(); ++pack)
+    {
+        if (cellOffsets[pack + 1] - cellOffsets[shards.back()] >= share)
+            shards.push_back(pack + 1);
+    }
+    if (shards.back() != packCount())
+        shards.push_back(packCount());
+    if (shards.size() == 1)
+        shards.push_back(0);
+    shardsStale = false;
+}
+
+/**
+ * @brief moves a single pack hours further along its profile
+ *
+ * The update of a flat pack already returns the min and sum of its new
+ * charges, which is its aggregate; only a topology needs another pass.
+ */
+void Fleet::advancePack(std::size_t pack, double hours)
+{
+    const std::size_t first = cellOffsets[pack];
+    const std::size_t n = cellOffsets[pack + 1] - first;
+    double *q = charge.data() + first;
+    const double *c = capacity.data() + first;
+    const std::vector<ScenarioStep> &steps = profiles[profile[pack]];
+
+    double left = hours;
+    const double idle = std::min(wait[pack], left);
+    wait[pack] -= idle;
+    left -= idle;
+
+    bool updated = false;
+    CellKernels::ChargeStats stats{0, 0, 0};
+    while (left > 0 && cursor[pack] < steps.size())
+    {
+        const ScenarioStep &step = steps[cursor[pack]];
+        double h = step.hours * duty[pack] - played[pack];
+        if (h <= left)
+        {
+            ++cursor[pack];
+            played[pack] = 0;
+        }
+        else
+        {
+            h = left;
+            played[pack] += h;
+        }
+        left -= h;
+        if (h <= 0)
+            continue;
+        if (step.action == ScenarioStep::USE)
+            stats = model.discharge(q, c, dischargeRate.data() + first, n, h);
+        else
+            stats = model.recharge(q, c, rechargeRate.data() + first, n, h);
+        updated = true;
+    }
+
+    const std::size_t root = nodeOffsets[pack];
+    if (updated)
+    {
+        if (nodeOffsets[pack + 1] - root == 1)
+            nodeCharge[root] = nodes[root].series ? stats.min : stats.sum;
+        else
+            evaluate(pack, false);
+    }
+    if (n != 0 && nodeCharge[root] <= 0)
+        depleted[pack] += hours;
+}
+
+/**
+ * @brief recomputes a pack's node charges, and its voltages and capacities too if all is set
+ *
+ * Children come after their parent, so walking the pack's nodes backwards
+ * visits them first, as in PackPlan::evaluate().
+ */
+void Fleet::evaluate(std::size_t pack, bool all)
+{
+    for (std::size_t k = nodeOffsets[pack + 1]; k-- > nodeOffsets[pack];)
+    {
+        const PackPlan::Node &node = nodes[k];
+        const std::size_t n = node.end - node.begin;
+        const double *q = (node.leafGroup ? charge.data() : nodeCharge.data()) + node.begin;
+        if (n == 0)
+        {
+            nodeCharge[k] = 0;
+            if (all)
+                nodeVoltage[k] = nodeCapacity[k] = 0;
+            continue;
+        }
+        nodeCharge[k] = node.series ? reduceMin(q, n) : reduceSum(q, n);
+        if (!all)
+            continue;
+        const double *v = (node.leafGroup ? voltage.data() : nodeVoltage.data()) + node.begin;
+        const double *c = (node.leafGroup ? capacity.data() : nodeCapacity.data()) + node.begin;
+        nodeVoltage[k] = node.series ? reduceSum(v, n) : v[0];
+        nodeCapacity[k] = node.series ? reduceMin(c, n) : reduceSum(c, n);
+    }
+}
+
+/**
+ * @brief parses a fleet file, see FleetSpec
+ */
+bool loadFleet(const std::string &path, FleetSpec &spec, std::string &error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    // Fleet directives are handled here and blanked out, like sweep directives
+    std::ostringstream scenarioText;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        ++lineNumber;
+        std::string content = line.substr(0, line.find('#'));
+        std::istringstream fields(content);
+        std::string keyword;
+        if (!(fields >> keyword) || (keyword != "vehicles" && keyword != "stagger" && keyword != "duty"))
+        {
+            scenarioText << line << '\n';
+            continue;
+        }
+        scenarioText << '\n';
+
+        bool ok;
+        // A negative count would wrap around
+        if (keyword == "vehicles")
+            ok = (fields >> std::ws).peek() != '-' && fields >> spec.vehicles && spec.vehicles > 0;
+        else if (keyword == "stagger")
+            ok = static_cast<bool>(fields >> spec.stagger) && spec.stagger >= 0;
+        else
+            ok = static_cast<bool>(fields >> spec.dutyMin >> spec.dutyMax) && spec.dutyMin > 0 &&
+                 spec.dutyMax >= spec.dutyMin;
+        std::string extra;
+        if (!ok || fields >> extra)
+        {
+            error = path + ": line " + std::to_string(lineNumber) + ": cannot parse '" + line + "'";
+            return false;
+        }
+    }
+
+    std::istringstream scenarioIn(scenarioText.str());
+    spec.base.name = path;
+    if (!parseScenario(scenarioIn, spec.base, error))
+    {
+        error = path + ": " + error;
+        return false;
+    }
+    if (spec.base.timestep <= 0)
+    {
+        error = path + ": a fleet needs a timestep";
+        return false;
+    }
+    if (spec.vehicles > MAX_CELLS / std::max<std::size_t>(spec.base.cellCount(), 1))
+    {
+        error = path + ": " + std::to_string(spec.vehicles) + " vehicles of " +
+                std::to_string(spec.base.cellCount()) + " cells exceed a fleet's 2^32 cells";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief builds the fleet of a spec and advances it tick by tick until every vehicle has played its profile
+ * @param spec the fleet to run
+ * @param threads number of worker threads, 0 for one per hardware thread
+ * @return the packs' final states, identical for any number of threads
+ *
+ * Every vehicle gets the base scenario's cells and follows its steps, vehicle
+ * k of N after k/N of the stagger and at duty factor k * GOLDEN mod 1 of the
+ * way through the duty range. Only the ticks are timed.
+ */
+FleetResult runFleet(const FleetSpec &spec, std::size_t threads)
+{
+    const Scenario &base = spec.base;
+    FleetResult result;
+    result.packs = spec.vehicles;
+
+    PackPlan plan;
+    std::string error;
+    if (!base.topology.empty())
+        PackPlan::parse(base.topology, plan, error);
+
+    std::vector<double> v, c, q, d, r;
+    for (const CellSpec &cell : base.cells)
+    {
+        v.insert(v.end(), cell.count, cell.voltage);
+        c.insert(c.end(), cell.count, cell.capacity);
+        q.insert(q.end(), cell.count, std::min(std::max(cell.initialCharge, 0.0), cell.capacity));
+        d.insert(d.end(), cell.count, cell.dischargeRate);
+        r.insert(r.end(), cell.count, cell.rechargeRate);
+    }
+    const std::size_t n = v.size();
+
+    Fleet fleet(base.model, threads);
+    fleet.reserve(spec.vehicles, spec.vehicles * n);
+    const std::size_t profile = fleet.addProfile(base.steps);
+    for (std::size_t k = 0; k < spec.vehicles; ++k)
+    {
+        double delay = spec.stagger * static_cast<double>(k) / static_cast<double>(spec.vehicles);
+        double spread = static_cast<double>(k) * GOLDEN;
+        double duty = spec.dutyMin + (spec.dutyMax - spec.dutyMin) * (spread - std::floor(spread));
+        fleet.addPack(base.type, plan, v.data(), c.data(), q.data(), n, d.data(), r.data(), profile, delay, duty);
+    }
+    result.cells = fleet.cellCount();
+
+    // The last tick is cut short at the end of the longest profile
+    result.hours = fleet.duration();
+    result.ticks = static_cast<std::size_t>(std::ceil(result.hours / base.timestep * (1 - 1e-12)));
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t tick = 0; tick < result.ticks; ++tick)
+        fleet.advance(std::min(base.timestep, result.hours - static_cast<double>(tick) * base.timestep));
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.threads = fleet.threadCount();
+    result.cellUpdatesPerSecond =
+        result.seconds > 0 ? static_cast<double>(result.cells) * static_cast<double>(result.ticks) / result.seconds : 0;
+
+    result.final.reserve(spec.vehicles);
+    result.depleted.reserve(spec.vehicles);
+    for (std::size_t pack = 0; pack < fleet.packCount(); ++pack)
+    {
+        result.final.push_back(StepResult{fleet.packVoltage(pack), fleet.packCapacity(pack), fleet.packCharge(pack)});
+        result.depleted.push_back(fleet.depletedHours(pack));
+    }
+    return result;
+}
+
+/**
+ * @brief writes one CSV row per pack: its final voltage, capacity and charge and its hours spent empty
+ */
+void writeFleetResults(std::ostream &out, const FleetResult &result)
+{
+    out << "pack,voltage,capacity,charge,depleted\n";
+    for (std::size_t pack = 0; pack < result.final.size(); ++pack)
+    {
+        const StepResult &s = result.final[pack];
+        out << pack << ',' << s.voltage << ',' << s.capacity << ',' << s.charge << ',' << result.depleted[pack] << '\n';
+    }
+}
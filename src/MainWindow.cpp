@@ -6,9 +6,19 @@
 #include <QLabel>
 #include <QGroupBox>
 #include <QFormLayout>
+#include <QCheckBox>
 #include <QComboBox>
 #include <QDebug>
 #include <QDoubleSpinBox>
+#include <QFileDialog>
+#include <QProgressBar>
+#include <QTimer>
+#include "PackFile.h"
+
+// Tick length of background simulations (one second); the Simulator fast-forwards between saturations
+static const double SIM_STEP_HOURS = 1.0 / 3600;
+// Frame interval while a simulation runs, about 60 fps
+static const int FRAME_MS = 16;
 
 /**
  * @brief Constructor for MainWindow
@@ -19,6 +29,7 @@ MainWindow::MainWindow(QWidget *parent)
 {
     // Initialize Logic
     pack = new BatteryPack(BatteryPack::SERIES);
+    pack->setEventSink(&events);
 
     // --- UI Setup --- //
     QWidget *centralWidget = new QWidget;
@@ -29,7 +40,7 @@ MainWindow::MainWindow(QWidget *parent)
     QVBoxLayout *controlsLayout = new QVBoxLayout();
 
     // 1. Add Battery Group
-    QGroupBox *addGroup = new QGroupBox("Add Battery");
+    addGroup = new QGroupBox("Add Battery");
     QFormLayout *addLayout = new QFormLayout();
     voltageInput = new QLineEdit("3.7");
     capacityInput = new QLineEdit("2000");
@@ -42,13 +53,32 @@ MainWindow::MainWindow(QWidget *parent)
     addGroup->setLayout(addLayout);
 
     // 2. Pack Configuration Group
-    QGroupBox *configGroup = new QGroupBox("Pack Configuration");
+    configGroup = new QGroupBox("Pack Configuration");
     QVBoxLayout *configLayout = new QVBoxLayout();
     typeCombo = new QComboBox();
     typeCombo->addItem("Series (Vertical)");
     typeCombo->addItem("Parallel (Horizontal)");
     configLayout->addWidget(new QLabel("Connection Type:"));
     configLayout->addWidget(typeCombo);
+
+    // Multi-level topology such as 4s2p, applied to the cells already in the pack
+    QHBoxLayout *topologyRow = new QHBoxLayout();
+    topologyInput = new QLineEdit();
+    topologyInput->setPlaceholderText("e.g. 4s2p");
+    QPushButton *btnTopology = new QPushButton("Apply");
+    topologyRow->addWidget(topologyInput);
+    topologyRow->addWidget(btnTopology);
+    configLayout->addWidget(new QLabel("Topology:"));
+    configLayout->addLayout(topologyRow);
+
+    // Cell temperatures with the default thermal model, and whether the canvas shows them
+    thermalCheck = new QCheckBox("Thermal model");
+    colouringCombo = new QComboBox();
+    colouringCombo->addItem("Charge");
+    colouringCombo->addItem("Temperature");
+    configLayout->addWidget(thermalCheck);
+    configLayout->addWidget(new QLabel("Colour by:"));
+    configLayout->addWidget(colouringCombo);
     configGroup->setLayout(configLayout);
 
     // 3. Simulation Group
@@ -66,22 +96,42 @@ MainWindow::MainWindow(QWidget *parent)
 
     // Add the Buttons
     QHBoxLayout *simButtonLayout = new QHBoxLayout();
-    QPushButton *btnUse = new QPushButton("Use");
-    QPushButton *btnCharge = new QPushButton("Recharge");
+    btnUse = new QPushButton("Use");
+    btnCharge = new QPushButton("Recharge");
+    btnCancel = new QPushButton("Cancel");
+    btnCancel->setEnabled(false);
     simButtonLayout->addWidget(btnUse);
     simButtonLayout->addWidget(btnCharge);
+    simButtonLayout->addWidget(btnCancel);
+
+    // Progress of the simulation running in the background
+    progressBar = new QProgressBar();
+    progressBar->setRange(0, 1000);
+    progressBar->setValue(0);
+    progressBar->setTextVisible(false);
 
     simMainLayout->addLayout(inputRow);
     simMainLayout->addLayout(simButtonLayout);
+    simMainLayout->addWidget(progressBar);
     simGroup->setLayout(simMainLayout);
 
-    // 4. Stats Label
+    // 4. Pack files
+    QGroupBox *fileGroup = new QGroupBox("Pack File");
+    QHBoxLayout *fileLayout = new QHBoxLayout();
+    QPushButton *btnSave = new QPushButton("Save...");
+    btnLoad = new QPushButton("Load...");
+    fileLayout->addWidget(btnSave);
+    fileLayout->addWidget(btnLoad);
+    fileGroup->setLayout(fileLayout);
+
+    // 5. Stats Label
     statusLabel = new QLabel("Stats will appear here");
     statusLabel->setStyleSheet("font-weight: bold; margin-top: 10px;");
 
     controlsLayout->addWidget(addGroup);
     controlsLayout->addWidget(configGroup);
     controlsLayout->addWidget(simGroup);
+    controlsLayout->addWidget(fileGroup);
     controlsLayout->addWidget(statusLabel);
     controlsLayout->addStretch();
 
@@ -96,8 +146,18 @@ MainWindow::MainWindow(QWidget *parent)
     // --- Connections --- //
     connect(btnAdd, &QPushButton::clicked, this, &MainWindow::addBattery);
     connect(typeCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(changePackType(int)));
+    connect(btnTopology, &QPushButton::clicked, this, &MainWindow::applyTopology);
+    connect(thermalCheck, &QCheckBox::toggled, this, &MainWindow::toggleThermal);
+    connect(colouringCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(changeColouring(int)));
     connect(btnUse, &QPushButton::clicked, this, &MainWindow::simulateUse);
     connect(btnCharge, &QPushButton::clicked, this, &MainWindow::simulateRecharge);
+    connect(btnCancel, &QPushButton::clicked, this, &MainWindow::cancelSimulation);
+    connect(btnSave, &QPushButton::clicked, this, &MainWindow::savePackFile);
+    connect(btnLoad, &QPushButton::clicked, this, &MainWindow::loadPackFile);
+
+    frameTimer = new QTimer(this);
+    frameTimer->setInterval(FRAME_MS);
+    connect(frameTimer, &QTimer::timeout, this, &MainWindow::showSimulationFrame);
 
     // Initial update
     updateLabels();
@@ -106,12 +166,11 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    // The worker may still be stepping the pack
+    worker.cancel();
+    worker.wait();
+    // The pack owns its cells and releases them with itself
     delete pack;
-    // Clean up the batteries we created
-    for (Battery *b : allBatteries)
-    {
-        delete b;
-    }
 }
 
 /**
@@ -126,11 +185,9 @@ void MainWindow::addBattery()
 
     if (ok1 && ok2 && ok3)
     {
-        Battery *b = new Battery(v, c, i);
-        allBatteries.push_back(b); // Store to delete later
-        pack->add(b);              // Add to current pack logic
+        pack->addCell(v, c, i); // The pack owns the new cell
 
-        canvas->update(); // Redraw
+        canvas->refreshCells(); // Redraw the new cell
         updateLabels();   // Update text stats
     }
 }
@@ -141,29 +198,106 @@ void MainWindow::addBattery()
  */
 void MainWindow::changePackType(int index)
 {
-    // Because BatteryPack doesn't have a setType() method in the header provided,
-    // we must recreate the pack and move the batteries over.
+    // Only the wiring changes: the cells stay where they are
+    pack->setConnectionType(index == 0 ? BatteryPack::SERIES : BatteryPack::PARALLEL);
 
-    BatteryPack::ConnectionType newType = (index == 0) ? BatteryPack::SERIES : BatteryPack::PARALLEL;
+    canvas->refreshCells();
+    updateLabels();
+}
 
-    // 1. Save the batteries from the old pack
-    std::vector<Battery *> cells = pack->getCells();
+/**
+ * @brief Slot to organise the cells into the topology typed by the user (e.g. 4s2p)
+ */
+void MainWindow::applyTopology()
+{
+    std::string error;
+    if (!pack->setTopology(topologyInput->text().toStdString(), error))
+    {
+        statusLabel->setText(QString::fromStdString(error));
+        return;
+    }
 
-    // 2. Delete old pack
-    delete pack;
+    // The outermost level decides the connection type; switching it would drop the topology again
+    typeCombo->blockSignals(true);
+    typeCombo->setCurrentIndex(pack->getConnectionType() == BatteryPack::SERIES ? 0 : 1);
+    typeCombo->blockSignals(false);
 
-    // 3. Create new pack
-    pack = new BatteryPack(newType);
+    canvas->refreshCells();
+    updateLabels();
+}
 
-    // 4. Re-add the batteries
-    for (Battery *b : cells)
+/**
+ * @brief Slot to attach or detach the thermal model
+ * @param on true to attach the default model
+ */
+void MainWindow::toggleThermal(bool on)
+{
+    if (on)
+        pack->setThermal(ThermalParameters());
+    else
+        pack->clearThermal();
+
+    canvas->refreshCells();
+    updateLabels();
+}
+
+/**
+ * @brief Slot to colour the cells by charge or by temperature
+ * @param index The new index selected
+ */
+void MainWindow::changeColouring(int index)
+{
+    canvas->setColouring(index == 1 ? BatteryCanvas::TEMPERATURE : BatteryCanvas::CHARGE);
+    canvas->refreshCells();
+}
+
+/**
+ * @brief Slot to write the pack to a snapshot file, also while a simulation runs
+ *
+ * During a run the charges come from the snapshot on screen and only the
+ * columns the worker never writes are read from the pack, so the worker keeps
+ * stepping while the file is written.
+ */
+void MainWindow::savePackFile()
+{
+    QString path = QFileDialog::getSaveFileName(this, "Save Pack", QString(), "Battery packs (*.bpk)");
+    if (path.isEmpty())
+        return;
+    std::string error;
+    if (!savePack(path.toStdString(), *pack, error, liveSnapshot))
+        statusLabel->setText(QString::fromStdString(error));
+}
+
+/**
+ * @brief Slot to replace the pack with one read from a snapshot file
+ */
+void MainWindow::loadPackFile()
+{
+    QString path = QFileDialog::getOpenFileName(this, "Load Pack", QString(), "Battery packs (*.bpk)");
+    if (path.isEmpty())
+        return;
+    std::string error;
+    std::unique_ptr<BatteryPack> loaded = loadPack(path.toStdString(), error);
+    if (!loaded)
     {
-        pack->add(b);
+        statusLabel->setText(QString::fromStdString(error));
+        return;
     }
 
-    // 5. Update the canvas to point to the new pack
+    delete pack;
+    pack = loaded.release();
+    pack->setEventSink(&events);
+    // Pack files hold no thermal state: the loaded cells start at the coolant temperature
+    if (thermalCheck->isChecked())
+        pack->setThermal(ThermalParameters());
+
+    typeCombo->blockSignals(true);
+    typeCombo->setCurrentIndex(pack->getConnectionType() == BatteryPack::SERIES ? 0 : 1);
+    typeCombo->blockSignals(false);
+    topologyInput->setText(QString::fromStdString(pack->getTopology().notation()));
+
     canvas->setBatteryPack(pack);
-    canvas->update();
+    canvas->refreshCells();
     updateLabels();
 }
 
@@ -172,21 +306,92 @@ void MainWindow::changePackType(int index)
  */
 void MainWindow::simulateUse()
 {
-    double hours = hoursInput->value(); // Get the dynamic value from UI
-    pack->use(hours);
-    canvas->update();
-    updateLabels();
+    startSimulation(ScenarioStep::USE);
 }
 
 /**
  * @brief Slot to simulate battery recharge
  */
 void MainWindow::simulateRecharge()
+{
+    startSimulation(ScenarioStep::RECHARGE);
+}
+
+/**
+ * @brief plays hours of use or recharge on the worker thread
+ * @param action use or recharge
+ *
+ * The window keeps running while the worker steps the pack; the frame timer
+ * shows its snapshots until it is done.
+ */
+void MainWindow::startSimulation(ScenarioStep::Action action)
 {
     double hours = hoursInput->value(); // Get the dynamic value from UI
-    pack->recharge(hours);
-    canvas->update();
+    std::vector<ScenarioStep> profile{ScenarioStep{action, hours}};
+    if (!worker.start(*pack, profile, SIM_STEP_HOURS))
+        return;
+
+    setEditable(false);
+    progressBar->setValue(0);
+    frameTimer->start();
+}
+
+/**
+ * @brief Slot to stop a running simulation early
+ */
+void MainWindow::cancelSimulation()
+{
+    worker.cancel();
+}
+
+/**
+ * @brief Slot called every frame while a simulation runs: shows the newest snapshot and the progress
+ */
+void MainWindow::showSimulationFrame()
+{
+    const PackSnapshot *snapshot = worker.latest();
+    if (snapshot && snapshot != liveSnapshot)
+    {
+        liveSnapshot = snapshot;
+        canvas->setSnapshot(snapshot);
+        canvas->refreshCells();
+        updateLabels();
+    }
+    progressBar->setValue(static_cast<int>(worker.progress() * progressBar->maximum()));
+
+    if (!worker.running())
+        finishSimulation();
+}
+
+/**
+ * @brief joins the worker and gives the pack back to the UI
+ */
+void MainWindow::finishSimulation()
+{
+    frameTimer->stop();
+    bool complete = worker.wait();
+    liveSnapshot = nullptr;
+    canvas->setSnapshot(nullptr);
+    canvas->refreshCells();
     updateLabels();
+    if (!complete)
+        statusLabel->setText(statusLabel->text() + "\nSimulation cancelled");
+    progressBar->setValue(complete ? progressBar->maximum() : 0);
+    setEditable(true);
+}
+
+/**
+ * @brief enables or disables every control that changes the pack
+ * @param editable false while the worker owns the pack
+ */
+void MainWindow::setEditable(bool editable)
+{
+    addGroup->setEnabled(editable);
+    configGroup->setEnabled(editable);
+    btnUse->setEnabled(editable);
+    btnCharge->setEnabled(editable);
+    btnLoad->setEnabled(editable);
+    btnCancel->setEnabled(!editable);
 }
 
 /**
@@ -194,9 +399,34 @@ void MainWindow::simulateRecharge()
  */
 void MainWindow::updateLabels()
 {
-    QString text = QString("Pack Voltage: %1 V\nPack Capacity: %2\nPack Charge: %3")
-                       .arg(pack->getVoltage())
-                       .arg(pack->getCapacity())
-                       .arg(pack->getCharge());
+    // While the worker owns the pack, its aggregates come from the snapshot
+    QString text = liveSnapshot ? QString("Pack Voltage: %1 V\nPack Capacity: %2\nPack Charge: %3\nSimulated: %4 h")
+                                      .arg(liveSnapshot->voltage)
+                                      .arg(liveSnapshot->capacity)
+                                      .arg(liveSnapshot->charge)
+                                      .arg(liveSnapshot->hours, 0, 'f', 2)
+                                : QString("Pack Voltage: %1 V\nPack Capacity: %2\nPack Charge: %3\n"
+                                          "Empty in: %4 h\nFull in: %5 h")
+                                      .arg(pack->getVoltage())
+                                      .arg(pack->getCapacity())
+                                      .arg(pack->getCharge())
+                                      .arg(pack->hoursToEmpty(), 0, 'f', 2)
+                                      .arg(pack->hoursToFull(), 0, 'f', 2);
+
+    // Report the cells that ran empty or full during the last action
+    int depleted = 0, overcharged = 0;
+    CellEvent event;
+    while (events.pop(event))
+    {
+        if (event.kind == CellEvent::DEPLETED)
+            ++depleted;
+        else
+            ++overcharged;
+    }
+    if (depleted)
+        text += QString("\n%1 battery(s) ran empty").arg(depleted);
+    if (overcharged)
+        text += QString("\n%1 battery(s) were overcharged").arg(overcharged);
+
     statusLabel->setText(text);
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include <limits>
+#include "MinTree.h"
+
+static const double INF = std::numeric_limits<double>::infinity();
+
+/**
+ * @brief replaces the contents with values[0..n)
+ */
+void MinTree::build(const double *values, std::size_t n)
+{
+    count = 0;
+    reserveLeaves(n);
+    for (std::size_t i = 0; i < leaves; ++i)
+        nodes[leaves + i] = i < n ? values[i] : INF;
+    count = n;
+    rebuildInner();
+}
+
+void MinTree::clear()
+{
+    nodes.clear();
+    leaves = 0;
+    count = 0;
+}
+
+/**
+ * @brief appends a value, amortized O(log n)
+ */
+void MinTree::push(double value)
+{
+    if (count == leaves)
+        reserveLeaves(count + 1);
+    set(count++, value);
+}
+
+/**
+ * @brief changes the value at index i
+ */
+void MinTree::set(std::size_t i, double value)
+{
+    std::size_t node = leaves + i;
+    nodes[node] = value;
+    for (node >>= 1; node >= 1; node >>= 1)
+    {
+        double l = nodes[2 * node], r = nodes[2 * node + 1];
+        double m = r < l ? r : l;
+        if (nodes[node] == m)
+            break;
+        nodes[node] = m;
+    }
+}
+
+/**
+ * @brief removes the value at index i, shifting later values down
+ */
+void MinTree::erase(std::size_t i)
+{
+    for (std::size_t k = leaves + i; k + 1 < leaves + count; ++k)
+        nodes[k] = nodes[k + 1];
+    nodes[leaves + --count] = INF;
+    rebuildInner();
+}
+
+/**
+ * @brief exchanges the values at indices i and j
+ */
+void MinTree::swap(std::size_t i, std::size_t j)
+{
+    double a = nodes[leaves + i];
+    set(i, nodes[leaves + j]);
+    set(j, a);
+}
+
+/**
+ * @brief removes the last value
+ */
+void MinTree::pop()
+{
+    set(--count, INF);
+}
+
+double MinTree::get(std::size_t i) const
+{
+    return nodes[leaves + i];
+}
+
+/**
+ * @brief returns the smallest value, +infinity if empty
+ */
+double MinTree::min() const
+{
+    return count == 0 ? INF : nodes[1];
+}
+
+/**
+ * @brief returns the index of the smallest value, size() if empty
+ */
+std::size_t MinTree::argmin() const
+{
+    if (count == 0)
+        return count;
+    std::size_t node = 1;
+    while (node < leaves)
+        node = nodes[2 * node] == nodes[node] ? 2 * node : 2 * node + 1;
+    return node - leaves;
+}
+
+std::size_t MinTree::size() const
+{
+    return count;
+}
+
+/**
+ * @brief recomputes every inner node from the leaves
+ */
+void MinTree::rebuildInner()
+{
+    if (leaves == 0)
+        return;
+    for (std::size_t node = leaves - 1; node >= 1; --node)
+    {
+        double l = nodes[2 * node], r = nodes[2 * node + 1];
+        nodes[node] = r < l ? r : l;
+    }
+}
+
+/**
+ * @brief makes room for at least n leaves
+ */
+void MinTree::reserveLeaves(std::size_t n)
+{
+    if (n <= leaves)
+        return;
+    std::size_t size = leaves ? leaves : 1;
+    while (size < n)
+        size <<= 1;
+
+    std::vector<double> grown(2 * size, INF);
+    for (std::size_t i = 0; i < count; ++i)
+        grown[size + i] = nodes[leaves + i];
+    nodes.swap(grown);
+    leaves = size;
+    rebuildInner();
+}
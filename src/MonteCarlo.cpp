@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <vector>
+#include "MonteCarlo.h"
+#include "CellStore.h"
+#include "PackPlan.h"
+#include "Philox.h"
+#include "ThreadPool.h"
+
+// Realizations per pool task. Tasks are merged in index order, so the result does not depend on the thread count
+static const std::size_t CHUNK = 1024;
+
+/**
+ * @brief the varied parameters, in the order their draws are numbered
+ */
+enum Parameter
+{
+    CAPACITY,
+    CHARGE,
+    VOLTAGE,
+    PARAMETERS
+};
+
+/**
+ * @brief parses "<distribution> <spread>" of a vary directive
+ */
+static bool parseVariation(std::istream &fields, Variation &variation)
+{
+    std::string distribution;
+    if (!(fields >> distribution >> variation.spread) || variation.spread < 0)
+        return false;
+    if (distribution == "normal")
+        variation.distribution = Variation::NORMAL;
+    else if (distribution == "uniform")
+        variation.distribution = Variation::UNIFORM;
+    else
+        return false;
+    return true;
+}
+
+/**
+ * @brief parses a Monte Carlo file, see MonteCarloSpec
+ */
+bool loadMonteCarlo(const std::string &path, MonteCarloSpec &spec, std::string &error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    // Monte Carlo directives are handled here and blanked out, like sweep directives
+    std::ostringstream scenarioText;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        ++lineNumber;
+        std::string content = line.substr(0, line.find('#'));
+        std::istringstream fields(content);
+        std::string keyword;
+        if (!(fields >> keyword) || (keyword != "realizations" && keyword != "seed" && keyword != "vary"))
+        {
+            scenarioText << line << '\n';
+            continue;
+        }
+        scenarioText << '\n';
+
+        // Counts are unsigned: a negative one would wrap around, so a leading '-' is refused
+        bool ok;
+        if (keyword == "realizations")
+        {
+            ok = (fields >> std::ws).peek() != '-' && fields >> spec.realizations && spec.realizations > 0;
+        }
+        else if (keyword == "seed")
+        {
+            ok = (fields >> std::ws).peek() != '-' && fields >> spec.seed;
+        }
+        else
+        {
+            std::string parameter;
+            ok = static_cast<bool>(fields >> parameter);
+            if (parameter == "capacity")
+                ok = ok && parseVariation(fields, spec.capacity);
+            else if (parameter == "charge")
+                ok = ok && parseVariation(fields, spec.charge);
+            else if (parameter == "voltage")
+                ok = ok && parseVariation(fields, spec.voltage);
+            else
+                ok = false;
+        }
+        std::string extra;
+        if (!ok || fields >> extra)
+        {
+            error = path + ": line " + std::to_string(lineNumber) + ": cannot parse '" + line + "'";
+            return false;
+        }
+    }
+
+    std::istringstream scenarioIn(scenarioText.str());
+    spec.base.name = path;
+    if (!parseScenario(scenarioIn, spec.base, error))
+    {
+        error = path + ": " + error;
+        return false;
+    }
+    return true;
+}
+
+namespace
+{
+    /**
+     * @brief the four metric summaries of a run of realizations
+     */
+    struct Summary
+    {
+        QuantileSketch capacity;
+        QuantileSketch runtime;
+        QuantileSketch imbalance;
+        QuantileSketch voltage;
+
+        void merge(const Summary &other)
+        {
+            capacity.merge(other.capacity);
+            runtime.merge(other.runtime);
+            imbalance.merge(other.imbalance);
+            voltage.merge(other.voltage);
+        }
+    };
+
+    /**
+     * @brief Draws pack realizations of a spec and measures them; one per task, reused for its whole chunk.
+     *
+     * Every draw has its own Philox counter (cell, parameter, realization)
+     * under the seed, so a realization comes out the same whichever thread
+     * draws it and in whatever order, and varying one more parameter does not
+     * change the draws of the others.
+     */
+    class PackSampler
+    {
+    public:
+        PackSampler(const MonteCarloSpec &spec, const PackPlan &plan) : spec(spec), plan(plan)
+        {
+            for (const CellSpec &cell : spec.base.cells)
+            {
+                double soc = cell.capacity > 0 ? std::min(cell.initialCharge / cell.capacity, 1.0) : 0;
+                voltage.insert(voltage.end(), cell.count, cell.voltage);
+                capacity.insert(capacity.end(), cell.count, cell.capacity);
+                stateOfCharge.insert(stateOfCharge.end(), cell.count, soc);
+                discharge.insert(discharge.end(), cell.count, cell.dischargeRate);
+                recharge.insert(recharge.end(), cell.count, cell.rechargeRate);
+            }
+            std::size_t n = capacity.size();
+            v.resize(n);
+            c.resize(n);
+            q.resize(n);
+            hours.resize(n);
+            nodeHours.resize(plan.getNodes().size());
+            store.setRateModel(spec.base.model);
+            store.reserve(n);
+        }
+
+        /**
+         * @brief draws realization r and adds its metrics to a summary
+         */
+        void sample(std::uint64_t r, Summary &out)
+        {
+            const std::size_t n = capacity.size();
+            double lowest = 1, highest = 0;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                c[i] = capacity[i] * factor(spec.capacity, r, i, CAPACITY);
+                double soc = std::min(stateOfCharge[i] * factor(spec.charge, r, i, CHARGE), 1.0);
+                q[i] = c[i] * soc;
+                v[i] = voltage[i] * factor(spec.voltage, r, i, VOLTAGE);
+                lowest = std::min(lowest, soc);
+                highest = std::max(highest, soc);
+            }
+            store.clear();
+            store.append(v.data(), c.data(), q.data(), n, discharge.data(), recharge.data());
+
+            double packVoltage, packCapacity, packCharge;
+            if (!plan.empty())
+            {
+                plan.evaluate(store, packVoltage, packCapacity, packCharge);
+            }
+            else if (spec.base.type == BatteryPack::SERIES)
+            {
+                packVoltage = store.sumVoltage();
+                packCapacity = store.minCapacity();
+            }
+            else
+            {
+                packVoltage = n ? v[0] : 0;
+                packCapacity = store.sumCapacity();
+            }
+            out.capacity.add(packCapacity);
+            out.runtime.add(runtime());
+            out.imbalance.add(n ? highest - lowest : 0);
+            out.voltage.add(packVoltage);
+        }
+
+    private:
+        const MonteCarloSpec &spec;
+        PackPlan plan; // a copy: evaluate() keeps its scratch in the plan
+        // Nominal columns of the base scenario
+        std::vector<double> voltage, capacity, stateOfCharge, discharge, recharge;
+        // The realization being measured
+        std::vector<double> v, c, q, hours, nodeHours;
+        CellStore store;
+
+        /**
+         * @brief returns the factor a variation puts on a nominal value, never negative
+         */
+        double factor(const Variation &variation, std::uint64_t r, std::size_t cell, Parameter p) const
+        {
+            if (variation.distribution == Variation::NONE)
+                return 1;
+            Philox::Block b = Philox::generate(spec.seed, static_cast<std::uint64_t>(cell) * PARAMETERS + p, r);
+            double x = variation.distribution == Variation::NORMAL ? Philox::normal(b) : 2 * Philox::uniform(b) - 1;
+            double f = 1 + variation.spread * x;
+            return f > 0 ? f : 0;
+        }
+
+        /**
+         * @brief returns the hours until the pack is empty, walking the topology like PackPlan::evaluate()
+         */
+        double runtime()
+        {
+            const std::size_t n = q.size();
+            const RateModel &model = store.getRateModel();
+            for (std::size_t i = 0; i < n; ++i)
+                hours[i] = q[i] > 0 ? model.hoursToEmpty(&q[i], &c[i], &discharge[i], 1) : 0;
+            if (n == 0)
+                return 0;
+            if (plan.empty())
+            {
+                bool series = spec.base.type == BatteryPack::SERIES;
+                return series ? *std::min_element(hours.begin(), hours.end())
+                              : *std::max_element(hours.begin(), hours.end());
+            }
+
+            const std::vector<PackPlan::Node> &nodes = plan.getNodes();
+            for (std::size_t k = nodes.size(); k-- > 0;)
+            {
+                const PackPlan::Node &node = nodes[k];
+                const double *t = (node.leafGroup ? hours.data() : nodeHours.data()) + node.begin;
+                if (node.end == node.begin)
+                    nodeHours[k] = 0;
+                else if (node.series)
+                    nodeHours[k] = *std::min_element(t, t + (node.end - node.begin));
+                else
+                    nodeHours[k] = *std::max_element(t, t + (node.end - node.begin));
+            }
+            return nodeHours[0];
+        }
+    };
+}
+
+/**
+ * @brief draws every realization of the spec on a work-stealing pool and summarises the pack metrics
+ * @param spec the analysis to run
+ * @param threads number of worker threads, 0 for one per hardware thread
+ * @return the summaries, identical for any number of threads
+ *
+ * Each task draws a fixed chunk of realizations into its own summary, and the
+ * summaries are merged in chunk order at the end. Memory stays at one summary
+ * per chunk, whatever the number of realizations.
+ */
+MonteCarloResult runMonteCarlo(const MonteCarloSpec &spec, std::size_t threads)
+{
+    MonteCarloResult result;
+    result.realizations = spec.realizations;
+    result.cells = spec.base.cellCount();
+
+    PackPlan plan;
+    std::string error;
+    if (!spec.base.topology.empty())
+        PackPlan::parse(spec.base.topology, plan, error);
+
+    auto start = std::chrono::steady_clock::now();
+    ThreadPool pool(threads);
+    result.threads = pool.size();
+
+    std::size_t chunks = (spec.realizations + CHUNK - 1) / CHUNK;
+    std::vector<Summary> summaries(chunks);
+    pool.parallelFor(chunks, [&](std::size_t chunk) {
+        PackSampler sampler(spec, plan);
+        std::size_t end = std::min(spec.realizations, (chunk + 1) * CHUNK);
+        for (std::size_t r = chunk * CHUNK; r < end; ++r)
+            sampler.sample(r, summaries[chunk]);
+    }, 1);
+
+    Summary total;
+    for (const Summary &s : summaries)
+        total.merge(s);
+    result.capacity = total.capacity;
+    result.runtime = total.runtime;
+    result.imbalance = total.imbalance;
+    result.voltage = total.voltage;
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.realizationsPerSecond = result.seconds > 0 ? result.realizations / result.seconds : 0;
+    return result;
+}
+
+/**
+ * @brief writes one CSV row per metric: count, mean, standard deviation, extremes and percentiles
+ */
+void writeMonteCarloResults(std::ostream &out, const MonteCarloResult &result)
+{
+    static const double PERCENTILES[] = {0.01, 0.05, 0.5, 0.95, 0.99};
+    out << "metric,count,mean,stddev,min,p1,p5,p50,p95,p99,max\n";
+    const struct
+    {
+        const char *name;
+        const QuantileSketch &sketch;
+    } metrics[] = {{"capacity", result.capacity},
+                   {"runtime", result.runtime},
+                   {"imbalance", result.imbalance},
+                   {"voltage", result.voltage}};
+    for (const auto &m : metrics)
+    {
+        out << m.name << ',' << m.sketch.count() << ',' << m.sketch.mean() << ',' << m.sketch.stddev() << ','
+            << m.sketch.min();
+        for (double p : PERCENTILES)
+            out << ',' << m.sketch.quantile(p);
+        out << ',' << m.sketch.max() << '\n';
+    }
+}
@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "LittleEndian.h"
+#include "PackFile.h"
+#include "SimulationWorker.h"
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char MAGIC[8] = {'B', 'A', 'T', 'P', 'A', 'C', 'K', '\0'};
+static const std::uint64_t FNV_OFFSET = 14695981039346656037ull;
+static const std::uint64_t FNV_PRIME = 1099511628211ull;
+// Columns are written through a buffer of this many 64-bit words (64 KiB)
+static const std::size_t CHUNK_WORDS = 8192;
+
+static std::size_t padded(std::size_t bytes)
+{
+    return (bytes + 7) & ~std::size_t(7);
+}
+
+/**
+ * @brief Writes the body of a snapshot file in fixed-size chunks while hashing it
+ */
+class BodyWriter
+{
+public:
+    BodyWriter(std::FILE *f, bool checksum) : file(f), hashing(checksum), swap(!LittleEndian::host()) {}
+
+    void word(std::uint64_t w)
+    {
+        if (hashing)
+            hash = (hash ^ w) * FNV_PRIME;
+        buffer[used++] = swap ? LittleEndian::swap64(w) : w;
+        if (used == CHUNK_WORDS)
+            flush();
+    }
+
+    void column(const double *values, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            word(LittleEndian::bits(values[i]));
+    }
+
+    // Writes a string zero padded to whole words
+    void text(const std::string &s)
+    {
+        std::vector<unsigned char> bytes(padded(s.size()), 0);
+        std::memcpy(bytes.data(), s.data(), s.size());
+        for (std::size_t i = 0; i < bytes.size(); i += 8)
+            word(LittleEndian::get64(&bytes[i]));
+    }
+
+    /**
+     * @brief writes the buffered words
+     * @return false if any write failed so far
+     */
+    bool flush()
+    {
+        if (used && std::fwrite(buffer.data(), sizeof(std::uint64_t), used, file) != used)
+            failed = true;
+        used = 0;
+        return !failed;
+    }
+
+    std::uint64_t checksum() const
+    {
+        return hashing ? hash : 0;
+    }
+
+private:
+    std::FILE *file;
+    bool hashing;
+    bool swap;
+    bool failed = false;
+    std::uint64_t hash = FNV_OFFSET;
+    std::vector<std::uint64_t> buffer = std::vector<std::uint64_t>(CHUNK_WORDS);
+    std::size_t used = 0;
+};
+
+/**
+ * @brief writes a pack to a snapshot file
+ * @param path the file to write
+ * @param pack the pack; only packs of plain cells can be saved
+ * @param error receives a message on failure
+ * @param charges optional snapshot to take the charges and elapsed hours from instead of the pack
+ * @param checksum whether to compute and store the checksum
+ * @return false if the pack has nested packs or the file cannot be written
+ *
+ * The file is streamed to path + ".tmp" a chunk at a time and renamed over path
+ * once complete, so an interrupted save never leaves a truncated snapshot
+ * behind. With a snapshot only the charges are not read from the pack; the
+ * other columns, topology and model are changed only by the thread that owns
+ * the pack, so this is safe while a worker steps it; with an aging model the
+ * capacities come from the snapshot as well. With a thermal model the nominal
+ * capacities and rates are saved, and charges at the same state of charge of
+ * the nominal capacity. An aging model's state is not saved: the faded
+ * capacities are, and a loaded pack ages on from them as if new.
+ */
+bool savePack(const std::string &path, const BatteryPack &pack, std::string &error, const PackSnapshot *charges,
+              bool checksum)
+{
+    const CellStore &store = pack.getCellStore();
+    std::size_t n = store.size();
+    if (pack.getCells().size() != n)
+    {
+        error = "packs with nested packs cannot be saved";
+        return false;
+    }
+    if (charges && charges->cellCharge.size() != n)
+    {
+        error = "the snapshot does not match the pack";
+        return false;
+    }
+
+    const std::string &topology = pack.getTopology().notation();
+    std::string model = pack.getRateModel().notation();
+    unsigned char header[PackFile::HEADER_SIZE] = {};
+    std::memcpy(header, MAGIC, sizeof MAGIC);
+    LittleEndian::put32(header + 8, PackFile::VERSION);
+    LittleEndian::put32(header + 12, checksum ? PackFile::CHECKSUM : 0);
+    LittleEndian::put32(header + 16, pack.getConnectionType() == BatteryPack::SERIES ? 0 : 1);
+    LittleEndian::put32(header + 20, static_cast<std::uint32_t>(topology.size()));
+    LittleEndian::put64(header + 24, n);
+    LittleEndian::put64(header + 32, LittleEndian::bits(charges ? charges->elapsed : pack.getElapsedHours()));
+    LittleEndian::put32(header + 48, static_cast<std::uint32_t>(model.size()));
+
+    std::string temporary = path + ".tmp";
+    std::FILE *f = std::fopen(temporary.c_str(), "wb");
+    if (!f)
+    {
+        error = "cannot open " + temporary;
+        return false;
+    }
+    bool ok = std::fwrite(header, 1, sizeof header, f) == sizeof header;
+
+    BodyWriter body(f, checksum);
+    body.text(topology);
+    body.text(model);
+    const double *charge = charges ? charges->cellCharge.data() : store.charge.data();
+    const double *nominal = store.nominalCapacities();
+    const CellThermal *thermal = store.getThermal();
+    std::vector<double> agedCapacity;
+    if (charges && store.getAging())
+    {
+        // Aging rewrites the capacities on the worker's thread: take them from the snapshot instead
+        agedCapacity.assign(charges->cellCapacity.begin(), charges->cellCapacity.end());
+        if (thermal)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+                agedCapacity[i] /= thermal->capacityFactor(charges->cellTemperature[i]);
+        }
+        nominal = agedCapacity.data();
+    }
+    std::vector<double> nominalCharge;
+    if (thermal)
+    {
+        const double *capacity = charges ? charges->cellCapacity.data() : store.capacity.data();
+        nominalCharge.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            double c = nominal[i];
+            nominalCharge[i] = c == capacity[i] ? charge[i] : capacity[i] > 0 ? std::min(charge[i] / capacity[i] * c, c) : 0;
+        }
+        charge = nominalCharge.data();
+    }
+    body.column(store.nominalVoltages(), n);
+    body.column(nominal, n);
+    body.column(charge, n);
+    body.column(store.nominalDischargeRates(), n);
+    body.column(store.nominalRechargeRates(), n);
+    ok = body.flush() && ok;
+
+    if (ok && checksum)
+    {
+        LittleEndian::put64(header + 40, body.checksum());
+        ok = std::fseek(f, 40, SEEK_SET) == 0 && std::fwrite(header + 40, 1, 8, f) == 8;
+    }
+    ok = std::fclose(f) == 0 && ok;
+    if (ok && std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        // Windows does not replace an existing file on rename
+        std::remove(path.c_str());
+        ok = std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+    {
+        std::remove(temporary.c_str());
+        error = "cannot write " + path;
+    }
+    return ok;
+}
+
+/**
+ * @brief Read-only view of a whole file: memory mapped where possible, read into memory otherwise
+ */
+class MappedFile
+{
+public:
+    bool open(const std::string &path)
+    {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in)
+            return false;
+        copy.resize(static_cast<std::size_t>(in.tellg()));
+        in.seekg(0);
+        if (!in.read(reinterpret_cast<char *>(copy.data()), static_cast<std::streamsize>(copy.size())))
+            return false;
+        bytes = copy.data();
+        length = copy.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        length = static_cast<std::size_t>(info.st_size);
+        if (length == 0)
+        {
+            ::close(fd);
+            return true;
+        }
+        void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+            return false;
+        madvise(map, length, MADV_SEQUENTIAL);
+        bytes = static_cast<const unsigned char *>(map);
+        return true;
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (bytes)
+            munmap(const_cast<unsigned char *>(bytes), length);
+#endif
+    }
+
+    const unsigned char *data() const
+    {
+        return bytes;
+    }
+
+    std::size_t size() const
+    {
+        return length;
+    }
+
+private:
+    const unsigned char *bytes = nullptr;
+    std::size_t length = 0;
+#ifdef _WIN32
+    std::vector<unsigned char> copy;
+#endif
+};
+
+/**
+ * @brief reads a pack from a snapshot file
+ * @param path the file to read
+ * @param error receives a message on failure
+ * @param verify whether to check the checksum when the file has one
+ * @return the pack, nullptr if the file cannot be read or is not a valid snapshot
+ *
+ * The file is mapped and every column is copied into the pack's cell storage
+ * with one bulk copy; nothing is parsed per cell. On big-endian hosts the
+ * columns are byte-swapped first.
+ */
+std::unique_ptr<BatteryPack> loadPack(const std::string &path, std::string &error, bool verify)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+    const unsigned char *data = file.data();
+    std::size_t size = file.size();
+    if (size < PackFile::HEADER_SIZE || std::memcmp(data, MAGIC, sizeof MAGIC) != 0)
+    {
+        error = path + " is not a pack file";
+        return nullptr;
+    }
+    std::uint32_t version = LittleEndian::get32(data + 8);
+    if (version != 1 && version != PackFile::VERSION)
+    {
+        error = path + ": unsupported pack file version " + std::to_string(version);
+        return nullptr;
+    }
+    std::uint32_t flags = LittleEndian::get32(data + 12);
+    std::uint32_t type = LittleEndian::get32(data + 16);
+    std::size_t topologyBytes = padded(LittleEndian::get32(data + 20));
+    std::uint64_t n = LittleEndian::get64(data + 24);
+    double elapsed = LittleEndian::fromBits(LittleEndian::get64(data + 32));
+    std::size_t modelLength = version == 1 ? 0 : LittleEndian::get32(data + 48);
+    std::size_t textBytes = topologyBytes + padded(modelLength);
+    std::size_t columnCount = version == 1 ? 3 : 5;
+
+    std::size_t body = size - PackFile::HEADER_SIZE;
+    if (type > 1 || textBytes > body || n > (body - textBytes) / (8 * columnCount) ||
+        textBytes + 8 * columnCount * n != body)
+    {
+        error = path + " is truncated or corrupt";
+        return nullptr;
+    }
+
+    bool little = LittleEndian::host();
+    const unsigned char *words = data + PackFile::HEADER_SIZE;
+    if (verify && (flags & PackFile::CHECKSUM))
+    {
+        std::uint64_t hash = FNV_OFFSET;
+        for (std::size_t i = 0; i < body; i += 8)
+        {
+            std::uint64_t w;
+            std::memcpy(&w, words + i, 8);
+            hash = (hash ^ (little ? w : LittleEndian::swap64(w))) * FNV_PRIME;
+        }
+        if (hash != LittleEndian::get64(data + 40))
+        {
+            error = path + ": checksum mismatch";
+            return nullptr;
+        }
+    }
+
+    std::size_t cells = static_cast<std::size_t>(n);
+    const unsigned char *columns = words + textBytes;
+    std::vector<double> swapped;
+    const double *voltage;
+    if (little)
+    {
+        // Columns start 8-byte aligned within a page-aligned mapping
+        voltage = reinterpret_cast<const double *>(columns);
+    }
+    else
+    {
+        swapped.resize(columnCount * cells);
+        for (std::size_t i = 0; i < swapped.size(); ++i)
+            swapped[i] = LittleEndian::fromBits(LittleEndian::get64(columns + 8 * i));
+        voltage = swapped.data();
+    }
+    const double *capacity = voltage + cells;
+    const double *charge = capacity + cells;
+    const double *discharge = columnCount == 5 ? charge + cells : nullptr;
+    const double *recharge = columnCount == 5 ? discharge + cells : nullptr;
+    for (std::size_t i = 0; i < cells; ++i)
+    {
+        if (!(charge[i] >= 0 && charge[i] <= capacity[i]))
+        {
+            error = path + ": cell " + std::to_string(i) + " has a charge outside [0, capacity]";
+            return nullptr;
+        }
+        if (discharge && !(discharge[i] > 0 && recharge[i] > 0))
+        {
+            error = path + ": cell " + std::to_string(i) + " has a rate that is not positive";
+            return nullptr;
+        }
+    }
+
+    RateModel model;
+    std::string spec(reinterpret_cast<const char *>(words + topologyBytes), modelLength);
+    if (!spec.empty() && !RateModel::parse(spec, model, error))
+    {
+        error = path + ": " + error;
+        return nullptr;
+    }
+
+    std::unique_ptr<BatteryPack> pack(new BatteryPack(type == 0 ? BatteryPack::SERIES : BatteryPack::PARALLEL));
+    pack->setRateModel(model);
+    pack->addCells(voltage, capacity, charge, cells, discharge, recharge);
+    pack->setElapsedHours(elapsed);
+    const char *notation = reinterpret_cast<const char *>(words);
+    std::string topology(notation, LittleEndian::get32(data + 20));
+    if (!topology.empty() && !pack->setTopology(topology, error))
+    {
+        error = path + ": " + error;
+        return nullptr;
+    }
+    return pack;
+}
@@ -0,0 +1,192 @@
+#include <cctype>
+#include <utility>
+#include "PackPlan.h"
+#include "CellKernels.h"
+#include "CellStore.h"
+
+/**
+ * @brief parses NsMp notation and builds the plan
+ * @param notation e.g. "96s4p"
+ * @param plan receives the plan
+ * @param error receives a message on failure
+ * @return true on success
+ */
+bool PackPlan::parse(const std::string &notation, PackPlan &plan, std::string &error)
+{
+    // 1. Split into (count, series) levels, outermost first
+    std::vector<std::pair<std::size_t, bool>> levels;
+    std::size_t i = 0;
+    while (i < notation.size())
+    {
+        if (std::isspace(static_cast<unsigned char>(notation[i])))
+        {
+            ++i;
+            continue;
+        }
+        std::size_t count = 0;
+        std::size_t digits = 0;
+        while (i < notation.size() && std::isdigit(static_cast<unsigned char>(notation[i])))
+        {
+            count = count * 10 + (notation[i++] - '0');
+            ++digits;
+        }
+        char kind = i < notation.size() ? static_cast<char>(std::tolower(static_cast<unsigned char>(notation[i]))) : 0;
+        if (digits == 0 || count == 0 || (kind != 's' && kind != 'p'))
+        {
+            error = "invalid topology '" + notation + "', expected e.g. 96s4p";
+            return false;
+        }
+        levels.push_back(std::make_pair(count, kind == 's'));
+        ++i;
+    }
+    if (levels.empty())
+    {
+        error = "empty topology";
+        return false;
+    }
+
+    // 2. Lay the levels out breadth first; node j of a level owns children [j*m, (j+1)*m) of the next one
+    PackPlan built;
+    built.text = notation;
+    std::size_t levelBegin = 0;
+    std::size_t levelSize = 1;
+    for (std::size_t l = 0; l < levels.size(); ++l)
+    {
+        std::size_t fanout = levels[l].first;
+        bool leaf = l + 1 == levels.size();
+        std::size_t childBegin = leaf ? 0 : levelBegin + levelSize;
+        for (std::size_t j = 0; j < levelSize; ++j)
+        {
+            Node node;
+            node.series = levels[l].second;
+            node.leafGroup = leaf;
+            node.begin = static_cast<std::uint32_t>(childBegin + j * fanout);
+            node.end = static_cast<std::uint32_t>(childBegin + (j + 1) * fanout);
+            built.nodes.push_back(node);
+        }
+        levelBegin += levelSize;
+        levelSize *= fanout;
+        if (levelSize > 0xffffffffu)
+        {
+            error = "topology '" + notation + "' is too large";
+            return false;
+        }
+    }
+    built.cells = levelSize;
+
+    plan = std::move(built);
+    return true;
+}
+
+bool PackPlan::empty() const
+{
+    return nodes.empty();
+}
+
+const std::string &PackPlan::notation() const
+{
+    return text;
+}
+
+std::size_t PackPlan::cellCount() const
+{
+    return cells;
+}
+
+const std::vector<PackPlan::Node> &PackPlan::getNodes() const
+{
+    return nodes;
+}
+
+/**
+ * @brief computes the aggregate voltage, capacity and charge of the root in one pass
+ * @param store the cell storage the leaf groups refer to
+ * @param voltage receives the pack voltage
+ * @param capacity receives the pack capacity
+ * @param charge receives the pack charge
+ */
+void PackPlan::evaluate(const CellStore &store, double &voltage, double &capacity, double &charge) const
+{
+    voltage = capacity = charge = 0;
+    if (nodes.empty())
+        return;
+
+    nodeVoltage.resize(nodes.size());
+    nodeCapacity.resize(nodes.size());
+    nodeCharge.resize(nodes.size());
+
+    // Children always come after their parent, so walking backwards visits them first
+    for (std::size_t k = nodes.size(); k-- > 0;)
+    {
+        const Node &node = nodes[k];
+        std::size_t n = node.end - node.begin;
+        const double *v = node.leafGroup ? store.voltage.data() : nodeVoltage.data();
+        const double *c = node.leafGroup ? store.capacity.data() : nodeCapacity.data();
+        const double *q = node.leafGroup ? store.charge.data() : nodeCharge.data();
+        v += node.begin;
+        c += node.begin;
+        q += node.begin;
+
+        if (n == 0)
+        {
+            nodeVoltage[k] = nodeCapacity[k] = nodeCharge[k] = 0;
+        }
+        else if (node.series)
+        {
+            nodeVoltage[k] = CellKernels::sum(v, n);
+            nodeCapacity[k] = CellKernels::min(c, n);
+            nodeCharge[k] = CellKernels::min(q, n);
+        }
+        else
+        {
+            nodeVoltage[k] = v[0];
+            nodeCapacity[k] = CellKernels::sum(c, n);
+            nodeCharge[k] = CellKernels::sum(q, n);
+        }
+    }
+
+    voltage = nodeVoltage[0];
+    capacity = nodeCapacity[0];
+    charge = nodeCharge[0];
+}
+
+/**
+ * @brief takes a cell slot out of its group without shifting the slots of the others
+ * @param slot the slot to remove
+ * @param path receives the slots the cell travels through to the end of the store
+ *
+ * The leaf groups are laid out in slot order, so walking them once moves the
+ * hole left by the cell to the end: each group from the cell's own on gives up
+ * its last slot, and the next group starts one slot earlier, on that hole.
+ */
+void PackPlan::removeCell(std::size_t slot, std::vector<std::size_t> &path)
+{
+    path.assign(1, slot);
+    for (Node &node : nodes)
+    {
+        if (!node.leafGroup || node.end <= slot)
+            continue;
+        if (node.begin > slot)
+            --node.begin;
+        if (node.end - 1 != path.back())
+            path.push_back(node.end - 1);
+        --node.end;
+    }
+    --cells;
+}
+
+/**
+ * @brief appends a new cell slot to the last group
+ */
+void PackPlan::appendCell()
+{
+    for (std::size_t k = nodes.size(); k-- > 0;)
+    {
+        if (nodes[k].leafGroup && nodes[k].end == cells)
+        {
+            ++nodes[k].end;
+            break;
+        }
+    }
+    ++cells;
+}
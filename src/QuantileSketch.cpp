@@ -0,0 +1,148 @@
+#include <cmath>
+#include "QuantileSketch.h"
+
+// Samples below this count as zero, so the bucket index stays in int range
+static const double SMALLEST = 1e-300;
+
+/**
+ * @brief creates an empty sketch
+ * @param alpha relative accuracy of the quantiles, e.g. 0.001 for 0.1%
+ */
+QuantileSketch::QuantileSketch(double alpha)
+    : alpha(alpha), logGamma(std::log((1 + alpha) / (1 - alpha))) {}
+
+int QuantileSketch::bucketOf(double x) const
+{
+    return static_cast<int>(std::ceil(std::log(x) / logGamma));
+}
+
+/**
+ * @brief makes room for bucket index i
+ */
+void QuantileSketch::cover(int i)
+{
+    if (buckets.empty())
+    {
+        first = i;
+        buckets.assign(1, 0);
+    }
+    else if (i < first)
+    {
+        buckets.insert(buckets.begin(), static_cast<std::size_t>(first - i), 0);
+        first = i;
+    }
+    else if (i >= first + static_cast<int>(buckets.size()))
+    {
+        buckets.resize(static_cast<std::size_t>(i - first + 1), 0);
+    }
+}
+
+/**
+ * @brief adds one sample, which must not be negative
+ *
+ * The moments are updated with Welford's method.
+ */
+void QuantileSketch::add(double x)
+{
+    ++n;
+    double delta = x - average;
+    average += delta / static_cast<double>(n);
+    m2 += delta * (x - average);
+    lowest = n == 1 || x < lowest ? x : lowest;
+    highest = n == 1 || x > highest ? x : highest;
+
+    if (x < SMALLEST)
+    {
+        ++zeros;
+        return;
+    }
+    int i = bucketOf(x);
+    cover(i);
+    ++buckets[static_cast<std::size_t>(i - first)];
+}
+
+/**
+ * @brief adds every sample of another sketch with the same alpha
+ */
+void QuantileSketch::merge(const QuantileSketch &other)
+{
+    if (other.n == 0)
+        return;
+    if (n == 0)
+    {
+        *this = other;
+        return;
+    }
+    double total = static_cast<double>(n + other.n);
+    double delta = other.average - average;
+    m2 += other.m2 + delta * delta * static_cast<double>(n) * static_cast<double>(other.n) / total;
+    average += delta * static_cast<double>(other.n) / total;
+    n += other.n;
+    lowest = other.lowest < lowest ? other.lowest : lowest;
+    highest = other.highest > highest ? other.highest : highest;
+
+    zeros += other.zeros;
+    if (!other.buckets.empty())
+    {
+        cover(other.first);
+        cover(other.first + static_cast<int>(other.buckets.size()) - 1);
+        for (std::size_t k = 0; k < other.buckets.size(); ++k)
+            buckets[static_cast<std::size_t>(other.first - first) + k] += other.buckets[k];
+    }
+}
+
+std::uint64_t QuantileSketch::count() const
+{
+    return n;
+}
+
+double QuantileSketch::mean() const
+{
+    return average;
+}
+
+double QuantileSketch::stddev() const
+{
+    return n > 1 ? std::sqrt(m2 / static_cast<double>(n - 1)) : 0;
+}
+
+double QuantileSketch::min() const
+{
+    return lowest;
+}
+
+double QuantileSketch::max() const
+{
+    return highest;
+}
+
+/**
+ * @brief returns the q-quantile, q in [0, 1]; 0 for an empty sketch
+ *
+ * Walks the buckets to the one holding the sample of rank q * (count - 1) and
+ * returns 2 gamma^i / (gamma + 1), clamped to the exact extremes.
+ */
+double QuantileSketch::quantile(double q) const
+{
+    if (n == 0)
+        return 0;
+    if (q <= 0)
+        return lowest;
+    if (q >= 1)
+        return highest;
+    double rank = q * static_cast<double>(n - 1);
+    double seen = static_cast<double>(zeros);
+    if (rank < seen)
+        return 0;
+    double gamma = (1 + alpha) / (1 - alpha);
+    for (std::size_t k = 0; k < buckets.size(); ++k)
+    {
+        seen += static_cast<double>(buckets[k]);
+        if (rank < seen)
+        {
+            double value = 2 * std::exp(logGamma * (first + static_cast<int>(k))) / (gamma + 1);
+            return value < lowest ? lowest : (value > highest ? highest : value);
+        }
+    }
+    return highest;
+}
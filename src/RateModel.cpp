@@ -0,0 +1,263 @@
+#include <sstream>
+#include <string>
+#include "RateModel.h"
+#include "CellKernelsClone.h"
+
+namespace
+{
+    /**
+     * @brief the update loops of one policy, compiled for the baseline ISA and, where possible, for AVX2
+     */
+    template <class Policy>
+    struct Batch
+    {
+        static CellKernels::ChargeStats discharge(const Policy &p, double *q, const double *c, const double *r,
+                                                  std::size_t n, double hours)
+        {
+            return RatePolicy::discharge(p, q, c, r, n, hours);
+        }
+        static CellKernels::ChargeStats recharge(const Policy &p, double *q, const double *c, const double *r,
+                                                 std::size_t n, double hours)
+        {
+            return RatePolicy::recharge(p, q, c, r, n, hours);
+        }
+        // Wide<> makes the loops separate instantiations, so they are inlined into the AVX2 functions only
+        template <class Step>
+        struct Wide : Step
+        {
+        };
+
+        CELLKERNELS_TARGET_AVX2 static CellKernels::ChargeStats dischargeWide(const Policy &p, double *q, const double *c,
+                                                                             const double *r, std::size_t n, double hours)
+        {
+            return RatePolicy::stepAll(Wide<RatePolicy::Discharged<Policy>>{{p, q, c, r, hours}}, q, n);
+        }
+        CELLKERNELS_TARGET_AVX2 static CellKernels::ChargeStats rechargeWide(const Policy &p, double *q, const double *c,
+                                                                            const double *r, std::size_t n, double hours)
+        {
+            return RatePolicy::stepAll(Wide<RatePolicy::Recharged<Policy>>{{p, q, c, r, hours}}, q, n);
+        }
+    };
+
+    /**
+     * @brief index of the table to use: the AVX2 build whenever CellKernels dispatches to AVX2
+     */
+    std::size_t wide()
+    {
+        return CellKernels::useAvx2() ? 1 : 0;
+    }
+}
+
+template <class Policy>
+const Policy &RateModel::policy() const
+{
+    static const Policy stateless = Policy();
+    return stateless;
+}
+
+// The CC/CV policy carries its parameters in the model
+template <>
+const RatePolicy::CcCv &RateModel::policy<RatePolicy::CcCv>() const
+{
+    return taper;
+}
+
+/**
+ * @brief returns the tables of batch functions for a policy, the baseline build first and the AVX2 build second
+ *
+ * Both builds inline the same policy templates and accumulate over the same
+ * lanes, so they give identical results.
+ */
+template <class Policy>
+const RateModel::Table *RateModel::tableFor()
+{
+    static const Table tables[2] = {
+        {
+            [](const RateModel &m, double *q, const double *c, const double *r, std::size_t n, double hours) {
+                return Batch<Policy>::discharge(m.policy<Policy>(), q, c, r, n, hours);
+            },
+            [](const RateModel &m, double *q, const double *c, const double *r, std::size_t n, double hours) {
+                return Batch<Policy>::recharge(m.policy<Policy>(), q, c, r, n, hours);
+            },
+            [](const RateModel &m, const double *q, const double *c, const double *r, std::size_t n) {
+                return RatePolicy::hoursToEmpty(m.policy<Policy>(), q, c, r, n);
+            },
+            [](const RateModel &m, const double *q, const double *c, const double *r, std::size_t n) {
+                return RatePolicy::hoursToFull(m.policy<Policy>(), q, c, r, n);
+            },
+            [](const RateModel &m, const double *q, const double *c, const double *r, std::size_t n, double *t) {
+                RatePolicy::timesToEmpty(m.policy<Policy>(), q, c, r, n, t);
+            },
+            [](const RateModel &m, const double *q, const double *c, const double *r, std::size_t n, double *t) {
+                RatePolicy::timesToFull(m.policy<Policy>(), q, c, r, n, t);
+            },
+        },
+        {
+            [](const RateModel &m, double *q, const double *c, const double *r, std::size_t n, double hours) {
+                return Batch<Policy>::dischargeWide(m.policy<Policy>(), q, c, r, n, hours);
+            },
+            [](const RateModel &m, double *q, const double *c, const double *r, std::size_t n, double hours) {
+                return Batch<Policy>::rechargeWide(m.policy<Policy>(), q, c, r, n, hours);
+            },
+            [](const RateModel &m, const double *q, const double *c, const double *r, std::size_t n) {
+                return RatePolicy::hoursToEmpty(m.policy<Policy>(), q, c, r, n);
+            },
+            [](const RateModel &m, const double *q, const double *c, const double *r, std::size_t n) {
+                return RatePolicy::hoursToFull(m.policy<Policy>(), q, c, r, n);
+            },
+            [](const RateModel &m, const double *q, const double *c, const double *r, std::size_t n, double *t) {
+                RatePolicy::timesToEmpty(m.policy<Policy>(), q, c, r, n, t);
+            },
+            [](const RateModel &m, const double *q, const double *c, const double *r, std::size_t n, double *t) {
+                RatePolicy::timesToFull(m.policy<Policy>(), q, c, r, n, t);
+            },
+        },
+    };
+    return tables;
+}
+
+RateModel::RateModel(Kind k, const Table *t) : type(k), table(t) {}
+
+RateModel::RateModel() : RateModel(CONSTANT_CURRENT, tableFor<RatePolicy::ConstantCurrent>()) {}
+
+RateModel RateModel::constantCurrent()
+{
+    return RateModel();
+}
+
+RateModel RateModel::cRate()
+{
+    return RateModel(C_RATE, tableFor<RatePolicy::CRate>());
+}
+
+/**
+ * @brief returns the CC/CV charging model
+ * @param cvStart fraction of the capacity where the constant-voltage phase starts, in [0, 1)
+ * @param cutoff fraction of the charging current at which charging ends, in (0, 1]
+ */
+RateModel RateModel::ccCv(double cvStart, double cutoff)
+{
+    RateModel model(CC_CV, tableFor<RatePolicy::CcCv>());
+    model.taper.cvStart = cvStart;
+    model.taper.cutoff = cutoff;
+    return model;
+}
+
+/**
+ * @brief parses "constant", "crate" or "cccv [cvStart [cutoff]]"
+ * @param spec the model name followed by its parameters
+ * @param model receives the model
+ * @param error receives a message on failure
+ * @return false if the name or a parameter is invalid
+ */
+bool RateModel::parse(const std::string &spec, RateModel &model, std::string &error)
+{
+    std::istringstream in(spec);
+    std::string name;
+    in >> name;
+    if (name == "constant")
+    {
+        model = constantCurrent();
+    }
+    else if (name == "crate")
+    {
+        model = cRate();
+    }
+    else if (name == "cccv")
+    {
+        RatePolicy::CcCv defaults;
+        double cvStart = defaults.cvStart, cutoff = defaults.cutoff;
+        if (!(in >> cvStart))
+            in.clear();
+        else if (!(in >> cutoff))
+            in.clear();
+        if (!(cvStart >= 0 && cvStart < 1) || !(cutoff > 0 && cutoff <= 1))
+        {
+            error = "cccv needs 0 <= cvStart < 1 and 0 < cutoff <= 1";
+            return false;
+        }
+        model = ccCv(cvStart, cutoff);
+    }
+    else
+    {
+        error = "unknown rate model '" + name + "' (expected constant, crate or cccv)";
+        return false;
+    }
+    std::string rest;
+    if (in >> rest)
+    {
+        error = "unexpected '" + rest + "' after rate model " + name;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief formats a value with the fewest of 15 or 17 digits that reads back to the same double
+ */
+static std::string exactText(double value)
+{
+    std::ostringstream out;
+    out.precision(15);
+    out << value;
+    if (std::stod(out.str()) != value)
+    {
+        out.str("");
+        out.precision(17);
+        out << value;
+    }
+    return out.str();
+}
+
+/**
+ * @brief returns the spec parse() reads back into this model
+ */
+std::string RateModel::notation() const
+{
+    switch (type)
+    {
+    case C_RATE:
+        return "crate";
+    case CC_CV:
+        return "cccv " + exactText(taper.cvStart) + " " + exactText(taper.cutoff);
+    default:
+        return "constant";
+    }
+}
+
+RateModel::Kind RateModel::kind() const
+{
+    return type;
+}
+
+CellKernels::ChargeStats RateModel::discharge(double *q, const double *c, const double *r, std::size_t n,
+                                              double hours) const
+{
+    return table[wide()].discharge(*this, q, c, r, n, hours);
+}
+
+CellKernels::ChargeStats RateModel::recharge(double *q, const double *c, const double *r, std::size_t n,
+                                             double hours) const
+{
+    return table[wide()].recharge(*this, q, c, r, n, hours);
+}
+
+double RateModel::hoursToEmpty(const double *q, const double *c, const double *r, std::size_t n) const
+{
+    return table[wide()].hoursToEmpty(*this, q, c, r, n);
+}
+
+double RateModel::hoursToFull(const double *q, const double *c, const double *r, std::size_t n) const
+{
+    return table[wide()].hoursToFull(*this, q, c, r, n);
+}
+
+void RateModel::timesToEmpty(const double *q, const double *c, const double *r, std::size_t n, double *t) const
+{
+    table[wide()].timesToEmpty(*this, q, c, r, n, t);
+}
+
+void RateModel::timesToFull(const double *q, const double *c, const double *r, std::size_t n, double *t) const
+{
+    table[wide()].timesToFull(*this, q, c, r, n, t);
+}
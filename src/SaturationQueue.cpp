@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include "SaturationQueue.h"
+
+static const double INF = std::numeric_limits<double>::infinity();
+
+// Cells per leaf of the tree
+static const std::size_t BLOCK = 8;
+
+// Summary of no cells: neutral for combine()
+static const SaturationQueue::Span NONE{INF, -INF, false};
+
+/**
+ * @brief returns the summary of two adjacent ranges
+ */
+static SaturationQueue::Span combine(const SaturationQueue::Span &a, const SaturationQueue::Span &b)
+{
+    return SaturationQueue::Span{b.first < a.first ? b.first : a.first, b.last > a.last ? b.last : a.last,
+                                 a.saturated || b.saturated};
+}
+
+/**
+ * @brief resizes to n cells and returns their times to be filled in, followed by rebuild()
+ */
+double *SaturationQueue::reset(std::size_t n)
+{
+    times.resize(n);
+    reserveCells(n);
+    return times.data();
+}
+
+void SaturationQueue::clear()
+{
+    times.clear();
+    nodes.clear();
+    leaves = 0;
+}
+
+/**
+ * @brief appends a cell, amortized O(log n)
+ */
+void SaturationQueue::push(double time)
+{
+    times.push_back(time);
+    if (times.size() > leaves * BLOCK)
+    {
+        reserveCells(times.size());
+        rebuild();
+        return;
+    }
+    updateBlock((times.size() - 1) / BLOCK);
+}
+
+/**
+ * @brief changes the time of cell i, -infinity once it has saturated
+ */
+void SaturationQueue::set(std::size_t i, double time)
+{
+    times[i] = time;
+    updateBlock(i / BLOCK);
+}
+
+/**
+ * @brief removes cell i, shifting later cells down
+ */
+void SaturationQueue::erase(std::size_t i)
+{
+    times.erase(times.begin() + i);
+    rebuild();
+}
+
+/**
+ * @brief exchanges the times of cells i and j
+ */
+void SaturationQueue::swap(std::size_t i, std::size_t j)
+{
+    double t = times[i];
+    set(i, times[j]);
+    set(j, t);
+}
+
+/**
+ * @brief removes the last cell
+ */
+void SaturationQueue::pop()
+{
+    times.pop_back();
+    updateBlock(times.size() / BLOCK);
+}
+
+double SaturationQueue::get(std::size_t i) const
+{
+    return times[i];
+}
+
+std::size_t SaturationQueue::size() const
+{
+    return times.size();
+}
+
+/**
+ * @brief returns the summary of cells [begin, end) from their times, without the tree
+ */
+SaturationQueue::Span SaturationQueue::scan(std::size_t begin, std::size_t end) const
+{
+    Span s = NONE;
+    for (std::size_t i = begin; i < end; ++i)
+    {
+        double t = times[i];
+        if (t == -INF)
+        {
+            s.saturated = true;
+            continue;
+        }
+        s.first = t < s.first ? t : s.first;
+        s.last = t > s.last ? t : s.last;
+    }
+    return s;
+}
+
+/**
+ * @brief returns the summary of cells [begin, end)
+ *
+ * The partial blocks at either end are scanned, the whole blocks in between
+ * come from the tree.
+ */
+SaturationQueue::Span SaturationQueue::span(std::size_t begin, std::size_t end) const
+{
+    std::size_t firstBlock = (begin + BLOCK - 1) / BLOCK, lastBlock = end / BLOCK;
+    if (firstBlock >= lastBlock)
+        return scan(begin, end);
+
+    Span left = scan(begin, firstBlock * BLOCK), right = scan(lastBlock * BLOCK, end);
+    // Bottom-up walk: the left and right edges close in on each other
+    for (std::size_t l = leaves + firstBlock, r = leaves + lastBlock; l < r; l >>= 1, r >>= 1)
+    {
+        if (l & 1)
+            left = combine(left, nodes[l++]);
+        if (r & 1)
+            right = combine(nodes[--r], right);
+    }
+    return combine(left, right);
+}
+
+/**
+ * @brief returns the cell with the earliest pending time, size() if none is pending
+ */
+std::size_t SaturationQueue::next() const
+{
+    if (times.empty() || nodes[1].first == INF)
+        return times.size();
+    std::size_t node = 1;
+    while (node < leaves)
+        node = nodes[2 * node].first == nodes[node].first ? 2 * node : 2 * node + 1;
+    std::size_t i = (node - leaves) * BLOCK;
+    while (times[i] != nodes[node].first)
+        ++i;
+    return i;
+}
+
+namespace
+{
+    /**
+     * @brief a subtree or a single cell (width 0) waiting in earliest(): its earliest time and its first cell
+     */
+    struct Candidate
+    {
+        double first;
+        std::size_t begin;
+        std::size_t node;
+        std::size_t width; // in blocks
+
+        bool operator>(const Candidate &other) const
+        {
+            return first != other.first ? first > other.first : begin > other.begin;
+        }
+    };
+}
+
+/**
+ * @brief appends the up to k cells with the earliest finite pending times to out, earliest first
+ *
+ * Each popped subtree is followed down to its earliest block, whose cells join
+ * the heap; the siblings passed on the way wait in the heap keyed by their
+ * earliest time. Every reported cell therefore costs O(log n) however many
+ * times are equal, and equal times come out in cell order, because the
+ * waiting ranges are disjoint and ordered by their first cell.
+ */
+void SaturationQueue::earliest(std::size_t k, std::vector<std::size_t> &out) const
+{
+    if (times.empty())
+        return;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+    frontier.push(Candidate{nodes[1].first, 0, 1, leaves});
+    while (!frontier.empty() && k != 0)
+    {
+        Candidate c = frontier.top();
+        frontier.pop();
+        if (c.first == INF)
+            break;
+        if (c.width == 0)
+        {
+            out.push_back(c.begin);
+            --k;
+            continue;
+        }
+        while (c.width > 1)
+        {
+            c.width >>= 1;
+            std::size_t left = 2 * c.node, right = left + 1;
+            Candidate other;
+            if (nodes[left].first == c.first)
+            {
+                other = Candidate{nodes[right].first, c.begin + c.width * BLOCK, right, c.width};
+                c.node = left;
+            }
+            else
+            {
+                other = Candidate{nodes[left].first, c.begin, left, c.width};
+                c.node = right;
+                c.begin += c.width * BLOCK;
+            }
+            if (other.first != INF)
+                frontier.push(other);
+        }
+        std::size_t end = c.begin + BLOCK < times.size() ? c.begin + BLOCK : times.size();
+        for (std::size_t i = c.begin; i < end; ++i)
+        {
+            if (times[i] != -INF && times[i] != INF)
+                frontier.push(Candidate{times[i], i, 0, 0});
+        }
+    }
+}
+
+/**
+ * @brief recomputes the leaf of block b and the nodes above it
+ */
+void SaturationQueue::updateBlock(std::size_t b)
+{
+    std::size_t begin = b * BLOCK, end = begin + BLOCK < times.size() ? begin + BLOCK : times.size();
+    std::size_t node = leaves + b;
+    nodes[node] = scan(begin, end);
+    for (node >>= 1; node >= 1; node >>= 1)
+        nodes[node] = combine(nodes[2 * node], nodes[2 * node + 1]);
+}
+
+/**
+ * @brief recomputes the tree from the times, O(n)
+ */
+void SaturationQueue::rebuild()
+{
+    if (leaves == 0)
+        return;
+    for (std::size_t b = 0; b < leaves; ++b)
+    {
+        std::size_t begin = b * BLOCK;
+        nodes[leaves + b] = begin < times.size() ? scan(begin, std::min(begin + BLOCK, times.size())) : NONE;
+    }
+    for (std::size_t node = leaves - 1; node >= 1; --node)
+        nodes[node] = combine(nodes[2 * node], nodes[2 * node + 1]);
+}
+
+/**
+ * @brief makes room for the blocks of at least n cells; the caller rebuilds
+ */
+void SaturationQueue::reserveCells(std::size_t n)
+{
+    std::size_t blocks = (n + BLOCK - 1) / BLOCK;
+    if (blocks <= leaves)
+        return;
+    std::size_t size = leaves ? leaves : 1;
+    while (size < blocks)
+        size <<= 1;
+    nodes.assign(2 * size, NONE);
+    leaves = size;
+}
@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include "Scenario.h"
+#include "Simulator.h"
+
+// Most steps repeat may expand a profile to, so a large count is a parse error rather than an allocation failure
+static const std::size_t MAX_STEPS = std::size_t(1) << 24;
+// Largest derating coefficient: the whole nominal value per kelvin
+static const double MAX_DERATING = 1;
+
+std::size_t Scenario::cellCount() const
+{
+    std::size_t total = 0;
+    for (const CellSpec &spec : cells)
+        total += spec.count;
+    return total;
+}
+
+/**
+ * @brief parses a scenario from a stream
+ * @param in the stream to read
+ * @param scenario receives the parsed scenario
+ * @param error receives a message naming the offending line on failure
+ * @return true on success
+ */
+bool parseScenario(std::istream &in, Scenario &scenario, std::string &error)
+{
+    std::string line;
+    int lineNumber = 0;
+    std::size_t rcPairs = 0;
+    bool derating = false;
+    std::size_t repeatStart = 0;
+    while (std::getline(in, line))
+    {
+        ++lineNumber;
+        std::string::size_type comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+
+        std::istringstream fields(line);
+        std::string keyword;
+        if (!(fields >> keyword))
+            continue;
+
+        bool ok = true;
+        if (keyword == "type")
+        {
+            std::string value;
+            ok = static_cast<bool>(fields >> value);
+            if (value == "series")
+                scenario.type = BatteryPack::SERIES;
+            else if (value == "parallel")
+                scenario.type = BatteryPack::PARALLEL;
+            else
+                ok = false;
+        }
+        else if (keyword == "topology")
+        {
+            ok = static_cast<bool>(fields >> scenario.topology);
+        }
+        else if (keyword == "timestep")
+        {
+            ok = static_cast<bool>(fields >> scenario.timestep) && scenario.timestep > 0;
+        }
+        else if (keyword == "name")
+        {
+            std::getline(fields >> std::ws, scenario.name);
+        }
+        else if (keyword == "cell")
+        {
+            CellSpec spec{0, 0, 0, 1};
+            ok = static_cast<bool>(fields >> spec.voltage >> spec.capacity >> spec.initialCharge);
+            // The trailing fields are optional, but one that is there must parse; a negative count would wrap around
+            if (ok && !(fields >> std::ws).eof())
+                ok = fields.peek() != '-' && fields >> spec.count && spec.count > 0;
+            if (ok && !(fields >> std::ws).eof())
+                ok = static_cast<bool>(fields >> spec.dischargeRate >> spec.rechargeRate) && spec.dischargeRate > 0 &&
+                     spec.rechargeRate > 0;
+            if (ok && !(fields >> std::ws).eof())
+                ok = fields >> spec.impedance && spec.impedance > 0 && (fields >> std::ws).eof();
+            if (ok)
+                scenario.cells.push_back(spec);
+        }
+        else if (keyword == "ocv")
+        {
+            std::vector<double> soc, volts;
+            double x, v;
+            while (fields >> x >> v)
+            {
+                soc.push_back(x);
+                volts.push_back(v);
+            }
+            ok = fields.eof();
+            std::string curveError;
+            if (ok && !scenario.circuit.ocv.set(soc, volts, curveError))
+            {
+                error = "line " + std::to_string(lineNumber) + ": " + curveError;
+                return false;
+            }
+        }
+        else if (keyword == "resistance")
+        {
+            ok = static_cast<bool>(fields >> scenario.circuit.seriesResistance) && scenario.circuit.seriesResistance >= 0;
+        }
+        else if (keyword == "rc")
+        {
+            RcPair pair;
+            ok = static_cast<bool>(fields >> pair.resistance >> pair.capacitance) && pair.resistance > 0 &&
+                 pair.capacitance > 0 && rcPairs < CircuitParameters::PAIRS;
+            if (ok)
+                scenario.circuit.pairs[rcPairs++] = pair;
+        }
+        else if (keyword == "sharing")
+        {
+            scenario.sharing = true;
+        }
+        else if (keyword == "thermal")
+        {
+            ThermalParameters &t = scenario.thermal;
+            ok = static_cast<bool>(fields >> t.heatCapacity >> t.neighbourConductance >> t.coolantConductance >>
+                                   t.coolantTemperature) &&
+                 t.heatCapacity > 0 && t.neighbourConductance >= 0 && t.coolantConductance >= 0;
+            // The trailing fields are optional, but one that is there must parse, like the cell's
+            if (ok && !(fields >> std::ws).eof())
+                ok = fields >> t.resistance && t.resistance >= 0;
+            if (ok && !(fields >> std::ws).eof())
+                ok = fields.peek() != '-' && fields >> t.columns && (fields >> std::ws).eof();
+            scenario.thermalModel = true;
+        }
+        else if (keyword == "derating")
+        {
+            ThermalParameters &t = scenario.thermal;
+            ok = static_cast<bool>(fields >> t.capacityCoefficient >> t.rateCoefficient) &&
+                 std::fabs(t.capacityCoefficient) <= MAX_DERATING && std::fabs(t.rateCoefficient) <= MAX_DERATING &&
+                 (fields >> std::ws).eof();
+            derating = true;
+        }
+        else if (keyword == "aging")
+        {
+            AgingParameters &a = scenario.aging;
+            ok = static_cast<bool>(fields >> a.calendarLoss >> a.cycleLoss) && a.calendarLoss >= 0 && a.cycleLoss >= 0;
+            // The trailing fields are optional, but one that is there must parse, like the cell's
+            if (ok && !(fields >> std::ws).eof())
+                ok = fields >> a.depthExponent && a.depthExponent > 0;
+            if (ok && !(fields >> std::ws).eof())
+                ok = fields >> a.interval && a.interval >= 0 && (fields >> std::ws).eof();
+            scenario.agingModel = true;
+        }
+        else if (keyword == "model")
+        {
+            std::string spec, modelError;
+            std::getline(fields >> std::ws, spec);
+            if (!RateModel::parse(spec, scenario.model, modelError))
+            {
+                error = "line " + std::to_string(lineNumber) + ": " + modelError;
+                return false;
+            }
+        }
+        else if (keyword == "use" || keyword == "recharge")
+        {
+            ScenarioStep step{keyword == "use" ? ScenarioStep::USE : ScenarioStep::RECHARGE, 0};
+            ok = static_cast<bool>(fields >> step.hours) && step.hours >= 0;
+            if (ok)
+                scenario.steps.push_back(step);
+        }
+        else if (keyword == "repeat")
+        {
+            // A negative count would wrap around
+            std::size_t count;
+            ok = (fields >> std::ws).peek() != '-' && fields >> count && count > 0 && (fields >> std::ws).eof();
+            const std::size_t end = scenario.steps.size();
+            if (ok && count > 1 && end > repeatStart &&
+                (repeatStart > MAX_STEPS || count > (MAX_STEPS - repeatStart) / (end - repeatStart)))
+            {
+                error = "line " + std::to_string(lineNumber) + ": repeat " + std::to_string(count) +
+                        " makes more than " + std::to_string(MAX_STEPS) + " steps";
+                return false;
+            }
+            if (ok)
+            {
+                scenario.steps.reserve(repeatStart + (end - repeatStart) * count);
+                for (std::size_t i = 1; i < count; ++i)
+                    scenario.steps.insert(scenario.steps.end(), scenario.steps.begin() + repeatStart,
+                                          scenario.steps.begin() + end);
+                repeatStart = scenario.steps.size();
+            }
+        }
+        else
+        {
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            error = "line " + std::to_string(lineNumber) + ": cannot parse '" + line + "'";
+            return false;
+        }
+    }
+
+    if (rcPairs != 0 && scenario.circuit.ocv.empty())
+    {
+        error = "rc pairs need an ocv curve";
+        return false;
+    }
+    if (scenario.sharing && scenario.circuit.ocv.empty())
+    {
+        error = "current sharing needs an ocv curve";
+        return false;
+    }
+    if (derating && !scenario.thermalModel)
+    {
+        error = "derating needs a thermal model";
+        return false;
+    }
+    if (!scenario.topology.empty())
+    {
+        PackPlan plan;
+        if (!PackPlan::parse(scenario.topology, plan, error))
+            return false;
+        if (plan.cellCount() != scenario.cellCount())
+        {
+            error = "topology " + scenario.topology + " needs " + std::to_string(plan.cellCount()) + " cells, found " +
+                    std::to_string(scenario.cellCount());
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief parses a scenario file, see parseScenario
+ */
+bool loadScenario(const std::string &path, Scenario &scenario, std::string &error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    if (scenario.name.empty())
+        scenario.name = path;
+    if (!parseScenario(in, scenario, error))
+    {
+        error = path + ": " + error;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief builds the pack described by the scenario and plays its time series
+ * @param scenario the scenario to run
+ * @param events optional sink for depletion and overcharge events
+ * @param fastForward with a timestep, skip analytically over ticks in which no cell saturates
+ * @return the pack state before the first step followed by the state after every step
+ */
+std::vector<StepResult> runScenario(const Scenario &scenario, EventSink *events, bool fastForward)
+{
+    BatteryPack pack(scenario.type);
+    pack.setEventSink(events);
+    buildPack(scenario, pack);
+    return playScenario(scenario, pack, fastForward);
+}
+
+/**
+ * @brief adds the scenario's cells to a pack and applies its rate model, circuit, topology, sharing, thermal and
+ *        aging models
+ * @param scenario the scenario to build
+ * @param pack an empty pack of the scenario's connection type
+ */
+void buildPack(const Scenario &scenario, BatteryPack &pack)
+{
+    pack.setRateModel(scenario.model);
+    for (const CellSpec &spec : scenario.cells)
+        pack.addCells(spec.count, spec.voltage, spec.capacity, spec.initialCharge, spec.dischargeRate,
+                      spec.rechargeRate);
+    if (!scenario.circuit.ocv.empty())
+    {
+        pack.setCircuit(scenario.circuit);
+        int index = 0;
+        for (const CellSpec &spec : scenario.cells)
+        {
+            for (std::size_t i = 0; i < spec.count; ++i, ++index)
+            {
+                if (spec.impedance != 1)
+                    pack.setImpedance(index, spec.impedance);
+            }
+        }
+    }
+    pack.setCurrentSharing(scenario.sharing);
+
+    if (!scenario.topology.empty())
+    {
+        std::string error;
+        pack.setTopology(scenario.topology, error);
+    }
+    if (scenario.thermalModel)
+        pack.setThermal(scenario.thermal);
+    if (scenario.agingModel)
+        pack.setAging(scenario.aging);
+}
+
+/**
+ * @brief returns the pack state recorded after a step
+ */
+static StepResult stepResult(const BatteryPack &pack)
+{
+    if (pack.getCells().empty())
+        return StepResult{0, 0, 0};
+    StepResult r{pack.getVoltage(), pack.getCapacity(), pack.getCharge()};
+    if (const CellThermal *thermal = pack.getCellStore().getThermal())
+    {
+        const std::vector<double> &t = thermal->temperature;
+        if (!t.empty())
+            r.temperature = *std::max_element(t.begin(), t.end());
+    }
+    if (const CellAging *aging = pack.getCellStore().getAging())
+    {
+        const std::vector<double> &h = aging->health;
+        if (!h.empty())
+            r.health = std::accumulate(h.begin(), h.end(), 0.0) / static_cast<double>(h.size());
+    }
+    return r;
+}
+
+/**
+ * @brief plays the time series of a scenario on an existing pack, ignoring the scenario's cells
+ * @param scenario the scenario whose steps and timestep to use
+ * @param pack the pack to drive
+ * @param fastForward with a timestep, skip analytically over ticks in which no cell saturates
+ * @return the pack state before the first step followed by the state after every step
+ */
+std::vector<StepResult> playScenario(const Scenario &scenario, BatteryPack &pack, bool fastForward)
+{
+    std::vector<StepResult> results;
+    results.reserve(scenario.steps.size() + 1);
+    results.push_back(stepResult(pack));
+    if (scenario.timestep > 0)
+    {
+        Simulator simulator(pack, scenario.steps, scenario.timestep);
+        simulator.setFastForward(fastForward);
+        for (std::size_t i = 0; i < scenario.steps.size(); ++i)
+        {
+            if (simulator.segment() == i)
+                simulator.finishSegment();
+            results.push_back(stepResult(pack));
+        }
+        return results;
+    }
+    for (const ScenarioStep &step : scenario.steps)
+    {
+        if (step.action == ScenarioStep::USE)
+            pack.use(step.hours);
+        else
+            pack.recharge(step.hours);
+        results.push_back(stepResult(pack));
+    }
+    return results;
+}
+
+/**
+ * @brief writes results as CSV (step,action,hours,voltage,capacity,charge), plus temperature with a thermal model
+ *        and health with an aging model
+ */
+void writeResults(std::ostream &out, const Scenario &scenario, const std::vector<StepResult> &results)
+{
+    out << "step,action,hours,voltage,capacity,charge" << (scenario.thermalModel ? ",temperature" : "")
+        << (scenario.agingModel ? ",health\n" : "\n");
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        const StepResult &r = results[i];
+        out << i << ',';
+        if (i == 0)
+            out << "init,0";
+        else
+            out << (scenario.steps[i - 1].action == ScenarioStep::USE ? "use," : "recharge,") << scenario.steps[i - 1].hours;
+        out << ',' << r.voltage << ',' << r.capacity << ',' << r.charge;
+        if (scenario.thermalModel)
+            out << ',' << r.temperature;
+        if (scenario.agingModel)
+            out << ',' << r.health;
+        out << '\n';
+    }
+}
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <chrono>
+#include "SimulationWorker.h"
+#include "Simulator.h"
+
+// A chunk never covers more than 1/CHUNKS of the profile, so progress moves at least this often
+static const std::uint64_t CHUNKS = 200;
+
+/**
+ * @brief copies the aggregates and the per-cell state of a pack
+ */
+void PackSnapshot::capture(const BatteryPack &pack)
+{
+    const std::vector<Battery *> &cells = pack.getCells();
+    const CellStore &store = pack.getCellStore();
+    bool empty = cells.empty();
+    voltage = empty ? 0 : pack.getVoltage();
+    capacity = empty ? 0 : pack.getCapacity();
+    charge = empty ? 0 : pack.getCharge();
+    elapsed = pack.getElapsedHours();
+
+    const CellThermal *thermal = store.getThermal();
+    if (store.size() == cells.size())
+    {
+        // Only plain cells: getCells() and the store are in the same order
+        cellCharge.assign(store.charge.begin(), store.charge.end());
+        if (thermal || store.getAging())
+            cellCapacity.assign(store.capacity.begin(), store.capacity.end());
+        else
+            cellCapacity.clear();
+        if (store.getCircuit())
+            cellVoltage.assign(store.voltage.begin(), store.voltage.end());
+        else
+            cellVoltage.clear();
+        if (thermal)
+            cellTemperature.assign(thermal->temperature.begin(), thermal->temperature.end());
+        else
+            cellTemperature.clear();
+        return;
+    }
+    // Nested packs may have circuits, thermal or aging models of their own, so their voltages and capacities are
+    // always copied
+    cellCharge.resize(cells.size());
+    cellCapacity.resize(cells.size());
+    cellVoltage.resize(cells.size());
+    cellTemperature.clear();
+    for (std::size_t i = 0; i < cells.size(); ++i)
+    {
+        cellCharge[i] = cells[i]->getCharge();
+        cellCapacity[i] = cells[i]->getCapacity();
+        cellVoltage[i] = cells[i]->getVoltage();
+    }
+}
+
+/**
+ * @brief cancels a running simulation and joins the thread
+ */
+SimulationWorker::~SimulationWorker()
+{
+    cancel();
+    wait();
+}
+
+/**
+ * @brief starts playing a profile on the worker thread
+ * @param pack the pack to drive, must outlive the run
+ * @param profile the segments to play
+ * @param stepHours the tick length, see Simulator
+ * @return false if a run is still in progress
+ */
+bool SimulationWorker::start(BatteryPack &pack, const std::vector<ScenarioStep> &profile, double stepHours)
+{
+    if (active.load(std::memory_order_acquire))
+        return false;
+    wait();
+
+    // No thread is running, so the buffers can be reset without synchronisation
+    middle.store(1, std::memory_order_relaxed);
+    back = 0;
+    front = 2;
+    published = false;
+    stop.store(false, std::memory_order_relaxed);
+    completed.store(false, std::memory_order_relaxed);
+    fraction.store(0, std::memory_order_relaxed);
+
+    active.store(true, std::memory_order_release);
+    thread = std::thread(&SimulationWorker::run, this, &pack, profile, stepHours);
+    return true;
+}
+
+void SimulationWorker::cancel()
+{
+    stop.store(true, std::memory_order_relaxed);
+}
+
+bool SimulationWorker::running() const
+{
+    return active.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief waits for the run to end and releases the thread; the pack belongs to the caller again
+ * @return true if the profile was played to the end, false if it was cancelled
+ */
+bool SimulationWorker::wait()
+{
+    if (thread.joinable())
+        thread.join();
+    return completed.load(std::memory_order_acquire);
+}
+
+double SimulationWorker::progress() const
+{
+    return fraction.load(std::memory_order_relaxed);
+}
+
+void SimulationWorker::setPublishInterval(double seconds)
+{
+    publishInterval = seconds;
+}
+
+/**
+ * @brief returns the newest published snapshot, nullptr before the first one
+ */
+const PackSnapshot *SimulationWorker::latest()
+{
+    if (middle.load(std::memory_order_relaxed) & FRESH)
+    {
+        // acquire pairs with the release in publish(), so the snapshot contents are visible
+        unsigned previous = middle.exchange(front, std::memory_order_acq_rel);
+        front = previous & 3;
+        published = true;
+    }
+    return published ? &buffers[front] : nullptr;
+}
+
+/**
+ * @brief captures the pack into the back buffer and swaps it into the middle
+ */
+void SimulationWorker::publish(const BatteryPack &pack, std::uint64_t sequence, double hours)
+{
+    PackSnapshot &snapshot = buffers[back];
+    snapshot.capture(pack);
+    snapshot.sequence = sequence;
+    snapshot.hours = hours;
+    snapshot.progress = fraction.load(std::memory_order_relaxed);
+    unsigned previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+    back = previous & 3;
+}
+
+/**
+ * @brief worker thread body
+ *
+ * Plays the profile chunk by chunk with fast-forward on, checking for
+ * cancellation and publishing a snapshot when the interval has passed. Chunks
+ * start at one tick and are sized from the time the previous one took, so
+ * that one takes about publishInterval: at most twice the previous chunk and
+ * at most 1/CHUNKS of the profile. Ticks that must be played one by one
+ * (thermal, sharing) thus keep cancellation and snapshots timely.
+ */
+void SimulationWorker::run(BatteryPack *pack, std::vector<ScenarioStep> profile, double stepHours)
+{
+    typedef std::chrono::steady_clock Clock;
+    Simulator simulator(*pack, profile, stepHours);
+    std::uint64_t total = simulator.totalTicks();
+    std::uint64_t limit = total / CHUNKS + 1;
+    std::uint64_t chunk = 1;
+    std::uint64_t sequence = 0;
+    const Clock::duration interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(publishInterval));
+    Clock::time_point lastPublish = Clock::now();
+
+    while (!simulator.done() && !stop.load(std::memory_order_relaxed))
+    {
+        Clock::time_point begin = Clock::now();
+        simulator.advance(chunk);
+        fraction.store(total ? static_cast<double>(simulator.ticks()) / static_cast<double>(total) : 1.0,
+                       std::memory_order_relaxed);
+        Clock::time_point now = Clock::now();
+        if (now - lastPublish >= interval)
+        {
+            publish(*pack, ++sequence, simulator.hours());
+            lastPublish = now;
+        }
+
+        double took = std::chrono::duration<double>(now - begin).count();
+        double fit = took > 0 ? static_cast<double>(chunk) * publishInterval / took : static_cast<double>(limit);
+        double next = std::min(std::min(fit, 2.0 * static_cast<double>(chunk)), static_cast<double>(limit));
+        chunk = next > 1 ? static_cast<std::uint64_t>(next) : 1;
+    }
+    if (simulator.done())
+        fraction.store(1.0, std::memory_order_relaxed);
+    publish(*pack, ++sequence, simulator.hours());
+
+    completed.store(simulator.done(), std::memory_order_release);
+    active.store(false, std::memory_order_release);
+}
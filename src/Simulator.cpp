@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cmath>
+#include "Simulator.h"
+
+// Relative slack when turning hours into tick counts, so rounding never puts a tick
+// boundary on the wrong side of a segment end or a saturation
+static const double TICK_SLACK = 1e-9;
+
+/**
+ * @brief prepares a run, nothing is applied until advance() or run()
+ * @param pack the pack to drive, must outlive the simulator
+ * @param profile the segments to play, in order
+ * @param stepHours the length of one tick in hours, must be positive
+ */
+Simulator::Simulator(BatteryPack &pack, const std::vector<ScenarioStep> &profile, double stepHours)
+    : pack(pack), stepHours(stepHours)
+{
+    segments.reserve(profile.size());
+    for (const ScenarioStep &step : profile)
+    {
+        Segment s;
+        s.recharging = step.action == ScenarioStep::RECHARGE;
+        double ticks = step.hours / stepHours;
+        s.fullTicks = static_cast<std::uint64_t>(std::floor(ticks * (1 + TICK_SLACK)));
+        s.lastTick = step.hours - static_cast<double>(s.fullTicks) * stepHours;
+        if (s.lastTick <= stepHours * TICK_SLACK)
+            s.lastTick = 0;
+        segments.push_back(s);
+    }
+    skipFinished();
+}
+
+void Simulator::setFastForward(bool on)
+{
+    fastForward = on;
+}
+
+bool Simulator::isFastForward() const
+{
+    return fastForward;
+}
+
+std::uint64_t Simulator::tickCount(const Segment &s)
+{
+    return s.fullTicks + (s.lastTick > 0 ? 1 : 0);
+}
+
+/**
+ * @brief applies hours of use or recharge to the pack
+ */
+void Simulator::apply(bool recharging, double hours)
+{
+    if (recharging)
+        pack.recharge(hours);
+    else
+        pack.use(hours);
+    elapsed += hours;
+    ++updates;
+}
+
+/**
+ * @brief moves past finished and empty segments so segment() and done() are exact
+ */
+void Simulator::skipFinished()
+{
+    while (current < segments.size() && tickInSegment >= tickCount(segments[current]))
+    {
+        ++current;
+        tickInSegment = 0;
+    }
+}
+
+/**
+ * @brief plays at most n full-length ticks of the current segment, n > 0
+ * @return the number of ticks played
+ *
+ * Without fast-forward, with current sharing or with a thermal model, this is a plain loop. With it, every tick before the one
+ * in which the next cell saturates goes into one update; if that tick is the
+ * first, it is played alone so its events are exact. With an aging model the
+ * update also ends with the tick that completes the aging interval.
+ */
+std::uint64_t Simulator::playFullTicks(std::uint64_t n)
+{
+    bool recharging = segments[current].recharging;
+    // Shared currents and temperatures change from tick to tick, so the ticks cannot be merged
+    if (!fastForward || pack.isCurrentSharing() || pack.getCellStore().getThermal())
+    {
+        for (std::uint64_t i = 0; i < n; ++i)
+            apply(recharging, stepHours);
+        return n;
+    }
+
+    // Capacities fade at the end of the update that completes an aging interval, so no update may run past one
+    if (const CellAging *aging = pack.getCellStore().getAging())
+    {
+        double due = std::ceil(aging->hoursUntilAging() / stepHours * (1 - TICK_SLACK));
+        if (due < static_cast<double>(n))
+            n = due > 1 ? static_cast<std::uint64_t>(due) : 1;
+    }
+
+    double horizon = pack.hoursUntilSaturation(recharging) / stepHours * (1 - TICK_SLACK);
+    if (horizon > static_cast<double>(n))
+    {
+        apply(recharging, static_cast<double>(n) * stepHours);
+        return n;
+    }
+    // Ticks that end strictly before the saturation
+    std::uint64_t safe = static_cast<std::uint64_t>(std::ceil(horizon));
+    safe = safe > 0 ? safe - 1 : 0;
+    if (safe == 0)
+    {
+        apply(recharging, stepHours);
+        return 1;
+    }
+    apply(recharging, static_cast<double>(safe) * stepHours);
+    return safe;
+}
+
+/**
+ * @brief plays up to ticks ticks of the profile
+ * @return the number of ticks played, less than requested only at the end of the profile
+ */
+std::uint64_t Simulator::advance(std::uint64_t ticks)
+{
+    std::uint64_t start = played;
+    while (ticks > 0 && current < segments.size())
+    {
+        const Segment &s = segments[current];
+        std::uint64_t done;
+        if (tickInSegment < s.fullTicks)
+        {
+            done = playFullTicks(std::min(ticks, s.fullTicks - tickInSegment));
+        }
+        else if (tickInSegment < tickCount(s))
+        {
+            apply(s.recharging, s.lastTick);
+            done = 1;
+        }
+        else
+        {
+            ++current;
+            tickInSegment = 0;
+            continue;
+        }
+        tickInSegment += done;
+        played += done;
+        ticks -= done;
+    }
+    skipFinished();
+    return played - start;
+}
+
+/**
+ * @brief plays the rest of the current segment
+ * @return the number of ticks played
+ */
+std::uint64_t Simulator::finishSegment()
+{
+    if (done())
+        return 0;
+    return advance(tickCount(segments[current]) - tickInSegment);
+}
+
+/**
+ * @brief plays the rest of the profile
+ * @return the number of ticks played
+ */
+std::uint64_t Simulator::run()
+{
+    return advance(totalTicks() - played);
+}
+
+bool Simulator::done() const
+{
+    return current >= segments.size();
+}
+
+std::size_t Simulator::segment() const
+{
+    return current;
+}
+
+std::uint64_t Simulator::ticks() const
+{
+    return played;
+}
+
+double Simulator::hours() const
+{
+    return elapsed;
+}
+
+std::uint64_t Simulator::totalTicks() const
+{
+    std::uint64_t total = 0;
+    for (const Segment &s : segments)
+        total += tickCount(s);
+    return total;
+}
+
+std::uint64_t Simulator::packUpdates() const
+{
+    return updates;
+}
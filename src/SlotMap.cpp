@@ -0,0 +1,89 @@
+#include <utility>
+#include "SlotMap.h"
+
+/**
+ * @brief returns a handle for a new element at position size()
+ */
+CellHandle SlotMap::insert()
+{
+    std::uint32_t key;
+    if (freeKeys.empty())
+    {
+        key = static_cast<std::uint32_t>(keys.size());
+        keys.push_back(Key{0, 0});
+    }
+    else
+    {
+        key = freeKeys.back();
+        freeKeys.pop_back();
+    }
+    keys[key].position = static_cast<std::uint32_t>(owners.size());
+    owners.push_back(key);
+    return CellHandle{key, keys[key].generation};
+}
+
+/**
+ * @brief records that the elements at positions a and b have been exchanged
+ */
+void SlotMap::swap(std::size_t a, std::size_t b)
+{
+    std::swap(owners[a], owners[b]);
+    keys[owners[a]].position = static_cast<std::uint32_t>(a);
+    keys[owners[b]].position = static_cast<std::uint32_t>(b);
+}
+
+/**
+ * @brief records that the last element has been removed; its handles become stale
+ */
+void SlotMap::pop()
+{
+    release(owners.back());
+    owners.pop_back();
+}
+
+/**
+ * @brief records that the element at position i has been removed and the later ones shifted down, O(n)
+ */
+void SlotMap::erase(std::size_t i)
+{
+    release(owners[i]);
+    owners.erase(owners.begin() + i);
+    for (std::size_t p = i; p < owners.size(); ++p)
+        keys[owners[p]].position = static_cast<std::uint32_t>(p);
+}
+
+void SlotMap::clear()
+{
+    for (std::uint32_t key : owners)
+        release(key);
+    owners.clear();
+}
+
+/**
+ * @brief returns the position of a handle's element, size() if the handle is stale
+ */
+std::size_t SlotMap::find(CellHandle h) const
+{
+    if (h.key >= keys.size() || keys[h.key].generation != h.generation)
+        return owners.size();
+    return keys[h.key].position;
+}
+
+CellHandle SlotMap::handle(std::size_t i) const
+{
+    return CellHandle{owners[i], keys[owners[i]].generation};
+}
+
+std::size_t SlotMap::size() const
+{
+    return owners.size();
+}
+
+/**
+ * @brief retires the key of a removed element so its handles go stale
+ */
+void SlotMap::release(std::uint32_t key)
+{
+    ++keys[key].generation;
+    freeKeys.push_back(key);
+}
@@ -0,0 +1,207 @@
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include "Sweep.h"
+#include "ThreadPool.h"
+
+/**
+ * @brief parses a sweep file, see SweepSpec
+ */
+bool loadSweep(const std::string &path, SweepSpec &spec, std::string &error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    // Sweep directives are handled here and blanked out, everything else is a plain scenario.
+    // Blank lines keep the scenario parser's line numbers matching the file.
+    std::ostringstream scenarioText;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        ++lineNumber;
+        std::string content = line.substr(0, line.find('#'));
+        std::istringstream fields(content);
+        std::string keyword, parameter;
+        if (!(fields >> keyword) || keyword != "sweep")
+        {
+            scenarioText << line << '\n';
+            continue;
+        }
+        scenarioText << '\n';
+
+        bool ok = static_cast<bool>(fields >> parameter);
+        std::string value;
+        std::size_t count = 0;
+        while (ok && fields >> value)
+        {
+            ++count;
+            std::istringstream number(value);
+            double x = 0;
+            std::size_t n = 0;
+            if (parameter == "type")
+            {
+                if (value == "series")
+                    spec.types.push_back(BatteryPack::SERIES);
+                else if (value == "parallel")
+                    spec.types.push_back(BatteryPack::PARALLEL);
+                else
+                    ok = false;
+            }
+            else if (parameter == "cells")
+            {
+                // A whole, positive count; a negative one would wrap around
+                ok = number.peek() != '-' && number >> n && n > 0 && number.eof();
+                spec.cellCounts.push_back(n);
+            }
+            else if (!(number >> x) || x < 0 || !number.eof())
+                ok = false;
+            else if (parameter == "capacity")
+                spec.capacities.push_back(x);
+            else if (parameter == "charge")
+                spec.initialCharges.push_back(x);
+            else if (parameter == "duty")
+                spec.dutyScales.push_back(x);
+            else
+                ok = false;
+        }
+        if (!ok || count == 0)
+        {
+            error = path + ": line " + std::to_string(lineNumber) + ": cannot parse '" + line + "'";
+            return false;
+        }
+    }
+
+    std::istringstream scenarioIn(scenarioText.str());
+    spec.base.name = path;
+    if (!parseScenario(scenarioIn, spec.base, error))
+    {
+        error = path + ": " + error;
+        return false;
+    }
+    if (spec.base.cells.empty() && !spec.cellCounts.empty())
+    {
+        error = path + ": 'sweep cells' needs a cell line to copy";
+        return false;
+    }
+    // A topology fixes every group's connection, so only 'sweep cells', which drops it, lets 'sweep type' act
+    if (!spec.types.empty() && !spec.base.topology.empty() && spec.cellCounts.empty())
+    {
+        error = path + ": 'sweep type' has no effect on a topology without 'sweep cells'";
+        return false;
+    }
+    return true;
+}
+
+static std::size_t dimension(std::size_t size)
+{
+    return size == 0 ? 1 : size;
+}
+
+/**
+ * @brief returns the number of scenarios the sweep expands to
+ */
+std::size_t sweepSize(const SweepSpec &spec)
+{
+    return dimension(spec.types.size()) * dimension(spec.cellCounts.size()) * dimension(spec.capacities.size()) *
+           dimension(spec.initialCharges.size()) * dimension(spec.dutyScales.size());
+}
+
+/**
+ * @brief builds scenario number index of the cartesian product and fills the parameter fields of its case
+ * @param spec the sweep
+ * @param index the scenario number, in [0, sweepSize(spec))
+ * @param sweepCase receives the parameters of that scenario
+ */
+Scenario expandSweep(const SweepSpec &spec, std::size_t index, SweepCase &sweepCase)
+{
+    Scenario scenario = spec.base;
+    sweepCase.index = index;
+
+    // Mixed-radix decomposition, the last listed parameter varies fastest
+    std::size_t duty = index % dimension(spec.dutyScales.size());
+    index /= dimension(spec.dutyScales.size());
+    std::size_t charge = index % dimension(spec.initialCharges.size());
+    index /= dimension(spec.initialCharges.size());
+    std::size_t capacity = index % dimension(spec.capacities.size());
+    index /= dimension(spec.capacities.size());
+    std::size_t cells = index % dimension(spec.cellCounts.size());
+    index /= dimension(spec.cellCounts.size());
+    std::size_t type = index;
+
+    if (!spec.types.empty())
+        scenario.type = spec.types[type];
+    if (!spec.cellCounts.empty())
+    {
+        CellSpec cell = scenario.cells[0];
+        cell.count = spec.cellCounts[cells];
+        scenario.cells.assign(1, cell);
+        scenario.topology.clear();
+    }
+    for (CellSpec &cell : scenario.cells)
+    {
+        if (!spec.capacities.empty())
+            cell.capacity = spec.capacities[capacity];
+        if (!spec.initialCharges.empty())
+            cell.initialCharge = spec.initialCharges[charge];
+    }
+    sweepCase.duty = spec.dutyScales.empty() ? 1.0 : spec.dutyScales[duty];
+    for (ScenarioStep &step : scenario.steps)
+        step.hours *= sweepCase.duty;
+
+    sweepCase.type = scenario.type;
+    sweepCase.cells = scenario.cellCount();
+    sweepCase.capacity = scenario.cells.empty() ? 0 : scenario.cells[0].capacity;
+    sweepCase.initialCharge = scenario.cells.empty() ? 0 : scenario.cells[0].initialCharge;
+    return scenario;
+}
+
+/**
+ * @brief runs every scenario of the sweep on a work-stealing pool
+ * @param spec the sweep to run
+ * @param threads number of worker threads, 0 for one per hardware thread
+ * @return results ordered by scenario index regardless of completion order
+ */
+SweepResult runSweep(const SweepSpec &spec, std::size_t threads)
+{
+    SweepResult result;
+    result.cases.resize(sweepSize(spec));
+
+    auto start = std::chrono::steady_clock::now();
+    ThreadPool pool(threads);
+    result.threads = pool.size();
+
+    // Every scenario writes only its own slot, so no synchronisation is needed for the results
+    pool.parallelFor(result.cases.size(), [&](std::size_t i) {
+        SweepCase &c = result.cases[i];
+        Scenario scenario = expandSweep(spec, i, c);
+        std::vector<StepResult> steps = runScenario(scenario);
+        c.initial = steps.front();
+        c.final = steps.back();
+        c.minCharge = c.initial.charge;
+        for (const StepResult &r : steps)
+            c.minCharge = r.charge < c.minCharge ? r.charge : c.minCharge;
+    }, 1);
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.scenariosPerSecond = result.seconds > 0 ? result.cases.size() / result.seconds : 0;
+    return result;
+}
+
+/**
+ * @brief writes one CSV row per scenario
+ */
+void writeSweepResults(std::ostream &out, const SweepResult &result)
+{
+    out << "index,type,cells,capacity,initialCharge,duty,voltage,packCapacity,initialPackCharge,finalPackCharge,minPackCharge\n";
+    for (const SweepCase &c : result.cases)
+    {
+        out << c.index << ',' << (c.type == BatteryPack::SERIES ? "series" : "parallel") << ',' << c.cells << ','
+            << c.capacity << ',' << c.initialCharge << ',' << c.duty << ',' << c.final.voltage << ','
+            << c.final.capacity << ',' << c.initial.charge << ',' << c.final.charge << ',' << c.minCharge << '\n';
+    }
+}
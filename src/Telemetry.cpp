@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include "BatteryPack.h"
+#include "LittleEndian.h"
+#include "Telemetry.h"
+
+#ifdef BATTERY_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+static const char MAGIC[8] = {'B', 'A', 'T', 'T', 'E', 'L', 'E', 'M'};
+static const std::uint32_t VERSION = 1;
+static const std::uint32_t XOR_ENCODED = 1;
+static const std::uint32_t CODEC_STORED = 0;
+static const std::uint32_t CODEC_ZLIB = 1;
+static const std::size_t BLOCK_HEADER = 24;
+// A block holds about this many values (8 MiB), and at most MAX_BLOCK_ROWS rows
+static const std::size_t BLOCK_VALUES = 1 << 20;
+static const std::size_t MAX_BLOCK_ROWS = 4096;
+
+static std::size_t padded(std::size_t bytes)
+{
+    return (bytes + 7) & ~std::size_t(7);
+}
+
+/**
+ * @brief opens the file, writes its header and records the pack's current state as the first row
+ * @param path the file to write
+ * @param pack the pack whose store slots the sampling options refer to
+ * @param options sampling and encoding
+ */
+TelemetryWriter::TelemetryWriter(const std::string &path, const BatteryPack &pack, const TelemetryOptions &options)
+    : decimation(std::max<std::size_t>(options.decimation, 1)), xorEncode(options.xorEncode), level(options.compression)
+{
+    std::size_t cells = pack.getCellStore().size();
+    if (!options.cells.empty())
+    {
+        slots = options.cells;
+    }
+    else if (options.cellStride > 0)
+    {
+        for (std::size_t i = 0; i < cells; i += options.cellStride)
+            slots.push_back(static_cast<std::uint32_t>(i));
+    }
+    contiguous = true;
+    for (std::size_t i = 0; i < slots.size(); ++i)
+    {
+        maxSlot = std::max(maxSlot, slots[i]);
+        contiguous = contiguous && slots[i] == i;
+    }
+    width = 3 + slots.size();
+    blockRows = std::min(std::max<std::size_t>(BLOCK_VALUES / width, 1), MAX_BLOCK_ROWS);
+
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return;
+
+    std::vector<unsigned char> header(24 + padded(4 * slots.size()), 0);
+    std::memcpy(header.data(), MAGIC, sizeof MAGIC);
+    LittleEndian::put32(&header[8], VERSION);
+    LittleEndian::put32(&header[12], xorEncode ? XOR_ENCODED : 0);
+    LittleEndian::put32(&header[16], static_cast<std::uint32_t>(slots.size()));
+    for (std::size_t k = 0; k < slots.size(); ++k)
+        LittleEndian::put32(&header[24 + 4 * k], slots[k]);
+    failed = std::fwrite(header.data(), 1, header.size(), file) != header.size();
+
+    for (Block &b : blocks)
+    {
+        b.values.resize(blockRows * width);
+        idle.push_back(&b);
+    }
+    filling = idle.back();
+    idle.pop_back();
+    previous.assign(width, 0);
+    encoder = std::thread(&TelemetryWriter::encodeLoop, this);
+
+    // The initial state is always recorded
+    skipped = decimation - 1;
+    record(pack);
+}
+
+/**
+ * @brief writes the remaining rows and closes the file
+ */
+TelemetryWriter::~TelemetryWriter()
+{
+    close();
+}
+
+bool TelemetryWriter::isOpen() const
+{
+    return file != nullptr;
+}
+
+std::uint64_t TelemetryWriter::rows() const
+{
+    return recorded;
+}
+
+/**
+ * @brief records the pack's state after an update, subject to decimation
+ *
+ * Called on the thread that steps the pack. Only copies values into the block
+ * being filled; encoding happens on the background thread.
+ */
+void TelemetryWriter::record(const BatteryPack &pack)
+{
+    if (!file || ++skipped < decimation)
+        return;
+    skipped = 0;
+
+    double *row = filling->values.data() + filling->rows * width;
+    bool empty = pack.getCells().empty();
+    row[0] = pack.getElapsedHours();
+    row[1] = empty ? 0 : pack.getVoltage();
+    row[2] = empty ? 0 : pack.getCharge();
+
+    const CellStore &store = pack.getCellStore();
+    const double *charge = store.charge.data();
+    const double *capacity = store.capacity.data();
+    double *soc = row + 3;
+    std::size_t k = slots.size();
+    if (k && maxSlot < store.size())
+    {
+        if (contiguous)
+        {
+            for (std::size_t i = 0; i < k; ++i)
+                soc[i] = charge[i] / capacity[i];
+        }
+        else
+        {
+            for (std::size_t i = 0; i < k; ++i)
+                soc[i] = charge[slots[i]] / capacity[slots[i]];
+        }
+    }
+    else
+    {
+        // Cells were removed since the writer was opened
+        for (std::size_t i = 0; i < k; ++i)
+            soc[i] = slots[i] < store.size() ? charge[slots[i]] / capacity[slots[i]]
+                                             : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    ++recorded;
+    if (++filling->rows == blockRows)
+        submit();
+}
+
+/**
+ * @brief queues the block being filled and takes an idle one, waiting if there is none
+ */
+void TelemetryWriter::submit()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    full.push_back(filling);
+    blockQueued.notify_one();
+    blockFreed.wait(lock, [this] { return !idle.empty(); });
+    filling = idle.back();
+    idle.pop_back();
+    filling->rows = 0;
+}
+
+/**
+ * @brief writes the remaining rows, stops the background thread and closes the file
+ * @return false if any write failed
+ */
+bool TelemetryWriter::close()
+{
+    if (!file)
+        return !failed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (filling->rows)
+            full.push_back(filling);
+        closing = true;
+    }
+    blockQueued.notify_one();
+    encoder.join();
+    failed = std::fclose(file) != 0 || failed;
+    file = nullptr;
+    return !failed;
+}
+
+/**
+ * @brief encoder thread body: encodes and writes queued blocks until closed
+ */
+void TelemetryWriter::encodeLoop()
+{
+    for (;;)
+    {
+        Block *block;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            blockQueued.wait(lock, [this] { return closing || !full.empty(); });
+            if (full.empty())
+                return;
+            block = full.front();
+            full.pop_front();
+        }
+        bool ok = writeBlock(*block);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = failed || !ok;
+            idle.push_back(block);
+        }
+        blockFreed.notify_one();
+    }
+}
+
+/**
+ * @brief encodes one block and appends it to the file
+ * @return false if the write failed
+ *
+ * The block is written as 8 byte planes: plane b holds byte b of every value,
+ * column after column. Values of a column change slowly, so after XOR with
+ * the previous row most high bytes are zero and the planes compress well.
+ */
+bool TelemetryWriter::writeBlock(const Block &block)
+{
+    std::size_t rows = block.rows;
+    std::size_t count = width * rows;
+    std::size_t bytes = 8 * count;
+    planes.resize(bytes);
+    for (std::size_t c = 0; c < width; ++c)
+    {
+        std::uint64_t prev = previous[c];
+        for (std::size_t r = 0; r < rows; ++r)
+        {
+            std::uint64_t w = LittleEndian::bits(block.values[r * width + c]);
+            std::uint64_t e = xorEncode ? w ^ prev : w;
+            prev = w;
+            std::size_t j = c * rows + r;
+            for (std::size_t b = 0; b < 8; ++b)
+                planes[b * count + j] = static_cast<unsigned char>(e >> (8 * b));
+        }
+        previous[c] = prev;
+    }
+
+    const unsigned char *payload = planes.data();
+    std::size_t stored = bytes;
+    std::uint32_t codec = CODEC_STORED;
+#ifdef BATTERY_HAVE_ZLIB
+    if (level > 0)
+    {
+        uLongf size = compressBound(static_cast<uLong>(bytes));
+        packed.resize(size);
+        if (compress2(packed.data(), &size, planes.data(), static_cast<uLong>(bytes), std::min(level, 9)) == Z_OK &&
+            size < bytes)
+        {
+            payload = packed.data();
+            stored = size;
+            codec = CODEC_ZLIB;
+        }
+    }
+#endif
+
+    unsigned char header[BLOCK_HEADER];
+    LittleEndian::put32(header, static_cast<std::uint32_t>(rows));
+    LittleEndian::put32(header + 4, codec);
+    LittleEndian::put64(header + 8, stored);
+    LittleEndian::put64(header + 16, bytes);
+    return std::fwrite(header, 1, sizeof header, file) == sizeof header &&
+           std::fwrite(payload, 1, stored, file) == stored;
+}
+
+/**
+ * @brief reads a telemetry file written by TelemetryWriter
+ * @param path the file to read
+ * @param data receives the history
+ * @param error receives a message on failure
+ * @return false if the file cannot be read or is corrupt
+ */
+bool loadTelemetry(const std::string &path, TelemetryData &data, std::string &error)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    data = TelemetryData();
+
+    unsigned char header[24];
+    if (!in.read(reinterpret_cast<char *>(header), sizeof header) || std::memcmp(header, MAGIC, sizeof MAGIC) != 0)
+    {
+        error = path + " is not a telemetry file";
+        return false;
+    }
+    if (LittleEndian::get32(header + 8) != VERSION)
+    {
+        error = path + ": unsupported telemetry version " + std::to_string(LittleEndian::get32(header + 8));
+        return false;
+    }
+    bool xorEncoded = (LittleEndian::get32(header + 12) & XOR_ENCODED) != 0;
+    std::size_t k = LittleEndian::get32(header + 16);
+    std::vector<unsigned char> slotBytes(padded(4 * k));
+    if (!in.read(reinterpret_cast<char *>(slotBytes.data()), static_cast<std::streamsize>(slotBytes.size())))
+    {
+        error = path + " is truncated";
+        return false;
+    }
+    for (std::size_t i = 0; i < k; ++i)
+        data.cells.push_back(LittleEndian::get32(&slotBytes[4 * i]));
+
+    std::size_t width = 3 + k;
+    std::vector<std::uint64_t> previous(width, 0);
+    std::vector<unsigned char> stored, planes;
+    std::vector<double> column;
+    unsigned char blockHeader[BLOCK_HEADER];
+    while (in.read(reinterpret_cast<char *>(blockHeader), sizeof blockHeader))
+    {
+        std::size_t rows = LittleEndian::get32(blockHeader);
+        std::uint32_t codec = LittleEndian::get32(blockHeader + 4);
+        std::uint64_t storedBytes = LittleEndian::get64(blockHeader + 8);
+        std::uint64_t rawBytes = LittleEndian::get64(blockHeader + 16);
+        if (rawBytes != width * 8 * rows || (codec == CODEC_STORED && storedBytes != rawBytes) || codec > CODEC_ZLIB)
+        {
+            error = path + " is corrupt";
+            return false;
+        }
+        stored.resize(static_cast<std::size_t>(storedBytes));
+        if (!in.read(reinterpret_cast<char *>(stored.data()), static_cast<std::streamsize>(stored.size())))
+        {
+            error = path + " is truncated";
+            return false;
+        }
+        if (codec == CODEC_STORED)
+        {
+            planes.swap(stored);
+        }
+        else
+        {
+#ifdef BATTERY_HAVE_ZLIB
+            planes.resize(static_cast<std::size_t>(rawBytes));
+            uLongf size = static_cast<uLongf>(rawBytes);
+            if (uncompress(planes.data(), &size, stored.data(), static_cast<uLong>(storedBytes)) != Z_OK ||
+                size != rawBytes)
+            {
+                error = path + " is corrupt";
+                return false;
+            }
+#else
+            error = path + " is compressed, but this build has no zlib";
+            return false;
+#endif
+        }
+
+        std::size_t first = data.hours.size();
+        data.hours.resize(first + rows);
+        data.voltage.resize(first + rows);
+        data.charge.resize(first + rows);
+        data.stateOfCharge.resize((first + rows) * k);
+        column.resize(rows);
+        std::size_t count = width * rows;
+        for (std::size_t c = 0; c < width; ++c)
+        {
+            const unsigned char *source = &planes[c * rows];
+            std::uint64_t prev = previous[c];
+            for (std::size_t r = 0; r < rows; ++r)
+            {
+                std::uint64_t e = 0;
+                for (std::size_t b = 0; b < 8; ++b)
+                    e |= static_cast<std::uint64_t>(source[b * count + r]) << (8 * b);
+                prev = xorEncoded ? e ^ prev : e;
+                column[r] = LittleEndian::fromBits(prev);
+            }
+            previous[c] = prev;
+
+            if (c < 3)
+            {
+                std::vector<double> &target = c == 0 ? data.hours : c == 1 ? data.voltage : data.charge;
+                std::copy(column.begin(), column.end(), target.begin() + first);
+            }
+            else
+            {
+                for (std::size_t r = 0; r < rows; ++r)
+                    data.stateOfCharge[(first + r) * k + (c - 3)] = column[r];
+            }
+        }
+    }
+    if (!in.eof() || in.gcount() != 0)
+    {
+        error = path + " is truncated";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief writes a history as CSV (hours,voltage,charge,cell<slot>...)
+ */
+void writeTelemetryCsv(std::ostream &out, const TelemetryData &data)
+{
+    std::size_t k = data.cells.size();
+    out << "hours,voltage,charge";
+    for (std::uint32_t slot : data.cells)
+        out << ",cell" << slot;
+    out << "\n";
+    for (std::size_t r = 0; r < data.hours.size(); ++r)
+    {
+        out << data.hours[r] << "," << data.voltage[r] << "," << data.charge[r];
+        for (std::size_t i = 0; i < k; ++i)
+            out << "," << data.stateOfCharge[r * k + i];
+        out << "\n";
+    }
+}
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include "ThreadPool.h"
+
+// Pool and worker index of the calling thread when it is a pool worker
+static thread_local const ThreadPool *currentPool = nullptr;
+static thread_local std::size_t currentWorker = 0;
+
+/**
+ * @brief starts the workers
+ * @param threads number of workers, 0 for one per hardware thread
+ */
+ThreadPool::ThreadPool(std::size_t threads)
+{
+    if (threads == 0)
+        threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+
+    for (std::size_t i = 0; i < threads; ++i)
+        queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
+    for (std::size_t i = 0; i < threads; ++i)
+        workers.emplace_back(&ThreadPool::run, this, i);
+}
+
+/**
+ * @brief waits for all queued tasks and joins the workers
+ */
+ThreadPool::~ThreadPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+std::size_t ThreadPool::size() const
+{
+    return workers.size();
+}
+
+/**
+ * @brief queues a task; tasks submitted from a worker go to that worker's own deque
+ * @param task the task to run
+ */
+void ThreadPool::submit(std::function<void()> task)
+{
+    std::size_t target = currentPool == this
+                             ? currentWorker
+                             : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    pending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(queues[target]->mutex);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+        // Publishing under sleepMutex keeps a worker from missing the wakeup between its check and its wait
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued.fetch_add(1);
+    }
+    wake.notify_one();
+}
+
+/**
+ * @brief blocks until every submitted task has finished
+ */
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    idle.wait(lock, [this] { return pending.load() == 0; });
+}
+
+/**
+ * @brief takes a task from the worker's own deque or steals one from another worker
+ * @param self the index of the calling worker
+ * @param task receives the task
+ * @return true if a task was taken
+ */
+bool ThreadPool::take(std::size_t self, std::function<void()> &task)
+{
+    {
+        WorkQueue &own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (std::size_t k = 1; k < queues.size(); ++k)
+    {
+        WorkQueue &victim = *queues[(self + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief main loop of worker self
+ * @param self the index of this worker
+ */
+void ThreadPool::run(std::size_t self)
+{
+    currentPool = this;
+    currentWorker = self;
+
+    std::function<void()> task;
+    for (;;)
+    {
+        if (take(self, task))
+        {
+            queued.fetch_sub(1);
+            task();
+            task = nullptr;
+            if (pending.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                idle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() == 0)
+            return;
+    }
+}
+
+/**
+ * @brief runs body(i) for every i in [0, count) across the pool and waits for completion
+ * @param count number of iterations
+ * @param body the function to run, must be safe to call concurrently for different i
+ * @param grain iterations per task, 0 to pick one from count and the pool size
+ *
+ * Must not be called from inside a pool task, since the caller blocks until the
+ * iterations are done.
+ */
+void ThreadPool::parallelFor(std::size_t count, const std::function<void(std::size_t)> &body, std::size_t grain)
+{
+    if (count == 0)
+        return;
+    if (grain == 0)
+        grain = std::max<std::size_t>(1, count / (size() * 8));
+
+    std::atomic<std::size_t> remaining{(count + grain - 1) / grain};
+    std::mutex doneMutex;
+    std::condition_variable done;
+
+    for (std::size_t begin = 0; begin < count; begin += grain)
+    {
+        std::size_t end = std::min(count, begin + grain);
+        submit([&, begin, end] {
+            for (std::size_t i = begin; i < end; ++i)
+                body(i);
+            if (remaining.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                done.notify_all();
+            }
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done.wait(lock, [&] { return remaining.load() == 0; });
+}
@@ -0,0 +1,345 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "CellKernels.h"
+#include "Fleet.h"
+#include "MonteCarlo.h"
+#include "PackFile.h"
+#include "Scenario.h"
+#include "Sweep.h"
+#include "Telemetry.h"
+
+static void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options] <scenario-file>\n"
+              << "  -o <file>                write results to <file> instead of stdout\n"
+              << "  --events <file>          write depletion/overcharge events to <file> (CSV)\n"
+              << "  --sweep                  treat the file as a parameter sweep and run it on all cores\n"
+              << "  --monte-carlo            treat the file as a Monte Carlo analysis and run it on all cores\n"
+              << "  --fleet                  treat the file as a fleet of vehicles and run it on all cores\n"
+              << "  --realizations <n>       override the number of Monte Carlo realizations\n"
+              << "  --seed <n>               override the Monte Carlo seed\n"
+              << "  -j <n>                   number of sweep, Monte Carlo or fleet worker threads (default: one per core)\n"
+              << "  --no-fast-forward        with a timestep, apply every tick instead of skipping ahead\n"
+              << "  --load <pack>            start from a saved pack instead of the scenario's cells\n"
+              << "  --save <pack>            save the pack to <pack> after the run\n"
+              << "  --telemetry <file>       record the pack's history after every update to <file>\n"
+              << "  --telemetry-every <n>    keep one update in <n> (default 1)\n"
+              << "  --telemetry-cells <n>    record the state of charge of every <n>th cell, 0 for none (default 1)\n"
+              << "  --dump-telemetry <file>  write a telemetry file as CSV and exit\n"
+              << "  --scalar                 force the scalar kernels\n"
+              << "  -h, --help               show this help\n";
+}
+
+/**
+ * @brief parses the value of a numeric option as a non-negative integer
+ * @return false, after reporting the option and value, if the value is not one
+ */
+static bool parseCount(const char *option, const char *text, unsigned long long &value)
+{
+    char *end = nullptr;
+    errno = 0;
+    if (*text >= '0' && *text <= '9')
+        value = std::strtoull(text, &end, 10);
+    if (!end || *end != '\0' || errno == ERANGE)
+    {
+        std::cerr << "invalid value '" << text << "' for " << option << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief opens the output file, or returns std::cout when no path was given
+ */
+static std::ostream *openOutput(const std::string &path, std::ofstream &file)
+{
+    if (path.empty())
+        return &std::cout;
+    file.open(path);
+    if (!file)
+    {
+        std::cerr << "cannot open " << path << std::endl;
+        return nullptr;
+    }
+    return &file;
+}
+
+/**
+ * @brief Headless entry point: runs one scenario, sweep, Monte Carlo or fleet file without a display and writes CSV results.
+ */
+int main(int argc, char *argv[])
+{
+    std::string scenarioPath;
+    std::string outputPath;
+    std::string eventsPath;
+    std::string loadPath;
+    std::string savePath;
+    std::string telemetryPath;
+    std::string dumpPath;
+    TelemetryOptions telemetryOptions;
+    bool sweep = false;
+    bool monteCarlo = false;
+    bool fleet = false;
+    std::size_t realizations = 0;
+    std::uint64_t seed = 0;
+    bool seeded = false;
+    bool fastForward = true;
+    std::size_t threads = 0;
+
+    unsigned long long value = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--events") == 0 && i + 1 < argc)
+        {
+            eventsPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+        {
+            loadPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+        {
+            savePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc)
+        {
+            telemetryPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--telemetry-every") == 0 && i + 1 < argc)
+        {
+            if (!parseCount(argv[i], argv[i + 1], value))
+                return 2;
+            telemetryOptions.decimation = static_cast<std::size_t>(value);
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--telemetry-cells") == 0 && i + 1 < argc)
+        {
+            if (!parseCount(argv[i], argv[i + 1], value))
+                return 2;
+            telemetryOptions.cellStride = static_cast<std::size_t>(value);
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--dump-telemetry") == 0 && i + 1 < argc)
+        {
+            dumpPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--sweep") == 0)
+        {
+            sweep = true;
+        }
+        else if (std::strcmp(argv[i], "--monte-carlo") == 0)
+        {
+            monteCarlo = true;
+        }
+        else if (std::strcmp(argv[i], "--fleet") == 0)
+        {
+            fleet = true;
+        }
+        else if (std::strcmp(argv[i], "--realizations") == 0 && i + 1 < argc)
+        {
+            if (!parseCount(argv[i], argv[i + 1], value))
+                return 2;
+            realizations = static_cast<std::size_t>(value);
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            if (!parseCount(argv[i], argv[i + 1], value))
+                return 2;
+            seed = value;
+            seeded = true;
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if (!parseCount(argv[i], argv[i + 1], value))
+                return 2;
+            threads = static_cast<std::size_t>(value);
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--no-fast-forward") == 0)
+        {
+            fastForward = false;
+        }
+        else if (std::strcmp(argv[i], "--scalar") == 0)
+        {
+            CellKernels::setForceScalar(true);
+        }
+        else if (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0)
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else if (argv[i][0] != '-' && scenarioPath.empty())
+        {
+            scenarioPath = argv[i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::ofstream file;
+    std::string error;
+
+    if (!dumpPath.empty())
+    {
+        TelemetryData data;
+        if (!loadTelemetry(dumpPath, data, error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        std::ostream *out = openOutput(outputPath, file);
+        if (!out)
+            return 1;
+        writeTelemetryCsv(*out, data);
+        return 0;
+    }
+
+    if (scenarioPath.empty())
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    if (sweep)
+    {
+        SweepSpec spec;
+        if (!loadSweep(scenarioPath, spec, error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        SweepResult result = runSweep(spec, threads);
+        std::ostream *out = openOutput(outputPath, file);
+        if (!out)
+            return 1;
+        writeSweepResults(*out, result);
+        std::cerr << result.cases.size() << " scenarios on " << result.threads << " threads in " << result.seconds
+                  << " s (" << result.scenariosPerSecond << " scenarios/s)" << std::endl;
+        return 0;
+    }
+
+    if (monteCarlo)
+    {
+        MonteCarloSpec spec;
+        if (!loadMonteCarlo(scenarioPath, spec, error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        if (realizations > 0)
+            spec.realizations = realizations;
+        if (seeded)
+            spec.seed = seed;
+        MonteCarloResult result = runMonteCarlo(spec, threads);
+        std::ostream *out = openOutput(outputPath, file);
+        if (!out)
+            return 1;
+        writeMonteCarloResults(*out, result);
+        std::cerr << result.realizations << " packs of " << result.cells << " cells on " << result.threads
+                  << " threads in " << result.seconds << " s (" << result.realizationsPerSecond << " packs/s)"
+                  << std::endl;
+        return 0;
+    }
+
+    if (fleet)
+    {
+        FleetSpec spec;
+        if (!loadFleet(scenarioPath, spec, error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        FleetResult result = runFleet(spec, threads);
+        std::ostream *out = openOutput(outputPath, file);
+        if (!out)
+            return 1;
+        writeFleetResults(*out, result);
+        std::cerr << result.packs << " packs of " << result.cells / result.packs << " cells on " << result.threads
+                  << " threads: " << result.hours << " h in " << result.ticks << " ticks, " << result.seconds << " s ("
+                  << result.cellUpdatesPerSecond << " cell updates/s)" << std::endl;
+        return 0;
+    }
+
+    Scenario scenario;
+    if (!loadScenario(scenarioPath, scenario, error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<FileEventSink> events;
+    if (!eventsPath.empty())
+    {
+        events.reset(new FileEventSink(eventsPath));
+        if (!events->isOpen())
+        {
+            std::cerr << "cannot open " << eventsPath << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<BatteryPack> pack;
+    if (!loadPath.empty())
+    {
+        pack = loadPack(loadPath, error);
+        if (!pack)
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        pack.reset(new BatteryPack(scenario.type));
+        buildPack(scenario, *pack);
+    }
+    pack->setEventSink(events.get());
+
+    std::unique_ptr<TelemetryWriter> telemetry;
+    if (!telemetryPath.empty())
+    {
+        telemetry.reset(new TelemetryWriter(telemetryPath, *pack, telemetryOptions));
+        if (!telemetry->isOpen())
+        {
+            std::cerr << "cannot open " << telemetryPath << std::endl;
+            return 1;
+        }
+        pack->setTelemetry(telemetry.get());
+    }
+
+    std::vector<StepResult> results = playScenario(scenario, *pack, fastForward);
+    if (telemetry)
+    {
+        pack->setTelemetry(nullptr);
+        if (!telemetry->close())
+        {
+            std::cerr << "cannot write " << telemetryPath << std::endl;
+            return 1;
+        }
+    }
+    if (!savePath.empty() && !savePack(savePath, *pack, error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    std::ostream *out = openOutput(outputPath, file);
+    if (!out)
+        return 1;
+    writeResults(*out, scenario, results);
+    return 0;
+}
@@ -0,0 +1,567 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "BatteryPack.h"
+#include "Fleet.h"
+#include "MonteCarlo.h"
+#include "PackFile.h"
+#include "PackPlan.h"
+#include "Scenario.h"
+#include "SimulationWorker.h"
+#include "Simulator.h"
+#include "Sweep.h"
+
+/**
+ * @brief Behaviour checks of the simulator core, one ctest case per function.
+ *
+ *     battery_tests <case>
+ *
+ * runs a single case and exits with status 1 if any of its checks failed;
+ * without an argument the cases are listed.
+ */
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                                               \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(condition))                                                                                              \
+        {                                                                                                              \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);                        \
+            ++failures;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+/**
+ * @brief a plain cell belongs to one pack at a time; add() refuses it until it is deleted from its pack
+ */
+static void packAddOwnership()
+{
+    // A cell created by one pack cannot be moved into another
+    BatteryPack a(BatteryPack::SERIES), b(BatteryPack::SERIES);
+    Battery *owned = a.addCell(3.7, 2000, 1500);
+    CHECK(!b.add(owned));
+    CHECK(b.getCells().empty());
+    a.deleteBattery(0);
+    CHECK(a.getCells().empty());
+    CHECK(b.getCells().empty());
+
+    // A caller-owned cell moves once its first pack lets it go, with its state
+    Battery cell(3.6, 3000, 1000);
+    CHECK(a.add(&cell));
+    CHECK(!a.add(&cell));
+    CHECK(!b.add(&cell));
+    CHECK(a.getCells().size() == 1);
+    a.use(0.5);
+    const double charge = cell.getCharge();
+    CHECK(charge < 1000);
+    a.deleteBattery(0);
+    CHECK(b.add(&cell));
+    CHECK(b.getCells().size() == 1 && b.getCells()[0] == &cell);
+    CHECK(b.getCharge() == charge);
+    b.deleteBattery(0);
+    CHECK(cell.getCharge() == charge);
+}
+
+/**
+ * @brief handles follow their cells through swap-and-pop deletions and turn stale once theirs is deleted
+ */
+static void handlesFollowCells()
+{
+    const char *topologies[] = {"", "2s6p", "3s2p2s"};
+    for (const char *topology : topologies)
+    {
+        BatteryPack pack(BatteryPack::SERIES);
+        std::string error;
+        for (int k = 0; k < 12; ++k)
+            pack.addCell(3.6, 2000, 100 + k);
+        if (*topology)
+            CHECK(pack.setTopology(topology, error));
+
+        // Each cell is known by its charge, which deletions do not touch
+        std::vector<CellHandle> handles;
+        for (int k = 0; k < 12; ++k)
+            handles.push_back(pack.getHandle(k));
+        CHECK(pack.getHandle(12) == CellHandle());
+        const int order[] = {4, 0, 11, 7, 5};
+        std::vector<bool> deleted(12, false);
+        for (int k : order)
+        {
+            CHECK(pack.deleteBattery(handles[k]));
+            deleted[k] = true;
+            for (int j = 0; j < 12; ++j)
+            {
+                int i = pack.indexOf(handles[j]);
+                if (deleted[j])
+                {
+                    CHECK(i == -1 && pack.getCell(handles[j]) == nullptr);
+                    continue;
+                }
+                CHECK(i >= 0 && i < static_cast<int>(pack.getCells().size()));
+                CHECK(pack.getCell(handles[j]) == pack.getCells()[i]);
+                CHECK(pack.getCell(handles[j])->getCharge() == 100 + j);
+            }
+        }
+        CHECK(pack.getCells().size() == 7);
+        CHECK(!pack.deleteBattery(handles[4]));
+        CHECK(pack.getCells().size() == 7);
+
+        // A new cell may reuse a deleted one's memory and key, but not its handle
+        pack.addCell(3.6, 2000, 500);
+        CellHandle fresh = pack.getHandle(7);
+        CHECK(pack.getCell(fresh)->getCharge() == 500);
+        for (int k : order)
+            CHECK(fresh != handles[k] && pack.getCell(handles[k]) == nullptr);
+
+        // Deleting by index is the same swap-and-pop
+        Battery *last = pack.getCells().back();
+        pack.deleteBattery(0);
+        CHECK(pack.getCells().size() == 7);
+        if (!*topology)
+            CHECK(pack.getCells()[0] == last);
+    }
+}
+
+/**
+ * @brief removeCell() hands back a swap path that moves the removed slot to the end while every other cell stays in
+ *        its group and the groups stay contiguous
+ */
+static void packPlanRemoveCell()
+{
+    const char *topologies[] = {"3s2p", "2s3p4s", "4s1p", "1s5p", "2s2p3p"};
+    for (const char *notation : topologies)
+    {
+        PackPlan original;
+        std::string error;
+        CHECK(PackPlan::parse(notation, original, error));
+        const std::size_t n = original.cellCount();
+        for (std::size_t slot = 0; slot < n; ++slot)
+        {
+            PackPlan plan = original;
+            std::vector<std::size_t> path;
+            plan.removeCell(slot, path);
+            CHECK(plan.cellCount() == n - 1);
+            CHECK(!path.empty() && path.front() == slot && path.back() == n - 1);
+
+            std::vector<std::size_t> cells(n);
+            for (std::size_t i = 0; i < n; ++i)
+                cells[i] = i;
+            for (std::size_t k = 0; k + 1 < path.size(); ++k)
+                std::swap(cells[path[k]], cells[path[k + 1]]);
+            CHECK(cells.back() == slot);
+            cells.pop_back();
+
+            const std::vector<PackPlan::Node> &before = original.getNodes(), &after = plan.getNodes();
+            CHECK(before.size() == after.size());
+            std::size_t covered = 0;
+            for (std::size_t k = 0; k < after.size() && k < before.size(); ++k)
+            {
+                if (!after[k].leafGroup)
+                {
+                    CHECK(after[k].begin == before[k].begin && after[k].end == before[k].end);
+                    continue;
+                }
+                const bool owner = before[k].begin <= slot && slot < before[k].end;
+                CHECK(after[k].begin == covered);
+                CHECK(after[k].end - after[k].begin == before[k].end - before[k].begin - (owner ? 1 : 0));
+                for (std::size_t i = after[k].begin; i < after[k].end; ++i)
+                    CHECK(cells[i] >= before[k].begin && cells[i] < before[k].end);
+                covered = after[k].end;
+            }
+            CHECK(covered == n - 1);
+        }
+    }
+}
+
+/**
+ * @brief parses a scenario given as text, failing the case if it does not parse
+ */
+static bool parse(const std::string &text, Scenario &scenario)
+{
+    std::istringstream in(text);
+    std::string error;
+    bool ok = parseScenario(in, scenario, error);
+    if (!ok)
+        std::fprintf(stderr, "scenario rejected: %s\n", error.c_str());
+    CHECK(ok);
+    return ok;
+}
+
+/**
+ * @brief returns a scenario of topology whose n cells all differ, so sums depend on their order
+ * @param steps the scenario's steps, each line ending in a newline
+ */
+static std::string unevenScenario(const std::string &topology, std::size_t n, const std::string &steps)
+{
+    std::ostringstream text;
+    text.precision(17);
+    text << "topology " << topology << "\ntimestep 0.1\n";
+    for (std::size_t k = 0; k < n; ++k)
+        text << "cell " << 3.6 + 0.013 * k / 3 << ' ' << 3000 - 7.1 * k << ' ' << 2000 + 31.7 * k / 7 << " 1 "
+             << 100 + 1.3 * k << ' ' << 150 - 0.7 * k << '\n';
+    return text.str() + steps;
+}
+
+/**
+ * @brief a fleet of one pack aggregates its cells bit for bit like BatteryPack, for group sizes around LANES and
+ *        SMALL_GROUP, as built and after a single tick
+ *
+ * Longer profiles are not compared: the fleet splits its updates at step ends
+ * where the pack plays whole ticks, so the cells' charges may round apart.
+ */
+static void fleetMatchesPack()
+{
+    const std::size_t sizes[] = {1, 3, 7, 8, 9, 10, 11, 12, 13, 15, 16, 17, 31, 32, 33, 40};
+    const char *profiles[] = {"", "use 0.1\n", "recharge 0.1\n"};
+    for (std::size_t n : sizes)
+    {
+        const std::string topologies[] = {"1s" + std::to_string(n) + "p", std::to_string(n) + "s1p",
+                                          "2s" + std::to_string(n) + "p"};
+        for (std::size_t k = 0; k < 9; ++k)
+        {
+            const std::string &topology = topologies[k % 3];
+            FleetSpec spec;
+            const std::size_t cells = k % 3 == 2 ? 2 * n : n;
+            if (!parse(unevenScenario(topology, cells, profiles[k / 3]), spec.base))
+                continue;
+            FleetResult fleet = runFleet(spec, 1);
+
+            BatteryPack pack(spec.base.type);
+            buildPack(spec.base, pack);
+            Simulator simulator(pack, spec.base.steps, spec.base.timestep);
+            simulator.setFastForward(false);
+            simulator.advance(simulator.totalTicks());
+
+            const bool same = fleet.final.size() == 1 && fleet.final[0].charge == pack.getCharge() &&
+                              fleet.final[0].voltage == pack.getVoltage() &&
+                              fleet.final[0].capacity == pack.getCapacity();
+            if (!same)
+                std::fprintf(stderr, "%s %s: fleet %.17g %.17g %.17g, pack %.17g %.17g %.17g\n", topology.c_str(),
+                             profiles[k / 3], fleet.final[0].voltage, fleet.final[0].capacity, fleet.final[0].charge,
+                             pack.getVoltage(), pack.getCapacity(), pack.getCharge());
+            CHECK(same);
+        }
+    }
+}
+
+/**
+ * @brief writes text to a file in the working directory and returns its path
+ */
+static std::string writeFile(const std::string &name, const std::string &text)
+{
+    std::ofstream(name) << text;
+    return name;
+}
+
+/**
+ * @brief a saved pack loads back with the same layout, cells, rate model and elapsed time; a corrupted one does not
+ */
+static void packFileRoundTrip()
+{
+    const std::string topologies[] = {"", "2s3p", "3s2p"};
+    for (const std::string &topology : topologies)
+    {
+        Scenario scenario;
+        std::string text = unevenScenario(topology.empty() ? "1s6p" : topology, 6, "use 2.5\n");
+        if (topology.empty())
+            text = "type parallel\nmodel cccv 0.8 0.05\n" + text.substr(text.find('\n') + 1);
+        if (!parse(text, scenario))
+            continue;
+        BatteryPack pack(scenario.type);
+        buildPack(scenario, pack);
+        pack.use(2.5);
+
+        for (bool checksum : {true, false})
+        {
+            std::string error;
+            CHECK(savePack("round_trip.bpk", pack, error, nullptr, checksum));
+            std::unique_ptr<BatteryPack> loaded = loadPack("round_trip.bpk", error);
+            CHECK(loaded != nullptr);
+            if (!loaded)
+            {
+                std::fprintf(stderr, "%s\n", error.c_str());
+                continue;
+            }
+            CHECK(loaded->getConnectionType() == pack.getConnectionType());
+            CHECK(loaded->getTopology().notation() == pack.getTopology().notation());
+            CHECK(loaded->getRateModel().notation() == pack.getRateModel().notation());
+            CHECK(loaded->getElapsedHours() == pack.getElapsedHours());
+            CHECK(loaded->getCells().size() == pack.getCells().size());
+            const CellStore &a = pack.getCellStore(), &b = loaded->getCellStore();
+            for (std::size_t i = 0; i < a.size() && i < b.size(); ++i)
+            {
+                CHECK(b.nominalVoltage(i) == a.nominalVoltage(i));
+                CHECK(b.capacity[i] == a.capacity[i]);
+                CHECK(b.charge[i] == a.charge[i]);
+                CHECK(b.nominalDischargeRate(i) == a.nominalDischargeRate(i));
+                CHECK(b.nominalRechargeRate(i) == a.nominalRechargeRate(i));
+            }
+            CHECK(loaded->getVoltage() == pack.getVoltage());
+            CHECK(loaded->getCharge() == pack.getCharge());
+        }
+
+        // A flipped bit in the body fails the checksum
+        std::string error;
+        CHECK(savePack("round_trip.bpk", pack, error));
+        std::fstream file("round_trip.bpk", std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(-3, std::ios::end);
+        char byte = static_cast<char>(file.get());
+        file.seekp(-3, std::ios::end);
+        file.put(static_cast<char>(byte ^ 0x10));
+        file.close();
+        CHECK(loadPack("round_trip.bpk", error) == nullptr);
+        CHECK(loadPack("round_trip.bpk", error, false) != nullptr);
+    }
+}
+
+/**
+ * @brief returns true if a and b agree to within a relative tolerance of scale
+ */
+static bool close(double a, double b, double scale)
+{
+    return std::fabs(a - b) <= 1e-9 * std::max(std::fabs(scale), 1.0);
+}
+
+/**
+ * @brief fast-forwarded profiles land on the state plain ticking reaches, with fewer pack updates
+ *
+ * Merged ticks add up in another order than single ones, so the two agree to
+ * rounding rather than bit for bit.
+ */
+static void fastForwardMatchesTicks()
+{
+    const std::string profile = "use 13.35\nrecharge 21\nuse 30\nrecharge 0.05\nuse 4.42\n";
+    const std::string variants[] = {"", "model cccv 0.8 0.05\n", "model crate\n",
+                                    "ocv 0 3.0 0.5 3.7 1 4.2\nresistance 0.02\nrc 0.015 3000\n",
+                                    "aging 0.02 0.001 1.5 2\n"};
+    const char *topologies[] = {"1s12p", "12s1p", "3s4p"};
+    for (const std::string &variant : variants)
+    {
+        for (const char *topology : topologies)
+        {
+            Scenario scenario;
+            if (!parse(variant + unevenScenario(topology, 12, profile), scenario))
+                continue;
+            BatteryPack fast(scenario.type), ticked(scenario.type);
+            buildPack(scenario, fast);
+            buildPack(scenario, ticked);
+            Simulator a(fast, scenario.steps, scenario.timestep), b(ticked, scenario.steps, scenario.timestep);
+            b.setFastForward(false);
+            a.run();
+            b.run();
+
+            CHECK(a.ticks() == b.ticks() && a.ticks() == a.totalTicks());
+            CHECK(a.packUpdates() < b.packUpdates());
+            CHECK(close(a.hours(), b.hours(), b.hours()));
+            CHECK(close(fast.getElapsedHours(), ticked.getElapsedHours(), ticked.getElapsedHours()));
+            bool same = close(fast.getVoltage(), ticked.getVoltage(), ticked.getVoltage()) &&
+                        close(fast.getCapacity(), ticked.getCapacity(), ticked.getCapacity()) &&
+                        close(fast.getCharge(), ticked.getCharge(), ticked.getCapacity());
+            const CellStore &x = fast.getCellStore(), &y = ticked.getCellStore();
+            for (std::size_t i = 0; i < x.size(); ++i)
+                same = same && close(x.charge[i], y.charge[i], y.capacity[i]) &&
+                       close(x.capacity[i], y.capacity[i], y.capacity[i]) && close(x.voltage[i], y.voltage[i], 1);
+            if (!same)
+                std::fprintf(stderr, "%s%s: fast %.17g %.17g %.17g, ticked %.17g %.17g %.17g\n", variant.c_str(),
+                             topology, fast.getVoltage(), fast.getCapacity(), fast.getCharge(), ticked.getVoltage(),
+                             ticked.getCapacity(), ticked.getCharge());
+            CHECK(same);
+        }
+    }
+}
+
+/**
+ * @brief fleet files with a vehicle count that is negative, not a whole number or too large are rejected
+ */
+static void fleetRejectsBadVehicles()
+{
+    const std::string base = "cell 3.7 2000 1500 4\ntimestep 0.1\nuse 1\n";
+    const char *bad[] = {"-1", "0", "2.5", "1 2", "18446744073709551616", "2000000000"};
+    for (const char *count : bad)
+    {
+        FleetSpec spec;
+        std::string error;
+        CHECK(!loadFleet(writeFile("fleet_vehicles.scenario", base + "vehicles " + count + "\n"), spec, error));
+    }
+    FleetSpec spec;
+    std::string error;
+    CHECK(loadFleet(writeFile("fleet_vehicles.scenario", base + "vehicles 3\n"), spec, error));
+    CHECK(spec.vehicles == 3);
+}
+
+/**
+ * @brief Monte Carlo files with a negative or fractional realization count or a negative seed are rejected
+ */
+static void monteCarloRejectsBadCounts()
+{
+    const std::string base = "cell 3.7 2000 1500 4\nuse 1\nvary capacity normal 0.02\n";
+    const char *bad[] = {"realizations -1", "realizations 0", "realizations 2.5", "realizations 10 x", "seed -3"};
+    for (const char *line : bad)
+    {
+        MonteCarloSpec spec;
+        std::string error;
+        CHECK(!loadMonteCarlo(writeFile("monte_carlo_counts.scenario", base + line + "\n"), spec, error));
+    }
+    MonteCarloSpec spec;
+    std::string error;
+    CHECK(loadMonteCarlo(writeFile("monte_carlo_counts.scenario", base + "realizations 25\nseed 7\n"), spec, error));
+    CHECK(spec.realizations == 25 && spec.seed == 7);
+}
+
+/**
+ * @brief returns true if a scenario made of a cell line and the given lines parses
+ */
+static bool parses(const std::string &lines)
+{
+    Scenario scenario;
+    std::istringstream in("cell 3.7 2000 1500 4\n" + lines);
+    std::string error;
+    return parseScenario(in, scenario, error);
+}
+
+/**
+ * @brief malformed directives are parse errors, never wrapped counts, silently dropped fields or aborts
+ */
+static void scenarioRejectsMalformed()
+{
+    const char *bad[] = {
+        "use 1\nrepeat -1\n",
+        "use 1\nrepeat 0\n",
+        "use 1\nrepeat 2 junk\n",
+        "use 1\nrepeat 2.5\n",
+        "use 1\nrecharge 1\nrepeat 9223372036854775807\n",
+        "use 1\nrepeat 18446744073709551615\n",
+        "aging 0.02 0.0001 junk\n",
+        "aging 0.02 0.0001 1.5 24 junk\n",
+        "aging 0.02 0.0001 -1\n",
+        "thermal 45 0.5 0.1 25 0.03 -3\n",
+        "thermal 45 0.5 0.1 25 0.03 4 junk\n",
+        "thermal 45 0.5 0.1 25 0.03 2.5\n",
+        "thermal 45 0.5 0.1 25 x\n",
+        "thermal 45 0.5 0.1 25\nderating 0.005 0.01 junk\n",
+        "thermal 45 0.5 0.1 25\nderating 0.005 2\n",
+        "thermal 45 0.5 0.1 25\nderating -1.5 0.01\n",
+    };
+    for (const char *lines : bad)
+    {
+        if (parses(lines))
+            std::fprintf(stderr, "accepted: %s", lines);
+        CHECK(!parses(lines));
+    }
+    const char *good[] = {
+        "use 1\nrecharge 1\nrepeat 3650\n",
+        "aging 0.02 0.0001\n",
+        "aging 0.02 0.0001 1.5 24   # with a comment\n",
+        "thermal 45 0.5 0.1 25 0.03 4\nderating -0.005 0.01\n",
+    };
+    for (const char *lines : good)
+        CHECK(parses(lines));
+
+    Scenario scenario;
+    std::istringstream in("cell 3.7 2000 1500\nuse 1\nrecharge 2\nrepeat 3\nuse 4\nrepeat 2\n");
+    std::string error;
+    CHECK(parseScenario(in, scenario, error));
+    CHECK(scenario.steps.size() == 8 && scenario.steps[6].hours == 4 && scenario.steps[7].hours == 4);
+}
+
+/**
+ * @brief sweep files with cell counts that are not whole and positive, or a type sweep a topology ignores, are
+ *        rejected
+ */
+static void sweepRejectsMalformed()
+{
+    const std::string base = "cell 3.7 2000 1500 4\nuse 1\n";
+    const char *bad[] = {
+        "sweep cells 10 0\n",
+        "sweep cells 2.5\n",
+        "sweep cells -1\n",
+        "sweep cells 10x\n",
+        "sweep cells\n",
+        "sweep capacity 2000abc\n",
+        "topology 2s2p\nsweep type series parallel\n",
+    };
+    for (const char *lines : bad)
+    {
+        SweepSpec spec;
+        std::string error;
+        if (loadSweep(writeFile("sweep_malformed.scenario", base + lines), spec, error))
+            std::fprintf(stderr, "accepted: %s", lines);
+        CHECK(!loadSweep(writeFile("sweep_malformed.scenario", base + lines), spec, error));
+    }
+    SweepSpec spec;
+    std::string error;
+    CHECK(loadSweep(writeFile("sweep_malformed.scenario",
+                              base + "topology 2s2p\nsweep cells 10 100\nsweep type series parallel\n"),
+                    spec, error));
+    CHECK(spec.cellCounts.size() == 2 && spec.cellCounts[0] == 10 && spec.cellCounts[1] == 100);
+    CHECK(sweepSize(spec) == 4);
+}
+
+/**
+ * @brief snapshots carry the cell voltages a circuit rewrites on every update, and only then
+ */
+static void snapshotCarriesVoltages()
+{
+    const std::string cells = "cell 3.7 2500 2500 3\ncell 3.6 2000 800 2\n";
+    Scenario plain, circuit;
+    if (!parse(cells, plain) || !parse(cells + "ocv 0 3.0 0.5 3.7 1 4.2\nresistance 0.02\nrc 0.015 3000\n", circuit))
+        return;
+
+    BatteryPack a(plain.type), b(circuit.type);
+    buildPack(plain, a);
+    buildPack(circuit, b);
+    a.use(0.5);
+    b.use(0.5);
+    PackSnapshot snapshot;
+    snapshot.capture(a);
+    CHECK(snapshot.cellVoltage.empty());
+    snapshot.capture(b);
+    CHECK(snapshot.cellVoltage.size() == b.getCells().size());
+    for (std::size_t i = 0; i < snapshot.cellVoltage.size(); ++i)
+        CHECK(snapshot.cellVoltage[i] == b.getCells()[i]->getVoltage());
+    CHECK(snapshot.cellVoltage[0] != snapshot.cellVoltage[3]);
+}
+
+struct TestCase
+{
+    const char *name;
+    void (*run)();
+};
+
+static const TestCase CASES[] = {
+    {"pack_add_ownership", packAddOwnership},
+    {"handles_follow_cells", handlesFollowCells},
+    {"pack_plan_remove_cell", packPlanRemoveCell},
+    {"fleet_matches_pack", fleetMatchesPack},
+    {"fleet_rejects_bad_vehicles", fleetRejectsBadVehicles},
+    {"monte_carlo_rejects_bad_counts", monteCarloRejectsBadCounts},
+    {"scenario_rejects_malformed", scenarioRejectsMalformed},
+    {"sweep_rejects_malformed", sweepRejectsMalformed},
+    {"snapshot_carries_voltages", snapshotCarriesVoltages},
+    {"pack_file_round_trip", packFileRoundTrip},
+    {"fast_forward_matches_ticks", fastForwardMatchesTicks},
+};
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        for (const TestCase &c : CASES)
+            std::printf("%s\n", c.name);
+        return 0;
+    }
+    for (const TestCase &c : CASES)
+    {
+        if (std::strcmp(c.name, argv[1]) == 0)
+        {
+            c.run();
+            return failures ? 1 : 0;
+        }
+    }
+    std::fprintf(stderr, "unknown case '%s'\n", argv[1]);
+    return 2;
+}
@@ -0,0 +1,32 @@
+# Runs the Monte Carlo example and checks that the voltage percentiles are
+# resolved: p1 < p5 < p95 < p99, all within the sample extremes.
+#
+#   cmake -DBATTERY_SIM=<path> -DSCENARIO=<path> -P monte_carlo_percentiles.cmake
+
+execute_process(
+    COMMAND ${BATTERY_SIM} --monte-carlo ${SCENARIO} --realizations 10000 -j 1
+    OUTPUT_VARIABLE output
+    ERROR_QUIET
+    RESULT_VARIABLE status)
+if (NOT status EQUAL 0)
+    message(FATAL_ERROR "battery_sim failed with ${status}")
+endif()
+
+string(REGEX MATCH "\nvoltage,[^\n]*" row "${output}")
+if (NOT row)
+    message(FATAL_ERROR "no voltage row in:\n${output}")
+endif()
+string(STRIP "${row}" row)
+string(REPLACE "," ";" fields "${row}")
+# metric,count,mean,stddev,min,p1,p5,p50,p95,p99,max
+list(GET fields 4 min)
+list(GET fields 5 p1)
+list(GET fields 6 p5)
+list(GET fields 8 p95)
+list(GET fields 9 p99)
+list(GET fields 10 max)
+
+if (p1 LESS min OR NOT p1 LESS p5 OR NOT p5 LESS p95 OR NOT p95 LESS p99 OR max LESS p99)
+    message(FATAL_ERROR "voltage percentiles not resolved: ${row}")
+endif()
+message(STATUS "voltage: min ${min} p1 ${p1} p5 ${p5} p95 ${p95} p99 ${p99} max ${max}")